@@ -1,5 +1,6 @@
 const { app, BrowserWindow, ipcMain, Menu } = require('electron')
 const path = require('path')
+const fs = require('fs')
 const fetch = require('node-fetch')
 
 let win
@@ -52,7 +53,17 @@ app.on('window-all-closed', () => {
 // IPC HANDLERS
 // ============================================================================
 
-ipcMain.handle('fetch-latest', async (_evt, host = 'http://127.0.0.1:8000', limit = 50) => {
+// Read on every call so edits to config.json apply without a restart
+ipcMain.handle('get-config', async () => {
+    try {
+        return JSON.parse(fs.readFileSync(path.join(__dirname, 'config.json'), 'utf8'))
+    } catch (error) {
+        console.error(`Could not read config.json: ${error.message}`)
+        return {}
+    }
+})
+
+ipcMain.handle('fetch-latest', async (_evt, host = 'http://127.0.0.1:8091', limit = 50) => {
     try {
         const url = `${host}/results/latest?limit=${limit}`
         const res = await fetch(url, { timeout: 5000 })
@@ -67,7 +78,26 @@ ipcMain.handle('fetch-latest', async (_evt, host = 'http://127.0.0.1:8000', limi
     }
 })
 
-ipcMain.handle('fetch-health', async (_evt, host = 'http://127.0.0.1:8000') => {
+ipcMain.handle('search-results', async (_evt, host = 'http://127.0.0.1:8091', params = {}) => {
+    try {
+        const query = new URLSearchParams()
+        Object.entries(params).forEach(([key, value]) => {
+            if (value !== undefined && value !== null && value !== '') query.set(key, value)
+        })
+        const url = `${host}/results/search?${query}`
+        const res = await fetch(url, { timeout: 5000 })
+        
+        if (!res.ok) {
+            return { error: `HTTP ${res.status}` }
+        }
+
+        return await res.json()
+    } catch (error) {
+        return { error: error.message }
+    }
+})
+
+ipcMain.handle('fetch-health', async (_evt, host = 'http://127.0.0.1:8091') => {
     try {
         const url = `${host}/healthz`
         const res = await fetch(url, { timeout: 5000 })
@@ -104,12 +134,35 @@ ipcMain.handle('discover-camera', async (_evt, ip, user, pass, brand) => {
     }
 })
 
-// Add function to test RTSP stream connectivity
+// Scan a subnet (e.g. 192.168.1.0/24) for cameras; the service probes hosts concurrently
+ipcMain.handle('scan-network', async (_evt, subnet, user, pass, brand) => {
+    try {
+        const url = `http://127.0.0.1:8091/discover/scan?subnet=${encodeURIComponent(subnet)}&user=${encodeURIComponent(user)}&password=${encodeURIComponent(pass)}&brand=${encodeURIComponent(brand || '')}`
+        console.log(`Scanning ${subnet} for cameras`)
+        const res = await fetch(url, { method: 'GET' })
+        if (!res.ok) {
+            const errorText = await res.text()
+            console.error(`Scan failed with status ${res.status}: ${errorText}`)
+            return { success: false, error: `HTTP ${res.status}: ${errorText}` }
+        }
+
+        const data = await res.json()
+        console.log(`Scan found ${data.cameras.length} cameras in ${data.elapsed_ms}ms`)
+        return data
+    } catch (error) {
+        console.error(`Scan error: ${error.message}`)
+        return { success: false, error: error.message }
+    }
+})
+
+// Test RTSP stream connectivity with a DESCRIBE; nothing is decoded
 ipcMain.handle('test-rtsp-stream', async (_evt, url) => {
     try {
-        // For now, we'll just return a mock response
-        // In a real implementation, you would test the RTSP stream here
-        return { success: true, message: 'اتصال به جریان RTSP برقرار شد' }
+        const res = await fetch(`http://127.0.0.1:8091/discover/probe?url=${encodeURIComponent(url)}`)
+        if (!res.ok) return { success: false, error: `HTTP ${res.status}` }
+        const info = await res.json()
+        if (!info.ok) return { success: false, error: info.error || `RTSP ${info.status}`, ...info }
+        return { success: true, message: 'اتصال به جریان RTSP برقرار شد', ...info }
     } catch (error) {
         return { success: false, error: error.message }
     }
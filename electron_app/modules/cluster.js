@@ -0,0 +1,99 @@
+/**
+ * Cluster Module - Finds the service node serving each camera
+ * Polls the coordinator's routing table; without a coordinator every camera is on the local service
+ */
+
+const LOCAL_SERVICE = 'http://127.0.0.1:8091';
+const ROUTE_REFRESH_MS = 3000;
+
+let routes = { version: -1, streams: {}, nodes: {} };
+const knownHosts = new Map(); // cameraId -> last node URL seen, kept while a camera is between nodes
+const routeListeners = new Set();
+let refreshTimer = null;
+
+// Cluster mode is on when localStorage.clusterCoordinator holds the coordinator URL
+function coordinatorUrl() {
+  return (localStorage.getItem('clusterCoordinator') || '').replace(/\/+$/, '');
+}
+
+function serviceHost(cameraId) {
+  return routes.streams[cameraId]?.url || knownHosts.get(cameraId) || LOCAL_SERVICE;
+}
+
+function serviceWsHost(cameraId) {
+  return serviceHost(cameraId).replace(/^http/, 'ws');
+}
+
+// Cameras are registered with the coordinator in cluster mode; it picks the node.
+// mainUrl marks rtspUrl as the camera's sub-stream
+function addStreamUrl(cameraId, rtspUrl, mainUrl) {
+  let query = `stream_id=${cameraId}&rtsp_url=${encodeURIComponent(rtspUrl)}&enable_ai=true`;
+  if (mainUrl) query += `&main_url=${encodeURIComponent(mainUrl)}`;
+  const coordinator = coordinatorUrl();
+  return coordinator ? `${coordinator}/cluster/add_stream?${query}` : `${LOCAL_SERVICE}/add_stream?${query}`;
+}
+
+async function refreshRoutes() {
+  const coordinator = coordinatorUrl();
+  if (!coordinator) return routes;
+
+  try {
+    const response = await fetch(`${coordinator}/cluster/routes`);
+    if (!response.ok) throw new Error(`HTTP ${response.status}`);
+    routes = await response.json();
+  } catch (error) {
+    console.warn('Could not refresh cluster routes:', error);
+    return routes;
+  }
+
+  // Only a move to another live node is a change; a camera whose node just
+  // died keeps its old host until the coordinator places it again
+  const moved = [];
+  Object.entries(routes.streams).forEach(([cameraId, route]) => {
+    if (!route.url || !route.ready) return;
+    const previous = knownHosts.get(cameraId);
+    knownHosts.set(cameraId, route.url);
+    if (previous && previous !== route.url) moved.push(cameraId);
+  });
+  if (moved.length) {
+    console.log('Cluster moved cameras:', moved);
+    routeListeners.forEach(listener => listener(moved));
+  }
+  return routes;
+}
+
+// Wait for a newly placed camera to be running on its node
+async function waitForRoute(cameraId, timeoutMs = 15000) {
+  if (!coordinatorUrl()) return LOCAL_SERVICE;
+  const deadline = Date.now() + timeoutMs;
+  while (Date.now() < deadline) {
+    await refreshRoutes();
+    const route = routes.streams[cameraId];
+    if (route?.ready) return route.url;
+    await new Promise(resolve => setTimeout(resolve, 1000));
+  }
+  return null;
+}
+
+function startRouteRefresh() {
+  if (refreshTimer || !coordinatorUrl()) return;
+  refreshRoutes();
+  refreshTimer = setInterval(refreshRoutes, ROUTE_REFRESH_MS);
+}
+
+// listener(cameraIds) is called with the cameras that moved to another node
+function onRouteChange(listener) {
+  routeListeners.add(listener);
+}
+
+export {
+  LOCAL_SERVICE,
+  coordinatorUrl,
+  serviceHost,
+  serviceWsHost,
+  addStreamUrl,
+  refreshRoutes,
+  waitForRoute,
+  startRouteRefresh,
+  onRouteChange
+};
@@ -3,10 +3,22 @@
  */
 
 import state from './state.js';
-import { formatTime, formatDateTime } from './ui.js';
+import { formatTime, formatDateTime, resultKey } from './ui.js';
+
+const RECENT_RESULTS = 5;
 
 function updateDashboard() {
-  // Update stats
+  updateStats();
+
+  // Update recent results
+  updateRecentResults();
+
+  // Draw charts
+  drawDetectionChart();
+  drawCameraChart();
+}
+
+function updateStats() {
   document.getElementById('totalPlates').textContent = state.results.length;
   document.getElementById('activeCameras').textContent = state.cameras.size;
   
@@ -18,49 +30,63 @@ function updateDashboard() {
   
   // Processing speed (mock)
   document.getElementById('processingSpeed').textContent = '45ms';
+}
 
-  // Update recent results
-  updateRecentResults();
-
-  // Draw charts
-  drawDetectionChart();
-  drawCameraChart();
+function buildResultItem(result) {
+  const item = document.createElement('div');
+  item.className = 'result-item';
+  item.dataset.resultKey = resultKey(result);
+  
+  const confidence = (result.confidence * 100).toFixed(1);
+  const confidencePercent = Math.min(100, confidence);
+  
+  item.innerHTML = `
+    <div class="result-info">
+      <div class="result-plate">${result.plate_text || 'نامشخص'}</div>
+      <div class="result-meta">
+        <span><i class="fas fa-camera"></i> ${result.camera_id || 'نامشخص'}</span>
+        <span><i class="fas fa-clock"></i> ${formatTime(result.timestamp)}</span>
+      </div>
+    </div>
+    <div class="result-confidence">
+      <div class="confidence-bar">
+        <div class="confidence-fill" style="width: ${confidencePercent}%"></div>
+      </div>
+      <span>${confidence}%</span>
+    </div>
+  `;
+  
+  item.addEventListener('click', () => showResultDetails(result));
+  return item;
 }
 
 function updateRecentResults() {
   const container = document.getElementById('recentResultsList');
   container.innerHTML = '';
 
-  const recentResults = state.results.slice(0, 5);
-  
-  recentResults.forEach(result => {
-    const item = document.createElement('div');
-    item.className = 'result-item';
-    
-    const confidence = (result.confidence * 100).toFixed(1);
-    const confidencePercent = Math.min(100, confidence);
-    
-    item.innerHTML = `
-      <div class="result-info">
-        <div class="result-plate">${result.plate_text || 'نامشخص'}</div>
-        <div class="result-meta">
-          <span><i class="fas fa-camera"></i> ${result.camera_id || 'نامشخص'}</span>
-          <span><i class="fas fa-clock"></i> ${formatTime(result.timestamp)}</span>
-        </div>
-      </div>
-      <div class="result-confidence">
-        <div class="confidence-bar">
-          <div class="confidence-fill" style="width: ${confidencePercent}%"></div>
-        </div>
-        <span>${confidence}%</span>
-      </div>
-    `;
-    
-    item.addEventListener('click', () => showResultDetails(result));
-    container.appendChild(item);
+  state.results.slice(0, RECENT_RESULTS).forEach(result => {
+    container.appendChild(buildResultItem(result));
   });
 }
 
+// A pushed result touches only the stats and its own item: a new or upgraded
+// read moves to the top and the list is trimmed, nothing else is re-rendered
+function applyResultToDashboard(result) {
+  updateStats();
+
+  // The list is showing search matches
+  if (document.getElementById('searchInput')?.value) return;
+
+  const container = document.getElementById('recentResultsList');
+  const key = resultKey(result);
+  const existing = Array.from(container.children).find(item => item.dataset.resultKey === key);
+  if (existing) existing.remove();
+  container.prepend(buildResultItem(result));
+  while (container.children.length > RECENT_RESULTS) {
+    container.lastElementChild.remove();
+  }
+}
+
 function drawDetectionChart() {
   const canvas = document.getElementById('detectionCanvas');
   if (!canvas) return;
@@ -206,4 +232,4 @@ function closeModal() {
   document.getElementById('detailsModal').classList.remove('active');
 }
 
-export { updateDashboard, updateRecentResults, drawDetectionChart, drawCameraChart, showResultDetails, closeModal };
\ No newline at end of file
+export { updateDashboard, updateRecentResults, applyResultToDashboard, drawDetectionChart, drawCameraChart, showResultDetails, closeModal };
\ No newline at end of file
@@ -7,6 +7,48 @@ import { showToast } from './ui.js';
 import { navigateTo } from './navigation.js';
 import { addStreamToLiveView } from './livestream.js';
 
+// A sub-stream comes with its main stream, which the service opens only
+// for fullscreen, plate crops and recording
+function cameraStreams(result) {
+  if (result.sub_url) return { url: result.sub_url, mainUrl: result.main_url };
+  const firstUrl = result.candidates[0];
+  const mainUrl = /_sub\b/.test(firstUrl) ? result.candidates.find(url => /_main\b/.test(url)) : undefined;
+  return { url: firstUrl, mainUrl };
+}
+
+// Add every camera found on a subnet (CIDR entered in the IP field)
+async function scanNetwork(subnet, user, pass, brand) {
+  console.log(`Scanning ${subnet} for cameras`);
+  const result = await window.lpr.scanNetwork(subnet, user, pass, brand);
+  console.log('Scan result:', result);
+
+  if (!result || result.error || result.success === false) {
+    showToast(`خطا در جستجوی شبکه: ${result?.error || 'پاسخی دریافت نشد'}`, 'error');
+    return;
+  }
+
+  const cameras = result.cameras.filter(camera => camera.candidates.length > 0);
+  let added = 0;
+  cameras.forEach(camera => {
+    const { url, mainUrl } = cameraStreams(camera);
+    if (state.discoveredCameras.some(c => c.url === url)) return;
+    addStreamToLiveView(url, mainUrl);
+    added++;
+  });
+
+  const seconds = (result.elapsed_ms / 1000).toFixed(1);
+  if (cameras.length === 0) {
+    showToast(`دوربینی در ${subnet} یافت نشد (${seconds} ثانیه)`, 'warning');
+    return;
+  }
+  showToast(`${cameras.length} دوربین در ${seconds} ثانیه یافت شد، ${added} دوربین جدید اضافه شد`, 'success');
+  if (added > 0) {
+    setTimeout(() => {
+      navigateTo('livestream');
+    }, 1500);
+  }
+}
+
 async function performDiscover() {
   const ip = document.getElementById('discoverIp').value;
   const user = document.getElementById('discoverUser').value;
@@ -23,6 +65,11 @@ async function performDiscover() {
   btn.innerHTML = '<i class="fas fa-spinner spin"></i> در حال کشف...';
 
   try {
+    if (ip.includes('/')) {
+      await scanNetwork(ip, user, pass, brand);
+      return;
+    }
+
     console.log(`Attempting to discover cameras: ${ip}, ${user}, ${brand}`);
     const result = await window.lpr.discover(ip, user, pass, brand);
     console.log('Discovery result:', result);
@@ -48,11 +95,11 @@ async function performDiscover() {
     if (result.candidates && result.candidates.length > 0) {
       // Automatically add the FIRST discovered camera to live view (only one)
       // Check if this camera is already added
-      const firstUrl = result.candidates[0];
+      const { url: firstUrl, mainUrl } = cameraStreams(result);
       const alreadyAdded = state.discoveredCameras.some(c => c.url === firstUrl);
       
       if (!alreadyAdded) {
-        addStreamToLiveView(firstUrl);
+        addStreamToLiveView(firstUrl, mainUrl);
         showToast(`دوربین به نمایش زنده اضافه شد`, 'success');
       } else {
         showToast('این دوربین قبلا اضافه شده است', 'info');
@@ -62,6 +109,8 @@ async function performDiscover() {
       setTimeout(() => {
         navigateTo('livestream');
       }, 1500);
+    } else if (result.auth_failed) {
+      showToast('نام کاربری یا رمز عبور دوربین اشتباه است', 'error');
     } else {
       showToast('آدرسی یافت نشد. لطفاً اطلاعات دوربین را بررسی کنید', 'warning');
     }
@@ -1,5 +1,6 @@
 /**
  * Export Module
+ * Exports stream from the server's results store; the in-memory CSV is the offline fallback
  */
 
 import state from './state.js';
@@ -18,21 +19,26 @@ function convertToCSV(data) {
     (r.bbox?.h || 0).toFixed(2),
   ]);
 
-  let csv = headers.join(',') + '\n';
+  const lines = [headers.join(',')];
   rows.forEach(row => {
-    csv += row.map(cell => `"${cell}"`).join(',') + '\n';
+    lines.push(row.map(cell => `"${cell}"`).join(','));
   });
 
-  return csv;
+  return lines.join('\n') + '\n';
 }
 
 function downloadCSV(csv, filename) {
   const blob = new Blob([csv], { type: 'text/csv;charset=utf-8;' });
-  const link = document.createElement('a');
   const url = URL.createObjectURL(blob);
+  downloadUrl(url, filename);
+  URL.revokeObjectURL(url);
+}
+
+function downloadUrl(url, filename) {
+  const link = document.createElement('a');
 
   link.setAttribute('href', url);
-  link.setAttribute('download', filename);
+  if (filename) link.setAttribute('download', filename);
   link.style.visibility = 'hidden';
 
   document.body.appendChild(link);
@@ -40,10 +46,36 @@ function downloadCSV(csv, filename) {
   document.body.removeChild(link);
 }
 
-function exportResults() {
-  const csv = convertToCSV(state.results);
-  downloadCSV(csv, 'license_plate_results.csv');
+// Server export URL for the results page filters (plate, camera, day)
+function exportUrl(format) {
+  const params = new URLSearchParams({ format });
+  const plate = document.getElementById('plateSearch')?.value;
+  const cameraId = document.getElementById('cameraFilter')?.value;
+  const date = document.getElementById('dateFilter')?.value;
+
+  if (plate) params.set('plate', plate);
+  if (cameraId) params.set('camera_id', cameraId);
+  if (date) {
+    const dayStart = new Date(`${date}T00:00:00`).getTime() / 1000;
+    params.set('start', dayStart);
+    params.set('end', dayStart + 86400);
+  }
+  return `${state.aiHost}/results/export?${params}`;
+}
+
+// format: 'csv', 'parquet', or 'zip' (CSV with the plate crops). The server
+// streams the file, so the renderer never holds it
+function exportResults(format = 'csv') {
+  if (typeof format !== 'string') format = 'csv'; // Called as a click handler
+
+  if (!state.isConnected) {
+    downloadCSV(convertToCSV(state.results), 'license_plate_results.csv');
+    showToast('سرویس در دسترس نیست؛ فقط نتایج بارگذاری‌شده دانلود شد', 'warning');
+    return;
+  }
+
+  downloadUrl(exportUrl(format));
   showToast('دانلود شروع شد', 'success');
 }
 
-export { convertToCSV, downloadCSV, exportResults };
\ No newline at end of file
+export { convertToCSV, downloadCSV, exportResults };
@@ -5,6 +5,8 @@
 import state from './state.js';
 import { showToast, formatTime } from './ui.js';
 
+let streamCounter = 0;
+
 function updateLiveStreamView() {
   console.log('Updating live stream view with', state.discoveredCameras.length, 'cameras');
   
@@ -50,6 +52,8 @@ function updateLiveStreamView() {
         <img id="video-${camera.id}" class="live-stream-video">
         <!-- Canvas element for live stream (fallback) -->
         <canvas id="stream-${camera.id}" class="live-stream-canvas"></canvas>
+        <!-- AI detections, drawn from metadata sent alongside the frames -->
+        <canvas id="overlay-${camera.id}" class="stream-overlay-canvas"></canvas>
         <div id="stream-placeholder-${camera.id}" class="stream-placeholder">
           <i class="fas fa-video"></i>
           <p>در انتظار شروع جریان زنده...</p>
@@ -100,14 +104,15 @@ function extractCameraName(url) {
   }
 }
 
-function addStreamToLiveView(url) {
-  // Generate a unique ID for the stream
-  const streamId = 'stream_' + Date.now();
+function addStreamToLiveView(url, mainUrl) {
+  // Generate a unique ID for the stream (a subnet scan adds several in the same millisecond)
+  const streamId = 'stream_' + Date.now() + '_' + (streamCounter++);
   
   // Extract camera info from URL
   const cameraInfo = {
     id: streamId,
     url: url,
+    mainUrl: mainUrl,
     name: extractCameraName(url),
     addedAt: new Date().toISOString()
   };
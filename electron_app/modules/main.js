@@ -16,12 +16,20 @@ import { previousPage, nextPage } from './pagination.js';
 import { updateCameraFilter } from './ui.js';
 import { loadResultsTable, filterResultsTable, filterByCamera, filterByDate } from './results.js';
 import { closeModal } from './dashboard.js';
+import { startRouteRefresh } from './cluster.js';
+import { loadOverlayOptions } from './overlay.js';
 
 // Initialize the application
 function initializeApp() {
   // Load initial data
   loadResults();
   updateConnectionStatus();
+
+  // Follow the cluster routing table when a coordinator is configured
+  startRouteRefresh();
+  
+  // Detection overlay options (ui.show_bbox / ui.show_confidence)
+  loadOverlayOptions();
   
   // Set initial values
   document.getElementById('aiHostInput').value = state.aiHost;
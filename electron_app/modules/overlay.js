@@ -0,0 +1,126 @@
+/**
+ * Overlay Module - Draws AI detections over live stream tiles
+ * Boxes arrive as metadata after the frame they belong to and are painted on a canvas stacked on the video
+ */
+
+// ui.show_bbox / ui.show_confidence from config.json
+const overlayOptions = { show_bbox: true, show_confidence: true };
+const overlays = new Map(); // cameraId -> last detections message
+const optionListeners = new Set();
+// Tiles change size on fullscreen and grid layout without a window resize
+const resizeObserver = typeof ResizeObserver !== 'undefined'
+  ? new ResizeObserver(entries => entries.forEach(entry => redraw(entry.target.dataset.cameraId)))
+  : null;
+
+const BOX_COLOR = '#00ff00';
+const LABEL_TEXT_COLOR = '#000000';
+
+async function loadOverlayOptions() {
+  try {
+    const config = await window.lpr.getConfig();
+    const ui = config?.ui || {};
+    const previous = overlayOptions.show_bbox;
+    if (typeof ui.show_bbox === 'boolean') overlayOptions.show_bbox = ui.show_bbox;
+    if (typeof ui.show_confidence === 'boolean') overlayOptions.show_confidence = ui.show_confidence;
+    overlays.forEach((_, cameraId) => redraw(cameraId));
+    if (previous !== overlayOptions.show_bbox) {
+      optionListeners.forEach(listener => listener(overlayOptions.show_bbox));
+    }
+  } catch (error) {
+    console.warn('Could not load overlay options:', error);
+  }
+  return overlayOptions;
+}
+
+// Whether viewers should ask the service for detections at all
+function overlayEnabled() {
+  return overlayOptions.show_bbox;
+}
+
+// listener(enabled) is called when show_bbox changes
+function onOverlayOptionsChange(listener) {
+  optionListeners.add(listener);
+}
+
+// Re-read when the window regains focus, so an edited config.json applies without a restart
+window.addEventListener('focus', loadOverlayOptions);
+
+function overlayCanvas(cameraId) {
+  return document.getElementById(`overlay-${cameraId}`);
+}
+
+// The video is drawn with object-fit: contain, so boxes are placed in the
+// letterboxed content rectangle rather than the whole element
+function contentRect(canvas, aspect) {
+  const width = canvas.width;
+  const height = canvas.height;
+  if (!aspect || width / height > aspect) {
+    const contentWidth = height * (aspect || width / height);
+    return { x: (width - contentWidth) / 2, y: 0, width: contentWidth, height };
+  }
+  const contentHeight = width / aspect;
+  return { x: 0, y: (height - contentHeight) / 2, width, height: contentHeight };
+}
+
+function redraw(cameraId) {
+  const canvas = overlayCanvas(cameraId);
+  if (!canvas) return;
+  const scale = window.devicePixelRatio || 1;
+  const width = Math.round(canvas.clientWidth * scale);
+  const height = Math.round(canvas.clientHeight * scale);
+  if (canvas.width !== width || canvas.height !== height) {
+    canvas.width = width;
+    canvas.height = height;
+  }
+  const ctx = canvas.getContext('2d');
+  ctx.clearRect(0, 0, canvas.width, canvas.height);
+
+  const message = overlays.get(cameraId);
+  if (!message || !overlayOptions.show_bbox || !message.boxes?.length || !width || !height) return;
+
+  const rect = contentRect(canvas, message.width / message.height);
+  ctx.lineWidth = 2 * scale;
+  ctx.font = `${12 * scale}px sans-serif`;
+  ctx.textBaseline = 'top';
+
+  message.boxes.forEach(([x1, y1, x2, y2], index) => {
+    const left = rect.x + x1 * rect.width;
+    const top = rect.y + y1 * rect.height;
+    ctx.strokeStyle = BOX_COLOR;
+    ctx.strokeRect(left, top, (x2 - x1) * rect.width, (y2 - y1) * rect.height);
+
+    let label = message.labels?.[index] || message.classes[index];
+    if (overlayOptions.show_confidence) label += ` ${message.scores[index].toFixed(2)}`;
+    const textHeight = 16 * scale;
+    const textWidth = ctx.measureText(label).width + 6 * scale;
+    const labelTop = top >= textHeight ? top - textHeight : top;
+    ctx.fillStyle = BOX_COLOR;
+    ctx.fillRect(left, labelTop, textWidth, textHeight);
+    ctx.fillStyle = LABEL_TEXT_COLOR;
+    ctx.fillText(label, left + 3 * scale, labelTop + 2 * scale);
+  });
+}
+
+// message is a {"type": "detections"} message from the stream WebSocket
+function showDetections(cameraId, message) {
+  const canvas = overlayCanvas(cameraId);
+  if (canvas && resizeObserver && !canvas.dataset.cameraId) {
+    canvas.dataset.cameraId = cameraId;
+    resizeObserver.observe(canvas);
+  }
+  overlays.set(cameraId, message);
+  redraw(cameraId);
+}
+
+function clearOverlay(cameraId) {
+  overlays.delete(cameraId);
+  redraw(cameraId);
+}
+
+export {
+  loadOverlayOptions,
+  overlayEnabled,
+  onOverlayOptionsChange,
+  showDetections,
+  clearOverlay
+};
@@ -0,0 +1,181 @@
+/**
+ * Render Pool Module - Off-main-thread drawing for live stream tiles
+ * Tile canvases are handed to render workers; frames are decoded there with createImageBitmap
+ */
+
+// Tiles served by one render worker before another is started
+const TILES_PER_WORKER = 4;
+
+const workers = []; // { worker, tiles: Set of cameraIds }
+const tiles = new Map(); // cameraId -> { canvas, entry, inFlight, pending, drawn, dropped, width, height }
+const snapshotRequests = new Map(); // requestId -> resolve
+let nextRequestId = 1;
+
+// Worker rendering can be switched off with localStorage.workerRendering = 'false'
+function workerRenderingSupported() {
+  return typeof Worker !== 'undefined' &&
+         typeof OffscreenCanvas !== 'undefined' &&
+         typeof HTMLCanvasElement.prototype.transferControlToOffscreen === 'function' &&
+         localStorage.getItem('workerRendering') !== 'false';
+}
+
+function handleWorkerMessage(message) {
+  if (message.type === 'drawn') {
+    const tile = tiles.get(message.cameraId);
+    if (!tile) return;
+    tile.inFlight = false;
+    const onDrawn = tile.onDrawn;
+    tile.onDrawn = null;
+    if (!message.error) {
+      tile.drawn++;
+      tile.width = message.width;
+      tile.height = message.height;
+      onDrawn?.();
+    }
+    // Send the newest frame that arrived while the last one was being painted
+    if (tile.pending) {
+      const { blob, onDrawn: pendingDrawn } = tile.pending;
+      tile.pending = null;
+      sendFrame(message.cameraId, tile, blob, pendingDrawn);
+    }
+  } else if (message.type === 'snapshot') {
+    const resolve = snapshotRequests.get(message.requestId);
+    snapshotRequests.delete(message.requestId);
+    if (resolve) resolve(message.blob);
+  }
+}
+
+function acquireWorker() {
+  let entry = workers.find(candidate => candidate.tiles.size < TILES_PER_WORKER);
+  if (!entry) {
+    const worker = new Worker(new URL('./renderworker.js', import.meta.url));
+    worker.onmessage = (event) => handleWorkerMessage(event.data);
+    worker.onerror = (error) => console.error('Render worker error:', error);
+    entry = { worker, tiles: new Set() };
+    workers.push(entry);
+  }
+  return entry;
+}
+
+function releaseTile(cameraId) {
+  const tile = tiles.get(cameraId);
+  if (!tile) return;
+  tiles.delete(cameraId);
+  tile.entry.tiles.delete(cameraId);
+  tile.entry.worker.postMessage({ type: 'detach', cameraId });
+
+  // Stop workers that no longer serve any tile
+  if (tile.entry.tiles.size === 0) {
+    tile.entry.worker.terminate();
+    workers.splice(workers.indexOf(tile.entry), 1);
+  }
+}
+
+// Hand a tile canvas to a render worker. Returns false when frames must be
+// drawn on the main thread (no OffscreenCanvas, or the canvas already has a
+// main-thread context). A canvas can only be transferred once, so it stays
+// attached across stop/start and is released when the view replaces it.
+function attachCanvas(cameraId, canvasElement) {
+  if (!canvasElement) return false;
+
+  const existing = tiles.get(cameraId);
+  if (existing && existing.canvas === canvasElement) return true;
+  if (existing) releaseTile(cameraId);
+
+  // Drop tiles whose canvas was removed by a re-render of the live view
+  tiles.forEach((tile, id) => {
+    if (!tile.canvas.isConnected) releaseTile(id);
+  });
+
+  if (!workerRenderingSupported()) return false;
+
+  let offscreen;
+  try {
+    offscreen = canvasElement.transferControlToOffscreen();
+  } catch (error) {
+    console.warn('Canvas cannot be transferred, drawing on the main thread:', cameraId, error);
+    return false;
+  }
+
+  const entry = acquireWorker();
+  entry.tiles.add(cameraId);
+  tiles.set(cameraId, {
+    canvas: canvasElement,
+    entry,
+    inFlight: false,
+    pending: null,
+    onDrawn: null,
+    drawn: 0,
+    dropped: 0,
+    width: 0,
+    height: 0
+  });
+  entry.worker.postMessage({ type: 'attach', cameraId, canvas: offscreen }, [offscreen]);
+  return true;
+}
+
+function sendFrame(cameraId, tile, blob, onDrawn) {
+  tile.inFlight = true;
+  tile.onDrawn = onDrawn || null;
+  tile.entry.worker.postMessage({ type: 'frame', cameraId, blob });
+}
+
+// Queue an encoded frame for a tile. One frame per tile is in the worker at a
+// time; anything newer replaces the waiting frame, so a display that can't
+// keep up drops frames instead of building latency. onDrawn runs once the
+// frame is painted
+function drawFrame(cameraId, blob, onDrawn) {
+  const tile = tiles.get(cameraId);
+  if (!tile) return false;
+
+  // Nothing is decoded for tiles that aren't on screen (other page, hidden window)
+  const hidden = document.hidden || !tile.canvas.offsetParent;
+  if (tile.inFlight || hidden) {
+    if (tile.pending) tile.dropped++;
+    tile.pending = { blob, onDrawn };
+  } else {
+    sendFrame(cameraId, tile, blob, onDrawn);
+  }
+  return true;
+}
+
+function clearCanvas(cameraId) {
+  const tile = tiles.get(cameraId);
+  if (!tile) return;
+  tile.pending = null;
+  tile.entry.worker.postMessage({ type: 'clear', cameraId });
+}
+
+function isWorkerCanvas(cameraId, canvasElement) {
+  const tile = tiles.get(cameraId);
+  return !!tile && tile.canvas === canvasElement;
+}
+
+// PNG of what the tile last painted (the canvas itself is owned by the worker)
+function snapshotCanvas(cameraId) {
+  const tile = tiles.get(cameraId);
+  if (!tile) return Promise.resolve(null);
+
+  const requestId = nextRequestId++;
+  return new Promise(resolve => {
+    snapshotRequests.set(requestId, resolve);
+    tile.entry.worker.postMessage({ type: 'snapshot', cameraId, requestId });
+  });
+}
+
+function getRenderStats() {
+  const stats = { workers: workers.length, tiles: {} };
+  tiles.forEach((tile, cameraId) => {
+    stats.tiles[cameraId] = { drawn: tile.drawn, dropped: tile.dropped, width: tile.width, height: tile.height };
+  });
+  return stats;
+}
+
+export {
+  attachCanvas,
+  drawFrame,
+  clearCanvas,
+  isWorkerCanvas,
+  snapshotCanvas,
+  getRenderStats
+};
@@ -0,0 +1,105 @@
+/**
+ * Render Worker - Decodes JPEG frames and draws them on transferred OffscreenCanvases
+ * Runs off the renderer's main thread; one worker serves several live tiles
+ */
+
+const tiles = new Map(); // cameraId -> { canvas, ctx, bitmap }
+let drawScheduled = false;
+
+// Workers get requestAnimationFrame for OffscreenCanvas; fall back to ~60 Hz
+const nextFrame = typeof self.requestAnimationFrame === 'function'
+  ? (callback) => self.requestAnimationFrame(callback)
+  : (callback) => setTimeout(callback, 16);
+
+function scheduleDraw() {
+  if (!drawScheduled) {
+    drawScheduled = true;
+    nextFrame(drawTiles);
+  }
+}
+
+// Paint the newest decoded frame of every tile once per display frame and
+// tell the main thread, which only then sends that tile's next frame
+function drawTiles() {
+  drawScheduled = false;
+  tiles.forEach((tile, cameraId) => {
+    const bitmap = tile.bitmap;
+    if (!bitmap) return;
+    tile.bitmap = null;
+
+    if (tile.canvas.width !== bitmap.width || tile.canvas.height !== bitmap.height) {
+      tile.canvas.width = bitmap.width;
+      tile.canvas.height = bitmap.height;
+    }
+    tile.ctx.drawImage(bitmap, 0, 0);
+    bitmap.close();
+
+    self.postMessage({ type: 'drawn', cameraId, width: tile.canvas.width, height: tile.canvas.height });
+  });
+}
+
+async function decodeFrame(cameraId, blob) {
+  let bitmap;
+  try {
+    bitmap = await createImageBitmap(blob);
+  } catch (error) {
+    // Corrupt or truncated JPEG - release the tile so the next frame is sent
+    self.postMessage({ type: 'drawn', cameraId, error: String(error) });
+    return;
+  }
+
+  const tile = tiles.get(cameraId);
+  if (!tile) {
+    bitmap.close();
+    return;
+  }
+  // A newer frame replaces one that has not been painted yet
+  if (tile.bitmap) tile.bitmap.close();
+  tile.bitmap = bitmap;
+  scheduleDraw();
+}
+
+async function snapshot(cameraId, requestId) {
+  const tile = tiles.get(cameraId);
+  let blob = null;
+  if (tile && tile.canvas.width && tile.canvas.height) {
+    try {
+      blob = await tile.canvas.convertToBlob({ type: 'image/png' });
+    } catch (error) {
+      console.warn('Render worker snapshot failed:', error);
+    }
+  }
+  self.postMessage({ type: 'snapshot', requestId, blob });
+}
+
+self.onmessage = (event) => {
+  const message = event.data;
+  const tile = tiles.get(message.cameraId);
+
+  switch (message.type) {
+    case 'attach':
+      tiles.set(message.cameraId, {
+        canvas: message.canvas,
+        ctx: message.canvas.getContext('2d', { alpha: false }),
+        bitmap: null
+      });
+      break;
+    case 'frame':
+      decodeFrame(message.cameraId, message.blob);
+      break;
+    case 'clear':
+      if (tile) {
+        if (tile.bitmap) tile.bitmap.close();
+        tile.bitmap = null;
+        tile.ctx.clearRect(0, 0, tile.canvas.width, tile.canvas.height);
+      }
+      break;
+    case 'detach':
+      if (tile && tile.bitmap) tile.bitmap.close();
+      tiles.delete(message.cameraId);
+      break;
+    case 'snapshot':
+      snapshot(message.cameraId, message.requestId);
+      break;
+  }
+};
@@ -0,0 +1,81 @@
+/**
+ * Result Feed Module - New and upgraded plate reads pushed over server-sent events
+ * Each event is applied to the dashboard and results table in place; EventSource resumes with Last-Event-ID
+ */
+
+import state from './state.js';
+import { updateConnectionStatus, updateCameraFilter, resultKey } from './ui.js';
+import { applyResultToDashboard } from './dashboard.js';
+import { upsertResultRow } from './results.js';
+import { loadResults } from './data.js';
+
+let source = null;
+
+// Push can be switched off with localStorage.pushResults = 'false'
+function pushResultsSupported() {
+  return typeof EventSource !== 'undefined' && localStorage.getItem('pushResults') !== 'false';
+}
+
+function applyResult(result) {
+  const key = resultKey(result);
+  const index = state.results.findIndex(r => resultKey(r) === key);
+  if (index !== -1) state.results.splice(index, 1);
+  state.results.unshift(result);
+  if (state.results.length > state.resultsLimit) {
+    state.results.length = state.resultsLimit;
+  }
+
+  if (result.camera_id && !state.cameras.has(result.camera_id)) {
+    state.cameras.add(result.camera_id);
+    updateCameraFilter();
+  }
+
+  if (state.currentPage === 'dashboard') {
+    applyResultToDashboard(result);
+  } else if (state.currentPage === 'results') {
+    upsertResultRow(result);
+  }
+}
+
+// onDown / onUp let the caller poll while the feed is unavailable
+function startResultFeed({ onDown, onUp } = {}) {
+  stopResultFeed();
+
+  source = new EventSource(`${state.aiHost}/results/stream`);
+
+  source.onopen = () => {
+    state.isConnected = true;
+    updateConnectionStatus();
+    onUp?.();
+  };
+
+  // Sent on a fresh connection and when the server can't resume from our
+  // last event: reload the list, then apply the events that follow
+  source.addEventListener('reset', () => {
+    loadResults();
+  });
+
+  source.addEventListener('result', (event) => {
+    try {
+      applyResult(JSON.parse(event.data));
+    } catch (error) {
+      console.warn('Bad result event:', error);
+    }
+  });
+
+  // EventSource reconnects on its own and resumes after the last event id
+  source.onerror = () => {
+    state.isConnected = false;
+    updateConnectionStatus();
+    onDown?.();
+  };
+}
+
+function stopResultFeed() {
+  if (source) {
+    source.close();
+    source = null;
+  }
+}
+
+export { pushResultsSupported, startResultFeed, stopResultFeed };
@@ -3,48 +3,101 @@
  */
 
 import state from './state.js';
-import { formatDateTime, formatTime } from './ui.js';
+import { formatDateTime, formatTime, resultKey } from './ui.js';
 import { showResultDetails } from './dashboard.js';
+import { searchResults } from './search.js';
 
-function loadResultsTable() {
+const TABLE_SEARCH_LIMIT = 200;
+
+let tableSearchToken = 0;
+
+function buildResultRow(result) {
+  const tr = document.createElement('tr');
+  tr.dataset.resultKey = resultKey(result);
+  const confidence = (result.confidence * 100).toFixed(1);
+  
+  tr.innerHTML = `
+    <td>${formatDateTime(result.timestamp)}</td>
+    <td>${result.camera_id || 'نامشخص'}</td>
+    <td><span class="plate-text">${result.plate_text || 'نامشخص'}</span></td>
+    <td><span class="confidence-badge">${confidence}%</span></td>
+    <td>
+      <small>
+        x: ${(result.bbox?.x || 0).toFixed(0)},
+        y: ${(result.bbox?.y || 0).toFixed(0)},
+        w: ${(result.bbox?.w || 0).toFixed(0)},
+        h: ${(result.bbox?.h || 0).toFixed(0)}
+      </small>
+    </td>
+    <td>
+      <div class="action-buttons">
+        <button class="btn-small" title="مشاهده جزئیات">
+          <i class="fas fa-eye"></i>
+        </button>
+        <button class="btn-small" title="دانلود">
+          <i class="fas fa-download"></i>
+        </button>
+      </div>
+    </td>
+  `;
+  
+  tr.querySelector('.btn-small').addEventListener('click', () => showResultDetails(result));
+  return tr;
+}
+
+function loadResultsTable(results = state.results) {
   const tbody = document.getElementById('resultsTableBody');
   tbody.innerHTML = '';
 
-  state.results.forEach(result => {
-    const tr = document.createElement('tr');
-    const confidence = (result.confidence * 100).toFixed(1);
-    
-    tr.innerHTML = `
-      <td>${formatDateTime(result.timestamp)}</td>
-      <td>${result.camera_id || 'نامشخص'}</td>
-      <td><span class="plate-text">${result.plate_text || 'نامشخص'}</span></td>
-      <td><span class="confidence-badge">${confidence}%</span></td>
-      <td>
-        <small>
-          x: ${(result.bbox?.x || 0).toFixed(0)},
-          y: ${(result.bbox?.y || 0).toFixed(0)},
-          w: ${(result.bbox?.w || 0).toFixed(0)},
-          h: ${(result.bbox?.h || 0).toFixed(0)}
-        </small>
-      </td>
-      <td>
-        <div class="action-buttons">
-          <button class="btn-small" title="مشاهده جزئیات">
-            <i class="fas fa-eye"></i>
-          </button>
-          <button class="btn-small" title="دانلود">
-            <i class="fas fa-download"></i>
-          </button>
-        </div>
-      </td>
-    `;
-    
-    tr.querySelector('.btn-small').addEventListener('click', () => showResultDetails(result));
-    tbody.appendChild(tr);
+  results.forEach(result => {
+    tbody.appendChild(buildResultRow(result));
   });
 }
 
-function filterResultsTable(query) {
+// Apply one pushed result: replace its row or insert it at the top, keeping
+// the table at the results limit. Other rows are left untouched
+function upsertResultRow(result) {
+  // The table is showing search matches
+  if (document.getElementById('plateSearch')?.value) return;
+
+  const tbody = document.getElementById('resultsTableBody');
+  const key = resultKey(result);
+  const existing = Array.from(tbody.children).find(row => row.dataset.resultKey === key);
+  if (existing) existing.remove();
+
+  const row = buildResultRow(result);
+  const cameraId = document.getElementById('cameraFilter')?.value;
+  if (cameraId && result.camera_id !== cameraId) row.style.display = 'none';
+  tbody.prepend(row);
+
+  while (tbody.children.length > state.resultsLimit) {
+    tbody.lastElementChild.remove();
+  }
+}
+
+// Plate search covers the whole stored history, not just the loaded page
+async function filterResultsTable(query) {
+  const token = ++tableSearchToken;
+  if (!query) {
+    loadResultsTable();
+    return;
+  }
+
+  try {
+    const data = await searchResults(query, TABLE_SEARCH_LIMIT);
+    if (token !== tableSearchToken) return;
+    if (data && !data.error) {
+      loadResultsTable(data.results);
+      return;
+    }
+  } catch (error) {
+    console.warn('Server search failed, filtering loaded rows:', error);
+  }
+  if (token !== tableSearchToken) return;
+  filterLoadedRows(query);
+}
+
+function filterLoadedRows(query) {
   const tbody = document.getElementById('resultsTableBody');
   const rows = tbody.querySelectorAll('tr');
 
@@ -84,4 +137,4 @@ function filterByDate(date) {
   });
 }
 
-export { loadResultsTable, filterResultsTable, filterByCamera, filterByDate };
\ No newline at end of file
+export { loadResultsTable, upsertResultRow, filterResultsTable, filterByCamera, filterByDate };
\ No newline at end of file
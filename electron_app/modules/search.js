@@ -1,5 +1,6 @@
 /**
  * Search and Filter Module
+ * Queries run against the server's results store; the loaded results are the offline fallback
  */
 
 import state from './state.js';
@@ -8,27 +9,43 @@ import { showResultDetails } from './dashboard.js';
 import { updateRecentResults } from './dashboard.js';
 import { loadResultsTable } from './results.js';
 
-function filterResults(query) {
-  if (!query) {
-    updateRecentResults();
-    return;
+const SEARCH_DEBOUNCE_MS = 200;
+
+let searchTimer = null;
+let searchToken = 0;
+
+// A known camera name filters by camera; anything else is plate text, matched
+// by prefix and then anywhere in the plate (the server folds 0/O, 8/B, ...)
+async function searchResults(query, limit = 50) {
+  const params = state.cameras.has(query)
+    ? { camera_id: query, limit }
+    : { plate: query, mode: 'prefix', limit };
+
+  let data = await window.lpr.searchResults(state.aiHost, params);
+  if (data && !data.error && params.plate && data.results.length === 0) {
+    data = await window.lpr.searchResults(state.aiHost, { ...params, mode: 'contains' });
   }
+  return data;
+}
 
-  const filtered = state.results.filter(r => 
-    r.plate_text?.includes(query) || 
+function localMatches(query) {
+  return state.results.filter(r =>
+    r.plate_text?.includes(query) ||
     r.camera_id?.includes(query)
   );
+}
 
+function renderMatches(matches) {
   const container = document.getElementById('recentResultsList');
   container.innerHTML = '';
 
-  filtered.slice(0, 5).forEach(result => {
+  matches.slice(0, 5).forEach(result => {
     const item = document.createElement('div');
     item.className = 'result-item';
-    
+
     const confidence = (result.confidence * 100).toFixed(1);
     const confidencePercent = Math.min(100, confidence);
-    
+
     item.innerHTML = `
       <div class="result-info">
         <div class="result-plate">${result.plate_text || 'نامشخص'}</div>
@@ -44,10 +61,35 @@ function filterResults(query) {
         <span>${confidence}%</span>
       </div>
     `;
-    
+
     item.addEventListener('click', () => showResultDetails(result));
     container.appendChild(item);
   });
 }
 
-export { filterResults };
\ No newline at end of file
+function filterResults(query) {
+  clearTimeout(searchTimer);
+  const token = ++searchToken;
+
+  if (!query) {
+    updateRecentResults();
+    return;
+  }
+
+  // Debounced so typing a plate sends one request, not one per key
+  searchTimer = setTimeout(async () => {
+    let matches;
+    try {
+      const data = await searchResults(query, 5);
+      matches = data && !data.error ? data.results : localMatches(query);
+    } catch (error) {
+      console.warn('Server search failed, filtering loaded results:', error);
+      matches = localMatches(query);
+    }
+    // A newer query has been typed meanwhile
+    if (token !== searchToken) return;
+    renderMatches(matches);
+  }, SEARCH_DEBOUNCE_MS);
+}
+
+export { filterResults, searchResults };
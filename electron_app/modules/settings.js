@@ -5,6 +5,7 @@
 import state from './state.js';
 import { showToast } from './ui.js';
 import { loadResults } from './data.js';
+import { pushResultsSupported, startResultFeed } from './resultfeed.js';
 
 async function testConnection() {
   const host = document.getElementById('aiHostInput').value;
@@ -46,8 +47,7 @@ function saveSettings() {
   state.refreshInterval = interval;
   state.resultsLimit = limit;
 
-  // Restart auto-refresh
-  clearInterval(state.autoRefreshTimer);
+  // Restart auto-refresh (and the result feed, the host may have changed)
   startAutoRefresh();
 
   showToast('تنظیمات ذخیره شد', 'success');
@@ -60,10 +60,27 @@ function resetSettings() {
   }
 }
 
-function startAutoRefresh() {
+function startPolling() {
+  if (state.autoRefreshTimer) return;
   state.autoRefreshTimer = setInterval(() => {
     loadResults();
   }, state.refreshInterval);
 }
 
+function stopPolling() {
+  clearInterval(state.autoRefreshTimer);
+  state.autoRefreshTimer = null;
+}
+
+// Results are pushed by the server; the interval poll only runs while the
+// push feed is down (or unsupported)
+function startAutoRefresh() {
+  stopPolling();
+  if (pushResultsSupported()) {
+    startResultFeed({ onDown: startPolling, onUp: stopPolling });
+    return;
+  }
+  startPolling();
+}
+
 export { testConnection, saveSettings, resetSettings, startAutoRefresh };
\ No newline at end of file
@@ -2,9 +2,20 @@
  * State Management Module
  */
 
+import { LOCAL_SERVICE } from './cluster.js';
+
+// Earlier builds defaulted to a port nothing listens on; the results store,
+// search, export and live feed are served by the stream service
+const LEGACY_AI_HOST = 'http://127.0.0.1:8000';
+
+function savedAiHost() {
+  const saved = localStorage.getItem('ai_host');
+  return saved && saved !== LEGACY_AI_HOST ? saved : LOCAL_SERVICE;
+}
+
 const state = {
   currentPage: 'dashboard',
-  aiHost: localStorage.getItem('ai_host') || 'http://127.0.0.1:8000',
+  aiHost: savedAiHost(),
   refreshInterval: parseInt(localStorage.getItem('refreshInterval') || '3000'),
   resultsLimit: parseInt(localStorage.getItem('resultsLimit') || '50'),
   theme: localStorage.getItem('theme') || 'dark',
@@ -7,6 +7,10 @@ import state from './state.js';
 import { showToast } from './ui.js';
 import { addStreamToPythonService } from './livestream.js';
 import { updateLiveStreamView } from './livestream.js';
+import { attachCanvas, drawFrame, clearCanvas, isWorkerCanvas, snapshotCanvas } from './renderpool.js';
+import { muxSupported, subscribeStream, unsubscribeStream, setStreamRendition, setStreamOverlay, notePainted, isMuxStream } from './streammux.js';
+import { overlayEnabled, onOverlayOptionsChange, showDetections, clearOverlay } from './overlay.js';
+import { serviceHost, serviceWsHost, addStreamUrl as clusterAddStreamUrl, waitForRoute, onRouteChange } from './cluster.js';
 
 // Maximum number of simultaneous active streams
 const MAX_ACTIVE_STREAMS = 4;
@@ -16,11 +20,63 @@ const activeStreams = new Set();
 const streamLastActivity = new Map();
 const streamRefreshTimers = new Map();
 const activeWebSockets = new Map(); // Track active WebSocket connections
+const activePassthrough = new Map(); // Track fMP4 passthrough sessions (WebSocket + MediaSource)
+const muxResubscribers = new Map(); // Per-camera resubscribe for tiles on the shared mux socket
+
+// Backoff (ms) before resubscribing a mux tile the server ended
+const MUX_RETRY_MIN_MS = 1000;
+const MUX_RETRY_MAX_MS = 15000;
 
 // Quality levels for streaming
 const QUALITY_LEVELS = [30, 50, 70, 90];
 let currentQuality = 50;
 
+// Server-side renditions (see /renditions): grid tiles get the smallest rung
+// that fills them, fullscreen gets native. The legacy quality presets map
+// onto the same ladder on the server
+const streamRenditions = new Map(); // Explicit per-camera choice (fullscreen / quality menu)
+
+function tileRendition(cameraId) {
+  const element = document.getElementById(`stream-${cameraId}`)?.closest('.stream-item') ||
+                  document.getElementById(`stream-${cameraId}`);
+  const width = (element?.clientWidth || 640) * (window.devicePixelRatio || 1);
+  if (width <= 400) return 'thumb';
+  if (width <= 800) return 'sd';
+  return 'hd';
+}
+
+function currentRendition(cameraId) {
+  return streamRenditions.get(cameraId) || tileRendition(cameraId);
+}
+
+function jpegStreamUrl(cameraId) {
+  const overlay = overlayEnabled() ? '&overlay=true' : '';
+  return `${serviceWsHost(cameraId)}/ws/stream/${cameraId}?rendition=${currentRendition(cameraId)}${overlay}`;
+}
+
+// show_bbox toggled in config.json: ask open streams to start or stop sending detections
+onOverlayOptionsChange(enabled => {
+  activeStreams.forEach(cameraId => {
+    if (!enabled) clearOverlay(cameraId);
+    if (isMuxStream(cameraId)) {
+      setStreamOverlay(cameraId, enabled);
+      return;
+    }
+    const ws = activeWebSockets.get(cameraId);
+    if (ws && ws.readyState === WebSocket.OPEN) ws.send(JSON.stringify({ type: 'overlay', enabled }));
+  });
+});
+
+// Switch this viewer's rendition over its open WebSocket; returns false when
+// there is no JPEG WebSocket to switch (passthrough / MJPEG / polling)
+function requestRendition(cameraId, message) {
+  if (isMuxStream(cameraId)) return setStreamRendition(cameraId, message);
+  const ws = activeWebSockets.get(cameraId);
+  if (!ws || ws.readyState !== WebSocket.OPEN) return false;
+  ws.send(JSON.stringify({ type: 'rendition', ...message }));
+  return true;
+}
+
 // Stream mode - WebSocket preferred for lower latency
 const STREAM_MODES = {
   WEBSOCKET: 'websocket',
@@ -29,6 +85,12 @@ const STREAM_MODES = {
 };
 let preferredMode = STREAM_MODES.WEBSOCKET; // Default to WebSocket
 
+// In WebSocket mode, try the camera's own H.264/H.265 first (decoded in the
+// renderer) and fall back to JPEG frames when the codec or ffmpeg is missing
+function passthroughSupported() {
+  return 'MediaSource' in window && localStorage.getItem('passthroughStreaming') !== 'false';
+}
+
 // Start streaming for a camera
 async function startStream(cameraId, rtspUrl) {
   console.log('Starting stream for camera:', cameraId);
@@ -71,7 +133,9 @@ async function startStream(cameraId, rtspUrl) {
   streamLastActivity.set(cameraId, Date.now());
   
   // First, add the stream to Python service (or check if it already exists)
-  const addStreamUrl = `http://127.0.0.1:8091/add_stream?stream_id=${cameraId}&rtsp_url=${encodeURIComponent(rtspUrl)}&enable_ai=true`;
+  // In cluster mode this goes to the coordinator, which places it on a node
+  const mainUrl = state.discoveredCameras.find(c => c.id === cameraId)?.mainUrl;
+  const addStreamUrl = clusterAddStreamUrl(cameraId, rtspUrl, mainUrl);
   let streamReady = false;
   
   try {
@@ -86,6 +150,9 @@ async function startStream(cameraId, rtspUrl) {
       // Stream was successfully added
       console.log('Added stream to Python service:', addResult);
       streamReady = true;
+      if (addResult.node !== undefined && !(await waitForRoute(cameraId))) {
+        throw new Error('هیچ گره‌ای در خوشه این دوربین را اجرا نکرد');
+      }
     } else if (addResult.message && addResult.message.includes('already exists')) {
       // Stream already exists - this is fine, we can proceed
       console.log('Stream already exists, proceeding with playback:', cameraId);
@@ -138,7 +205,7 @@ async function startStream(cameraId, rtspUrl) {
   // Check stream info endpoint (lighter than fetching frames)
   while (!streamInitialized && attempts < maxAttempts) {
     try {
-      const infoUrl = `http://127.0.0.1:8091/stream/${cameraId}/info?t=${Date.now()}`;
+      const infoUrl = `${serviceHost(cameraId)}/stream/${cameraId}/info?t=${Date.now()}`;
       console.log('Checking stream info:', infoUrl);
       
       const controller = new AbortController();
@@ -159,7 +226,11 @@ async function startStream(cameraId, rtspUrl) {
           console.log(`Stream initialized (attempt ${attempts + 1})`);
           break;
         } else {
-          console.log(`Stream not yet opened (attempt ${attempts + 1})`);
+          console.log(`Stream not yet opened (attempt ${attempts + 1})`, info.connection);
+          // The service retries unreachable cameras with backoff
+          if (info.connection?.state === 'backoff') {
+            statusIndicator.textContent = 'دوربین در دسترس نیست، تلاش مجدد...';
+          }
         }
       } else {
         console.log(`Stream info endpoint returned ${infoResponse.status} (attempt ${attempts + 1})`);
@@ -183,16 +254,31 @@ async function startStream(cameraId, rtspUrl) {
   // Proceed with streaming based on preferred mode
   console.log(`Starting stream with mode: ${preferredMode}`);
   
-  // Set up refresh timer to reconnect if stream is idle
+  // Set up refresh timer to reconnect if stream is idle; mux tiles get one
+  // too since the shared socket's watchdog can't see a single stalled camera
+  const useMux = preferredMode === STREAM_MODES.WEBSOCKET && muxSupported();
   setupStreamRefreshTimer(cameraId);
   
   if (preferredMode === STREAM_MODES.WEBSOCKET) {
     // Try WebSocket first for lowest latency
-    const wsUrl = `ws://127.0.0.1:8091/ws/stream/${cameraId}`;
-    console.log('Using WebSocket URL:', wsUrl);
+    const startJpegStream = () => {
+      if (useMux) {
+        setupMuxStream(cameraId, videoElement, canvasElement, placeholder, statusIndicator);
+      } else {
+        setupWebSocketStream(cameraId, jpegStreamUrl(cameraId), videoElement, canvasElement, statusIndicator);
+      }
+    };
+    
+    if (passthroughSupported()) {
+      const started = setupPassthroughStream(cameraId, canvasElement, statusIndicator, () => {
+        console.log('Passthrough not available, using JPEG WebSocket for:', cameraId);
+        startJpegStream();
+      });
+      if (started) return;
+    }
     
     try {
-      setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, statusIndicator);
+      startJpegStream();
     } catch (error) {
       console.error('WebSocket stream failed, falling back to MJPEG:', error);
       fallbackToMjpeg(cameraId, videoElement, canvasElement, placeholder, statusIndicator);
@@ -205,7 +291,7 @@ async function startStream(cameraId, rtspUrl) {
 
 // Fallback to MJPEG streaming if WebSocket fails
 function fallbackToMjpeg(cameraId, videoElement, canvasElement, placeholder, statusIndicator) {
-  const mjpegUrl = `http://127.0.0.1:8091/stream/${cameraId}/mjpeg`;
+  const mjpegUrl = `${serviceHost(cameraId)}/stream/${cameraId}/mjpeg`;
   console.log('Using MJPEG URL:', mjpegUrl);
   
   // Try MJPEG stream
@@ -217,6 +303,108 @@ function fallbackToMjpeg(cameraId, videoElement, canvasElement, placeholder, sta
   }
 }
 
+// Set up a stream on the shared multiplexed WebSocket
+function setupMuxStream(cameraId, videoElement, canvasElement, placeholder, statusIndicator) {
+  console.log(`Subscribing ${cameraId} on the mux WebSocket`);
+  
+  const offscreen = attachCanvas(cameraId, canvasElement);
+  const ctx = offscreen ? null : canvasElement.getContext('2d');
+  if (!offscreen && !ctx) {
+    console.error('Could not get canvas context');
+    return false;
+  }
+  
+  canvasElement.style.display = 'block';
+  if (videoElement) videoElement.style.display = 'none';
+  
+  let announced = false;
+  let decoding = false; // Main-thread path drops frames while one is decoding
+  let retryDelay = MUX_RETRY_MIN_MS;
+  let retryTimer = null;
+  
+  const onFrame = (blob, { timestamp }) => {
+    streamLastActivity.set(cameraId, Date.now());
+    if (offscreen) {
+      drawFrame(cameraId, blob, () => notePainted(cameraId, timestamp));
+      return;
+    }
+    if (decoding) return;
+    decoding = true;
+    createImageBitmap(blob).then(bitmap => {
+      if (canvasElement.width !== bitmap.width || canvasElement.height !== bitmap.height) {
+        canvasElement.width = bitmap.width;
+        canvasElement.height = bitmap.height;
+      }
+      ctx.drawImage(bitmap, 0, 0);
+      bitmap.close();
+      notePainted(cameraId, timestamp);
+    }).catch(error => {
+      console.warn('Could not decode frame for:', cameraId, error);
+    }).finally(() => {
+      decoding = false;
+    });
+  };
+  
+  const onStatus = (type, message) => {
+    if (type === 'subscribed') {
+      console.log(`Stream info for ${cameraId}:`, message.info);
+      statusIndicator.textContent = 'در حال پخش (WebSocket)';
+      statusIndicator.className = 'status-indicator connected';
+      retryDelay = MUX_RETRY_MIN_MS;
+      if (!announced) {
+        announced = true;
+        showToast('جریان زنده شروع شد (WebSocket)', 'success');
+      }
+    } else if (type === 'detections') {
+      showDetections(cameraId, message);
+    } else if (type === 'rendition') {
+      console.log(`Rendition for ${cameraId}:`, message.data);
+    } else if (type === 'disconnected') {
+      statusIndicator.textContent = 'در حال اتصال مجدد...';
+      statusIndicator.className = 'status-indicator warning';
+    } else if (type === 'ended') {
+      // Server dropped the stream (e.g. camera reconnect); retry like the
+      // legacy socket does on close
+      console.warn(`Mux stream ended for ${cameraId}:`, message.message || '');
+      statusIndicator.textContent = 'در حال اتصال مجدد...';
+      statusIndicator.className = 'status-indicator warning';
+      resubscribe();
+    } else if (type === 'error') {
+      console.error(`Mux stream error for ${cameraId}:`, message.message || '');
+      statusIndicator.textContent = 'خطا در اتصال WebSocket';
+      statusIndicator.className = 'status-indicator warning';
+      clearTimeout(retryTimer);
+      muxResubscribers.delete(cameraId);
+      unsubscribeStream(cameraId);
+      if (activeStreams.has(cameraId)) {
+        fallbackToMjpeg(cameraId, videoElement, canvasElement, placeholder, statusIndicator);
+      }
+    }
+  };
+  
+  const subscribe = () => {
+    subscribeStream(cameraId, currentRendition(cameraId), onFrame, onStatus, overlayEnabled());
+  };
+  
+  // Drop the subscription and take it again after a backoff, as long as the
+  // tile is still open and hasn't been restarted in the meantime
+  const resubscribe = () => {
+    unsubscribeStream(cameraId);
+    clearTimeout(retryTimer);
+    retryTimer = setTimeout(() => {
+      retryTimer = null;
+      if (activeStreams.has(cameraId) && muxResubscribers.get(cameraId) === resubscribe) {
+        subscribe();
+      }
+    }, retryDelay);
+    retryDelay = Math.min(retryDelay * 2, MUX_RETRY_MAX_MS);
+  };
+  
+  muxResubscribers.set(cameraId, resubscribe);
+  subscribe();
+  return true;
+}
+
 // Set up WebSocket stream
 function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, statusIndicator) {
   console.log(`Setting up WebSocket stream for ${cameraId} at ${wsUrl}`);
@@ -240,8 +428,11 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
       return false;
     }
     
-    const ctx = canvasElement.getContext('2d');
-    if (!ctx) {
+    // Frames are decoded and drawn by a render worker when the canvas can be
+    // transferred; otherwise on the main thread as before
+    const offscreen = attachCanvas(cameraId, canvasElement);
+    const ctx = offscreen ? null : canvasElement.getContext('2d');
+    if (!offscreen && !ctx) {
       console.error('Could not get canvas context');
       return false;
     }
@@ -267,6 +458,10 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
       if (event.data instanceof Blob) {
         // Binary frame data
         const blob = event.data;
+        if (offscreen) {
+          drawFrame(cameraId, blob);
+          return;
+        }
         const url = URL.createObjectURL(blob);
         const img = new Image();
         
@@ -287,8 +482,12 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
         // JSON message (info, heartbeat, etc.)
         try {
           const data = JSON.parse(event.data);
-          if (data.type === 'info') {
+          if (data.type === 'detections') {
+            showDetections(cameraId, data);
+          } else if (data.type === 'info') {
             console.log(`Stream info for ${cameraId}:`, data.data);
+          } else if (data.type === 'rendition') {
+            console.log(`Rendition for ${cameraId}:`, data.data);
           } else if (data.type === 'heartbeat') {
             // Just a keepalive, no action needed
           } else if (data.type === 'error') {
@@ -306,7 +505,7 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
       statusIndicator.className = 'status-indicator warning';
       
       // Fallback to MJPEG
-      const mjpegUrl = `http://127.0.0.1:8091/stream/${cameraId}/mjpeg`;
+      const mjpegUrl = `${serviceHost(cameraId)}/stream/${cameraId}/mjpeg`;
       if (videoElement) {
         console.log('Falling back to MJPEG stream');
         setupMjpegStream(cameraId, mjpegUrl, videoElement, canvasElement, null, statusIndicator);
@@ -325,7 +524,7 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
         setTimeout(() => {
           // Try WebSocket first if preferred
           if (preferredMode === STREAM_MODES.WEBSOCKET) {
-            const wsUrl = `ws://127.0.0.1:8091/ws/stream/${cameraId}`;
+            const wsUrl = jpegStreamUrl(cameraId);
             console.log(`Trying WebSocket stream at ${wsUrl}`);
             
             const success = setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, statusIndicator);
@@ -340,7 +539,7 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
           }
           
           // Reconnect with WebSocket
-          const wsUrl = `ws://127.0.0.1:8091/ws/stream/${cameraId}`;
+          const wsUrl = jpegStreamUrl(cameraId);
           const videoElement = document.getElementById(`video-${cameraId}`);
           const canvasElement = document.getElementById(`stream-${cameraId}`);
           const statusIndicator = document.getElementById(`stream-status-${cameraId}`);
@@ -361,6 +560,193 @@ function setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, stat
   }
 }
 
+// Set up passthrough stream - fMP4 fragments appended to a MediaSource so the
+// renderer decodes the camera's video in hardware
+function setupPassthroughStream(cameraId, canvasElement, statusIndicator, onFallback) {
+  closePassthroughStream(cameraId);
+  
+  const container = canvasElement?.parentElement;
+  if (!container || !window.MediaSource) {
+    return false;
+  }
+  
+  const video = document.createElement('video');
+  video.id = `passthrough-${cameraId}`;
+  video.muted = true;
+  video.autoplay = true;
+  video.playsInline = true;
+  Object.assign(video.style, {
+    position: 'absolute',
+    top: '0',
+    left: '0',
+    width: '100%',
+    height: '100%',
+    objectFit: 'contain',
+    backgroundColor: '#000',
+    zIndex: '1'
+  });
+  container.appendChild(video);
+  
+  const ws = new WebSocket(`${serviceWsHost(cameraId)}/ws/passthrough/${cameraId}`);
+  ws.binaryType = 'arraybuffer';
+  
+  const session = { ws, video, mediaSource: null, objectUrl: null, sourceBuffer: null, queue: [], failed: false, playing: false };
+  activePassthrough.set(cameraId, session);
+  
+  // A fresh MediaSource per remuxer run: a restarted remuxer starts its
+  // timeline over, which an existing SourceBuffer would park behind currentTime
+  const openMediaSource = () => {
+    if (session.objectUrl) URL.revokeObjectURL(session.objectUrl);
+    session.mediaSource = new MediaSource();
+    session.objectUrl = URL.createObjectURL(session.mediaSource);
+    session.sourceBuffer = null;
+    session.queue.length = 0;
+    session.playing = false;
+    video.src = session.objectUrl;
+  };
+  openMediaSource();
+  
+  const fail = (reason) => {
+    if (session.failed) return;
+    session.failed = true;
+    console.warn(`Passthrough failed for ${cameraId}: ${reason}`);
+    closePassthroughStream(cameraId);
+    canvasElement.style.display = 'block';
+    if (activeStreams.has(cameraId)) {
+      onFallback();
+    }
+  };
+  
+  // Keep playback at the live edge and only a few seconds buffered
+  const keepLive = () => {
+    const sourceBuffer = session.sourceBuffer;
+    if (!sourceBuffer || sourceBuffer.updating || video.buffered.length === 0) return false;
+    const end = video.buffered.end(video.buffered.length - 1);
+    if (end - video.currentTime > 1.5) {
+      video.currentTime = end - 0.3;
+    }
+    const start = video.buffered.start(0);
+    if (video.currentTime - start > 10) {
+      sourceBuffer.remove(start, video.currentTime - 5);
+      return true;
+    }
+    return false;
+  };
+  
+  const pump = () => {
+    const sourceBuffer = session.sourceBuffer;
+    if (!sourceBuffer || sourceBuffer.updating || session.queue.length === 0) return;
+    try {
+      sourceBuffer.appendBuffer(session.queue.shift());
+    } catch (error) {
+      if (error.name === 'QuotaExceededError') {
+        // Drop the backlog; the server resyncs slow viewers at a keyframe
+        session.queue.length = 0;
+      } else {
+        fail(error.message);
+      }
+    }
+  };
+  
+  const openSourceBuffer = (mediaSource, mime) => {
+    if (mediaSource !== session.mediaSource) return; // Replaced by a later reset
+    try {
+      session.sourceBuffer = mediaSource.addSourceBuffer(mime);
+    } catch (error) {
+      fail(error.message);
+      return;
+    }
+    session.sourceBuffer.mode = 'segments';
+    session.sourceBuffer.addEventListener('updateend', () => {
+      if (!session.playing && video.buffered.length > 0) {
+        session.playing = true;
+        video.play().catch(() => {});
+      }
+      if (!keepLive()) pump();
+    });
+    session.sourceBuffer.addEventListener('error', () => fail('SourceBuffer error'));
+    pump();
+  };
+  
+  ws.onmessage = (event) => {
+    if (event.data instanceof ArrayBuffer) {
+      // Init segment or media fragment, in order. Heartbeats don't count as
+      // activity so the refresh timer still notices a stalled remuxer
+      streamLastActivity.set(cameraId, Date.now());
+      session.queue.push(event.data);
+      pump();
+      return;
+    }
+    
+    let data;
+    try {
+      data = JSON.parse(event.data);
+    } catch (e) {
+      return; // "Stream ended" - the close handler takes over
+    }
+    
+    if (data.type === 'init') {
+      if (!MediaSource.isTypeSupported(data.mime)) {
+        fail(`unsupported codec ${data.codec}`);
+        return;
+      }
+      if (data.reset) {
+        // Remuxer restarted; its init segment is the next binary message
+        console.log(`Passthrough remuxer restarted for ${cameraId}, resetting playback`);
+        openMediaSource();
+      }
+      const mediaSource = session.mediaSource;
+      if (mediaSource.readyState === 'open') {
+        openSourceBuffer(mediaSource, data.mime);
+      } else {
+        mediaSource.addEventListener('sourceopen', () => openSourceBuffer(mediaSource, data.mime), { once: true });
+      }
+      if (data.reset) return;
+      
+      canvasElement.style.display = 'none';
+      statusIndicator.textContent = `در حال پخش (${data.codec.startsWith('avc1') ? 'H.264' : 'H.265'})`;
+      statusIndicator.className = 'status-indicator connected';
+      showToast('جریان زنده شروع شد', 'success');
+    } else if (data.type === 'error') {
+      fail(data.message);
+    }
+  };
+  
+  ws.onerror = () => fail('WebSocket error');
+  
+  ws.onclose = () => {
+    if (session.failed || activePassthrough.get(cameraId) !== session) return;
+    closePassthroughStream(cameraId);
+    if (activeStreams.has(cameraId)) {
+      console.log(`Passthrough closed for ${cameraId}, reconnecting`);
+      setTimeout(() => {
+        if (activeStreams.has(cameraId) && !activePassthrough.has(cameraId)) {
+          setupPassthroughStream(cameraId, canvasElement, statusIndicator, onFallback);
+        }
+      }, 2000);
+    }
+  };
+  
+  return true;
+}
+
+// Tear down a passthrough session and its video element
+function closePassthroughStream(cameraId) {
+  const session = activePassthrough.get(cameraId);
+  if (!session) return;
+  activePassthrough.delete(cameraId);
+  
+  session.ws.onclose = null;
+  if (session.ws.readyState !== WebSocket.CLOSED) {
+    session.ws.close();
+  }
+  session.video.pause();
+  session.video.removeAttribute('src');
+  session.video.load();
+  URL.revokeObjectURL(session.objectUrl);
+  session.video.remove();
+}
+
 // Set up MJPEG stream
 function setupMjpegStream(cameraId, mjpegUrl, videoElement, canvasElement, placeholder, statusIndicator) {
   // Reset any existing handlers
@@ -457,8 +843,16 @@ function setupStreamRefreshTimer(cameraId) {
       console.log(`Refreshing inactive stream ${cameraId}`);
       const videoElement = document.getElementById(`video-${cameraId}`);
       
-      // Check if we're using WebSocket
-      if (activeWebSockets.has(cameraId)) {
+      // Check if we're using passthrough or WebSocket
+      if (activePassthrough.has(cameraId)) {
+        const canvasElement = document.getElementById(`stream-${cameraId}`);
+        const statusIndicator = document.getElementById(`stream-status-${cameraId}`);
+        const wsUrl = jpegStreamUrl(cameraId);
+        setupPassthroughStream(cameraId, canvasElement, statusIndicator, () => {
+          setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, statusIndicator);
+        });
+        streamLastActivity.set(cameraId, now);
+      } else if (activeWebSockets.has(cameraId)) {
         // Close and reopen WebSocket
         const ws = activeWebSockets.get(cameraId);
         if (ws && ws.readyState !== WebSocket.CLOSED) {
@@ -466,11 +860,15 @@ function setupStreamRefreshTimer(cameraId) {
         }
         
         // Reconnect with WebSocket
-        const wsUrl = `ws://127.0.0.1:8091/ws/stream/${cameraId}`;
+        const wsUrl = jpegStreamUrl(cameraId);
         const videoElement = document.getElementById(`video-${cameraId}`);
         const canvasElement = document.getElementById(`stream-${cameraId}`);
         const statusIndicator = document.getElementById(`stream-status-${cameraId}`);
         setupWebSocketStream(cameraId, wsUrl, videoElement, canvasElement, statusIndicator);
+      } else if (muxResubscribers.has(cameraId)) {
+        // Stalled mux tile: resubscribe on the shared socket
+        muxResubscribers.get(cameraId)();
+        streamLastActivity.set(cameraId, now);
       } else if (videoElement && videoElement.src) {
         // Force refresh by temporarily clearing and resetting the source
         const currentSrc = videoElement.src;
@@ -497,6 +895,7 @@ function stopStream(cameraId) {
   
   // Remove from active streams
   activeStreams.delete(cameraId);
+  streamRenditions.delete(cameraId);
   
   // Close WebSocket if active
   if (activeWebSockets.has(cameraId)) {
@@ -507,6 +906,17 @@ function stopStream(cameraId) {
     activeWebSockets.delete(cameraId);
   }
   
+  // Leave the shared mux connection
+  muxResubscribers.delete(cameraId);
+  unsubscribeStream(cameraId);
+  
+  // Close passthrough session if active
+  closePassthroughStream(cameraId);
+  
+  // Worker-owned canvases stay attached so the tile can be restarted
+  clearCanvas(cameraId);
+  clearOverlay(cameraId);
+  
   // Clear refresh timer
   if (streamRefreshTimers.has(cameraId)) {
     clearInterval(streamRefreshTimers.get(cameraId));
@@ -576,6 +986,10 @@ async function toggleFullscreenStream(cameraId) {
       streamContainer.classList.remove('fullscreen');
       document.body.classList.remove('fullscreen-active');
       
+      // Back to the tile-sized rendition once the layout has settled
+      streamRenditions.delete(cameraId);
+      setTimeout(() => requestRendition(cameraId, { rendition: tileRendition(cameraId) }), 300);
+      
       setTimeout(async () => {
         if (document.fullscreenElement) {
           if (document.exitFullscreen) {
@@ -624,6 +1038,10 @@ async function toggleFullscreenStream(cameraId) {
         if (icon) icon.className = 'fas fa-compress';
       }
       
+      // Fullscreen viewers get the native resolution
+      streamRenditions.set(cameraId, 'native');
+      requestRendition(cameraId, { rendition: 'native' });
+      
       // Add quality selector in fullscreen mode
       addQualitySelector(streamContainer, cameraId);
       
@@ -741,16 +1159,8 @@ async function changeStreamQuality(cameraId, quality) {
           localStorage.setItem(`stream-quality-${cameraId}`, q);
           
           // Send quality change request to backend without restarting stream
-          const qualityUrl = `http://127.0.0.1:8091/set_quality?stream_id=${cameraId}&quality=${qualities[q]}`;
           try {
-            const response = await fetch(qualityUrl, { method: 'POST' });
-            const result = await response.json();
-            
-            if (result.success) {
-              showToast(`کیفیت پخش به ${q} تغییر کرد`, 'success');
-            } else {
-              showToast(`خطا در تغییر کیفیت: ${result.message || 'خطای ناشناخته'}`, 'warning');
-            }
+            await applyStreamQuality(cameraId, qualities[q], q);
           } catch (error) {
             console.error('Error changing quality:', error);
             showToast('خطا در تغییر کیفیت', 'error');
@@ -797,21 +1207,37 @@ async function changeStreamQuality(cameraId, quality) {
     localStorage.setItem(`stream-quality-${cameraId}`, quality);
     
     // Send quality change request to backend without restarting stream
-    const qualityUrl = `http://127.0.0.1:8091/set_quality?stream_id=${cameraId}&quality=${quality}`;
-    const response = await fetch(qualityUrl, { method: 'POST' });
-    const result = await response.json();
-    
-    if (result.success) {
-      showToast(`کیفیت پخش به ${quality} تغییر کرد`, 'success');
-    } else {
-      showToast(`خطا در تغییر کیفیت: ${result.message || 'خطای ناشناخته'}`, 'warning');
-    }
+    currentQuality = quality;
+    await applyStreamQuality(cameraId, quality, quality);
   } catch (error) {
     console.error('Error changing quality:', error);
     showToast('خطا در تغییر کیفیت', 'error');
   }
 }
 
+// Apply a quality preset: only this viewer's WebSocket switches rendition
+// when it is open, otherwise the stream's default rendition is changed
+async function applyStreamQuality(cameraId, quality, label) {
+  const qualityRenditions = { 30: 'sd', 50: 'hd', 70: 'hd', 90: 'native' };
+  const rendition = qualityRenditions[quality] || 'hd';
+  streamRenditions.set(cameraId, rendition);
+  
+  if (requestRendition(cameraId, { rendition })) {
+    showToast(`کیفیت پخش به ${label} تغییر کرد`, 'success');
+    return;
+  }
+  
+  const qualityUrl = `${serviceHost(cameraId)}/set_quality?stream_id=${cameraId}&rendition=${rendition}`;
+  const response = await fetch(qualityUrl, { method: 'POST' });
+  const result = await response.json();
+  
+  if (result.success) {
+    showToast(`کیفیت پخش به ${label} تغییر کرد`, 'success');
+  } else {
+    showToast(`خطا در تغییر کیفیت: ${result.message || result.detail || 'خطای ناشناخته'}`, 'warning');
+  }
+}
+
 // Listen for fullscreen changes to update button icon
 document.addEventListener('fullscreenchange', updateFullscreenButtons);
 document.addEventListener('webkitfullscreenchange', updateFullscreenButtons);
@@ -837,16 +1263,22 @@ function updateFullscreenButtons() {
 function captureSnapshot(cameraId) {
   const videoElement = document.getElementById(`video-${cameraId}`);
   const canvasElement = document.getElementById(`stream-${cameraId}`);
+  const passthroughVideo = activePassthrough.get(cameraId)?.video;
   
-  // Try video element first, then canvas
-  const element = videoElement?.src && videoElement.style.display !== 'none' ? videoElement : 
+  // Try passthrough video first, then video element, then canvas
+  const element = passthroughVideo?.videoWidth ? passthroughVideo :
+                  videoElement?.src && videoElement.style.display !== 'none' ? videoElement : 
                   canvasElement?.style.display !== 'none' ? canvasElement : null;
   
   if (element) {
     // Create canvas from element
     const canvas = document.createElement('canvas');
     
-    if (element instanceof HTMLImageElement) {
+    if (element instanceof HTMLVideoElement) {
+      // Passthrough video (decoded in the renderer)
+      canvas.width = element.videoWidth;
+      canvas.height = element.videoHeight;
+    } else if (element instanceof HTMLImageElement) {
       // Video element (MJPEG stream)
       canvas.width = element.videoWidth || element.naturalWidth || 640;
       canvas.height = element.videoHeight || element.naturalHeight || 480;
@@ -859,12 +1291,11 @@ function captureSnapshot(cameraId) {
       return;
     }
     
-    const ctx = canvas.getContext('2d');
-    
-    // Draw the current frame
-    ctx.drawImage(element, 0, 0, canvas.width, canvas.height);
-    
-    canvas.toBlob((blob) => {
+    const saveSnapshot = (blob) => {
+      if (!blob) {
+        showToast('هیچ تصویری برای ثبت وجود ندارد', 'warning');
+        return;
+      }
       const url = URL.createObjectURL(blob);
       const a = document.createElement('a');
       a.href = url;
@@ -874,7 +1305,20 @@ function captureSnapshot(cameraId) {
       document.body.removeChild(a);
       URL.revokeObjectURL(url);
       showToast('عکس ثبت شد', 'success');
-    }, 'image/png');
+    };
+    
+    // A worker-owned canvas can't be read here; its worker encodes the PNG
+    if (isWorkerCanvas(cameraId, element)) {
+      snapshotCanvas(cameraId).then(saveSnapshot);
+      return;
+    }
+    
+    const ctx = canvas.getContext('2d');
+    
+    // Draw the current frame
+    ctx.drawImage(element, 0, 0, canvas.width, canvas.height);
+    
+    canvas.toBlob(saveSnapshot, 'image/png');
   } else {
     showToast('هیچ تصویری برای ثبت وجود ندارد', 'warning');
   }
@@ -918,39 +1362,79 @@ function startFramePolling(cameraId, canvasElement, statusIndicator) {
     }
   }
   
-  const ctx = canvasElement.getContext('2d');
-  const frameUrl = `http://127.0.0.1:8091/stream/${cameraId}/frame`;
+  const offscreen = attachCanvas(cameraId, canvasElement);
+  const ctx = offscreen ? null : canvasElement.getContext('2d');
+  const frameUrl = `${serviceHost(cameraId)}/stream/${cameraId}/frame`;
   
-  // Optimized frame polling with faster refresh rate
+  // Long-poll keyed on the frame sequence: the server holds each request
+  // until a newer frame exists (or answers 304), so no duplicate frames are
+  // fetched and the rendition's frame rate paces the loop
+  const LONG_POLL_WAIT = 5; // Seconds the server may hold a request
   let errorCount = 0;
-  let currentDelay = 100; // Start with 100ms (10 FPS) for smoother video
+  let currentDelay = 0;
   let isPolling = true;
   let abortController = null;
+  let lastSeq = null;
+  let lastRendition = null;
   
   const pollFrame = async () => {
     if (!isPolling) return;
     
     try {
-      const timestamp = Date.now();
+      // Sequence numbers are per rendition, so a switch starts over
+      const rendition = currentRendition(cameraId);
+      if (rendition !== lastRendition) {
+        lastRendition = rendition;
+        lastSeq = null;
+      }
+      
       abortController = new AbortController();
       const timeoutId = setTimeout(() => {
         abortController.abort();
         console.log('Frame request timeout for:', cameraId);
-      }, 3000); // 3 second timeout (reduced from 5s)
+      }, (LONG_POLL_WAIT + 3) * 1000);
       
-      // Reduced logging to improve performance
-      const response = await fetch(`${frameUrl}?t=${timestamp}`, {
-        cache: 'no-cache',
+      const after = lastSeq !== null ? `&after_seq=${lastSeq}` : '';
+      const response = await fetch(`${frameUrl}?rendition=${rendition}&wait=${LONG_POLL_WAIT}${after}`, {
+        cache: 'no-store',
         signal: abortController.signal
       });
       
       clearTimeout(timeoutId);
       
+      if (response.status === 304) {
+        // Nothing newer within the wait - ask again right away
+        errorCount = 0;
+        if (isPolling) {
+          state.streamIntervals[cameraId] = setTimeout(pollFrame, 0);
+        }
+        return;
+      }
+      
       if (!response.ok) {
         throw new Error(`HTTP ${response.status}`);
       }
       
+      const seq = parseInt(response.headers.get('X-Frame-Seq'), 10);
+      lastSeq = Number.isNaN(seq) ? null : seq;
+      
       const blob = await response.blob();
+      
+      if (offscreen) {
+        // The render worker decodes, letterboxing is left to CSS object-fit
+        drawFrame(cameraId, blob);
+        errorCount = 0;
+        currentDelay = 0;
+        if (statusIndicator) {
+          statusIndicator.textContent = 'در حال پخش';
+          statusIndicator.className = 'status-indicator connected';
+        }
+        if (isPolling) {
+          state.streamIntervals[cameraId] = setTimeout(pollFrame, currentDelay);
+        }
+        return;
+      }
+      
       const imageUrl = URL.createObjectURL(blob);
       
       const img = new Image();
@@ -988,7 +1472,7 @@ function startFramePolling(cameraId, canvasElement, statusIndicator) {
         
         // Reset error count on success
         errorCount = 0;
-        currentDelay = 100; // Keep faster refresh rate
+        currentDelay = 0; // The server paces the next request
         
         if (statusIndicator) {
           statusIndicator.textContent = 'در حال پخش';
@@ -1006,7 +1490,7 @@ function startFramePolling(cameraId, canvasElement, statusIndicator) {
         URL.revokeObjectURL(imageUrl);
         errorCount++;
         // Faster recovery on errors
-        currentDelay = Math.min(currentDelay * 1.2, 2000); // Max 2 seconds (reduced from 10s)
+        currentDelay = Math.min(Math.max(currentDelay, 100) * 1.2, 2000); // Max 2 seconds (reduced from 10s)
         if (isPolling) {
           const nextTimeout = setTimeout(pollFrame, currentDelay);
           state.streamIntervals[cameraId] = nextTimeout;
@@ -1029,7 +1513,7 @@ function startFramePolling(cameraId, canvasElement, statusIndicator) {
         errorCount++;
         
         // Exponential backoff on errors to prevent resource exhaustion
-        currentDelay = Math.min(currentDelay * 2, 10000); // Max 10 seconds
+        currentDelay = Math.min(Math.max(currentDelay, 100) * 2, 10000); // Max 10 seconds
         
         if (statusIndicator && errorCount < 3) {
           statusIndicator.textContent = 'خطا در اتصال';
@@ -1087,6 +1571,17 @@ function initStreamingMode() {
 // Call initialization on module load
 initStreamingMode();
 
+// A camera moved to another cluster node (failover or rebalance): reconnect
+// its tile to the new node
+onRouteChange(cameraIds => {
+  cameraIds.filter(cameraId => activeStreams.has(cameraId)).forEach(cameraId => {
+    const camera = state.discoveredCameras.find(c => c.id === cameraId);
+    if (!camera) return;
+    stopStream(cameraId);
+    startStream(cameraId, camera.url);
+  });
+});
+
 // Make sure functions are available globally
 window.startStream = startStream;
 window.stopStream = stopStream;
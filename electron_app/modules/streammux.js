@@ -0,0 +1,249 @@
+/**
+ * Stream Mux Module - Every JPEG camera stream over one WebSocket per service node
+ * Frames carry a small binary header; subscriptions are JSON control messages
+ */
+
+import { serviceWsHost } from './cluster.js';
+
+const MUX_PATH = '/ws/mux';
+
+// version u8, rendition u8, stream id length u16, sequence u32,
+// timestamp f64 (seconds), payload length u32 - big endian
+const HEADER_BYTES = 20;
+const MUX_VERSION = 1;
+// Capture-to-glass samples kept per camera between reports
+const LATENCY_SAMPLES_MAX = 100;
+
+const subscriptions = new Map(); // cameraId -> { host, rendition, overlay, onFrame, onStatus, latency }
+const connections = new Map(); // host -> { socket, reconnectTimer, reconnectDelay, lastMessageTime, renditionNames }
+const textDecoder = new TextDecoder();
+let watchdogTimer = null;
+
+// The mux can be switched off with localStorage.muxStreaming = 'false'
+function muxSupported() {
+  return localStorage.getItem('muxStreaming') !== 'false';
+}
+
+// In a cluster each node carries its own cameras, so there is one mux per node
+function hostSubscriptions(host) {
+  return [...subscriptions].filter(([, subscription]) => subscription.host === host);
+}
+
+function send(host, message) {
+  const socket = connections.get(host)?.socket;
+  if (!socket || socket.readyState !== WebSocket.OPEN) return false;
+  socket.send(JSON.stringify(message));
+  return true;
+}
+
+function connect(host) {
+  let connection = connections.get(host);
+  if (!connection) {
+    connection = {
+      socket: null,
+      reconnectTimer: null,
+      reconnectDelay: 1000,
+      lastMessageTime: 0,
+      renditionNames: ['thumb', 'sd', 'hd', 'native'] // Replaced by the server's hello
+    };
+    connections.set(host, connection);
+  }
+  const current = connection.socket;
+  if (current && (current.readyState === WebSocket.OPEN || current.readyState === WebSocket.CONNECTING)) {
+    return;
+  }
+
+  const socket = new WebSocket(host + MUX_PATH);
+  socket.binaryType = 'arraybuffer';
+  connection.socket = socket;
+
+  socket.onopen = () => {
+    console.log('Mux WebSocket connected:', host);
+    connection.reconnectDelay = 1000;
+    connection.lastMessageTime = Date.now();
+    // (Re)subscribe everything the view still wants from this node
+    hostSubscriptions(host).forEach(([cameraId, subscription]) => {
+      send(host, { type: 'subscribe', stream_id: cameraId, rendition: subscription.rendition,
+                   overlay: subscription.overlay });
+    });
+  };
+
+  socket.onmessage = (event) => {
+    connection.lastMessageTime = Date.now();
+    if (event.data instanceof ArrayBuffer) {
+      handleFrames(host, connection, event.data);
+    } else {
+      handleControl(connection, event.data);
+    }
+  };
+
+  socket.onerror = (error) => {
+    console.error('Mux WebSocket error:', error);
+  };
+
+  socket.onclose = () => {
+    console.log('Mux WebSocket closed:', host);
+    if (connection.socket === socket) connection.socket = null;
+    // A connection dropped by unsubscribeStream may have been replaced already
+    if (connections.get(host) !== connection) return;
+    const remaining = hostSubscriptions(host);
+    remaining.forEach(([, subscription]) => subscription.onStatus?.('disconnected'));
+    if (remaining.length === 0) {
+      connections.delete(host);
+      return;
+    }
+    scheduleReconnect(host, connection);
+  };
+
+  startWatchdog();
+}
+
+function scheduleReconnect(host, connection) {
+  if (connection.reconnectTimer) return;
+  connection.reconnectTimer = setTimeout(() => {
+    connection.reconnectTimer = null;
+    if (hostSubscriptions(host).length > 0) connect(host);
+  }, connection.reconnectDelay);
+  connection.reconnectDelay = Math.min(connection.reconnectDelay * 2, 15000);
+}
+
+// One timer for all nodes: the server heartbeats every second, so a
+// silent socket is stale and gets replaced. The same tick reports
+// capture-to-glass latency for /metrics
+function startWatchdog() {
+  if (watchdogTimer) return;
+  watchdogTimer = setInterval(() => {
+    if (subscriptions.size === 0) {
+      clearInterval(watchdogTimer);
+      watchdogTimer = null;
+      return;
+    }
+    connections.forEach((connection, host) => {
+      const socket = connection.socket;
+      if (socket && socket.readyState === WebSocket.OPEN && Date.now() - connection.lastMessageTime > 15000) {
+        console.log('Mux WebSocket idle, reconnecting:', host);
+        socket.close();
+      }
+    });
+    subscriptions.forEach((subscription, cameraId) => {
+      if (subscription.latency.length === 0) return;
+      send(subscription.host, { type: 'latency', stream_id: cameraId, samples: subscription.latency });
+      subscription.latency = [];
+    });
+  }, 5000);
+}
+
+// A binary message holds one or more frame records back to back
+function handleFrames(host, connection, buffer) {
+  const view = new DataView(buffer);
+  let offset = 0;
+
+  while (offset + HEADER_BYTES <= buffer.byteLength) {
+    if (view.getUint8(offset) !== MUX_VERSION) {
+      console.warn('Unknown mux frame version:', view.getUint8(offset));
+      return;
+    }
+    const rendition = connection.renditionNames[view.getUint8(offset + 1)];
+    const idLength = view.getUint16(offset + 2);
+    const seq = view.getUint32(offset + 4);
+    const timestamp = view.getFloat64(offset + 8);
+    const payloadLength = view.getUint32(offset + 16);
+
+    const idStart = offset + HEADER_BYTES;
+    const payloadStart = idStart + idLength;
+    const cameraId = textDecoder.decode(new Uint8Array(buffer, idStart, idLength));
+
+    const subscription = subscriptions.get(cameraId);
+    if (subscription && subscription.host === host) {
+      const blob = new Blob([new Uint8Array(buffer, payloadStart, payloadLength)], { type: 'image/jpeg' });
+      subscription.onFrame(blob, { seq, timestamp, rendition });
+    }
+    offset = payloadStart + payloadLength;
+  }
+}
+
+function handleControl(connection, text) {
+  let message;
+  try {
+    message = JSON.parse(text);
+  } catch (e) {
+    console.warn('Non-JSON mux message received:', text);
+    return;
+  }
+
+  if (message.type === 'hello') {
+    connection.renditionNames = message.renditions || connection.renditionNames;
+    return;
+  }
+  if (message.type === 'heartbeat') return;
+
+  const subscription = message.stream_id ? subscriptions.get(message.stream_id) : null;
+  if (subscription) {
+    subscription.onStatus?.(message.type, message);
+  }
+}
+
+// Subscribe a camera; onFrame(blob, { seq, timestamp, rendition }) gets every
+// frame, onStatus(type, message) gets subscribed / rendition / detections /
+// error / ended. With overlay the service sends detections after their frames
+function subscribeStream(cameraId, rendition, onFrame, onStatus, overlay = false) {
+  const host = serviceWsHost(cameraId);
+  const previous = subscriptions.get(cameraId);
+  if (previous && previous.host !== host) unsubscribeStream(cameraId);
+
+  subscriptions.set(cameraId, { host, rendition, overlay, onFrame, onStatus, latency: [] });
+  if (!send(host, { type: 'subscribe', stream_id: cameraId, rendition, overlay })) {
+    connect(host);
+  }
+}
+
+function unsubscribeStream(cameraId) {
+  const subscription = subscriptions.get(cameraId);
+  if (!subscription) return;
+  subscriptions.delete(cameraId);
+  send(subscription.host, { type: 'unsubscribe', stream_id: cameraId });
+
+  // Nothing left to carry on that node - let the connection go
+  const connection = connections.get(subscription.host);
+  if (connection && hostSubscriptions(subscription.host).length === 0) {
+    clearTimeout(connection.reconnectTimer);
+    connections.delete(subscription.host);
+    connection.socket?.close();
+  }
+}
+
+function setStreamRendition(cameraId, message) {
+  const subscription = subscriptions.get(cameraId);
+  if (!subscription) return false;
+  if (message.rendition) subscription.rendition = message.rendition;
+  return send(subscription.host, { type: 'rendition', stream_id: cameraId, ...message });
+}
+
+function setStreamOverlay(cameraId, enabled) {
+  const subscription = subscriptions.get(cameraId);
+  if (!subscription) return false;
+  subscription.overlay = enabled;
+  return send(subscription.host, { type: 'overlay', stream_id: cameraId, enabled });
+}
+
+// Called once a frame is on screen with the capture timestamp from its header.
+// Assumes the service and this machine share a clock (same host or NTP)
+function notePainted(cameraId, timestamp) {
+  const subscription = subscriptions.get(cameraId);
+  if (!subscription || !timestamp || subscription.latency.length >= LATENCY_SAMPLES_MAX) return;
+  subscription.latency.push(Math.round((Date.now() / 1000 - timestamp) * 10000) / 10000);
+}
+
+function isMuxStream(cameraId) {
+  return subscriptions.has(cameraId);
+}
+
+export {
+  muxSupported,
+  subscribeStream,
+  unsubscribeStream,
+  setStreamRendition,
+  setStreamOverlay,
+  notePainted,
+  isMuxStream
+};
@@ -82,4 +82,9 @@ function formatDateTime(timestamp) {
   return date.toLocaleString('fa-IR');
 }
 
-export { showToast, updateConnectionStatus, updateCameraFilter, formatTime, formatDateTime };
\ No newline at end of file
+// Feed ids restart with the service; first_seen keeps keys from earlier runs apart
+function resultKey(result) {
+  return `${result.id}:${result.first_seen}`;
+}
+
+export { showToast, updateConnectionStatus, updateCameraFilter, formatTime, formatDateTime, resultKey };
\ No newline at end of file
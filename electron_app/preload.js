@@ -1,6 +1,18 @@
 const { contextBridge, ipcRenderer } = require('electron')
 
 contextBridge.exposeInMainWorld('lpr', {
+    /**
+     * Read the app's config.json
+     * @returns {Promise<Object>} Parsed config (empty when it can't be read)
+     */
+    getConfig: async () => {
+        try {
+            return await ipcRenderer.invoke('get-config')
+        } catch (e) {
+            return {}
+        }
+    },
+
     /**
      * Fetch latest license plate recognition results
      * @param {string} host - AI service host URL
@@ -15,6 +27,20 @@ contextBridge.exposeInMainWorld('lpr', {
         }
     },
 
+    /**
+     * Search stored recognition results on the server
+     * @param {string} host - AI service host URL
+     * @param {Object} params - plate, mode, camera_id, start, end, min_confidence, limit, cursor
+     * @returns {Promise<Object>} { results, next_cursor }
+     */
+    searchResults: async (host, params) => {
+        try {
+            return await ipcRenderer.invoke('search-results', host, params)
+        } catch (e) {
+            return { error: String(e) }
+        }
+    },
+
     /**
      * Check health status of AI service
      * @param {string} host - AI service host URL
@@ -42,5 +68,21 @@ contextBridge.exposeInMainWorld('lpr', {
         } catch (e) {
             return { success: false, error: String(e) }
         }
+    },
+
+    /**
+     * Scan a subnet for cameras
+     * @param {string} subnet - CIDR range, e.g. 192.168.1.0/24
+     * @param {string} user - Camera username
+     * @param {string} pass - Camera password
+     * @param {string} brand - Camera brand (optional)
+     * @returns {Promise<Object>} Scan results with the cameras found and their streams
+     */
+    scanNetwork: async (subnet, user, pass, brand) => {
+        try {
+            return await ipcRenderer.invoke('scan-network', subnet, user, pass, brand)
+        } catch (e) {
+            return { success: false, error: String(e) }
+        }
     }
 })
\ No newline at end of file
@@ -5,49 +5,54 @@ High-performance object detection and recognition
 
 import cv2
 import numpy as np
-from ultralytics import YOLO
-import torch
 from typing import List, Dict, Tuple, Optional
+import os
 import time
 from loguru import logger
 import asyncio
-from concurrent.futures import ThreadPoolExecutor
-import threading
+from collections import deque
+
+from detections import Detections
+from inference_backends import InferenceBackend, create_backend, detect_device, downscale_frame, BACKEND_AUTO
+from inference_scheduler import BatchInferenceScheduler
+from lpr import LPRScheduler, PlateReader
 
 class AIProcessor:
     """High-performance AI processor for CCTV recognition"""
     
-    def __init__(self, model_path: str = "yolov8n.pt", device: str = "auto"):
-        self.model_path = model_path
+    def __init__(self, model_path: str = None, device: str = "auto", backend: str = None):
+        self.model_path = model_path or os.environ.get("AI_MODEL_PATH", "yolov8n.pt")
+        self.backend_name = backend or os.environ.get("AI_BACKEND", BACKEND_AUTO)
         self.device = self._get_optimal_device(device)
-        self.model = None
-        self.executor = ThreadPoolExecutor(max_workers=4)
-        self.processing_queue = asyncio.Queue()
-        self.results_cache = {}
-        self.cache_lock = threading.Lock()
+        self.model: Optional[InferenceBackend] = None
+        self.input_size = int(os.environ.get("AI_INPUT_SIZE", 640))
         
         # Performance metrics
-        self.inference_times = []
+        self.inference_times = deque(maxlen=100)  # Per-frame seconds for the rolling average
         self.total_inferences = 0
+        self.total_batches = 0
+        
+        # Cross-stream batching of inference requests
+        self.scheduler = BatchInferenceScheduler(self)
+        
+        # Plate detector + OCR, batched across vehicles and cameras
+        self.plate_reader = PlateReader(self.device)
+        self.lpr_scheduler = LPRScheduler(self.plate_reader)
         
         logger.info(f"AI Processor initialized with device: {self.device}")
     
     def _get_optimal_device(self, device: str) -> str:
         """Determine the optimal device for inference"""
-        if device == "auto":
-            if torch.cuda.is_available():
-                return "cuda"
-            elif hasattr(torch.backends, 'mps') and torch.backends.mps.is_available():
-                return "mps"
-            else:
-                return "cpu"
-        return device
+        return detect_device(device)
     
     def load_model(self) -> bool:
-        """Load the YOLO model"""
+        """Load the detection model through its backend"""
         try:
-            self.model = YOLO(self.model_path)
-            logger.info(f"Model loaded successfully: {self.model_path}")
+            backend = create_backend(self.model_path, self.device, self.backend_name, self.input_size)
+            backend.load()
+            self.model = backend
+            logger.info(f"Model loaded successfully: {self.model_path} ({backend.name})")
+            self.plate_reader.load()
             return True
         except Exception as e:
             logger.error(f"Failed to load model: {e}")
@@ -55,149 +60,79 @@ class AIProcessor:
     
     def preprocess_frame(self, frame: np.ndarray) -> np.ndarray:
         """Preprocess frame for optimal inference"""
-        # Resize if too large (maintain aspect ratio)
-        height, width = frame.shape[:2]
-        max_size = 1280
+        return downscale_frame(frame)
+    
+    @staticmethod
+    def _is_gpu_frame(frame) -> bool:
+        """Check for a GPU-resident frame (e.g. an NVDEC GpuFrame)"""
+        return hasattr(frame, "__cuda_array_interface__")
+    
+    def detect_objects(self, frame: np.ndarray, confidence_threshold: float = 0.5,
+                       as_arrays: bool = False, stream_id: str = "default"):
+        """Detect objects in frame using YOLO
+        
+        Returns a list of detection dicts, or a struct-of-arrays Detections
+        when as_arrays is set. Blocks on the batch scheduler, whose thread is
+        the only one that touches the backend.
+        """
+        return self.scheduler.submit(stream_id, frame, confidence_threshold, as_arrays).result()
+    
+    def detect_objects_batch(self, frames: List, confidence_threshold: float = 0.5,
+                             as_arrays: bool = False) -> List:
+        """Detect objects in several frames with a single batched forward pass"""
+        names = self.model.names if self.model is not None else []
+        batch_results: List[Detections] = [Detections.empty(names) for _ in frames]
         
-        if max(height, width) > max_size:
-            scale = max_size / max(height, width)
-            new_width = int(width * scale)
-            new_height = int(height * scale)
-            frame = cv2.resize(frame, (new_width, new_height), interpolation=cv2.INTER_LINEAR)
+        def finish(results: List[Detections]) -> List:
+            return results if as_arrays else [result.to_dicts() for result in results]
         
-        return frame
-    
-    def detect_objects(self, frame: np.ndarray, confidence_threshold: float = 0.5) -> List[Dict]:
-        """Detect objects in frame using YOLO"""
         if self.model is None:
             logger.warning("Model not loaded")
-            return []
+            return finish(batch_results)
         
-        # Add logging to check frame properties
-        logger.debug(f"Processing frame with shape: {frame.shape if frame is not None else 'None'}")
-        
-        if frame is None or frame.size == 0:
+        valid = [i for i, frame in enumerate(frames) if frame is not None and frame.size > 0]
+        if len(valid) < len(frames):
             logger.warning("Empty or None frame provided for detection")
-            return []
+        if not valid:
+            return finish(batch_results)
         
         start_time = time.time()
         
         try:
-            # Preprocess frame
-            processed_frame = self.preprocess_frame(frame)
-            logger.debug(f"Preprocessed frame shape: {processed_frame.shape}")
-            
-            # Run inference
-            results = self.model(processed_frame, conf=confidence_threshold, verbose=False)
-            logger.debug(f"Model inference completed, results type: {type(results)}")
+            logger.debug(f"Running batch of {len(valid)} frames on {self.model.name}")
             
-            # Process results
-            detections = []
-            for result in results:
-                boxes = result.boxes
-                if boxes is not None:
-                    logger.debug(f"Found {len(boxes)} boxes in result")
-                    for box in boxes:
-                        # Get box coordinates
-                        x1, y1, x2, y2 = box.xyxy[0].cpu().numpy()
-                        confidence = box.conf[0].cpu().numpy()
-                        class_id = int(box.cls[0].cpu().numpy())
-                        class_name = self.model.names[class_id]
-                        
-                        detections.append({
-                            "bbox": [int(x1), int(y1), int(x2), int(y2)],
-                            "confidence": float(confidence),
-                            "class_id": class_id,
-                            "class_name": class_name,
-                            "timestamp": time.time()
-                        })
-                else:
-                    logger.debug("No boxes found in result")
+            # One backend call for the whole batch, routed back to its frames
+            results = self.model.infer_batch([frames[i] for i in valid], confidence_threshold)
+            for index, detections in zip(valid, results):
+                batch_results[index] = detections
             
             # Update performance metrics
             inference_time = time.time() - start_time
-            self.inference_times.append(inference_time)
-            self.total_inferences += 1
-            
-            # Keep only last 100 inference times for rolling average
-            if len(self.inference_times) > 100:
-                self.inference_times = self.inference_times[-100:]
+            self.inference_times.append(inference_time / len(valid))
+            self.total_inferences += len(valid)
+            self.total_batches += 1
             
-            logger.debug(f"Detected {len(detections)} objects with confidence threshold {confidence_threshold}")
-            return detections
+            logger.debug(f"Detected {sum(len(d) for d in batch_results)} objects in {len(valid)} frames with confidence threshold {confidence_threshold}")
+            return finish(batch_results)
             
         except Exception as e:
             logger.error(f"Error during object detection: {e}")
             import traceback
             logger.error(f"Traceback: {traceback.format_exc()}")
-            return []
-    
-    def detect_license_plates(self, frame: np.ndarray) -> List[Dict]:
-        """Specialized license plate detection"""
-        # Use YOLO to detect vehicles first
-        vehicle_detections = self.detect_objects(frame, confidence_threshold=0.3)
-        
-        # Filter for vehicles (car, truck, bus, motorcycle)
-        vehicle_classes = [2, 3, 5, 7]  # COCO class IDs for vehicles
-        vehicles = [det for det in vehicle_detections if det["class_id"] in vehicle_classes]
-        
-        license_plates = []
-        for vehicle in vehicles:
-            x1, y1, x2, y2 = vehicle["bbox"]
-            
-            # Extract vehicle region
-            vehicle_roi = frame[y1:y2, x1:x2]
-            
-            # Look for license plate in vehicle region
-            # This is a simplified approach - in production, use a dedicated LPR model
-            plate_candidates = self._find_license_plate_candidates(vehicle_roi)
-            
-            for plate in plate_candidates:
-                # Adjust coordinates to full frame
-                plate["bbox"] = [
-                    x1 + plate["bbox"][0],
-                    y1 + plate["bbox"][1],
-                    x1 + plate["bbox"][2],
-                    y1 + plate["bbox"][3]
-                ]
-                plate["vehicle_bbox"] = vehicle["bbox"]
-                plate["vehicle_confidence"] = vehicle["confidence"]
-                license_plates.append(plate)
-        
-        return license_plates
+            return finish(batch_results)
     
-    def _find_license_plate_candidates(self, vehicle_roi: np.ndarray) -> List[Dict]:
-        """Find potential license plate regions in vehicle ROI"""
-        candidates = []
-        
-        try:
-            # Convert to grayscale
-            gray = cv2.cvtColor(vehicle_roi, cv2.COLOR_BGR2GRAY)
-            
-            # Apply edge detection
-            edges = cv2.Canny(gray, 50, 150)
-            
-            # Find contours
-            contours, _ = cv2.findContours(edges, cv2.RETR_EXTERNAL, cv2.CHAIN_APPROX_SIMPLE)
-            
-            for contour in contours:
-                # Get bounding rectangle
-                x, y, w, h = cv2.boundingRect(contour)
-                
-                # Filter by aspect ratio (license plates are typically wider than tall)
-                aspect_ratio = w / h
-                if 2.0 <= aspect_ratio <= 6.0 and w > 50 and h > 10:
-                    candidates.append({
-                        "bbox": [x, y, x + w, y + h],
-                        "confidence": 0.5,  # Placeholder confidence
-                        "class_name": "license_plate",
-                        "timestamp": time.time()
-                    })
-        
-        except Exception as e:
-            logger.error(f"Error finding license plate candidates: {e}")
-        
-        return candidates
+    def detect_license_plates(self, frame: np.ndarray, vehicle_detections=None,
+                              stream_id: str = "default") -> List[Dict]:
+        """Specialized license plate detection
+        
+        Pass the frame's vehicle detections when they are already known so
+        YOLO does not run twice on the same frame. Both passes go through
+        their schedulers rather than calling the models directly.
+        """
+        if vehicle_detections is None:
+            vehicle_detections = self.detect_objects(frame, confidence_threshold=0.3, as_arrays=True,
+                                                     stream_id=stream_id)
+        return self.lpr_scheduler.submit(stream_id, frame, vehicle_detections).result()
     
     def draw_detections(self, frame: np.ndarray, detections: List[Dict]) -> np.ndarray:
         """Draw detection boxes on frame"""
@@ -228,28 +163,32 @@ class AIProcessor:
         
         return {
             "total_inferences": self.total_inferences,
+            "total_batches": self.total_batches,
+            "average_batch_size": self.total_inferences / self.total_batches if self.total_batches else 0,
+            "scheduler": self.scheduler.get_stats(),
             "average_inference_time": avg_inference_time,
             "estimated_fps": fps,
             "device": self.device,
-            "model_loaded": self.model is not None
+            "backend": self.model.name if self.model is not None else self.backend_name,
+            "model_path": self.model_path,
+            "model_loaded": self.model is not None,
+            "lpr": dict(self.plate_reader.get_stats(), scheduler=self.lpr_scheduler.get_stats())
         }
     
-    async def process_frame_async(self, frame: np.ndarray, detection_type: str = "objects") -> List[Dict]:
-        """Asynchronously process a frame"""
-        loop = asyncio.get_event_loop()
-        
+    async def process_frame_async(self, frame: np.ndarray, detection_type: str = "objects",
+                                  stream_id: str = "default") -> List[Dict]:
+        """Asynchronously process a frame
+        
+        Inference goes through the batch scheduler so frames from every
+        stream share forward passes; plate reading is batched the same way
+        by the LPR scheduler.
+        """
         if detection_type == "license_plates":
-            result = await loop.run_in_executor(
-                self.executor, 
-                self.detect_license_plates, 
-                frame
-            )
+            vehicles = await self.scheduler.submit_async(stream_id, frame, confidence_threshold=0.3,
+                                                         as_arrays=True)
+            result = await asyncio.wrap_future(self.lpr_scheduler.submit(stream_id, frame, vehicles))
         else:
-            result = await loop.run_in_executor(
-                self.executor, 
-                self.detect_objects, 
-                frame
-            )
+            result = await self.scheduler.submit_async(stream_id, frame)
         
         return result
 
@@ -0,0 +1,426 @@
+"""
+Per-Stream AI Stage
+Detection-interval striding and motion gating in front of the batch scheduler
+"""
+
+import itertools
+import os
+import threading
+import time
+from typing import Callable, Dict, List, Optional, Tuple
+
+import cv2
+import numpy as np
+from loguru import logger
+
+from detections import Detections
+from frame_pool import FrameHandle
+from lpr import VEHICLE_CLASSES, PlateResultsFeed
+from metrics import metrics
+from tracker import ObjectTracker
+
+# Each stage's tracker numbers tracks from 1, so results are keyed per stage
+# generation as well: a re-added stream never upgrades an earlier car's read
+_generations = itertools.count(1)
+
+
+class MotionGate:
+    """Cheap motion detector over a downscaled, blurred grayscale frame
+
+    Keeps a running-average background and reports motion when enough
+    pixels differ from it. After motion the gate stays open for hold
+    seconds so objects that stop (a car pulling up) still get detected, and
+    it opens every refresh seconds regardless so static detections are
+    periodically confirmed.
+    """
+
+    def __init__(self, width: int = 160, pixel_threshold: int = 25, min_area: float = None,
+                 hold: float = 2.0, refresh: float = 30.0, learning_rate: float = 0.05):
+        self.width = width
+        self.pixel_threshold = pixel_threshold
+        self.min_area = min_area if min_area is not None else float(os.environ.get("AI_MOTION_MIN_AREA", 0.003))
+        self.hold = hold
+        self.refresh = refresh
+        self.learning_rate = learning_rate
+        self._background: Optional[np.ndarray] = None
+        self._open_until = 0.0
+        self._last_open = 0.0
+        self.last_motion_area = 0.0
+
+    def _small_gray(self, frame) -> np.ndarray:
+        # GPU frames are shrunk on the device, so only a thumbnail is downloaded
+        if hasattr(frame, "download"):
+            frame = frame.download(self.width)
+        height, width = frame.shape[:2]
+        if width > self.width:
+            frame = cv2.resize(frame, (self.width, max(1, int(height * self.width / width))),
+                               interpolation=cv2.INTER_AREA)
+        gray = cv2.cvtColor(frame, cv2.COLOR_BGR2GRAY) if frame.ndim == 3 else frame
+        return cv2.GaussianBlur(gray, (5, 5), 0)
+
+    def check(self, frame) -> bool:
+        """Update the background with a frame and report whether to run inference"""
+        now = time.time()
+        gray = self._small_gray(frame)
+
+        if self._background is None or self._background.shape != gray.shape:
+            self._background = gray.astype(np.float32)
+            self._open_until = now + self.hold
+            self._last_open = now
+            return True
+
+        diff = cv2.absdiff(gray, cv2.convertScaleAbs(self._background))
+        self.last_motion_area = np.count_nonzero(diff > self.pixel_threshold) / diff.size
+        cv2.accumulateWeighted(gray, self._background, self.learning_rate)
+
+        if self.last_motion_area >= self.min_area:
+            self._open_until = now + self.hold
+        if now < self._open_until or now - self._last_open >= self.refresh:
+            self._last_open = now
+            return True
+        return False
+
+    def reset(self):
+        self._background = None
+
+
+class StreamAIStage:
+    """AI stage for one stream, fed by its capture worker
+
+    The capture loop calls tick() for every frame pulled from the camera and
+    asks due() whether the next frame should be decoded for inference. Every
+    interval frames one frame is offered; the motion gate drops it on static
+    scenes, otherwise it goes to the shared batch scheduler. Only one request
+    per stream is in flight, so a slow model sheds load instead of queueing.
+    Results pass through the stream's tracker, which tags each detection
+    with a stable track id.
+    """
+
+    def __init__(self, stream_id: str, processor, interval: int, motion_gate: Optional[MotionGate],
+                 confidence_threshold: float = 0.5,
+                 on_result: Optional[Callable[["StreamAIStage", FrameHandle, Detections, int], None]] = None):
+        self.stream_id = stream_id
+        self.processor = processor
+        self.interval = max(1, interval)
+        self.motion_gate = motion_gate
+        self.confidence_threshold = confidence_threshold
+        self.on_result = on_result
+        self.tracker = ObjectTracker(class_groups=[VEHICLE_CLASSES])
+        self.generation = next(_generations)
+        self.enabled = True
+        self.frames_since_offer = 0
+        self.in_flight = False
+
+        # Latest results, replaced as a whole so readers never see a mix
+        self.latest: Optional[Detections] = None
+        self.latest_seq = 0
+        self.latest_plates: List[Dict] = []
+        self.lpr_in_flight = False
+        # Dual-stream cameras: returns a retained main-stream frame to read
+        # plates from, or None to read them off the detection frame
+        self.detail_source: Optional[Callable[[], Optional[FrameHandle]]] = None
+        # (version, {rendition: frame seq}, payload) for viewers drawing boxes
+        # over the video themselves; replaced as a whole like latest
+        self.overlay: Optional[Tuple[int, Dict[str, int], Dict]] = None
+        self.on_overlay: Optional[Callable[["StreamAIStage"], None]] = None
+
+        # Stats
+        self.offered = 0
+        self.submitted = 0
+        self.skipped_static = 0
+        self.skipped_busy = 0
+        self.completed = 0
+        self.lpr_submitted = 0
+        self.lpr_skipped_busy = 0
+        self.lpr_skipped_tracked = 0
+
+    def tick(self, count: int = 1):
+        """Count frames pulled from the camera"""
+        self.frames_since_offer += count
+
+    def due(self) -> bool:
+        """Whether the next frame should be decoded and offered"""
+        return (self.enabled and not self.in_flight and self.processor.model is not None
+                and self.frames_since_offer >= self.interval)
+
+    def offer(self, handle: FrameHandle, frame_seq: int = 0, rendition_seqs: Optional[Dict[str, int]] = None) -> bool:
+        """Offer a decoded frame; returns True if it was submitted for inference
+
+        The stage retains the handle until inference and on_result are done.
+        rendition_seqs maps each rendition to the sequence number its ring
+        gave this frame (or the newest before it), which ties the overlay
+        to the frame viewers were sent.
+        """
+        if not self.enabled or self.processor.model is None:
+            return False
+        if self.in_flight:
+            self.skipped_busy += 1
+            return False
+
+        self.frames_since_offer = 0
+        self.offered += 1
+        if self.motion_gate is not None and not self.motion_gate.check(handle.frame):
+            self.skipped_static += 1
+            return False
+
+        self.in_flight = True
+        self.submitted += 1
+        handle.retain()
+        future = self.processor.scheduler.submit(self.stream_id, handle.frame, self.confidence_threshold,
+                                                 as_arrays=True)
+        future.add_done_callback(lambda done: self._on_result(done, handle, frame_seq, rendition_seqs))
+        return True
+
+    def _on_result(self, future, handle: FrameHandle, frame_seq: int, rendition_seqs: Optional[Dict[str, int]]):
+        self.in_flight = False
+        try:
+            detections = future.result()
+        except Exception as e:
+            logger.error(f"Inference failed for stream {self.stream_id}: {e}")
+            handle.release()
+            return
+        try:
+            self.tracker.update(detections)
+            self.latest = detections
+            self.latest_seq = frame_seq
+            self.completed += 1
+            height, width = handle.frame.shape[:2]
+            self._set_overlay(detections.to_overlay(width, height, self._plate_labels(detections)),
+                              rendition_seqs or {})
+            if self.on_result is not None:
+                self.on_result(self, handle, detections, frame_seq)
+        finally:
+            handle.release()
+
+    def _plate_labels(self, detections: Detections) -> List[Optional[str]]:
+        # Best plate read so far for each tracked vehicle
+        if detections.track_ids is None:
+            return [None] * len(detections)
+        labels = []
+        for track_id in detections.track_ids.tolist():
+            track = self.tracker.get(track_id)
+            labels.append(track.plate_text if track is not None else None)
+        return labels
+
+    def _set_overlay(self, payload: Dict, rendition_seqs: Dict[str, int]):
+        version = self.overlay[0] + 1 if self.overlay is not None else 1
+        self.overlay = (version, rendition_seqs, payload)
+        if self.on_overlay is not None:
+            try:
+                self.on_overlay(self)
+            except Exception as e:
+                logger.error(f"Overlay listener failed for stream {self.stream_id}: {e}")
+
+    def set_enabled(self, enabled: bool):
+        self.enabled = enabled
+        if not enabled:
+            self.latest = None
+            self.latest_plates = []
+            # Viewers clear their boxes on an empty overlay
+            self._set_overlay(Detections.empty(()).to_overlay(1, 1), {})
+            if self.motion_gate is not None:
+                self.motion_gate.reset()
+
+    def get_stats(self) -> Dict:
+        """Get per-stream AI statistics"""
+        return {
+            "enabled": self.enabled,
+            "interval": self.interval,
+            "motion_gate": self.motion_gate is not None,
+            "motion_area": self.motion_gate.last_motion_area if self.motion_gate is not None else None,
+            "offered": self.offered,
+            "submitted": self.submitted,
+            "skipped_static": self.skipped_static,
+            "skipped_busy": self.skipped_busy,
+            "completed": self.completed,
+            "lpr_submitted": self.lpr_submitted,
+            "lpr_skipped_busy": self.lpr_skipped_busy,
+            "lpr_skipped_tracked": self.lpr_skipped_tracked,
+            "tracker": self.tracker.get_stats(),
+            "gated_ratio": self.skipped_static / self.offered if self.offered else 0,
+        }
+
+
+class AIPipeline:
+    """Owns the per-stream AI stages and loads the model on first use
+
+    Vehicles found by a stage go on to the LPR scheduler, which batches
+    plate detection and OCR across cameras; reads with text land in the
+    results feed, and in the persistent store when one is attached. New
+    vehicle tracks and stored plate reads are reported to on_event(stream_id,
+    kind, info), which may return an event clip id.
+    """
+
+    def __init__(self, processor, interval: int = None, motion_gate: bool = None, lpr: bool = None):
+        self.processor = processor
+        self.interval = interval or int(os.environ.get("DETECTION_INTERVAL", 5))
+        self.motion_gate = (motion_gate if motion_gate is not None
+                            else os.environ.get("AI_MOTION_GATE", "1") not in ("0", "false", "no"))
+        self.lpr = lpr if lpr is not None else os.environ.get("LPR_ENABLED", "1") not in ("0", "false", "no")
+        self.results = PlateResultsFeed()
+        # A tracked vehicle is re-read only when its crop is this much better
+        self.reread_gain = float(os.environ.get("LPR_REREAD_GAIN", 1.5))
+        self.max_reads_per_track = int(os.environ.get("LPR_MAX_READS_PER_TRACK", 4))
+        self.stages: Dict[str, StreamAIStage] = {}
+        self.on_event: Optional[Callable[[str, str, Dict], Optional[str]]] = None
+        self.store = None  # ResultsStore, attached by the service
+        self._load_lock = threading.Lock()
+        self._loading = False
+
+    def ensure_model(self):
+        """Load the model in the background the first time a stage needs it"""
+        with self._load_lock:
+            if self.processor.model is not None or self._loading:
+                return
+            self._loading = True
+
+        def load():
+            try:
+                self.processor.load_model()
+            finally:
+                self._loading = False
+
+        threading.Thread(target=load, name="ai-model-loader", daemon=True).start()
+
+    def attach(self, stream_id: str) -> StreamAIStage:
+        """Create the AI stage for a stream"""
+        stage = self.stages.get(stream_id)
+        if stage is None:
+            gate = MotionGate() if self.motion_gate else None
+            stage = StreamAIStage(stream_id, self.processor, self.interval, gate,
+                                  on_result=self._on_result)
+            self.stages[stream_id] = stage
+        self.ensure_model()
+        return stage
+
+    def _emit(self, stream_id: str, kind: str, info: Dict) -> Optional[str]:
+        if self.on_event is None:
+            return None
+        try:
+            return self.on_event(stream_id, kind, info)
+        except Exception as e:
+            logger.error(f"Event handler failed for stream {stream_id}: {e}")
+            return None
+
+    def _on_result(self, stage: StreamAIStage, handle: FrameHandle, detections: Detections, frame_seq: int):
+        vehicles = detections.of_classes(VEHICLE_CLASSES)
+        if len(vehicles) == 0:
+            return
+        if self.on_event is not None:
+            for track_id in vehicles.track_ids.tolist():
+                track = stage.tracker.get(track_id)
+                if track is not None and track.hits == 1:
+                    self._emit(stage.stream_id, "vehicle", {"track_id": track_id, "frame_seq": frame_seq})
+        if self.lpr:
+            self._read_plates(stage, handle, vehicles, frame_seq)
+
+    def _read_plates(self, stage: StreamAIStage, handle: FrameHandle, vehicles: Detections, frame_seq: int):
+        # One LPR job per stream at a time; newer frames will carry the same vehicles
+        if stage.lpr_in_flight:
+            stage.lpr_skipped_busy += 1
+            return
+
+        # Only new tracks, or tracks with a clearly better (bigger, sharper
+        # detection) crop than any already tried, go to OCR
+        boxes = vehicles.boxes
+        qualities = (boxes[:, 2] - boxes[:, 0]) * (boxes[:, 3] - boxes[:, 1]) * vehicles.scores
+        wanted = []
+        for index, (track_id, quality) in enumerate(zip(vehicles.track_ids.tolist(), qualities.tolist())):
+            track = stage.tracker.get(track_id)
+            if track is None or track.wants_plate_read(quality, self.reread_gain, self.max_reads_per_track):
+                wanted.append(index)
+                if track is not None:
+                    track.note_plate_attempt(quality)
+        stage.lpr_skipped_tracked += len(vehicles) - len(wanted)
+        if not wanted:
+            return
+        vehicles = vehicles.filter(np.asarray(wanted, dtype=np.int64))
+
+        stage.lpr_in_flight = True
+        stage.lpr_submitted += 1
+        # Held until the plate crops are copied out of the frame. A recent
+        # main-stream frame replaces a sub-stream one, with the vehicle boxes
+        # scaled to it; plate boxes are then in main-stream coordinates
+        detail = stage.detail_source() if stage.detail_source is not None else None
+        if detail is not None:
+            height, width = handle.frame.shape[:2]
+            detail_height, detail_width = detail.frame.shape[:2]
+            vehicles = vehicles.scaled(detail_width / width, detail_height / height)
+            handle = detail
+        else:
+            handle.retain()
+        submitted_at = time.perf_counter()
+        future = self.processor.lpr_scheduler.submit(stage.stream_id, handle.frame, vehicles)
+
+        def done(future):
+            try:
+                read(future)
+            finally:
+                handle.release()
+
+        def read(future):
+            stage.lpr_in_flight = False
+            metrics.observe(stage.stream_id, "ocr", time.perf_counter() - submitted_at)
+            try:
+                plates = future.result()
+            except Exception as e:
+                logger.error(f"Plate reading failed for stream {stage.stream_id}: {e}")
+                return
+            best = []
+            for plate in plates:
+                plate["frame_seq"] = frame_seq
+                track_id = int(vehicles.track_ids[plate["vehicle_index"]])
+                plate["track_id"] = track_id if track_id >= 0 else None
+                track = stage.tracker.get(track_id)
+                # Keep the best read per track; weaker re-reads are dropped
+                if track is None or track.offer_plate(plate):
+                    best.append(plate)
+            stage.latest_plates = plates
+            stored = self.results.add(stage.stream_id, best, publish=False, generation=stage.generation)
+            for result in stored:
+                clip_id = self._emit(stage.stream_id, "plate", {
+                    "result_id": result["id"], "plate_text": result.get("plate_text"),
+                    "track_id": result.get("track_id"), "frame_seq": frame_seq})
+                if clip_id is not None:
+                    result["event_clip"] = clip_id
+            self.results.publish(stored)
+            if self.store is not None and stored:
+                self.store.add(stored, self._plate_crops(handle.frame, stored) if self.store.save_crops else None)
+
+        future.add_done_callback(done)
+
+    @staticmethod
+    def _plate_crops(frame, results: List[Dict]) -> Dict[int, np.ndarray]:
+        """Plate crops by result id, copied so they outlive the frame buffer"""
+        if hasattr(frame, "download"):
+            frame = frame.download()
+        height, width = frame.shape[:2]
+        crops = {}
+        for result in results:
+            bbox = result.get("bbox")
+            if not bbox:
+                continue
+            x1, y1, x2, y2 = (int(value) for value in bbox[:4])
+            x1, y1, x2, y2 = max(0, x1), max(0, y1), min(width, x2), min(height, y2)
+            if x2 > x1 and y2 > y1:
+                crops[result["id"]] = frame[y1:y2, x1:x2].copy()
+        return crops
+
+    def detach(self, stream_id: str):
+        stage = self.stages.pop(stream_id, None)
+        if stage is not None:
+            self.results.forget(stream_id, stage.generation)
+
+    def get(self, stream_id: str) -> Optional[StreamAIStage]:
+        return self.stages.get(stream_id)
+
+    def get_stats(self) -> Dict:
+        """Get processor and per-stream AI statistics"""
+        return {
+            "detection_interval": self.interval,
+            "motion_gate": self.motion_gate,
+            "lpr": self.lpr,
+            "model_loading": self._loading,
+            "processor": self.processor.get_performance_stats(),
+            "streams": {stream_id: stage.get_stats() for stream_id, stage in self.stages.items()},
+        }
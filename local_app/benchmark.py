@@ -0,0 +1,644 @@
+"""
+Benchmark Harness
+Synthetic RTSP cameras and simulated viewers against simple_service.py, plus per-backend inference throughput
+"""
+
+import argparse
+import asyncio
+import json
+import os
+import platform
+import re
+import shutil
+import subprocess
+import sys
+import threading
+import time
+from datetime import datetime
+from typing import Dict, List, Optional
+
+import aiohttp
+import cv2
+import numpy as np
+import psutil
+
+from renditions import DEFAULT_RENDITION, RENDITIONS
+from stream_mux import MUX_HEADER, MUX_VERSION
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPORT_VERSION = 1
+
+# A camera keeps up when the service pulls at least this share of its frame rate
+SUSTAIN_RATIO = 0.9
+
+# p99 latency differences below this are noise, not regressions
+LATENCY_SLACK_MS = 5.0
+
+VIEWER_KINDS = ("ws", "mux", "mjpeg", "poll")
+MOTION_LEVELS = ("static", "low", "high")
+
+# ffmpeg encoder arguments per source codec; keyframe interval is appended per camera
+CODECS = {
+    "h264": ["-c:v", "libx264", "-preset", "ultrafast", "-tune", "zerolatency", "-pix_fmt", "yuv420p"],
+    "h265": ["-c:v", "libx265", "-preset", "ultrafast", "-tune", "zerolatency", "-pix_fmt", "yuv420p",
+             "-x265-params", "log-level=error"],
+}
+
+# Default model file per inference backend, as AIProcessor would load it
+BACKEND_MODELS = {"onnxruntime": "yolov8n.onnx", "ultralytics": "yolov8n.pt"}
+
+
+def source_filter(width: int, height: int, fps: float, motion: str) -> str:
+    """lavfi graph for a synthetic camera at a motion level"""
+    size = f"{width}x{height}"
+    if motion == "static":
+        # Nothing moves: the motion gate should skip every frame
+        return f"smptebars=size={size}:rate={fps}"
+    if motion == "low":
+        # One small object crossing a still scene, like a car in a parking lot
+        box = max(16, width // 24)
+        return (f"smptebars=size={size}:rate={fps}[bg];color=white:size={box}x{box}:rate={fps}[box];"
+                f"[bg][box]overlay=x='mod(t*{width // 8},W-w)':y=H/2:shortest=1[out0]")
+    # Every pixel changes every frame
+    return f"testsrc2=size={size}:rate={fps},noise=alls=20:allf=t"
+
+
+class SyntheticCamera:
+    """One ffmpeg process serving a generated stream over RTSP
+
+    ffmpeg's listen mode serves a single client and exits when it
+    disconnects, so the process is restarted in a loop; a service that
+    reconnects finds the camera back within a fraction of a second. It only
+    encodes while the service is connected.
+    """
+
+    def __init__(self, index: int, port: int, width: int, height: int, fps: float,
+                 codec: str, motion: str):
+        self.index = index
+        self.url = f"rtsp://127.0.0.1:{port}/cam{index}"
+        self.command = [
+            "ffmpeg", "-hide_banner", "-loglevel", "error", "-re",
+            "-f", "lavfi", "-i", source_filter(width, height, fps, motion),
+            "-an", *CODECS[codec], "-g", str(max(1, int(fps * 2))),
+            "-f", "rtsp", "-rtsp_transport", "tcp", "-rtsp_flags", "listen", self.url,
+        ]
+        self.restarts = 0
+        self._process: Optional[subprocess.Popen] = None
+        self._stopped = threading.Event()
+        self._thread = threading.Thread(target=self._run, name=f"bench-camera-{index}", daemon=True)
+
+    def start(self):
+        self._thread.start()
+
+    def _run(self):
+        while not self._stopped.is_set():
+            self._process = subprocess.Popen(self.command, stdin=subprocess.DEVNULL,
+                                             stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+            self._process.wait()
+            if not self._stopped.is_set():
+                self.restarts += 1
+                self._stopped.wait(0.2)
+
+    def stop(self):
+        self._stopped.set()
+        if self._process is not None and self._process.poll() is None:
+            self._process.terminate()
+            try:
+                self._process.wait(5)
+            except subprocess.TimeoutExpired:
+                self._process.kill()
+
+
+class ServiceProcess:
+    """simple_service.py launched for one benchmark step, or an already running one"""
+
+    def __init__(self, url: str, env: Dict[str, str], launch: bool, pid: Optional[int] = None):
+        self.url = url.rstrip("/")
+        self.env = env
+        self.launch = launch
+        self.pid = pid
+        self._process: Optional[subprocess.Popen] = None
+        self._log = None
+
+    def start(self):
+        if not self.launch:
+            return
+        os.makedirs(os.path.join(HERE, "logs"), exist_ok=True)
+        self._log = open(os.path.join(HERE, "logs", "benchmark_service.log"), "ab")
+        self._process = subprocess.Popen([sys.executable, "simple_service.py"], cwd=HERE,
+                                         env=dict(os.environ, **self.env),
+                                         stdout=self._log, stderr=subprocess.STDOUT)
+        self.pid = self._process.pid
+
+    async def wait_ready(self, session: aiohttp.ClientSession, timeout: float = 120.0):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if self._process is not None and self._process.poll() is not None:
+                raise RuntimeError("Service exited during startup, see logs/benchmark_service.log")
+            try:
+                async with session.get(f"{self.url}/healthz") as response:
+                    if response.status == 200:
+                        return
+            except aiohttp.ClientError:
+                pass
+            await asyncio.sleep(0.5)
+        raise RuntimeError(f"Service at {self.url} not ready after {timeout:.0f}s")
+
+    def usage(self) -> Optional[Dict]:
+        """CPU seconds and memory of the service and its shard/ffmpeg children"""
+        if self.pid is None:
+            return None
+        try:
+            root = psutil.Process(self.pid)
+            processes = [root] + root.children(recursive=True)
+        except psutil.NoSuchProcess:
+            return None
+        cpu = memory = 0.0
+        for process in processes:
+            try:
+                times = process.cpu_times()
+                cpu += times.user + times.system
+                try:
+                    # USS counts shared-memory frame slots once, not per process
+                    memory += process.memory_full_info().uss
+                except (psutil.AccessDenied, AttributeError):
+                    memory += process.memory_info().rss
+            except psutil.NoSuchProcess:
+                continue
+        return {"cpu_seconds": cpu, "memory_bytes": memory, "processes": len(processes)}
+
+    def stop(self):
+        if self._process is None:
+            return
+        self._process.terminate()
+        try:
+            self._process.wait(15)
+        except subprocess.TimeoutExpired:
+            self._process.kill()
+            self._process.wait()
+        self._process = None
+        self._log.close()
+
+
+class ViewerStats:
+    """Frames, bytes and capture-to-client latency for every viewer of one kind"""
+
+    def __init__(self, kind: str, viewers: int, streams_per_viewer: int = 1):
+        self.kind = kind
+        self.viewers = viewers
+        self.streams_per_viewer = streams_per_viewer
+        self.reset()
+
+    def reset(self):
+        self.frames = 0
+        self.bytes = 0
+        self.errors = 0
+        self.latencies: List[float] = []
+
+    def record(self, size: int, timestamp: Optional[float]):
+        self.frames += 1
+        self.bytes += size
+        if timestamp:
+            self.latencies.append(time.time() - timestamp)
+
+    def summary(self, duration: float) -> Dict:
+        samples = sorted(self.latencies)
+        streams = max(1, self.viewers * self.streams_per_viewer)
+        return {
+            "viewers": self.viewers,
+            "fps_per_stream": round(self.frames / duration / streams, 2),
+            "mbps": round(self.bytes * 8 / duration / 1e6, 2),
+            "errors": self.errors,
+            "latency_samples": len(samples),
+            "latency_ms_p50": percentile_ms(samples, 0.5),
+            "latency_ms_p99": percentile_ms(samples, 0.99),
+        }
+
+
+def percentile_ms(samples: List[float], fraction: float) -> Optional[float]:
+    if not samples:
+        return None
+    return round(samples[min(len(samples) - 1, int(fraction * len(samples)))] * 1000, 1)
+
+
+async def _retry(viewer, stats: ViewerStats):
+    # Viewers reconnect like the Electron client does; errors are counted, not fatal
+    while True:
+        try:
+            await viewer()
+        except asyncio.CancelledError:
+            raise
+        except Exception:
+            stats.errors += 1
+        await asyncio.sleep(1.0)
+
+
+async def ws_viewer(session, base: str, stream_id: str, rendition: str, stats: ViewerStats):
+    """/ws/stream carries bare JPEGs, so only throughput is measured"""
+    url = f"{base.replace('http', 'ws', 1)}/ws/stream/{stream_id}?rendition={rendition}"
+
+    async def view():
+        async with session.ws_connect(url, max_msg_size=0) as ws:
+            async for message in ws:
+                if message.type == aiohttp.WSMsgType.BINARY:
+                    stats.record(len(message.data), None)
+
+    await _retry(view, stats)
+
+
+async def mux_viewer(session, base: str, stream_ids: List[str], rendition: str, stats: ViewerStats):
+    """A video wall: one /ws/mux connection subscribed to every camera"""
+    url = f"{base.replace('http', 'ws', 1)}/ws/mux"
+
+    async def view():
+        async with session.ws_connect(url, max_msg_size=0) as ws:
+            for stream_id in stream_ids:
+                await ws.send_json({"type": "subscribe", "stream_id": stream_id, "rendition": rendition})
+            async for message in ws:
+                if message.type != aiohttp.WSMsgType.BINARY:
+                    continue
+                data, offset = message.data, 0
+                while offset + MUX_HEADER.size <= len(data):
+                    version, _, id_length, _, timestamp, length = MUX_HEADER.unpack_from(data, offset)
+                    if version != MUX_VERSION:
+                        break
+                    stats.record(length, timestamp)
+                    offset += MUX_HEADER.size + id_length + length
+
+    await _retry(view, stats)
+
+
+async def mjpeg_viewer(session, base: str, stream_id: str, rendition: str, stats: ViewerStats):
+    url = f"{base}/stream/{stream_id}/mjpeg?rendition={rendition}"
+
+    async def view():
+        async with session.get(url, timeout=aiohttp.ClientTimeout(total=None, sock_read=10)) as response:
+            reader = response.content
+            while True:
+                line = await reader.readline()
+                if not line:
+                    return
+                if not line.startswith(b"--"):
+                    continue
+                headers = {}
+                while True:
+                    line = (await reader.readline()).strip()
+                    if not line:
+                        break
+                    name, _, value = line.decode("latin1").partition(":")
+                    headers[name.strip().lower()] = value.strip()
+                length = int(headers.get("content-length", 0))
+                if not length:
+                    raise RuntimeError("MJPEG part without Content-Length")
+                await reader.readexactly(length)
+                stats.record(length, float(headers.get("x-frame-timestamp", 0)))
+
+    await _retry(view, stats)
+
+
+async def poll_viewer(session, base: str, stream_id: str, rendition: str, stats: ViewerStats):
+    """Long-polls /frame for each frame after the last one seen"""
+    url = f"{base}/stream/{stream_id}/frame"
+
+    async def view():
+        seq = None
+        while True:
+            params = {"rendition": rendition, "wait": 2}
+            if seq is not None:
+                params["after_seq"] = seq
+            async with session.get(url, params=params) as response:
+                if response.status == 304:
+                    continue
+                if response.status != 200:
+                    raise RuntimeError(f"HTTP {response.status}")
+                data = await response.read()
+                seq = int(response.headers.get("X-Frame-Seq", 0))
+                stats.record(len(data), float(response.headers.get("X-Frame-Timestamp", 0)))
+
+    await _retry(view, stats)
+
+
+_SAMPLE = re.compile(r'^(\w+)\{([^}]*)\} (\S+)$')
+_LABEL = re.compile(r'(\w+)="((?:[^"\\]|\\.)*)"')
+
+
+async def scrape_counters(session, base: str) -> Dict[str, Dict[str, float]]:
+    """Per-stream grabbed/decoded frame counters from /metrics"""
+    counters: Dict[str, Dict[str, float]] = {"cctv_frames_grabbed_total": {}, "cctv_frames_decoded_total": {}}
+    async with session.get(f"{base}/metrics") as response:
+        text = await response.text()
+    for line in text.splitlines():
+        match = _SAMPLE.match(line)
+        if match and match.group(1) in counters:
+            labels = dict(_LABEL.findall(match.group(2)))
+            counters[match.group(1)][labels.get("stream", "")] = float(match.group(3))
+    return counters
+
+
+def parse_viewers(spec: str) -> Dict[str, int]:
+    """kind=count pairs such as ws=2,mjpeg=1; ws/mjpeg/poll are per camera, mux is per wall client"""
+    viewers: Dict[str, int] = {}
+    for part in filter(None, (part.strip() for part in spec.split(","))):
+        kind, _, count = part.partition("=")
+        if kind not in VIEWER_KINDS:
+            raise argparse.ArgumentTypeError(f"Unknown viewer kind '{kind}', expected one of {list(VIEWER_KINDS)}")
+        viewers[kind] = int(count or 1)
+    return viewers
+
+
+def host_info() -> Dict:
+    return {
+        "hostname": platform.node(),
+        "platform": platform.platform(),
+        "python": platform.python_version(),
+        "opencv": cv2.__version__,
+        "logical_cores": psutil.cpu_count(),
+        "physical_cores": psutil.cpu_count(logical=False),
+        "memory_gb": round(psutil.virtual_memory().total / 2 ** 30, 1),
+    }
+
+
+async def run_step(args, cameras: List[SyntheticCamera], urls: List[str]) -> Dict:
+    """Run the service with len(urls) cameras and the configured viewers, then measure"""
+    count = len(urls)
+    service = ServiceProcess(args.service_url or f"http://127.0.0.1:{args.port}",
+                             dict(args.env, CCTV_SERVICE_HOST="127.0.0.1", CCTV_SERVICE_PORT=str(args.port)),
+                             launch=not args.service_url, pid=args.service_pid)
+    stream_ids = [f"bench_{index}" for index in range(count)]
+    tasks: List[asyncio.Task] = []
+    stats: Dict[str, ViewerStats] = {}
+    base = service.url
+
+    async with aiohttp.ClientSession(connector=aiohttp.TCPConnector(limit=0)) as session:
+        service.start()
+        try:
+            await service.wait_ready(session)
+            idle = service.usage()
+
+            for stream_id, url in zip(stream_ids, urls):
+                params = {"stream_id": stream_id, "rtsp_url": url, "enable_ai": str(args.ai).lower(),
+                          "record": "false"}
+                async with session.post(f"{base}/add_stream", params=params) as response:
+                    if response.status != 200:
+                        raise RuntimeError(f"add_stream {stream_id} failed: HTTP {response.status}")
+
+            for kind, viewers in args.viewers.items():
+                if kind == "mux":
+                    stats[kind] = ViewerStats(kind, viewers, count)
+                    tasks += [asyncio.create_task(mux_viewer(session, base, stream_ids, args.rendition, stats[kind]))
+                              for _ in range(viewers)]
+                    continue
+                stats[kind] = ViewerStats(kind, viewers * count)
+                viewer = {"ws": ws_viewer, "mjpeg": mjpeg_viewer, "poll": poll_viewer}[kind]
+                tasks += [asyncio.create_task(viewer(session, base, stream_id, args.rendition, stats[kind]))
+                          for stream_id in stream_ids for _ in range(viewers)]
+
+            print(f"[{count} cameras] warming up for {args.warmup:.0f}s", file=sys.stderr)
+            await asyncio.sleep(args.warmup)
+            for viewer_stats in stats.values():
+                viewer_stats.reset()
+            before, usage_before, started = await scrape_counters(session, base), service.usage(), time.time()
+
+            print(f"[{count} cameras] measuring for {args.duration:.0f}s", file=sys.stderr)
+            await asyncio.sleep(args.duration)
+            after, usage_after, elapsed = await scrape_counters(session, base), service.usage(), time.time() - started
+            async with session.get(f"{base}/stage_stats") as response:
+                stages = await response.json()
+        finally:
+            for task in tasks:
+                task.cancel()
+            await asyncio.gather(*tasks, return_exceptions=True)
+            if service.launch:
+                service.stop()
+            else:
+                for stream_id in stream_ids:
+                    try:
+                        async with session.delete(f"{base}/remove_stream/{stream_id}"):
+                            pass
+                    except aiohttp.ClientError:
+                        pass
+
+    def rate(counter: str, stream_id: str) -> float:
+        return (after[counter].get(stream_id, 0) - before[counter].get(stream_id, 0)) / elapsed
+
+    grab_fps = {stream_id: round(rate("cctv_frames_grabbed_total", stream_id), 2) for stream_id in stream_ids}
+    decode_fps = {stream_id: round(rate("cctv_frames_decoded_total", stream_id), 2) for stream_id in stream_ids}
+    viewers = {kind: viewer_stats.summary(elapsed) for kind, viewer_stats in stats.items()}
+
+    # Viewers get at most the rendition's frame rate, not the camera's
+    viewer_target = min(args.fps, RENDITIONS[args.rendition].max_fps) * SUSTAIN_RATIO
+    sustained = (min(grab_fps.values()) >= args.fps * SUSTAIN_RATIO
+                 and all(summary["fps_per_stream"] >= viewer_target for summary in viewers.values()))
+
+    result = {
+        "cameras": count,
+        "sustained": sustained,
+        "grab_fps_min": min(grab_fps.values()),
+        "grab_fps_mean": round(sum(grab_fps.values()) / count, 2),
+        "decode_fps_mean": round(sum(decode_fps.values()) / count, 2),
+        "viewers": viewers,
+        "bottlenecks": {stream_id: stages.get(stream_id, {}).get("bottleneck") for stream_id in stream_ids},
+        "stages": stages.get(stream_ids[0], {}).get("stages", {}),
+        "cores_used": None,
+        "cameras_per_core": None,
+        "memory_per_stream_mb": None,
+        "service_memory_mb": None,
+        "camera_restarts": sum(camera.restarts for camera in cameras[:count]),
+    }
+    if usage_before is not None and usage_after is not None:
+        cores = (usage_after["cpu_seconds"] - usage_before["cpu_seconds"]) / elapsed
+        result["cores_used"] = round(cores, 2)
+        result["cameras_per_core"] = round(count / cores, 2) if cores > 0 else None
+        result["service_memory_mb"] = round(usage_after["memory_bytes"] / 2 ** 20, 1)
+        if idle is not None:
+            result["memory_per_stream_mb"] = round((usage_after["memory_bytes"] - idle["memory_bytes"]) / count / 2 ** 20, 1)
+    return result
+
+
+def bench_inference(args) -> Dict:
+    """Frames per second of each AIProcessor backend at the configured batch sizes"""
+    from inference_backends import create_backend, detect_device, downscale_frame
+
+    device = detect_device(args.device)
+    rng = np.random.default_rng(0)
+    frames = [downscale_frame(rng.integers(0, 256, (args.height, args.width, 3), dtype=np.uint8))
+              for _ in range(max(args.batch_sizes))]
+    results = {}
+    for name in args.backends:
+        model_path = args.model or BACKEND_MODELS.get(name, "")
+        print(f"[inference] {name} on {device} with {model_path}", file=sys.stderr)
+        try:
+            backend = create_backend(model_path, device, name, args.input_size)
+            backend.load()
+        except Exception as e:
+            results[name] = {"error": str(e)}
+            continue
+        batches = {}
+        for batch_size in args.batch_sizes:
+            batch = frames[:batch_size]
+            for _ in range(3):
+                backend.infer_batch(batch, 0.25)
+            times = []
+            for _ in range(args.iterations):
+                started = time.perf_counter()
+                backend.infer_batch(batch, 0.25)
+                times.append(time.perf_counter() - started)
+            times.sort()
+            batches[str(batch_size)] = {
+                "batch_ms_p50": percentile_ms(times, 0.5),
+                "batch_ms_p99": percentile_ms(times, 0.99),
+                "fps": round(batch_size * len(times) / sum(times), 1),
+            }
+        results[name] = {
+            "backend": backend.name,
+            "device": device,
+            "model": model_path,
+            "input_size": args.input_size,
+            "batches": batches,
+            "best_fps": max(batch["fps"] for batch in batches.values()),
+        }
+    return results
+
+
+def compare(report: Dict, baseline: Dict, tolerance: float) -> List[str]:
+    """Regressions of report against an earlier report from the same hardware"""
+    regressions = []
+    previous = {step["cameras"]: step for step in baseline.get("steps", [])}
+    for step in report.get("steps", []):
+        old = previous.get(step["cameras"])
+        if old is None:
+            continue
+        label = f"{step['cameras']} cameras"
+        if old.get("sustained") and not step["sustained"]:
+            regressions.append(f"{label}: no longer sustained")
+        if old.get("cameras_per_core") and step["cameras_per_core"] is not None \
+                and step["cameras_per_core"] < old["cameras_per_core"] * (1 - tolerance):
+            regressions.append(f"{label}: cameras per core {old['cameras_per_core']} -> {step['cameras_per_core']}")
+        if old.get("memory_per_stream_mb") and step["memory_per_stream_mb"] is not None \
+                and step["memory_per_stream_mb"] > old["memory_per_stream_mb"] * (1 + tolerance):
+            regressions.append(f"{label}: memory per stream {old['memory_per_stream_mb']} -> "
+                               f"{step['memory_per_stream_mb']} MB")
+        for kind, viewer in step["viewers"].items():
+            before = old.get("viewers", {}).get(kind, {}).get("latency_ms_p99")
+            now = viewer["latency_ms_p99"]
+            if before is not None and now is not None and now > before * (1 + tolerance) + LATENCY_SLACK_MS:
+                regressions.append(f"{label}: {kind} p99 latency {before} -> {now} ms")
+    if report.get("max_sustained_cameras", 0) < (baseline.get("max_sustained_cameras") or 0):
+        regressions.append(f"max sustained cameras {baseline['max_sustained_cameras']} -> "
+                           f"{report['max_sustained_cameras']}")
+    for name, result in report.get("inference", {}).items():
+        before = baseline.get("inference", {}).get(name, {}).get("best_fps")
+        if before and result.get("best_fps") is not None and result["best_fps"] < before * (1 - tolerance):
+            regressions.append(f"inference {name}: {before} -> {result['best_fps']} fps")
+    return regressions
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[-1])
+    load = parser.add_argument_group("load")
+    load.add_argument("--cameras", default="4", help="Camera counts to step through, e.g. 4,8,16 (default: 4)")
+    load.add_argument("--width", type=int, default=1920)
+    load.add_argument("--height", type=int, default=1080)
+    load.add_argument("--fps", type=float, default=15)
+    load.add_argument("--codec", choices=sorted(CODECS), default="h264")
+    load.add_argument("--motion", choices=MOTION_LEVELS, default="low")
+    load.add_argument("--viewers", type=parse_viewers, default="ws=1",
+                      help="Viewers as kind=count; ws/mjpeg/poll per camera, mux per wall client (default: ws=1)")
+    load.add_argument("--rendition", choices=list(RENDITIONS), default=DEFAULT_RENDITION)
+    load.add_argument("--ai", action="store_true", help="Enable detection on every camera")
+    load.add_argument("--warmup", type=float, default=10)
+    load.add_argument("--duration", type=float, default=30)
+    load.add_argument("--port", type=int, default=8191, help="Port for the launched service")
+    load.add_argument("--rtsp-port", type=int, default=8600, help="First port of the synthetic cameras")
+    load.add_argument("--source-url", help="Use existing cameras instead, e.g. rtsp://10.0.0.5:8554/cam{index}")
+    load.add_argument("--service-url", help="Drive a running service instead of launching one per step")
+    load.add_argument("--service-pid", type=int, help="PID of --service-url's process, for CPU and memory")
+    load.add_argument("--env", action="append", default=[], metavar="KEY=VALUE",
+                      help="Environment for the launched service, e.g. CCTV_SHARD_WORKERS=4")
+    load.add_argument("--skip-load", action="store_true", help="Only run the inference benchmark")
+    ai = parser.add_argument_group("inference")
+    ai.add_argument("--inference", action="store_true", help="Benchmark inference backends in-process")
+    ai.add_argument("--backends", default="onnxruntime,ultralytics")
+    ai.add_argument("--model", help="Model file for every backend (default: yolov8n.onnx / yolov8n.pt)")
+    ai.add_argument("--device", default="auto")
+    ai.add_argument("--input-size", type=int, default=int(os.environ.get("AI_INPUT_SIZE", 640)))
+    ai.add_argument("--batch-sizes", default="1,4,8")
+    ai.add_argument("--iterations", type=int, default=20)
+    report = parser.add_argument_group("report")
+    report.add_argument("--output", help="Write the JSON report here instead of stdout")
+    report.add_argument("--baseline", help="Earlier report to compare against; exits 1 on a regression")
+    report.add_argument("--tolerance", type=float, default=0.1, help="Allowed relative regression (default: 0.1)")
+    args = parser.parse_args(argv)
+
+    args.cameras = sorted({int(count) for count in args.cameras.split(",") if int(count or 0) > 0})
+    args.backends = [name.strip() for name in args.backends.split(",") if name.strip()]
+    args.batch_sizes = [int(size) for size in args.batch_sizes.split(",") if size.strip()]
+    args.env = dict(item.split("=", 1) for item in args.env)
+    return args
+
+
+def main(argv=None) -> int:
+    args = parse_args(argv)
+    report = {
+        "version": REPORT_VERSION,
+        "timestamp": datetime.now().isoformat(),
+        "host": host_info(),
+        "config": {
+            "width": args.width, "height": args.height, "fps": args.fps, "codec": args.codec,
+            "motion": args.motion, "viewers": args.viewers, "rendition": args.rendition, "ai": args.ai,
+            "duration": args.duration, "env": args.env,
+        },
+        "steps": [],
+        "max_sustained_cameras": 0,
+    }
+
+    if not args.skip_load and args.cameras:
+        cameras: List[SyntheticCamera] = []
+        if args.source_url:
+            urls = [args.source_url.format(index=index) for index in range(max(args.cameras))]
+        else:
+            if shutil.which("ffmpeg") is None:
+                print("ffmpeg not found; install it or pass --source-url", file=sys.stderr)
+                return 2
+            cameras = [SyntheticCamera(index, args.rtsp_port + index, args.width, args.height, args.fps,
+                                       args.codec, args.motion) for index in range(max(args.cameras))]
+            for camera in cameras:
+                camera.start()
+            urls = [camera.url for camera in cameras]
+        try:
+            for count in args.cameras:
+                step = asyncio.run(run_step(args, cameras, urls[:count]))
+                report["steps"].append(step)
+                print(f"[{count} cameras] sustained={step['sustained']} cameras/core={step['cameras_per_core']} "
+                      f"grab fps min={step['grab_fps_min']}", file=sys.stderr)
+                if step["sustained"]:
+                    report["max_sustained_cameras"] = count
+                else:
+                    # Larger steps would only fall further behind
+                    break
+        finally:
+            for camera in cameras:
+                camera.stop()
+
+    if args.inference:
+        report["inference"] = bench_inference(args)
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(report, json.load(f), args.tolerance)
+        for regression in regressions:
+            print(f"REGRESSION: {regression}", file=sys.stderr)
+        if regressions:
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
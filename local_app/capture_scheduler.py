@@ -0,0 +1,157 @@
+"""
+Capture Scheduler
+Drives every stream's capture loop from a small shared worker pool
+"""
+
+import heapq
+import itertools
+import os
+import queue
+import threading
+import time
+from typing import Callable, Dict, List, Optional, Tuple
+
+
+class CaptureTask:
+    """Scheduling handle for one stream
+
+    step() runs one capture step and returns the delay in seconds before the
+    stream should be serviced again, or None to stop. A task is only ever
+    held by one worker at a time, so a stream's capture object is never
+    touched concurrently.
+    """
+
+    def __init__(self, key: str, step: Callable[[], Optional[float]],
+                 on_cancel: Optional[Callable[[], None]] = None):
+        self.key = key
+        self.step = step
+        self.on_cancel = on_cancel
+        self.cancelled = False
+
+    def finish(self):
+        if self.on_cancel is not None:
+            try:
+                self.on_cancel()
+            except Exception as e:
+                print(f"Error finishing capture task {self.key}: {e}")
+
+
+class CaptureScheduler:
+    """Round-robin scheduler over a fixed pool of capture workers
+
+    Workers block on the demuxer (grab/read) rather than sleeping in a pacing
+    loop. Because streams are serviced round-robin, a stream usually comes
+    back to the front after its next packet has already arrived, so with
+    many cameras the grabs rarely wait at all. Streams that need a pause
+    (reconnect cooldown, read errors) sit in a timer heap instead of holding
+    a worker.
+    """
+
+    def __init__(self, workers: Optional[int] = None):
+        self.workers = workers or int(os.environ.get("CCTV_CAPTURE_WORKERS", os.cpu_count() or 4))
+        self.running = True
+        self._tasks: Dict[str, CaptureTask] = {}
+        self._ready: "queue.Queue[Optional[CaptureTask]]" = queue.Queue()
+        self._delayed: List[Tuple[float, int, CaptureTask]] = []
+        self._delayed_cond = threading.Condition()
+        self._counter = itertools.count()
+        self._threads: List[threading.Thread] = []
+
+        for index in range(self.workers):
+            thread = threading.Thread(target=self._worker_loop, name=f"capture-worker-{index}", daemon=True)
+            thread.start()
+            self._threads.append(thread)
+
+        timer = threading.Thread(target=self._timer_loop, name="capture-timer", daemon=True)
+        timer.start()
+        self._threads.append(timer)
+
+        print(f"CaptureScheduler started with {self.workers} workers")
+
+    def add(self, key: str, step: Callable[[], Optional[float]],
+            on_cancel: Optional[Callable[[], None]] = None) -> CaptureTask:
+        """Start servicing a stream"""
+        self.remove(key)
+        task = CaptureTask(key, step, on_cancel)
+        self._tasks[key] = task
+        self._ready.put(task)
+        return task
+
+    def remove(self, key: str) -> bool:
+        """Stop servicing a stream; its on_cancel runs once no worker holds it"""
+        task = self._tasks.pop(key, None)
+        if task is None:
+            return False
+        task.cancelled = True
+        # Pull it out of the timer heap early so cleanup isn't delayed
+        with self._delayed_cond:
+            self._delayed_cond.notify()
+        return True
+
+    @property
+    def stream_count(self) -> int:
+        return len(self._tasks)
+
+    @property
+    def ready_depth(self) -> int:
+        """Streams waiting for a free capture worker"""
+        return self._ready.qsize()
+
+    def pending_delayed(self) -> int:
+        with self._delayed_cond:
+            return len(self._delayed)
+
+    def shutdown(self):
+        """Stop all workers"""
+        self.running = False
+        for key in list(self._tasks.keys()):
+            self.remove(key)
+        for _ in range(self.workers):
+            self._ready.put(None)
+        with self._delayed_cond:
+            self._delayed_cond.notify_all()
+
+    def _requeue(self, task: CaptureTask, delay: float):
+        if delay <= 0:
+            self._ready.put(task)
+            return
+        with self._delayed_cond:
+            heapq.heappush(self._delayed, (time.monotonic() + delay, next(self._counter), task))
+            self._delayed_cond.notify()
+
+    def _worker_loop(self):
+        while self.running:
+            task = self._ready.get()
+            if task is None:
+                break
+            if task.cancelled:
+                task.finish()
+                continue
+
+            try:
+                delay = task.step()
+            except Exception as e:
+                print(f"Error in capture step for {task.key}: {e}")
+                delay = 0.5
+
+            if task.cancelled or delay is None:
+                task.cancelled = True
+                task.finish()
+                continue
+
+            self._requeue(task, delay)
+
+    def _timer_loop(self):
+        while self.running:
+            with self._delayed_cond:
+                now = time.monotonic()
+                due: List[CaptureTask] = []
+                while self._delayed and (self._delayed[0][0] <= now or self._delayed[0][2].cancelled):
+                    due.append(heapq.heappop(self._delayed)[2])
+                if not due:
+                    timeout = self._delayed[0][0] - now if self._delayed else None
+                    self._delayed_cond.wait(timeout)
+                    continue
+            # Cancelled tasks go through the ready queue so a worker finishes them
+            for task in due:
+                self._ready.put(task)
@@ -0,0 +1,278 @@
+"""
+Capture Sources with Selectable Decode Backends
+Software, FFmpeg hardware (VAAPI / QSV / D3D11) and NVDEC GPU-resident decode
+"""
+
+import os
+from typing import Optional, Tuple
+
+import cv2
+import numpy as np
+
+# Decode modes accepted per stream
+DECODE_SOFTWARE = "software"
+DECODE_AUTO = "auto"
+DECODE_NVDEC = "nvdec"
+DECODE_VAAPI = "vaapi"
+DECODE_QSV = "qsv"
+DECODE_D3D11 = "d3d11"
+DECODE_MODES = (DECODE_SOFTWARE, DECODE_AUTO, DECODE_NVDEC, DECODE_VAAPI, DECODE_QSV, DECODE_D3D11)
+
+DEFAULT_DECODE_MODE = os.environ.get("CCTV_DECODE", DECODE_SOFTWARE)
+
+# RTSP handshake and read timeouts; a dead camera fails its open quickly and
+# the connection manager retries it with backoff
+OPEN_TIMEOUT_MS = int(os.environ.get("CCTV_OPEN_TIMEOUT_MS", 10000))
+READ_TIMEOUT_MS = int(os.environ.get("CCTV_READ_TIMEOUT_MS", 5000))
+
+# FFmpeg hardware acceleration constants (OpenCV >= 4.5.2)
+_FFMPEG_HW_MODES = {
+    DECODE_AUTO: "VIDEO_ACCELERATION_ANY",
+    DECODE_VAAPI: "VIDEO_ACCELERATION_VAAPI",
+    DECODE_QSV: "VIDEO_ACCELERATION_MFX",
+    DECODE_D3D11: "VIDEO_ACCELERATION_D3D11",
+}
+
+
+def _timeout_params() -> list:
+    # Only honoured when passed at open time (OpenCV >= 4.5.2)
+    if not hasattr(cv2, "CAP_PROP_OPEN_TIMEOUT_MSEC"):
+        return []
+    return [cv2.CAP_PROP_OPEN_TIMEOUT_MSEC, OPEN_TIMEOUT_MS, cv2.CAP_PROP_READ_TIMEOUT_MSEC, READ_TIMEOUT_MS]
+
+
+def cuda_available() -> bool:
+    """Check whether OpenCV was built with CUDA and a device is present"""
+    try:
+        return hasattr(cv2, "cuda") and cv2.cuda.getCudaEnabledDeviceCount() > 0
+    except Exception:
+        return False
+
+
+def nvdec_available() -> bool:
+    """Check whether the cudacodec NVDEC reader is usable"""
+    return cuda_available() and hasattr(cv2, "cudacodec")
+
+
+class GpuFrame:
+    """A decoded frame that stays in GPU memory
+
+    Exposes __cuda_array_interface__ so torch (or cupy) can wrap the surface
+    without a host round-trip. Host consumers call download(), which can
+    resize on the GPU first so only the bytes actually needed cross PCIe.
+    """
+
+    def __init__(self, gpu_mat):
+        self.gpu = gpu_mat
+        self._host: Optional[np.ndarray] = None
+
+    @property
+    def shape(self) -> Tuple[int, int, int]:
+        cols, rows = self.gpu.size()
+        return rows, cols, self.gpu.channels()
+
+    @property
+    def size(self) -> int:
+        rows, cols, channels = self.shape
+        return rows * cols * channels
+
+    @property
+    def __cuda_array_interface__(self) -> dict:
+        rows, cols, channels = self.shape
+        return {
+            "shape": (rows, cols, channels),
+            "typestr": "|u1",
+            "data": (self.gpu.cudaPtr(), False),
+            "strides": (self.gpu.step, channels, 1),
+            "version": 3,
+        }
+
+    def download(self, max_width: Optional[int] = None) -> np.ndarray:
+        """Download as a host BGR image, optionally downscaled on the GPU first"""
+        if max_width is None and self._host is not None:
+            return self._host
+
+        gpu = self.gpu
+        cols, rows = gpu.size()
+        if max_width is not None and cols > max_width:
+            scale = max_width / cols
+            gpu = cv2.cuda.resize(gpu, (max_width, int(rows * scale)))
+        if gpu.channels() == 4:
+            gpu = cv2.cuda.cvtColor(gpu, cv2.COLOR_BGRA2BGR)
+        host = gpu.download()
+
+        if max_width is None:
+            self._host = host
+        return host
+
+    def copy(self) -> np.ndarray:
+        """Host copy, matching the ndarray interface used by frame readers"""
+        return self.download().copy()
+
+
+def to_host(frame, max_width: Optional[int] = None) -> np.ndarray:
+    """Return a host BGR array for any frame produced by a CaptureSource"""
+    if isinstance(frame, GpuFrame):
+        return frame.download(max_width)
+    return frame
+
+
+class CaptureSource:
+    """Uniform wrapper over cv2.VideoCapture and cv2.cudacodec readers"""
+
+    def __init__(self, rtsp_url: str, decode_mode: str = DEFAULT_DECODE_MODE,
+                 hw_device: int = -1):
+        self.rtsp_url = rtsp_url
+        self.requested_mode = decode_mode if decode_mode in DECODE_MODES else DECODE_SOFTWARE
+        self.hw_device = hw_device
+        self.decode_mode = DECODE_SOFTWARE
+        self.on_gpu = False
+        self._cap = None
+        self._reader = None
+        self._reader_opened = False
+        self._open()
+
+    def _open(self):
+        mode = self.requested_mode
+
+        if mode == DECODE_NVDEC:
+            if self._open_nvdec():
+                return
+            print(f"NVDEC not available for {self.rtsp_url}, falling back to FFmpeg hardware decode")
+            mode = DECODE_AUTO
+
+        if mode in _FFMPEG_HW_MODES and self._open_ffmpeg_hw(mode):
+            return
+
+        if mode != DECODE_SOFTWARE:
+            print(f"Hardware decode '{mode}' not available, using software decode")
+        self._open_software()
+
+    def _open_software(self):
+        params = _timeout_params()
+        if params:
+            self._cap = cv2.VideoCapture(self.rtsp_url, cv2.CAP_FFMPEG, params)
+        else:
+            self._cap = cv2.VideoCapture(self.rtsp_url, cv2.CAP_FFMPEG)
+        self.decode_mode = DECODE_SOFTWARE
+        self._configure_capture()
+
+    def _open_ffmpeg_hw(self, mode: str) -> bool:
+        accel_name = _FFMPEG_HW_MODES[mode]
+        if not hasattr(cv2, "CAP_PROP_HW_ACCELERATION") or not hasattr(cv2, accel_name):
+            return False
+        try:
+            params = [
+                cv2.CAP_PROP_HW_ACCELERATION, getattr(cv2, accel_name),
+                cv2.CAP_PROP_HW_DEVICE, self.hw_device,
+            ] + _timeout_params()
+            cap = cv2.VideoCapture(self.rtsp_url, cv2.CAP_FFMPEG, params)
+            if not cap.isOpened():
+                cap.release()
+                return False
+            # ANY may silently resolve to software; keep whatever FFmpeg picked
+            accel = int(cap.get(cv2.CAP_PROP_HW_ACCELERATION))
+            if mode != DECODE_AUTO and accel != getattr(cv2, accel_name):
+                cap.release()
+                return False
+            self._cap = cap
+            self.decode_mode = mode if accel else DECODE_SOFTWARE
+            self._configure_capture()
+            return True
+        except Exception as e:
+            print(f"FFmpeg hardware decode '{mode}' failed: {e}")
+            return False
+
+    def _open_nvdec(self) -> bool:
+        if not nvdec_available():
+            return False
+        try:
+            reader = cv2.cudacodec.createVideoReader(self.rtsp_url)
+            if hasattr(reader, "set") and hasattr(cv2.cudacodec, "ColorFormat_BGR"):
+                reader.set(cv2.cudacodec.ColorFormat_BGR)
+            self._reader = reader
+            self._reader_opened = True
+            self.decode_mode = DECODE_NVDEC
+            self.on_gpu = True
+            return True
+        except Exception as e:
+            print(f"NVDEC reader failed for {self.rtsp_url}: {e}")
+            return False
+
+    def _configure_capture(self):
+        # Set optimized properties
+        self._cap.set(cv2.CAP_PROP_BUFFERSIZE, 1)  # Minimize buffer for lowest latency
+        self._cap.set(cv2.CAP_PROP_FPS, 30)  # Target 30 FPS
+
+    def isOpened(self) -> bool:
+        if self._reader is not None:
+            return self._reader_opened
+        return self._cap is not None and self._cap.isOpened()
+
+    def grab(self) -> bool:
+        """Advance to the next frame without producing an image"""
+        if self._reader is not None:
+            try:
+                if hasattr(self._reader, "grab"):
+                    return bool(self._reader.grab())
+                ret, _ = self._reader.nextFrame()
+                return bool(ret)
+            except Exception:
+                self._reader_opened = False
+                return False
+        return self._cap.grab()
+
+    def retrieve(self):
+        """Produce the image for the last grabbed frame"""
+        if self._reader is not None:
+            try:
+                ret, gpu_mat = self._reader.retrieve()
+                return ret, GpuFrame(gpu_mat) if ret else None
+            except Exception:
+                self._reader_opened = False
+                return False, None
+        return self._cap.retrieve()
+
+    def read(self, out: Optional[np.ndarray] = None):
+        """Grab and decode the next frame (GpuFrame for NVDEC, ndarray otherwise)
+
+        Host frames are decoded into out when it matches the stream geometry.
+        """
+        if self._reader is not None:
+            try:
+                ret, gpu_mat = self._reader.nextFrame()
+            except Exception:
+                self._reader_opened = False
+                return False, None
+            if not ret:
+                return False, None
+            return True, GpuFrame(gpu_mat)
+        if out is not None:
+            return self._cap.read(out)
+        return self._cap.read()
+
+    def get(self, prop_id: int) -> float:
+        if self._reader is not None:
+            try:
+                fmt = self._reader.format()
+                if prop_id == cv2.CAP_PROP_FRAME_WIDTH:
+                    return float(fmt.width)
+                if prop_id == cv2.CAP_PROP_FRAME_HEIGHT:
+                    return float(fmt.height)
+                if prop_id == cv2.CAP_PROP_FPS:
+                    return float(getattr(fmt, "fps", 0.0))
+            except Exception:
+                pass
+            return 0.0
+        return self._cap.get(prop_id)
+
+    def set(self, prop_id: int, value: float) -> bool:
+        if self._reader is not None:
+            return False
+        return self._cap.set(prop_id, value)
+
+    def release(self):
+        if self._cap is not None:
+            self._cap.release()
+        self._reader = None
+        self._reader_opened = False
@@ -0,0 +1,400 @@
+"""
+Camera Cluster
+Consistent-hash stream placement across service nodes, with heartbeats and failover
+"""
+
+import bisect
+import hashlib
+import json
+import os
+import socket
+import threading
+import time
+import urllib.error
+import urllib.request
+from concurrent.futures import ThreadPoolExecutor
+from typing import Dict, List, Optional, Set, Tuple
+
+# A coordinator keeps the camera catalog and placement; nodes join it by URL.
+# One process may be both
+COORDINATOR_ENABLED = os.environ.get("CCTV_CLUSTER_COORDINATOR", "0").lower() not in ("0", "false", "no")
+COORDINATOR_URL = os.environ.get("CCTV_COORDINATOR_URL", "").rstrip("/")
+NODE_ID = os.environ.get("CCTV_NODE_ID", socket.gethostname())
+NODE_URL = os.environ.get("CCTV_NODE_URL", "").rstrip("/")
+NODE_DECODE_SLOTS = int(os.environ.get("CCTV_NODE_DECODE_SLOTS", os.cpu_count() or 4))
+NODE_GPUS = os.environ.get("CCTV_NODE_GPUS", "auto")
+GPU_SLOT_WEIGHT = float(os.environ.get("CCTV_GPU_SLOT_WEIGHT", 16))
+NODE_TTL = float(os.environ.get("CCTV_NODE_TTL", 4.0))
+CATALOG_PATH = os.environ.get("CCTV_CLUSTER_CATALOG", "cluster_cameras.json")
+HEARTBEAT_INTERVAL = 1.0
+VNODES_PER_SLOT = 16
+ADD_RETRY_SECONDS = 10.0
+
+
+def detect_gpus() -> int:
+    """CUDA devices OpenCV can use, or the CCTV_NODE_GPUS override"""
+    if NODE_GPUS != "auto":
+        return int(NODE_GPUS)
+    try:
+        import cv2
+        return cv2.cuda.getCudaEnabledDeviceCount() if hasattr(cv2, "cuda") else 0
+    except Exception:
+        return 0
+
+
+def node_weight(decode_slots: int, gpus: int) -> float:
+    """Placement weight: decode slots, with each GPU counted as GPU_SLOT_WEIGHT slots"""
+    return max(1.0, decode_slots + gpus * GPU_SLOT_WEIGHT)
+
+
+def _hash(key: str) -> int:
+    return int.from_bytes(hashlib.blake2b(key.encode("utf-8"), digest_size=8).digest(), "big")
+
+
+class HashRing:
+    """Weighted consistent-hash ring
+
+    Each node gets virtual points in proportion to its weight, named
+    "{node}#{i}", so a node joining (or growing) only claims the streams
+    that fall on its new points and a node leaving only releases its own.
+    """
+
+    def __init__(self, weights: Dict[str, float], vnodes_per_unit: int = VNODES_PER_SLOT):
+        points = []
+        for node_id, weight in weights.items():
+            for index in range(max(1, int(round(weight * vnodes_per_unit)))):
+                points.append((_hash(f"{node_id}#{index}"), node_id))
+        points.sort()
+        self._keys = [point for point, _ in points]
+        self._nodes = [node_id for _, node_id in points]
+
+    def lookup(self, key: str) -> Optional[str]:
+        if not self._keys:
+            return None
+        index = bisect.bisect(self._keys, _hash(key)) % len(self._keys)
+        return self._nodes[index]
+
+
+class NodeInfo:
+    """A node as last reported by its heartbeat"""
+
+    __slots__ = ("node_id", "url", "decode_slots", "gpus", "streams", "states", "joined", "last_seen")
+
+    def __init__(self, node_id: str, url: str, decode_slots: int, gpus: int):
+        self.node_id = node_id
+        self.url = url
+        self.decode_slots = decode_slots
+        self.gpus = gpus
+        self.streams: List[str] = []
+        # stream_id -> connection state (connecting / connected / backoff)
+        self.states: Dict[str, str] = {}
+        self.joined = time.time()
+        self.last_seen = self.joined
+
+    @property
+    def weight(self) -> float:
+        return node_weight(self.decode_slots, self.gpus)
+
+    def to_dict(self) -> Dict:
+        return {
+            "node_id": self.node_id,
+            "url": self.url,
+            "decode_slots": self.decode_slots,
+            "gpus": self.gpus,
+            "weight": self.weight,
+            "running": len(self.streams),
+            "last_seen": self.last_seen,
+        }
+
+
+class ClusterCoordinator:
+    """Camera catalog, node membership and the placement derived from them
+
+    Nodes heartbeat every second and get back the streams placed on them;
+    a node silent for NODE_TTL seconds is dropped and its cameras move to
+    their next point on the ring. The catalog is saved to disk so a
+    restarted coordinator places the same cameras again.
+    """
+
+    def __init__(self, catalog_path: str = CATALOG_PATH, ttl: float = NODE_TTL):
+        self.catalog_path = catalog_path
+        self.ttl = ttl
+        self.nodes: Dict[str, NodeInfo] = {}
+        self.cameras: Dict[str, Dict] = self._load_catalog()
+        self.placement: Dict[str, Optional[str]] = {}
+        self.version = 0
+        self._ring = HashRing({})
+        self._lock = threading.Lock()
+        self.failovers = 0
+        self.moved_streams = 0
+        self.running = True
+        threading.Thread(target=self._monitor_loop, name="cluster-monitor", daemon=True).start()
+        print(f"Cluster coordinator started with {len(self.cameras)} cameras in the catalog")
+
+    def _load_catalog(self) -> Dict[str, Dict]:
+        try:
+            with open(self.catalog_path, "r", encoding="utf-8") as f:
+                return json.load(f)
+        except FileNotFoundError:
+            return {}
+        except (OSError, ValueError) as e:
+            print(f"Could not read cluster catalog {self.catalog_path}: {e}")
+            return {}
+
+    def _save_catalog(self):
+        temporary = self.catalog_path + ".tmp"
+        try:
+            with open(temporary, "w", encoding="utf-8") as f:
+                json.dump(self.cameras, f, ensure_ascii=False, indent=2)
+            os.replace(temporary, self.catalog_path)
+        except OSError as e:
+            print(f"Could not save cluster catalog {self.catalog_path}: {e}")
+
+    def _rebalance(self, reason: str):
+        # Called under the lock
+        self._ring = HashRing({node_id: node.weight for node_id, node in self.nodes.items()})
+        placement = {stream_id: self._ring.lookup(stream_id) for stream_id in self.cameras}
+        moved = sum(1 for stream_id, node_id in placement.items()
+                    if self.placement.get(stream_id) not in (None, node_id))
+        self.placement = placement
+        self.moved_streams += moved
+        self.version += 1
+        print(f"Cluster placement v{self.version} ({reason}): {len(self.nodes)} nodes, "
+              f"{len(placement)} cameras, {moved} moved")
+
+    def heartbeat(self, node_id: str, url: str, decode_slots: int, gpus: int, streams: List[str],
+                  states: Optional[Dict[str, str]] = None) -> Dict:
+        """Record a node's heartbeat; returns the streams it should be running"""
+        with self._lock:
+            node = self.nodes.get(node_id)
+            if node is None:
+                node = self.nodes[node_id] = NodeInfo(node_id, url, decode_slots, gpus)
+                self._rebalance(f"{node_id} joined")
+            elif (node.decode_slots, node.gpus) != (decode_slots, gpus):
+                node.decode_slots, node.gpus = decode_slots, gpus
+                self._rebalance(f"{node_id} capacity changed")
+            node.url = url
+            node.streams = streams
+            node.states = states or {}
+            node.last_seen = time.time()
+            return {
+                "version": self.version,
+                "streams": {stream_id: self.cameras[stream_id] for stream_id, placed in self.placement.items()
+                            if placed == node_id},
+            }
+
+    def expire(self):
+        """Drop nodes whose heartbeats stopped and move their cameras"""
+        now = time.time()
+        with self._lock:
+            dead = [node_id for node_id, node in self.nodes.items() if now - node.last_seen > self.ttl]
+            if not dead:
+                return
+            for node_id in dead:
+                del self.nodes[node_id]
+            self.failovers += len(dead)
+            self._rebalance(f"{', '.join(dead)} lost")
+
+    def _monitor_loop(self):
+        while self.running:
+            time.sleep(HEARTBEAT_INTERVAL)
+            self.expire()
+
+    def add_camera(self, stream_id: str, rtsp_url: str, decode_mode: str, enable_ai: bool,
+                   record: bool, main_url: Optional[str] = None) -> Optional[NodeInfo]:
+        """Add or update a camera; returns the node it is placed on (None with no nodes)"""
+        with self._lock:
+            self.cameras[stream_id] = {"rtsp_url": rtsp_url, "decode_mode": decode_mode,
+                                       "enable_ai": enable_ai, "record": record, "main_url": main_url}
+            self.placement[stream_id] = self._ring.lookup(stream_id)
+            self.version += 1
+            self._save_catalog()
+            node_id = self.placement[stream_id]
+            return self.nodes.get(node_id) if node_id is not None else None
+
+    def remove_camera(self, stream_id: str) -> bool:
+        with self._lock:
+            if self.cameras.pop(stream_id, None) is None:
+                return False
+            self.placement.pop(stream_id, None)
+            self.version += 1
+            self._save_catalog()
+            return True
+
+    def routes(self) -> Dict:
+        """Routing table for clients: the node serving each camera, whether it has the camera yet
+        and its connection state there
+        """
+        with self._lock:
+            streams = {}
+            for stream_id, node_id in self.placement.items():
+                node = self.nodes.get(node_id) if node_id is not None else None
+                streams[stream_id] = {
+                    "node": node_id,
+                    "url": node.url if node is not None else None,
+                    "ready": node is not None and stream_id in node.streams,
+                    "state": node.states.get(stream_id) if node is not None else None,
+                }
+            return {
+                "version": self.version,
+                "streams": streams,
+                "nodes": {node_id: node.url for node_id, node in self.nodes.items()},
+            }
+
+    def get_stats(self) -> Dict:
+        with self._lock:
+            counts: Dict[Optional[str], int] = {}
+            for node_id in self.placement.values():
+                counts[node_id] = counts.get(node_id, 0) + 1
+            return {
+                "version": self.version,
+                "cameras": len(self.cameras),
+                "unplaced": counts.get(None, 0),
+                "nodes": [{**node.to_dict(), "assigned": counts.get(node_id, 0)}
+                          for node_id, node in self.nodes.items()],
+                "failovers": self.failovers,
+                "moved_streams": self.moved_streams,
+            }
+
+
+class ClusterAgent:
+    """Keeps this node registered with the coordinator and runs the streams placed on it
+
+    Only streams the agent started are stopped when the coordinator moves
+    them away, so cameras added to this node directly keep running. If the
+    coordinator is unreachable the node keeps its current streams.
+    """
+
+    def __init__(self, processor, coordinator_url: str = COORDINATOR_URL, node_id: str = NODE_ID,
+                 node_url: str = NODE_URL, decode_slots: int = NODE_DECODE_SLOTS):
+        self.processor = processor
+        self.coordinator_url = coordinator_url
+        self.node_id = node_id
+        self.node_url = node_url
+        self.decode_slots = decode_slots
+        self.gpus = detect_gpus()
+        self.managed: Set[str] = set()
+        self._applied: Dict[str, Tuple] = {}  # Catalog config each managed stream was started with
+        self.version = 0
+        self.connected = False
+        self.heartbeat_errors = 0
+        self._pending: Set[str] = set()
+        self._failed: Dict[str, float] = {}
+        self._lock = threading.Lock()
+        self._executor = ThreadPoolExecutor(max_workers=4, thread_name_prefix="cluster-add")
+        self.running = False
+
+    def start(self):
+        if self.running:
+            return
+        if not self.node_url:
+            print("CCTV_NODE_URL is not set; clients will not be able to reach this node's streams")
+        self.running = True
+        threading.Thread(target=self._heartbeat_loop, name="cluster-agent", daemon=True).start()
+        print(f"Cluster node {self.node_id} ({self.node_url}) joining {self.coordinator_url}")
+
+    def stop(self):
+        self.running = False
+        self._executor.shutdown(wait=False)
+
+    def _post(self, path: str, body: Dict) -> Dict:
+        request = urllib.request.Request(self.coordinator_url + path, data=json.dumps(body).encode("utf-8"),
+                                         headers={"Content-Type": "application/json"}, method="POST")
+        with urllib.request.urlopen(request, timeout=2.0) as response:
+            return json.loads(response.read().decode("utf-8"))
+
+    def _heartbeat_loop(self):
+        while self.running:
+            try:
+                reply = self._post("/cluster/heartbeat", {
+                    "node_id": self.node_id,
+                    "url": self.node_url,
+                    "decode_slots": self.decode_slots,
+                    "gpus": self.gpus,
+                    # Registered streams, not only open captures: a camera that is
+                    # connecting or backing off is already served here
+                    "streams": list(self.processor.stream_urls),
+                    "states": self._connection_states(),
+                })
+                if not self.connected:
+                    print(f"Cluster node {self.node_id} connected to coordinator")
+                self.connected = True
+                self.version = reply.get("version", self.version)
+                self._reconcile(reply.get("streams", {}))
+            except (OSError, ValueError, urllib.error.URLError) as e:
+                self.heartbeat_errors += 1
+                if self.connected:
+                    print(f"Cluster coordinator unreachable, keeping current streams: {e}")
+                self.connected = False
+            time.sleep(HEARTBEAT_INTERVAL)
+
+    def _connection_states(self) -> Dict[str, str]:
+        states = {}
+        for stream_id in list(self.processor.stream_urls):
+            connection = self.processor.connections.state(stream_id)
+            if connection is not None:
+                states[stream_id] = connection["state"]
+        return states
+
+    def _reconcile(self, desired: Dict[str, Dict]):
+        now = time.time()
+        for stream_id in list(self.managed):
+            if stream_id not in desired:
+                print(f"Cluster moved {stream_id} off this node")
+                self.processor.remove_stream(stream_id)
+                self.managed.discard(stream_id)
+                self._applied.pop(stream_id, None)
+
+        for stream_id, spec in desired.items():
+            current = self.processor.stream_urls.get(stream_id)
+            if (current is not None and stream_id in self.managed
+                    and self._applied.get(stream_id) != self._config(spec)):
+                # Camera edited in the catalog (URL, decode mode, AI, recording)
+                print(f"Cluster restarting {stream_id} with its updated config")
+                self.processor.remove_stream(stream_id)
+                current = None
+            if current is not None:
+                continue
+            with self._lock:
+                if stream_id in self._pending or now - self._failed.get(stream_id, 0.0) < ADD_RETRY_SECONDS:
+                    continue
+                self._pending.add(stream_id)
+            # Opening a camera can take seconds; don't hold up heartbeats
+            self._executor.submit(self._add, stream_id, spec)
+
+    @staticmethod
+    def _config(spec: Dict) -> Tuple:
+        """The catalog fields a stream is started with, in add_stream order"""
+        return (spec["rtsp_url"], spec.get("decode_mode", "software"), spec.get("enable_ai", True),
+                spec.get("record", False), spec.get("main_url"))
+
+    def _add(self, stream_id: str, spec: Dict):
+        config = self._config(spec)
+        try:
+            added = self.processor.add_stream(stream_id, *config)
+        except Exception as e:
+            print(f"Cluster could not start {stream_id}: {e}")
+            added = False
+        with self._lock:
+            self._pending.discard(stream_id)
+            if added:
+                self.managed.add(stream_id)
+                self._applied[stream_id] = config
+                self._failed.pop(stream_id, None)
+            else:
+                self._failed[stream_id] = time.time()
+
+    def get_stats(self) -> Dict:
+        return {
+            "node_id": self.node_id,
+            "url": self.node_url,
+            "coordinator": self.coordinator_url,
+            "connected": self.connected,
+            "version": self.version,
+            "decode_slots": self.decode_slots,
+            "gpus": self.gpus,
+            "weight": node_weight(self.decode_slots, self.gpus),
+            "managed_streams": sorted(self.managed),
+            "pending": sorted(self._pending),
+            "heartbeat_errors": self.heartbeat_errors,
+        }
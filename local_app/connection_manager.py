@@ -0,0 +1,257 @@
+"""
+Connection Manager
+Bounded parallel camera opens with jittered exponential backoff
+"""
+
+import os
+import random
+import threading
+import time
+from collections import deque
+from concurrent.futures import ThreadPoolExecutor
+from typing import Callable, Dict, List, Optional
+
+# Opens in flight at once; a site coming back from a power cut opens this
+# many cameras in parallel instead of one per blocked capture worker
+CONNECT_WORKERS = int(os.environ.get("CCTV_CONNECT_WORKERS", 16))
+BACKOFF_INITIAL = float(os.environ.get("CCTV_RECONNECT_BACKOFF", 1.0))
+BACKOFF_MAX = float(os.environ.get("CCTV_RECONNECT_BACKOFF_MAX", 60.0))
+# A camera has to stay up this long before its backoff resets; one that
+# accepts the open and then fails the first read still backs off
+HEALTHY_SECONDS = float(os.environ.get("CCTV_RECONNECT_HEALTHY_SECONDS", 10.0))
+LATENCY_SAMPLES = 20
+
+CONNECTING = "connecting"
+CONNECTED = "connected"
+BACKOFF = "backoff"
+
+
+class Backoff:
+    """Jittered exponential backoff
+
+    The n-th consecutive failure waits between half and all of
+    min(maximum, initial * 2**n), so cameras that went down together
+    spread their retries out instead of hammering the network in lockstep.
+    """
+
+    def __init__(self, initial: float = BACKOFF_INITIAL, maximum: float = BACKOFF_MAX):
+        self.initial = initial
+        self.maximum = maximum
+        self.failures = 0
+        self.next_attempt = 0.0
+
+    def failed(self, now: Optional[float] = None) -> float:
+        """Record a failure; returns the delay before the next attempt"""
+        ceiling = min(self.maximum, self.initial * (2 ** min(self.failures, 30)))
+        delay = ceiling / 2 + random.uniform(0.0, ceiling / 2)
+        self.failures += 1
+        self.next_attempt = (now if now is not None else time.time()) + delay
+        return delay
+
+    def reset(self):
+        self.failures = 0
+        self.next_attempt = 0.0
+
+    def ready(self, now: float) -> bool:
+        return now >= self.next_attempt
+
+
+class CameraConnection:
+    """Connection state and connect history for one camera"""
+
+    __slots__ = ("key", "rtsp_url", "decode_mode", "on_open", "opener", "state", "backoff", "generation",
+                 "attempts", "last_error", "latencies", "connected_at", "started_at")
+
+    def __init__(self, key: str, rtsp_url: str, decode_mode: str, on_open: Callable, opener: Callable):
+        self.key = key
+        self.rtsp_url = rtsp_url
+        self.decode_mode = decode_mode
+        self.on_open = on_open
+        self.opener = opener
+        self.state = CONNECTING
+        self.backoff = Backoff()
+        self.generation = 0
+        self.attempts = 0
+        self.last_error: Optional[str] = None
+        self.latencies: deque = deque(maxlen=LATENCY_SAMPLES)
+        self.connected_at: Optional[float] = None
+        self.started_at = time.time()
+
+    def to_dict(self) -> Dict:
+        now = time.time()
+        return {
+            "state": self.state,
+            "attempts": self.attempts,
+            "failures": self.backoff.failures,
+            "last_error": self.last_error,
+            "retry_in": round(max(0.0, self.backoff.next_attempt - now), 1) if self.state == BACKOFF else None,
+            "last_connect_ms": round(self.latencies[-1] * 1000, 1) if self.latencies else None,
+            "connected_at": self.connected_at,
+        }
+
+
+class ConnectionManager:
+    """Opens camera streams off the API and capture threads
+
+    connect() returns at once. Opens run on a bounded pool; a failed open
+    is retried after its camera's backoff, and a successful one is handed
+    to on_open(capture). Reconnects go through the same path, so a capture
+    worker never blocks on an RTSP handshake; a reconnect within
+    HEALTHY_SECONDS of the last open counts as a failure and waits out the
+    backoff. Captures that finish opening after their camera was cancelled
+    are released.
+
+    opener(key, rtsp_url, decode_mode) returns an open capture or None;
+    connect() can override it per camera.
+    """
+
+    def __init__(self, opener: Callable[[str, str, str], Optional[object]], workers: int = CONNECT_WORKERS):
+        self.opener = opener
+        self.workers = workers
+        self._executor = ThreadPoolExecutor(max_workers=workers, thread_name_prefix="camera-connect")
+        self._connections: Dict[str, CameraConnection] = {}
+        self._lock = threading.Lock()
+        self.in_flight = 0
+        self.opened = 0
+        self.failed = 0
+
+    def connect(self, key: str, rtsp_url: str, decode_mode: str, on_open: Callable[[object], None],
+                opener: Optional[Callable[[str, str, str], Optional[object]]] = None):
+        """Open (or reopen) a camera in the background"""
+        now = time.time()
+        delay = 0.0
+        with self._lock:
+            connection = self._connections.get(key)
+            if connection is None:
+                connection = CameraConnection(key, rtsp_url, decode_mode, on_open, opener or self.opener)
+                self._connections[key] = connection
+            elif connection.state == CONNECTING and connection.rtsp_url == rtsp_url:
+                connection.on_open = on_open
+                return
+            elif connection.state == CONNECTED and connection.rtsp_url == rtsp_url:
+                # Dropped after opening: only a camera that stayed up earns a fresh backoff
+                if now - (connection.connected_at or 0.0) >= HEALTHY_SECONDS:
+                    connection.backoff.reset()
+                else:
+                    connection.last_error = "dropped right after opening"
+                    delay = connection.backoff.failed(now)
+            connection.rtsp_url = rtsp_url
+            connection.decode_mode = decode_mode
+            connection.on_open = on_open
+            connection.state = BACKOFF if delay else CONNECTING
+            connection.generation += 1
+            connection.started_at = now
+            generation = connection.generation
+
+        if delay:
+            print(f"{key} dropped {now - connection.connected_at:.1f}s after opening, "
+                  f"reconnecting in {delay:.1f}s")
+            timer = threading.Timer(delay, self._retry, args=(connection, generation))
+            timer.daemon = True
+            timer.start()
+            return
+        self._executor.submit(self._attempt, connection, generation)
+
+    def cancel(self, key: str):
+        """Forget a camera; an open still in flight is released when it lands"""
+        with self._lock:
+            connection = self._connections.pop(key, None)
+            if connection is not None:
+                connection.generation += 1
+
+    def _current(self, connection: CameraConnection, generation: int) -> bool:
+        # Called under the lock
+        return self._connections.get(connection.key) is connection and connection.generation == generation
+
+    def _attempt(self, connection: CameraConnection, generation: int):
+        with self._lock:
+            if not self._current(connection, generation):
+                return
+            connection.attempts += 1
+            connection.state = CONNECTING
+            self.in_flight += 1
+
+        started = time.monotonic()
+        cap, error = None, None
+        try:
+            cap = connection.opener(connection.key, connection.rtsp_url, connection.decode_mode)
+        except Exception as e:
+            error = str(e)
+        latency = time.monotonic() - started
+
+        with self._lock:
+            self.in_flight -= 1
+            current = self._current(connection, generation)
+            if cap is not None and current:
+                connection.state = CONNECTED
+                connection.latencies.append(latency)
+                connection.connected_at = time.time()
+                connection.last_error = None
+                self.opened += 1
+                on_open = connection.on_open
+            elif current:
+                connection.state = BACKOFF
+                connection.last_error = error or "open failed"
+                delay = connection.backoff.failed()
+                self.failed += 1
+                on_open = None
+            else:
+                on_open = None
+
+        if cap is not None and on_open is None:
+            # Cancelled while opening
+            cap.release()
+            return
+        if cap is None:
+            if current:
+                print(f"Could not open {connection.key} ({connection.last_error}), "
+                      f"retrying in {delay:.1f}s (attempt {connection.attempts})")
+                timer = threading.Timer(delay, self._retry, args=(connection, generation))
+                timer.daemon = True
+                timer.start()
+            return
+
+        print(f"Opened {connection.key} in {latency:.2f}s (attempt {connection.attempts})")
+        try:
+            on_open(cap)
+        except Exception as e:
+            print(f"Error handing over capture for {connection.key}: {e}")
+            cap.release()
+
+    def _retry(self, connection: CameraConnection, generation: int):
+        with self._lock:
+            if not self._current(connection, generation):
+                return
+        self._executor.submit(self._attempt, connection, generation)
+
+    def state(self, key: str) -> Optional[Dict]:
+        with self._lock:
+            connection = self._connections.get(key)
+            return connection.to_dict() if connection is not None else None
+
+    def get_stats(self) -> Dict:
+        with self._lock:
+            connections = list(self._connections.values())
+            in_flight = self.in_flight
+        counts = {CONNECTING: 0, CONNECTED: 0, BACKOFF: 0}
+        latencies: List[float] = []
+        for connection in connections:
+            counts[connection.state] += 1
+            latencies.extend(connection.latencies)
+        latencies.sort()
+
+        def percentile(fraction: float) -> Optional[float]:
+            if not latencies:
+                return None
+            return round(latencies[min(len(latencies) - 1, int(fraction * len(latencies)))] * 1000, 1)
+
+        return {
+            "workers": self.workers,
+            "in_flight": in_flight,
+            "states": counts,
+            "opened": self.opened,
+            "failed": self.failed,
+            "connect_ms_p50": percentile(0.5),
+            "connect_ms_p95": percentile(0.95),
+            "cameras": {connection.key: connection.to_dict() for connection in connections},
+        }
@@ -0,0 +1,141 @@
+"""
+Detection Results
+Compact struct-of-arrays container for per-frame detections
+"""
+
+import time
+from typing import Dict, Iterable, List, Optional, Sequence
+
+import numpy as np
+
+
+class Detections:
+    """Detections for one frame stored as contiguous arrays
+
+    boxes is (N, 4) float32 xyxy in original frame coordinates, scores is
+    (N,) float32 and class_ids is (N,) int32. Filtering and class-name
+    mapping work on whole arrays; to_dicts() produces the legacy list of
+    dicts in a single pass when a caller needs it. track_ids is filled in
+    by the tracker (-1 for untracked detections).
+    """
+
+    __slots__ = ("boxes", "scores", "class_ids", "names", "timestamp", "track_ids")
+
+    def __init__(self, boxes: np.ndarray, scores: np.ndarray, class_ids: np.ndarray,
+                 names: Sequence[str], timestamp: Optional[float] = None):
+        self.boxes = np.ascontiguousarray(boxes, dtype=np.float32).reshape(-1, 4)
+        self.scores = np.ascontiguousarray(scores, dtype=np.float32).reshape(-1)
+        self.class_ids = np.ascontiguousarray(class_ids, dtype=np.int32).reshape(-1)
+        self.names = names
+        self.timestamp = timestamp if timestamp is not None else time.time()
+        self.track_ids: Optional[np.ndarray] = None
+
+    @classmethod
+    def empty(cls, names: Sequence[str], timestamp: Optional[float] = None) -> "Detections":
+        return cls(np.empty((0, 4), np.float32), np.empty(0, np.float32),
+                   np.empty(0, np.int32), names, timestamp)
+
+    @classmethod
+    def from_rows(cls, rows: np.ndarray, names: Sequence[str], scale: float = 1.0,
+                  timestamp: Optional[float] = None) -> "Detections":
+        """Build from an (N, 6) [x1, y1, x2, y2, conf, cls] array"""
+        rows = np.asarray(rows, dtype=np.float32).reshape(-1, 6)
+        boxes = rows[:, :4] / scale if scale != 1.0 else rows[:, :4]
+        return cls(boxes, rows[:, 4], rows[:, 5], names, timestamp)
+
+    @classmethod
+    def from_dicts(cls, detections: List[Dict], names: Sequence[str] = (),
+                   timestamp: Optional[float] = None) -> "Detections":
+        """Build from the legacy list-of-dicts form"""
+        if not detections:
+            return cls.empty(names, timestamp)
+        return cls(np.array([d["bbox"] for d in detections], np.float32),
+                   np.array([d["confidence"] for d in detections], np.float32),
+                   np.array([d["class_id"] for d in detections], np.int32),
+                   names, timestamp if timestamp is not None else detections[0].get("timestamp"))
+
+    def __len__(self) -> int:
+        return len(self.scores)
+
+    def filter(self, mask: np.ndarray) -> "Detections":
+        """Select detections by boolean mask or index array"""
+        selected = Detections(self.boxes[mask], self.scores[mask], self.class_ids[mask],
+                              self.names, self.timestamp)
+        if self.track_ids is not None:
+            selected.track_ids = self.track_ids[mask]
+        return selected
+
+    def scaled(self, sx: float, sy: float) -> "Detections":
+        """The same detections with boxes in a frame scaled by (sx, sy)"""
+        scaled = Detections(self.boxes * np.array([sx, sy, sx, sy], np.float32), self.scores,
+                            self.class_ids, self.names, self.timestamp)
+        scaled.track_ids = self.track_ids
+        return scaled
+
+    def above(self, confidence_threshold: float) -> "Detections":
+        """Keep detections at or above a confidence"""
+        if len(self) == 0 or self.scores.min() >= confidence_threshold:
+            return self
+        return self.filter(self.scores >= confidence_threshold)
+
+    def of_classes(self, class_ids: Iterable[int]) -> "Detections":
+        """Keep detections of the given class ids"""
+        return self.filter(np.isin(self.class_ids, np.fromiter(class_ids, dtype=np.int32)))
+
+    @property
+    def class_names(self) -> List[str]:
+        names = self.names
+        count = len(names)
+        return [names[i] if i < count else str(i) for i in self.class_ids.tolist()]
+
+    def to_dicts(self) -> List[Dict]:
+        """Legacy list-of-dicts form"""
+        if len(self) == 0:
+            return []
+        boxes = self.boxes.astype(np.int32).tolist()
+        scores = self.scores.tolist()
+        class_ids = self.class_ids.tolist()
+        timestamp = self.timestamp
+        detections = [
+            {
+                "bbox": box,
+                "confidence": score,
+                "class_id": class_id,
+                "class_name": name,
+                "timestamp": timestamp
+            }
+            for box, score, class_id, name in zip(boxes, scores, class_ids, self.class_names)
+        ]
+        if self.track_ids is not None:
+            for detection, track_id in zip(detections, self.track_ids.tolist()):
+                detection["track_id"] = track_id
+        return detections
+
+    def to_compact(self) -> Dict:
+        """Compact JSON-friendly struct-of-arrays form"""
+        return {
+            "timestamp": self.timestamp,
+            "boxes": self.boxes.round(1).tolist(),
+            "scores": self.scores.round(3).tolist(),
+            "class_ids": self.class_ids.tolist(),
+            "class_names": self.class_names,
+            "track_ids": self.track_ids.tolist() if self.track_ids is not None else None,
+        }
+
+    def to_overlay(self, width: int, height: int, labels: Optional[Sequence[Optional[str]]] = None) -> Dict:
+        """Overlay form for viewers: boxes as fractions of a width x height frame
+
+        Fractions fit every rendition of the stream, so one payload serves
+        all viewers and the boxes are drawn client-side over the video.
+        """
+        scale = np.array([width, height, width, height], np.float32)
+        return {
+            "timestamp": self.timestamp,
+            "width": width,
+            "height": height,
+            "boxes": (self.boxes / scale).clip(0.0, 1.0).round(4).tolist(),
+            "scores": self.scores.round(2).tolist(),
+            "classes": self.class_names,
+            "track_ids": self.track_ids.tolist() if self.track_ids is not None else None,
+            "labels": list(labels) if labels is not None else None,
+        }
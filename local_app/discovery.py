@@ -0,0 +1,489 @@
+"""
+Camera Discovery
+WS-Discovery and concurrent RTSP DESCRIBE probing, with stream info read from the SDP
+"""
+
+import asyncio
+import base64
+import hashlib
+import ipaddress
+import os
+import re
+import socket
+import time
+import uuid
+import xml.etree.ElementTree as ET
+from typing import Dict, List, Optional, Tuple
+from urllib.parse import quote, urlsplit
+
+DISCOVERY_CONCURRENCY = int(os.environ.get("CCTV_DISCOVERY_CONCURRENCY", 64))
+DISCOVERY_CACHE_TTL = float(os.environ.get("CCTV_DISCOVERY_CACHE_TTL", 300))
+# Port checks use the short timeout; DESCRIBE gets longer since some cameras are slow to answer
+CONNECT_TIMEOUT = 0.7
+DESCRIBE_TIMEOUT = 3.0
+WS_DISCOVERY_TIMEOUT = 2.0
+MAX_SCAN_HOSTS = 1024
+PATHS_PER_HOST = 4  # DESCRIBEs in flight per camera
+
+WS_DISCOVERY_ADDR = ("239.255.255.250", 3702)
+
+# Main stream first, then sub-streams. Cameras lock accounts after repeated
+# failed logins, so without a brand each vendor is tried in turn and probing
+# stops at the first one that answers
+RTSP_PATHS: Dict[str, List[str]] = {
+    "reolink": ["/h264Preview_01_main", "/h264Preview_01_sub"],
+    "hikvision": ["/Streaming/Channels/101", "/Streaming/Channels/102"],
+    "dahua": ["/cam/realmonitor?channel=1&subtype=0", "/cam/realmonitor?channel=1&subtype=1"],
+    "axis": ["/axis-media/media.amp"],
+    "generic": ["/stream1", "/stream2", "/live/ch00_0", "/live/ch00_1"],
+}
+
+_WS_PROBE = (
+    '<?xml version="1.0" encoding="UTF-8"?>'
+    '<e:Envelope xmlns:e="http://www.w3.org/2003/05/soap-envelope" '
+    'xmlns:w="http://schemas.xmlsoap.org/ws/2004/08/addressing" '
+    'xmlns:d="http://schemas.xmlsoap.org/ws/2005/04/discovery" '
+    'xmlns:dn="http://www.onvif.org/ver10/network/wsdl">'
+    '<e:Header><w:MessageID>uuid:{message_id}</w:MessageID>'
+    '<w:To e:mustUnderstand="true">urn:schemas-xmlsoap-org:ws:2005:04:discovery</w:To>'
+    '<w:Action e:mustUnderstand="true">http://schemas.xmlsoap.org/ws/2005/04/discovery/Probe</w:Action>'
+    '</e:Header><e:Body><d:Probe><d:Types>dn:NetworkVideoTransmitter</d:Types></d:Probe></e:Body>'
+    '</e:Envelope>'
+)
+
+
+class _Bits:
+    """MSB-first bit reader over an RBSP (emulation prevention bytes removed)"""
+
+    def __init__(self, data: bytes):
+        self.data = data
+        self.pos = 0
+
+    def u(self, count: int) -> int:
+        value = 0
+        for _ in range(count):
+            byte = self.data[self.pos >> 3]
+            value = (value << 1) | ((byte >> (7 - (self.pos & 7))) & 1)
+            self.pos += 1
+        return value
+
+    def ue(self) -> int:
+        zeros = 0
+        while self.u(1) == 0:
+            zeros += 1
+            if zeros > 31:
+                raise ValueError("Bad exp-Golomb code")
+        return (1 << zeros) - 1 + self.u(zeros)
+
+    def se(self) -> int:
+        value = self.ue()
+        return (value + 1) // 2 if value & 1 else -(value // 2)
+
+
+def _rbsp(nal: bytes) -> bytes:
+    return re.sub(b"\x00\x00\x03(?=[\x00-\x03])", b"\x00\x00", nal)
+
+
+def parse_h264_sps(nal: bytes) -> Dict:
+    """Width, height, profile, level and (when signalled) FPS from an H.264 SPS NAL unit"""
+    bits = _Bits(_rbsp(nal[1:]))
+    profile = bits.u(8)
+    bits.u(8)  # Constraint flags
+    level = bits.u(8)
+    bits.ue()  # seq_parameter_set_id
+    chroma_format = 1
+    if profile in (100, 110, 122, 244, 44, 83, 86, 118, 128, 138, 139, 134, 135):
+        chroma_format = bits.ue()
+        if chroma_format == 3:
+            bits.u(1)  # separate_colour_plane_flag
+        bits.ue()  # bit_depth_luma_minus8
+        bits.ue()  # bit_depth_chroma_minus8
+        bits.u(1)  # qpprime_y_zero_transform_bypass_flag
+        if bits.u(1):  # seq_scaling_matrix_present_flag
+            for index in range(8 if chroma_format != 3 else 12):
+                if bits.u(1):
+                    last, next_scale = 8, 8
+                    for _ in range(16 if index < 6 else 64):
+                        if next_scale:
+                            next_scale = (last + bits.se()) % 256
+                        last = next_scale or last
+    bits.ue()  # log2_max_frame_num_minus4
+    poc_type = bits.ue()
+    if poc_type == 0:
+        bits.ue()
+    elif poc_type == 1:
+        bits.u(1)
+        bits.se()
+        bits.se()
+        for _ in range(bits.ue()):
+            bits.se()
+    bits.ue()  # max_num_ref_frames
+    bits.u(1)  # gaps_in_frame_num_value_allowed_flag
+    width_mbs = bits.ue() + 1
+    height_units = bits.ue() + 1
+    frame_mbs_only = bits.u(1)
+    if not frame_mbs_only:
+        bits.u(1)  # mb_adaptive_frame_field_flag
+    bits.u(1)  # direct_8x8_inference_flag
+    crop = (0, 0, 0, 0)
+    if bits.u(1):
+        crop = (bits.ue(), bits.ue(), bits.ue(), bits.ue())
+    sub_width = 2 if chroma_format in (1, 2) else 1
+    sub_height = 2 if chroma_format == 1 else 1
+    width = width_mbs * 16 - (crop[0] + crop[1]) * sub_width
+    height = (2 - frame_mbs_only) * height_units * 16 - (crop[2] + crop[3]) * sub_height * (2 - frame_mbs_only)
+    info = {"profile": profile, "level": level / 10.0, "width": width, "height": height}
+
+    try:
+        if bits.u(1):  # vui_parameters_present_flag
+            if bits.u(1) and bits.u(8) == 255:  # aspect_ratio_info
+                bits.u(32)
+            if bits.u(1):  # overscan_info_present_flag
+                bits.u(1)
+            if bits.u(1):  # video_signal_type_present_flag
+                bits.u(4)
+                if bits.u(1):
+                    bits.u(24)
+            if bits.u(1):  # chroma_loc_info_present_flag
+                bits.ue()
+                bits.ue()
+            if bits.u(1):  # timing_info_present_flag
+                units, scale = bits.u(32), bits.u(32)
+                if units:
+                    info["fps"] = round(scale / (2.0 * units), 2)
+    except IndexError:
+        pass  # Truncated VUI; keep what was read
+    return info
+
+
+def parse_sdp(sdp: str) -> Dict:
+    """Video codec, resolution and FPS (plus audio codec) from an RTSP DESCRIBE body"""
+    info: Dict = {"codec": None, "width": None, "height": None, "fps": None, "audio": None}
+    media = None
+    for line in sdp.splitlines():
+        line = line.strip()
+        if line.startswith("m="):
+            media = line[2:].split(" ", 1)[0]
+            continue
+        if media == "audio" and line.startswith("a=rtpmap:") and info["audio"] is None:
+            info["audio"] = line.split(" ", 1)[-1].split("/", 1)[0]
+        if media != "video":
+            continue
+        if line.startswith("a=rtpmap:") and info["codec"] is None:
+            info["codec"] = line.split(" ", 1)[-1].split("/", 1)[0].upper()
+        elif line.startswith("a=framerate:") or line.startswith("a=x-framerate:"):
+            try:
+                info["fps"] = float(line.split(":", 1)[1])
+            except ValueError:
+                pass
+        elif line.startswith("a=x-dimensions:"):
+            try:
+                width, height = line.split(":", 1)[1].split(",")[:2]
+                info["width"], info["height"] = int(width), int(height)
+            except ValueError:
+                pass
+        elif line.startswith("a=fmtp:") and "sprop-parameter-sets=" in line:
+            sets = line.split("sprop-parameter-sets=", 1)[1].split(";", 1)[0].strip()
+            try:
+                sps = base64.b64decode(sets.split(",")[0] + "==")
+                if sps and sps[0] & 0x1F == 7:
+                    parsed = parse_h264_sps(sps)
+                    info["width"], info["height"] = parsed["width"], parsed["height"]
+                    info["profile"], info["level"] = parsed["profile"], parsed["level"]
+                    if parsed.get("fps") and not info["fps"]:
+                        info["fps"] = parsed["fps"]
+            except (ValueError, IndexError):
+                pass
+    return info
+
+
+def _digest_header(challenge: str, user: str, password: str, method: str, uri: str) -> str:
+    fields = dict(re.findall(r'(\w+)="?([^",]*)"?', challenge))
+    realm, nonce = fields.get("realm", ""), fields.get("nonce", "")
+    ha1 = hashlib.md5(f"{user}:{realm}:{password}".encode()).hexdigest()
+    ha2 = hashlib.md5(f"{method}:{uri}".encode()).hexdigest()
+    header = f'Digest username="{user}", realm="{realm}", nonce="{nonce}", uri="{uri}"'
+    if "auth" in fields.get("qop", "").split(","):
+        cnonce = uuid.uuid4().hex[:16]
+        response = hashlib.md5(f"{ha1}:{nonce}:00000001:{cnonce}:auth:{ha2}".encode()).hexdigest()
+        header += f', qop=auth, nc=00000001, cnonce="{cnonce}"'
+    else:
+        response = hashlib.md5(f"{ha1}:{nonce}:{ha2}".encode()).hexdigest()
+    if "opaque" in fields:
+        header += f', opaque="{fields["opaque"]}"'
+    return header + f', response="{response}"'
+
+
+async def _read_response(reader: asyncio.StreamReader) -> Tuple[int, Dict[str, List[str]], bytes]:
+    head = await reader.readuntil(b"\r\n\r\n")
+    lines = head.decode("latin-1").split("\r\n")
+    parts = lines[0].split(" ", 2)
+    if len(parts) < 2 or not parts[0].startswith("RTSP/"):
+        raise ValueError(f"Not an RTSP response: {lines[0][:60]}")
+    headers: Dict[str, List[str]] = {}
+    for line in lines[1:]:
+        if ":" in line:
+            name, value = line.split(":", 1)
+            headers.setdefault(name.strip().lower(), []).append(value.strip())
+    length = int(headers.get("content-length", ["0"])[0])
+    body = await reader.readexactly(length) if length else b""
+    return int(parts[1]), headers, body
+
+
+async def rtsp_describe(url: str, user: str = "", password: str = "", timeout: float = DESCRIBE_TIMEOUT) -> Dict:
+    """DESCRIBE one RTSP URL and parse its SDP; never sets up or decodes media
+
+    Returns {"ok": True, ...stream info} or {"ok": False, "status"/"error"}.
+    Credentials in the URL are used when user/password are not given.
+    """
+    parts = urlsplit(url)
+    user = user or (parts.username or "")
+    password = password or (parts.password or "")
+    host, port = parts.hostname, parts.port or 554
+    request_uri = f"rtsp://{host}:{port}{parts.path or '/'}" + (f"?{parts.query}" if parts.query else "")
+
+    started = time.monotonic()
+    try:
+        reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+    except (OSError, asyncio.TimeoutError) as e:
+        return {"ok": False, "error": f"connect failed: {e or 'timeout'}"}
+    try:
+        authorization = None
+        for cseq in (1, 2):
+            request = (f"DESCRIBE {request_uri} RTSP/1.0\r\nCSeq: {cseq}\r\nAccept: application/sdp\r\n"
+                       f"User-Agent: cctv-discovery\r\n")
+            if authorization:
+                request += f"Authorization: {authorization}\r\n"
+            writer.write((request + "\r\n").encode("latin-1"))
+            await writer.drain()
+            status, headers, body = await asyncio.wait_for(_read_response(reader), timeout)
+            if status == 401 and authorization is None and user:
+                challenges = headers.get("www-authenticate", [])
+                digest = next((c for c in challenges if c.lower().startswith("digest")), None)
+                if digest is not None:
+                    authorization = _digest_header(digest, user, password, "DESCRIBE", request_uri)
+                else:
+                    authorization = "Basic " + base64.b64encode(f"{user}:{password}".encode()).decode()
+                continue
+            break
+        if status != 200:
+            return {"ok": False, "status": status}
+        info = parse_sdp(body.decode("utf-8", "replace"))
+        info.update(ok=True, describe_ms=round((time.monotonic() - started) * 1000, 1))
+        return info
+    except (OSError, ValueError, asyncio.TimeoutError, asyncio.IncompleteReadError) as e:
+        return {"ok": False, "error": str(e) or type(e).__name__}
+    finally:
+        writer.close()
+
+
+async def port_open(host: str, port: int = 554, timeout: float = CONNECT_TIMEOUT) -> bool:
+    try:
+        _, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+    except (OSError, asyncio.TimeoutError):
+        return False
+    writer.close()
+    return True
+
+
+def _rtsp_url(ip: str, port: int, path: str, user: str, password: str) -> str:
+    auth = f"{quote(user, safe='')}:{quote(password, safe='')}@" if user else ""
+    return f"rtsp://{auth}{ip}:{port}{path}"
+
+
+async def probe_camera(ip: str, user: str, password: str, brand: str = "", port: int = 554) -> Dict:
+    """Find a camera's RTSP streams by DESCRIBE-ing its vendor paths
+
+    Streams come back widest first with a "main" / "sub" profile, and the
+    result carries main_url / sub_url for dual-stream ingest.
+    """
+    started = time.monotonic()
+    if not await port_open(ip, port):
+        return {"ip": ip, "ip_reachable": False, "streams": [], "candidates": []}
+
+    brands = [brand.lower()] if brand and brand.lower() in RTSP_PATHS else list(RTSP_PATHS)
+    limit = asyncio.Semaphore(PATHS_PER_HOST)
+    streams: List[Dict] = []
+    auth_failed = False
+
+    async def describe(path: str) -> Optional[Dict]:
+        async with limit:
+            result = await rtsp_describe(_rtsp_url(ip, port, path, user, password), user, password)
+        if not result.pop("ok"):
+            return {"auth_failed": True} if result.get("status") == 401 else None
+        result.update(path=path, url=_rtsp_url(ip, port, path, user, password))
+        return result
+
+    for name in brands:
+        results = await asyncio.gather(*(describe(path) for path in RTSP_PATHS[name]))
+        auth_failed = auth_failed or any(r is not None and r.get("auth_failed") for r in results)
+        found = [r for r in results if r is not None and not r.get("auth_failed")]
+        if found:
+            for result in found:
+                result["brand"] = name
+            streams = found
+            break
+        if auth_failed:
+            break  # Wrong credentials; other vendors' paths would only add failed logins
+
+    streams.sort(key=lambda s: (s.get("width") or 0) * (s.get("height") or 0), reverse=True)
+    for index, stream in enumerate(streams):
+        stream["profile"] = "main" if index == 0 else "sub"
+    main = streams[0]["url"] if streams else None
+    sub = streams[-1]["url"] if len(streams) > 1 else None
+    return {
+        "ip": ip,
+        "ip_reachable": True,
+        "auth_failed": auth_failed and not streams,
+        "brand": streams[0]["brand"] if streams else None,
+        "streams": streams,
+        "main_url": main,
+        "sub_url": sub,
+        # Legacy order: sub-stream first, then main
+        "candidates": ([sub] if sub else []) + ([main] if main else []),
+        "elapsed_ms": round((time.monotonic() - started) * 1000, 1),
+    }
+
+
+class _WsDiscoveryProtocol(asyncio.DatagramProtocol):
+    def __init__(self):
+        self.replies: List[Tuple[bytes, str]] = []
+
+    def datagram_received(self, data: bytes, addr):
+        self.replies.append((data, addr[0]))
+
+
+def _parse_probe_match(data: bytes, source_ip: str) -> Optional[Dict]:
+    try:
+        root = ET.fromstring(data)
+    except ET.ParseError:
+        return None
+    xaddrs, scopes = "", ""
+    for element in root.iter():
+        tag = element.tag.rsplit("}", 1)[-1]
+        if tag == "XAddrs" and element.text:
+            xaddrs = element.text
+        elif tag == "Scopes" and element.text:
+            scopes = element.text
+    if not xaddrs:
+        return None
+    info = {"ip": source_ip, "xaddrs": xaddrs.split()}
+    for scope in scopes.split():
+        for field in ("name", "hardware", "location"):
+            prefix = f"onvif://www.onvif.org/{field}/"
+            if scope.startswith(prefix):
+                info[field] = scope[len(prefix):].replace("%20", " ")
+    return info
+
+
+async def ws_discover(timeout: float = WS_DISCOVERY_TIMEOUT) -> List[Dict]:
+    """ONVIF devices answering a WS-Discovery probe on the local network"""
+    loop = asyncio.get_running_loop()
+    try:
+        transport, protocol = await loop.create_datagram_endpoint(_WsDiscoveryProtocol, local_addr=("0.0.0.0", 0))
+    except OSError as e:
+        print(f"WS-Discovery unavailable: {e}")
+        return []
+    try:
+        sock = transport.get_extra_info("socket")
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+        transport.sendto(_WS_PROBE.format(message_id=uuid.uuid4()).encode("utf-8"), WS_DISCOVERY_ADDR)
+        await asyncio.sleep(timeout)
+    except OSError as e:
+        print(f"WS-Discovery probe failed: {e}")
+    finally:
+        transport.close()
+    devices: Dict[str, Dict] = {}
+    for data, source_ip in protocol.replies:
+        match = _parse_probe_match(data, source_ip)
+        if match is not None:
+            devices.setdefault(source_ip, match)
+    return list(devices.values())
+
+
+class DiscoveryCache:
+    """Probe results kept for DISCOVERY_CACHE_TTL seconds, so re-opening the
+    discovery page or re-scanning a subnet doesn't hit every camera again"""
+
+    def __init__(self, ttl: float = DISCOVERY_CACHE_TTL):
+        self.ttl = ttl
+        self._entries: Dict[Tuple, Tuple[float, Dict]] = {}
+        self.hits = 0
+        self.misses = 0
+
+    def get(self, key: Tuple) -> Optional[Dict]:
+        entry = self._entries.get(key)
+        if entry is None or time.time() - entry[0] > self.ttl:
+            self._entries.pop(key, None)
+            self.misses += 1
+            return None
+        self.hits += 1
+        return entry[1]
+
+    def put(self, key: Tuple, value: Dict):
+        self._entries[key] = (time.time(), value)
+        if len(self._entries) > 4096:
+            now = time.time()
+            for stale in [k for k, (stored, _) in self._entries.items() if now - stored > self.ttl]:
+                del self._entries[stale]
+
+    def get_stats(self) -> Dict:
+        return {"ttl": self.ttl, "entries": len(self._entries), "hits": self.hits, "misses": self.misses}
+
+
+class DiscoveryEngine:
+    """Camera probing for the discovery endpoints, with a shared result cache"""
+
+    def __init__(self, concurrency: int = DISCOVERY_CONCURRENCY):
+        self.concurrency = concurrency
+        self.cache = DiscoveryCache()
+
+    async def probe(self, ip: str, user: str, password: str, brand: str = "", refresh: bool = False) -> Dict:
+        key = (ip, user, hashlib.sha1(password.encode()).hexdigest(), brand.lower())
+        cached = None if refresh else self.cache.get(key)
+        if cached is not None:
+            return dict(cached, cached=True)
+        result = await probe_camera(ip, user, password, brand)
+        # Unreachable hosts are not cached; a camera being plugged in should show up on the next try
+        if result["ip_reachable"]:
+            self.cache.put(key, result)
+        return dict(result, cached=False)
+
+    async def scan(self, subnet: str, user: str, password: str, brand: str = "", refresh: bool = False) -> Dict:
+        """Probe every host of a subnet with an open RTSP port, plus ONVIF devices inside it"""
+        network = ipaddress.ip_network(subnet, strict=False)
+        if network.num_addresses > MAX_SCAN_HOSTS:
+            raise ValueError(f"Subnet {subnet} has more than {MAX_SCAN_HOSTS} addresses")
+        started = time.monotonic()
+        limit = asyncio.Semaphore(self.concurrency)
+        hosts = [str(host) for host in (network.hosts() if network.num_addresses > 1 else [network.network_address])]
+
+        async def check(host: str) -> Optional[str]:
+            async with limit:
+                return host if await port_open(host) else None
+
+        onvif_task = asyncio.ensure_future(ws_discover())
+        open_hosts = {host for host in await asyncio.gather(*(check(host) for host in hosts)) if host}
+        onvif = {device["ip"]: device for device in await onvif_task
+                 if ipaddress.ip_address(device["ip"]) in network}
+
+        async def probe(host: str) -> Dict:
+            async with limit:
+                result = await self.probe(host, user, password, brand, refresh)
+            if host in onvif:
+                result["onvif"] = onvif[host]
+            return result
+
+        targets = sorted(open_hosts | set(onvif), key=ipaddress.ip_address)
+        cameras = await asyncio.gather(*(probe(host) for host in targets))
+        return {
+            "subnet": str(network),
+            "hosts_scanned": len(hosts),
+            "rtsp_hosts": len(open_hosts),
+            "onvif_devices": len(onvif),
+            "cameras": [camera for camera in cameras if camera["streams"] or camera.get("onvif")],
+            "elapsed_ms": round((time.monotonic() - started) * 1000, 1),
+        }
+
+    def get_stats(self) -> Dict:
+        return {"concurrency": self.concurrency, "cache": self.cache.get_stats()}
@@ -0,0 +1,137 @@
+"""
+Decoded Frame Pool
+Per-stream recycled frame buffers with reference-counted handles
+"""
+
+import os
+import threading
+from typing import Dict, List, Optional
+
+import numpy as np
+
+# Latest frame, the one being decoded, one in AI and one in plate reading
+FRAME_POOL_SLOTS = int(os.environ.get("CCTV_FRAME_POOL_SLOTS", 4))
+
+
+class FrameHandle:
+    """A decoded frame shared by the capture loop, the latest-frame slot and the AI stages
+
+    Holders call retain() before keeping the frame past the call that
+    handed it to them and release() when done; the slot goes back to its
+    pool when the last holder lets go. Frames that don't come from a pool
+    (GPU frames, pool misses) get handles too, so holders need not care.
+    """
+
+    __slots__ = ("frame", "_pool", "_generation", "_refs")
+
+    def __init__(self, frame, pool: Optional["FramePool"] = None, generation: int = 0):
+        self.frame = frame
+        self._pool = pool
+        self._generation = generation
+        self._refs = 1
+
+    def retain(self) -> "FrameHandle":
+        if self._pool is None:
+            self._refs += 1
+        else:
+            with self._pool._lock:
+                self._refs += 1
+        return self
+
+    def release(self):
+        pool = self._pool
+        if pool is None:
+            self._refs -= 1
+            return
+        with pool._lock:
+            self._refs -= 1
+            if self._refs == 0:
+                pool._recycle(self)
+
+    @property
+    def pooled(self) -> bool:
+        return self._pool is not None
+
+
+class FramePool:
+    """Recycled host buffers at one stream's decode geometry
+
+    The capture loop decodes straight into a free slot, so a steady stream
+    stops allocating a new frame per read. The first decodes at a new
+    geometry are adopted as slots until the pool holds `slots` buffers;
+    after a reconnect at another resolution the old slots drain away as
+    their holders release them. When every slot is held the decode falls
+    back to a fresh array for that frame.
+    """
+
+    def __init__(self, slots: int = FRAME_POOL_SLOTS):
+        self.slots = slots
+        self._lock = threading.Lock()
+        self._free: List[np.ndarray] = []
+        self._shape = None
+        self._generation = 0
+        self._allocated = 0
+        self.hits = 0
+        self.misses = 0
+
+    def _acquire(self) -> Optional[np.ndarray]:
+        with self._lock:
+            if self._free:
+                self.hits += 1
+                return self._free.pop()
+            if self._shape is not None and self._allocated >= self.slots:
+                self.misses += 1
+            return None
+
+    def _adopt(self, frame: np.ndarray) -> FrameHandle:
+        with self._lock:
+            if frame.shape != self._shape or frame.dtype != np.uint8:
+                self._shape = frame.shape if frame.dtype == np.uint8 else None
+                self._generation += 1
+                self._free = []
+                self._allocated = 0
+            if self._shape is None or self._allocated >= self.slots:
+                return FrameHandle(frame)
+            self._allocated += 1
+            return FrameHandle(frame, self, self._generation)
+
+    def _recycle(self, handle: FrameHandle):
+        # Called under the lock; buffers from an old geometry are dropped
+        if handle._generation == self._generation:
+            self._free.append(handle.frame)
+        handle._pool = None
+        handle.frame = None
+
+    def read(self, cap) -> Optional[FrameHandle]:
+        """Decode the next frame from a CaptureSource into a pooled buffer"""
+        buffer = self._acquire()
+        ret, frame = cap.read(buffer)
+        if not ret or frame is None:
+            if buffer is not None:
+                with self._lock:
+                    self._free.append(buffer)
+            return None
+        if not isinstance(frame, np.ndarray):
+            # GPU frames own their device surface
+            if buffer is not None:
+                with self._lock:
+                    self._free.append(buffer)
+            return FrameHandle(frame)
+        if buffer is not None:
+            with self._lock:
+                if frame is buffer:
+                    return FrameHandle(frame, self, self._generation)
+                # The decoder reallocated; keep the buffer unless the geometry changed
+                if frame.shape == self._shape:
+                    self._free.append(buffer)
+        return self._adopt(frame)
+
+    def get_stats(self) -> Dict:
+        with self._lock:
+            return {
+                "slots": self._allocated,
+                "free": len(self._free),
+                "shape": list(self._shape) if self._shape is not None else None,
+                "hits": self.hits,
+                "misses": self.misses,
+            }
@@ -0,0 +1,101 @@
+"""
+Shared Encoded Frame Ring
+Encode each frame once and fan it out to every consumer by sequence number
+"""
+
+import threading
+import time
+from typing import List, Optional
+
+
+class EncodedFrame:
+    """A single encoded frame published into a stream ring
+
+    The encoded bytes are immutable and shared by reference: the ring slot
+    holds one reference and every consumer that picked the frame up holds
+    another, so a buffer stays alive until the last reader drops it even if
+    the slot has already been overwritten by a newer frame. Nothing is copied
+    on the way out.
+    """
+
+    __slots__ = ("seq", "timestamp", "data", "width", "height")
+
+    def __init__(self, seq: int, timestamp: float, data: bytes, width: int, height: int):
+        self.seq = seq
+        self.timestamp = timestamp
+        self.data = data
+        self.width = width
+        self.height = height
+
+    def view(self) -> memoryview:
+        """Zero-copy view of the encoded bytes"""
+        return memoryview(self.data)
+
+    def __len__(self) -> int:
+        return len(self.data)
+
+
+class EncodedFrameRing:
+    """Fixed-size ring of encoded frames for one stream
+
+    The capture thread publishes each frame once; WebSocket, MJPEG and
+    snapshot consumers keep their own last-sent sequence number and read the
+    newest frame they have not sent yet.
+    """
+
+    def __init__(self, capacity: int = 4):
+        self.capacity = max(1, capacity)
+        self._slots: List[Optional[EncodedFrame]] = [None] * self.capacity
+        self._seq = 0
+        self._cond = threading.Condition()
+
+    @property
+    def seq(self) -> int:
+        """Sequence number of the newest published frame (0 before the first frame)"""
+        return self._seq
+
+    def publish(self, data: bytes, width: int = 0, height: int = 0,
+                timestamp: Optional[float] = None) -> EncodedFrame:
+        """Publish a newly encoded frame and wake any blocked readers"""
+        with self._cond:
+            seq = self._seq + 1
+            frame = EncodedFrame(seq, timestamp if timestamp is not None else time.time(),
+                                 data, width, height)
+            self._slots[seq % self.capacity] = frame
+            self._seq = seq
+            self._cond.notify_all()
+        return frame
+
+    def latest(self) -> Optional[EncodedFrame]:
+        """Get the newest frame in the ring"""
+        seq = self._seq
+        if seq == 0:
+            return None
+        return self._slots[seq % self.capacity]
+
+    def get(self, seq: int) -> Optional[EncodedFrame]:
+        """Get a specific frame if it is still held by the ring"""
+        frame = self._slots[seq % self.capacity]
+        if frame is not None and frame.seq == seq:
+            return frame
+        return None
+
+    def get_newer(self, last_seq: int) -> Optional[EncodedFrame]:
+        """Get the newest frame if it is newer than last_seq, without blocking"""
+        frame = self.latest()
+        if frame is not None and frame.seq > last_seq:
+            return frame
+        return None
+
+    def wait_newer(self, last_seq: int, timeout: Optional[float] = None) -> Optional[EncodedFrame]:
+        """Block until a frame newer than last_seq is published or timeout expires"""
+        with self._cond:
+            if self._seq <= last_seq:
+                self._cond.wait_for(lambda: self._seq > last_seq, timeout)
+            return self.get_newer(last_seq)
+
+    def clear(self):
+        """Drop every held frame and wake blocked readers"""
+        with self._cond:
+            self._slots = [None] * self.capacity
+            self._cond.notify_all()
@@ -0,0 +1,138 @@
+"""
+Image Kernels
+Allocation-free resize, letterbox and JPEG encode for the per-frame hot paths
+"""
+
+import os
+import threading
+from typing import Dict, Optional, Tuple
+
+import cv2
+import numpy as np
+
+# auto uses libjpeg-turbo through PyTurboJPEG when it is installed, else OpenCV's encoder
+JPEG_ENCODER = os.environ.get("CCTV_JPEG_ENCODER", "auto")
+LETTERBOX_FILL = 114
+
+_scratch = threading.local()
+
+
+def scratch(name: str, shape: Tuple[int, ...], dtype=np.uint8) -> np.ndarray:
+    """Per-thread reusable buffer, reallocated only when the shape changes
+
+    Capture and inference threads each get their own, so a buffer is never
+    written by two threads; callers must be done with it before asking
+    for the same name again.
+    """
+    buffers: Optional[Dict[str, np.ndarray]] = getattr(_scratch, "buffers", None)
+    if buffers is None:
+        buffers = _scratch.buffers = {}
+    buffer = buffers.get(name)
+    if buffer is None or buffer.shape != shape or buffer.dtype != dtype:
+        buffer = buffers[name] = np.empty(shape, dtype=dtype)
+    return buffer
+
+
+def resize_into(image: np.ndarray, width: int, height: int, name: str,
+                interpolation: int = cv2.INTER_AREA) -> np.ndarray:
+    """cv2.resize into a per-thread scratch buffer instead of a fresh array"""
+    out = scratch(name, (height, width) + image.shape[2:], image.dtype)
+    cv2.resize(image, (width, height), dst=out, interpolation=interpolation)
+    return out
+
+
+def resize_to_width(image: np.ndarray, max_width: Optional[int], name: str) -> np.ndarray:
+    """Downscale to a rendition width, keeping the aspect ratio
+
+    Each rung resizes into its own per-thread scratch buffer, so a rendition
+    cascade allocates nothing once the stream's geometry is steady.
+    """
+    if max_width is None or image.shape[1] <= max_width:
+        return image
+    height = max(1, int(image.shape[0] * max_width / image.shape[1]))
+    return resize_into(image, max_width, height, "rendition:" + name)
+
+
+class Letterbox:
+    """Letterbox BGR frames into CHW float32 RGB model input in place
+
+    The frame is resized straight into the padded canvas, and the border is
+    filled only when the frame geometry changes, so a steady camera costs
+    one resize and one fused swap/normalize/transpose pass per frame, both
+    written into preallocated memory. Not thread-safe: one instance per
+    inference thread.
+    """
+
+    def __init__(self, size: int):
+        self.size = size
+        self.canvas = np.full((size, size, 3), LETTERBOX_FILL, dtype=np.uint8)
+        self._geometry: Optional[Tuple[int, int, int, int]] = None
+
+    def geometry(self, height: int, width: int) -> Tuple[float, int, int, int, int]:
+        """(ratio, left, top, new_width, new_height) for a frame size"""
+        size = self.size
+        ratio = min(size / height, size / width)
+        new_width, new_height = int(round(width * ratio)), int(round(height * ratio))
+        left = int(round((size - new_width) / 2 - 0.1))
+        top = int(round((size - new_height) / 2 - 0.1))
+        return ratio, left, top, new_width, new_height
+
+    def into(self, frame: np.ndarray, out: np.ndarray) -> Tuple[float, int, int]:
+        """Letterbox a frame into a (3, size, size) float32 slot; returns (ratio, pad_x, pad_y)"""
+        ratio, left, top, new_width, new_height = self.geometry(*frame.shape[:2])
+        geometry = (left, top, new_width, new_height)
+        if geometry != self._geometry:
+            self.canvas.fill(LETTERBOX_FILL)
+            self._geometry = geometry
+
+        region = self.canvas[top:top + new_height, left:left + new_width]
+        cv2.resize(frame, (new_width, new_height), dst=region, interpolation=cv2.INTER_LINEAR)
+
+        # BGR HWC uint8 -> RGB CHW float32 in [0, 1], one pass
+        np.multiply(self.canvas[..., ::-1].transpose(2, 0, 1), 1.0 / 255.0, out=out, casting="unsafe")
+        return ratio, left, top
+
+
+class JpegEncoder:
+    """JPEG encoding that releases the GIL
+
+    Both encoders run the libjpeg-turbo SIMD code and drop the GIL while
+    compressing: OpenCV's bindings do so for imencode, and PyTurboJPEG
+    calls the library through ctypes. PyTurboJPEG additionally skips
+    OpenCV's intermediate vector and uses the fast integer DCT.
+    """
+
+    def __init__(self, backend: str = JPEG_ENCODER):
+        self.backend = "opencv"
+        self._turbo = None
+        if backend in ("auto", "turbojpeg"):
+            try:
+                from turbojpeg import TurboJPEG, TJFLAG_FASTDCT
+                self._turbo = TurboJPEG()
+                self._flags = TJFLAG_FASTDCT
+                self.backend = "turbojpeg"
+            except (ImportError, OSError, RuntimeError) as e:
+                if backend == "turbojpeg":
+                    print(f"PyTurboJPEG unavailable, using OpenCV JPEG encoder: {e}")
+
+    def encode(self, image: np.ndarray, quality: int) -> bytes:
+        if self._turbo is not None:
+            return self._turbo.encode(image, quality=quality, flags=self._flags)
+        ok, buffer = cv2.imencode(".jpg", image, [cv2.IMWRITE_JPEG_QUALITY, quality])
+        if not ok:
+            raise ValueError("JPEG encode failed")
+        return buffer.tobytes()
+
+
+jpeg_encoder = JpegEncoder()
+
+
+def simd_features() -> Dict:
+    """CPU features OpenCV dispatches its kernels on"""
+    return {
+        "optimized": cv2.useOptimized(),
+        "threads": cv2.getNumThreads(),
+        "avx2": cv2.checkHardwareSupport(cv2.CPU_AVX2),
+        "neon": cv2.checkHardwareSupport(cv2.CPU_NEON),
+        "jpeg_encoder": jpeg_encoder.backend,
+    }
@@ -0,0 +1,351 @@
+"""
+Inference Backends for AIProcessor
+Ultralytics/torch and native ONNX Runtime (CPU / CUDA / TensorRT) detectors
+"""
+
+import ast
+import os
+import time
+from typing import List, Optional, Tuple
+
+import cv2
+import numpy as np
+from loguru import logger
+
+from detections import Detections
+from image_kernels import Letterbox
+
+# COCO class names, used when a model carries no names metadata
+COCO_NAMES = [
+    "person", "bicycle", "car", "motorcycle", "airplane", "bus", "train", "truck", "boat",
+    "traffic light", "fire hydrant", "stop sign", "parking meter", "bench", "bird", "cat", "dog",
+    "horse", "sheep", "cow", "elephant", "bear", "zebra", "giraffe", "backpack", "umbrella",
+    "handbag", "tie", "suitcase", "frisbee", "skis", "snowboard", "sports ball", "kite",
+    "baseball bat", "baseball glove", "skateboard", "surfboard", "tennis racket", "bottle",
+    "wine glass", "cup", "fork", "knife", "spoon", "bowl", "banana", "apple", "sandwich", "orange",
+    "broccoli", "carrot", "hot dog", "pizza", "donut", "cake", "chair", "couch", "potted plant",
+    "bed", "dining table", "toilet", "tv", "laptop", "mouse", "remote", "keyboard", "cell phone",
+    "microwave", "oven", "toaster", "sink", "refrigerator", "book", "clock", "vase", "scissors",
+    "teddy bear", "hair drier", "toothbrush",
+]
+
+BACKEND_AUTO = "auto"
+BACKEND_ULTRALYTICS = "ultralytics"
+BACKEND_ONNXRUNTIME = "onnxruntime"
+BACKENDS = (BACKEND_AUTO, BACKEND_ULTRALYTICS, BACKEND_ONNXRUNTIME)
+
+
+def downscale_frame(frame: np.ndarray, max_size: int = 1280) -> np.ndarray:
+    """Resize if too large (maintain aspect ratio)"""
+    height, width = frame.shape[:2]
+    if max(height, width) > max_size:
+        scale = max_size / max(height, width)
+        new_width = int(width * scale)
+        new_height = int(height * scale)
+        frame = cv2.resize(frame, (new_width, new_height), interpolation=cv2.INTER_LINEAR)
+    return frame
+
+
+def resolve_backend(model_path: str, backend: str = BACKEND_AUTO) -> str:
+    """Pick a backend from the requested name and the model file type"""
+    if backend != BACKEND_AUTO:
+        return backend
+    if model_path.lower().endswith(".onnx"):
+        return BACKEND_ONNXRUNTIME
+    return BACKEND_ULTRALYTICS
+
+
+def detect_device(device: str = "auto") -> str:
+    """Determine the optimal device without importing torch unless it is installed"""
+    if device != "auto":
+        return device
+    try:
+        import torch
+        if torch.cuda.is_available():
+            return "cuda"
+        if hasattr(torch.backends, 'mps') and torch.backends.mps.is_available():
+            return "mps"
+        return "cpu"
+    except ImportError:
+        pass
+    try:
+        import onnxruntime as ort
+        if "CUDAExecutionProvider" in ort.get_available_providers():
+            return "cuda"
+    except ImportError:
+        pass
+    return "cpu"
+
+
+def _is_gpu_frame(frame) -> bool:
+    """Check for a GPU-resident frame (e.g. an NVDEC GpuFrame)"""
+    return hasattr(frame, "__cuda_array_interface__")
+
+
+def ort_providers(device: str) -> List[str]:
+    """ONNX Runtime execution providers for a device, best first"""
+    import onnxruntime as ort
+    available = ort.get_available_providers()
+    requested = os.environ.get("AI_ORT_PROVIDER", "")
+    if requested == "tensorrt" or device == "tensorrt":
+        wanted = ["TensorrtExecutionProvider", "CUDAExecutionProvider", "CPUExecutionProvider"]
+    elif device.startswith("cuda"):
+        wanted = ["CUDAExecutionProvider", "CPUExecutionProvider"]
+    else:
+        wanted = ["CPUExecutionProvider"]
+    return [provider for provider in wanted if provider in available] or ["CPUExecutionProvider"]
+
+
+def ort_session(model_path: str, device: str):
+    """Create an optimized ONNX Runtime session for a model"""
+    import onnxruntime as ort
+    options = ort.SessionOptions()
+    options.graph_optimization_level = ort.GraphOptimizationLevel.ORT_ENABLE_ALL
+    return ort.InferenceSession(model_path, sess_options=options, providers=ort_providers(device))
+
+
+class InferenceBackend:
+    """Common interface for detection backends
+
+    infer_batch takes host BGR frames (or GPU frames where supported) and
+    returns one Detections per frame with boxes in original frame
+    coordinates.
+    """
+
+    name = "base"
+
+    def __init__(self, model_path: str, device: str, input_size: int = 640):
+        self.model_path = model_path
+        self.device = device
+        self.input_size = input_size
+        self.names: List[str] = list(COCO_NAMES)
+
+    def load(self):
+        raise NotImplementedError
+
+    def infer_batch(self, frames: List, confidence_threshold: float) -> List[Detections]:
+        raise NotImplementedError
+
+
+class UltralyticsBackend(InferenceBackend):
+    """YOLO through ultralytics/torch, including the zero-copy GPU frame path"""
+
+    name = BACKEND_ULTRALYTICS
+
+    def load(self):
+        from ultralytics import YOLO
+        self.model = YOLO(self.model_path)
+        names = self.model.names
+        self.names = [names[i] for i in sorted(names)] if isinstance(names, dict) else list(names)
+
+    def _gpu_frame_to_tensor(self, frame, square: bool = False):
+        """Letterbox a GPU-resident BGR(A) frame into a BCHW tensor without leaving the device"""
+        import torch
+        import torch.nn.functional as F
+
+        # Zero-copy wrap of the decoder surface
+        surface = torch.as_tensor(frame, device=self.device)
+        height, width = surface.shape[:2]
+
+        # BGR(A) HWC uint8 -> RGB BCHW float in [0, 1]
+        tensor = surface[..., [2, 1, 0]].permute(2, 0, 1).unsqueeze(0).float().div_(255.0)
+
+        scale = self.input_size / max(height, width)
+        new_height, new_width = int(round(height * scale)), int(round(width * scale))
+        tensor = F.interpolate(tensor, size=(new_height, new_width), mode="bilinear", align_corners=False)
+
+        # Pad right/bottom to the model stride (or to a square for batching)
+        # so boxes only need rescaling
+        if square:
+            pad_h = self.input_size - new_height
+            pad_w = self.input_size - new_width
+        else:
+            pad_h = (32 - new_height % 32) % 32
+            pad_w = (32 - new_width % 32) % 32
+        if pad_h or pad_w:
+            tensor = F.pad(tensor, (0, pad_w, 0, pad_h), value=114.0 / 255.0)
+
+        return tensor.contiguous(), scale
+
+    def infer_batch(self, frames: List, confidence_threshold: float) -> List[Detections]:
+        # GPU-resident frames stay on the device only if the whole batch can
+        if self.device.startswith("cuda") and all(_is_gpu_frame(frame) for frame in frames):
+            import torch
+            # Decoded surfaces stay on the GPU all the way into the model;
+            # batches are letterboxed to a common square so they stack
+            prepared = [self._gpu_frame_to_tensor(frame, square=len(frames) > 1) for frame in frames]
+            model_input = torch.cat([tensor for tensor, _ in prepared])
+        else:
+            prepared = []
+            for frame in frames:
+                if _is_gpu_frame(frame):
+                    frame = frame.download()
+                processed_frame = downscale_frame(frame)
+                prepared.append((processed_frame, processed_frame.shape[1] / frame.shape[1]))
+            model_input = [processed for processed, _ in prepared]
+
+        # Run inference - one forward pass for the whole batch
+        results = self.model(model_input, conf=confidence_threshold, verbose=False)
+        timestamp = time.time()
+
+        # Pull every frame's [x1, y1, x2, y2, conf, cls] rows to the host in
+        # one transfer instead of three device syncs per box
+        import torch
+        datas = [result.boxes.data if result.boxes is not None else None for result in results]
+        counts = [len(data) if data is not None else 0 for data in datas]
+        if sum(counts):
+            rows = torch.cat([data for data in datas if data is not None]).cpu().numpy()
+        else:
+            rows = np.empty((0, 6), np.float32)
+
+        detections = []
+        offset = 0
+        for count, (_, scale) in zip(counts, prepared):
+            detections.append(Detections.from_rows(rows[offset:offset + count], self.names, scale, timestamp))
+            offset += count
+        return detections
+
+
+class OnnxRuntimeBackend(InferenceBackend):
+    """YOLOv8 ONNX graph through ONNX Runtime with native letterbox and NMS
+
+    Needs only onnxruntime and numpy at runtime, so edge boxes without a GPU
+    start in well under a second and skip the torch/ultralytics footprint.
+    """
+
+    name = BACKEND_ONNXRUNTIME
+
+    def __init__(self, model_path: str, device: str, input_size: int = 640,
+                 iou_threshold: float = 0.45, max_detections: int = 300):
+        super().__init__(model_path, device, input_size)
+        self.iou_threshold = iou_threshold
+        self.max_detections = max_detections
+        self.session = None
+        self.input_name = None
+        self.static_batch: Optional[int] = None
+        self._input_buffer: Optional[np.ndarray] = None
+        self._letterbox: Optional[Letterbox] = None
+
+    def load(self):
+        self.session = ort_session(self.model_path, self.device)
+
+        model_input = self.session.get_inputs()[0]
+        self.input_name = model_input.name
+        batch_dim, _, height, width = model_input.shape
+        self.static_batch = batch_dim if isinstance(batch_dim, int) else None
+        if isinstance(height, int) and isinstance(width, int):
+            self.input_size = height
+
+        # Ultralytics exports store class names in the model metadata
+        metadata = self.session.get_modelmeta().custom_metadata_map
+        if "names" in metadata:
+            try:
+                names = ast.literal_eval(metadata["names"])
+                self.names = [names[i] for i in sorted(names)] if isinstance(names, dict) else list(names)
+            except (ValueError, SyntaxError):
+                pass
+
+        logger.info(f"ONNX Runtime session ready with providers {self.session.get_providers()}")
+
+    def _letterbox_into(self, frame: np.ndarray, out: np.ndarray) -> Tuple[float, float, float]:
+        """Letterbox a BGR frame into a CHW float32 slot; returns (ratio, pad_x, pad_y)"""
+        if self._letterbox is None or self._letterbox.size != self.input_size:
+            self._letterbox = Letterbox(self.input_size)
+        return self._letterbox.into(frame, out)
+
+    def _batch_buffer(self, batch_size: int) -> np.ndarray:
+        size = self.input_size
+        if self._input_buffer is None or self._input_buffer.shape[0] < batch_size:
+            self._input_buffer = np.empty((batch_size, 3, size, size), dtype=np.float32)
+        return self._input_buffer[:batch_size]
+
+    @staticmethod
+    def _nms(boxes: np.ndarray, scores: np.ndarray, iou_threshold: float, max_detections: int) -> np.ndarray:
+        """Greedy NMS over xyxy boxes; returns kept indices sorted by score"""
+        order = scores.argsort()[::-1]
+        areas = (boxes[:, 2] - boxes[:, 0]) * (boxes[:, 3] - boxes[:, 1])
+        keep = []
+        while order.size > 0 and len(keep) < max_detections:
+            i = order[0]
+            keep.append(i)
+            if order.size == 1:
+                break
+            rest = order[1:]
+            xx1 = np.maximum(boxes[i, 0], boxes[rest, 0])
+            yy1 = np.maximum(boxes[i, 1], boxes[rest, 1])
+            xx2 = np.minimum(boxes[i, 2], boxes[rest, 2])
+            yy2 = np.minimum(boxes[i, 3], boxes[rest, 3])
+            inter = np.clip(xx2 - xx1, 0, None) * np.clip(yy2 - yy1, 0, None)
+            iou = inter / (areas[i] + areas[rest] - inter + 1e-7)
+            order = rest[iou <= iou_threshold]
+        return np.asarray(keep, dtype=np.int64)
+
+    def _postprocess(self, output: np.ndarray, confidence_threshold: float,
+                     ratio: float, pad_x: float, pad_y: float,
+                     frame_shape: Tuple[int, int]) -> Tuple[np.ndarray, np.ndarray, np.ndarray]:
+        """Decode one (4 + classes, anchors) YOLOv8 head into boxes/scores/classes"""
+        predictions = output.T  # (anchors, 4 + classes)
+        class_scores = predictions[:, 4:]
+        class_ids = class_scores.argmax(axis=1)
+        scores = class_scores[np.arange(len(class_ids)), class_ids]
+
+        mask = scores >= confidence_threshold
+        if not mask.any():
+            return np.empty((0, 4), np.float32), np.empty(0, np.float32), np.empty(0, np.int64)
+        predictions, scores, class_ids = predictions[mask], scores[mask], class_ids[mask]
+
+        # cx, cy, w, h -> x1, y1, x2, y2
+        boxes = np.empty((len(predictions), 4), dtype=np.float32)
+        half_w = predictions[:, 2] / 2
+        half_h = predictions[:, 3] / 2
+        boxes[:, 0] = predictions[:, 0] - half_w
+        boxes[:, 1] = predictions[:, 1] - half_h
+        boxes[:, 2] = predictions[:, 0] + half_w
+        boxes[:, 3] = predictions[:, 1] + half_h
+
+        # Class-aware NMS in one pass by offsetting each class into its own space
+        offsets = class_ids[:, None].astype(np.float32) * (self.input_size * 2)
+        keep = self._nms(boxes + offsets, scores, self.iou_threshold, self.max_detections)
+        boxes, scores, class_ids = boxes[keep], scores[keep], class_ids[keep]
+
+        # Undo letterbox back to original frame coordinates
+        boxes[:, [0, 2]] = (boxes[:, [0, 2]] - pad_x) / ratio
+        boxes[:, [1, 3]] = (boxes[:, [1, 3]] - pad_y) / ratio
+        height, width = frame_shape
+        np.clip(boxes[:, 0::2], 0, width, out=boxes[:, 0::2])
+        np.clip(boxes[:, 1::2], 0, height, out=boxes[:, 1::2])
+        return boxes, scores, class_ids
+
+    def infer_batch(self, frames: List, confidence_threshold: float) -> List[Detections]:
+        frames = [frame.download() if _is_gpu_frame(frame) else frame for frame in frames]
+
+        # Static-batch exports (the default yolov8n.onnx) run frame by frame;
+        # dynamic-batch exports take the whole batch in one run
+        chunk = self.static_batch or len(frames)
+        results: List[Detections] = []
+        for start in range(0, len(frames), chunk):
+            group = frames[start:start + chunk]
+            batch = self._batch_buffer(chunk)
+            letterbox = [self._letterbox_into(frame, batch[i]) for i, frame in enumerate(group)]
+            if len(group) < chunk:
+                batch[len(group):] = 0.0
+
+            outputs = self.session.run(None, {self.input_name: batch})[0]
+            timestamp = time.time()
+            for i, frame in enumerate(group):
+                ratio, pad_x, pad_y = letterbox[i]
+                boxes, scores, class_ids = self._postprocess(
+                    outputs[i], confidence_threshold, ratio, pad_x, pad_y, frame.shape[:2])
+                results.append(Detections(boxes, scores, class_ids, self.names, timestamp))
+        return results
+
+
+def create_backend(model_path: str, device: str, backend: str = BACKEND_AUTO,
+                   input_size: int = 640) -> InferenceBackend:
+    """Instantiate (but do not load) the backend for a model"""
+    backend = resolve_backend(model_path, backend)
+    if backend == BACKEND_ONNXRUNTIME:
+        return OnnxRuntimeBackend(model_path, device, input_size)
+    if backend == BACKEND_ULTRALYTICS:
+        return UltralyticsBackend(model_path, device, input_size)
+    raise ValueError(f"Unknown inference backend '{backend}', expected one of {list(BACKENDS)}")
@@ -0,0 +1,136 @@
+"""
+Batched Inference Scheduler
+Collects frames from every stream into dynamic batches for one forward pass
+"""
+
+import asyncio
+import os
+import queue
+import threading
+import time
+from collections import deque
+from concurrent.futures import Future
+from typing import Dict, List
+
+from loguru import logger
+
+from detections import Detections
+from metrics import metrics
+
+
+class InferenceRequest:
+    """One frame waiting for detection"""
+
+    __slots__ = ("stream_id", "frame", "confidence_threshold", "as_arrays", "future", "enqueued_at")
+
+    def __init__(self, stream_id: str, frame, confidence_threshold: float, as_arrays: bool = False):
+        self.stream_id = stream_id
+        self.frame = frame
+        self.confidence_threshold = confidence_threshold
+        self.as_arrays = as_arrays
+        self.future: Future = Future()
+        self.enqueued_at = time.time()
+
+
+class BatchInferenceScheduler:
+    """Dynamic batching in front of AIProcessor.detect_objects_batch
+
+    A single worker thread owns the model. It waits for the first request,
+    then keeps collecting until either max_batch_size frames are queued or
+    max_wait_ms has passed since that first request, runs one batched
+    forward pass and resolves each request's future with its own results.
+    """
+
+    def __init__(self, processor, max_batch_size: int = None, max_wait_ms: float = None):
+        self.processor = processor
+        self.max_batch_size = max_batch_size or int(os.environ.get("AI_MAX_BATCH", 8))
+        self.max_wait = (max_wait_ms if max_wait_ms is not None
+                         else float(os.environ.get("AI_MAX_WAIT_MS", 10))) / 1000.0
+        self._queue: "queue.Queue[InferenceRequest]" = queue.Queue()
+        self._thread = None
+        self._lock = threading.Lock()
+        self.running = True
+
+        # Stats
+        self.batches = 0
+        self.frames = 0
+        self.queue_wait_times = deque(maxlen=100)  # Seconds for the rolling average
+
+    def _ensure_started(self):
+        if self._thread is not None:
+            return
+        with self._lock:
+            if self._thread is None:
+                self._thread = threading.Thread(target=self._run, name="inference-batcher", daemon=True)
+                self._thread.start()
+
+    def submit(self, stream_id: str, frame, confidence_threshold: float = 0.5,
+               as_arrays: bool = False) -> Future:
+        """Queue a frame for detection; the future resolves to its detections
+
+        Results are a list of dicts, or a Detections struct-of-arrays when
+        as_arrays is set.
+        """
+        self._ensure_started()
+        request = InferenceRequest(stream_id, frame, confidence_threshold, as_arrays)
+        self._queue.put(request)
+        return request.future
+
+    async def submit_async(self, stream_id: str, frame, confidence_threshold: float = 0.5,
+                           as_arrays: bool = False):
+        """Queue a frame and await its detections"""
+        return await asyncio.wrap_future(self.submit(stream_id, frame, confidence_threshold, as_arrays))
+
+    def _collect_batch(self) -> List[InferenceRequest]:
+        first = self._queue.get()
+        batch = [first]
+        deadline = first.enqueued_at + self.max_wait
+        while len(batch) < self.max_batch_size:
+            remaining = deadline - time.time()
+            try:
+                if remaining <= 0:
+                    batch.append(self._queue.get_nowait())
+                else:
+                    batch.append(self._queue.get(timeout=remaining))
+            except queue.Empty:
+                break
+        return batch
+
+    def _run(self):
+        while self.running:
+            batch = self._collect_batch()
+            started = time.time()
+
+            # Run at the loosest threshold in the batch and filter per request
+            threshold = min(request.confidence_threshold for request in batch)
+            try:
+                results = self.processor.detect_objects_batch([r.frame for r in batch], threshold, as_arrays=True)
+            except Exception as e:
+                logger.error(f"Batched inference failed: {e}")
+                names = self.processor.model.names if self.processor.model is not None else []
+                results = [Detections.empty(names) for _ in batch]
+
+            elapsed = time.time() - started
+            for request, detections in zip(batch, results):
+                detections = detections.above(request.confidence_threshold)
+                metrics.observe(request.stream_id, "inference_queue", started - request.enqueued_at)
+                metrics.observe(request.stream_id, "inference", elapsed)
+                if not request.future.done():
+                    request.future.set_result(detections if request.as_arrays else detections.to_dicts())
+                self.queue_wait_times.append(started - request.enqueued_at)
+
+            self.batches += 1
+            self.frames += len(batch)
+
+    def get_stats(self) -> Dict:
+        """Get batching statistics"""
+        waits = self.queue_wait_times
+        return {
+            "max_batch_size": self.max_batch_size,
+            "max_wait_ms": self.max_wait * 1000.0,
+            "batches": self.batches,
+            "frames": self.frames,
+            "average_batch_size": self.frames / self.batches if self.batches else 0,
+            "average_queue_wait_ms": (sum(waits) / len(waits) * 1000.0) if waits else 0,
+            "queue_depth": self._queue.qsize(),
+        }
@@ -0,0 +1,493 @@
+"""
+License Plate Recognition
+Two-stage plate detection and OCR, batched across vehicles and cameras
+"""
+
+import collections
+import itertools
+import os
+import queue
+import threading
+import time
+from concurrent.futures import Future
+from typing import Dict, List, Optional, Sequence, Tuple
+
+import cv2
+import numpy as np
+from loguru import logger
+
+from detections import Detections
+from image_kernels import resize_into, scratch
+from inference_backends import BACKEND_AUTO, InferenceBackend, create_backend, ort_session
+
+# COCO class IDs for vehicles (car, motorcycle, bus, truck)
+VEHICLE_CLASSES = (2, 3, 5, 7)
+
+DEFAULT_CHARSET = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+
+
+def contour_plate_candidates(vehicle_roi: np.ndarray) -> Tuple[np.ndarray, np.ndarray]:
+    """Fallback plate search when no plate detector is configured
+
+    Canny + contours with a plate-shaped aspect ratio filter. Candidates are
+    scored by how close their aspect ratio is to a typical plate (~4:1) so the
+    best one can be picked per vehicle.
+    """
+    try:
+        gray = cv2.cvtColor(vehicle_roi, cv2.COLOR_BGR2GRAY)
+        edges = cv2.Canny(gray, 50, 150)
+        contours, _ = cv2.findContours(edges, cv2.RETR_EXTERNAL, cv2.CHAIN_APPROX_SIMPLE)
+    except Exception as e:
+        logger.error(f"Error finding license plate candidates: {e}")
+        return np.empty((0, 4), np.float32), np.empty(0, np.float32)
+
+    if not contours:
+        return np.empty((0, 4), np.float32), np.empty(0, np.float32)
+    rects = np.array([cv2.boundingRect(contour) for contour in contours], np.float32)
+    x, y, w, h = rects.T
+    aspect = w / np.maximum(h, 1.0)
+    mask = (aspect >= 2.0) & (aspect <= 6.0) & (w > 50) & (h > 10)
+    if not mask.any():
+        return np.empty((0, 4), np.float32), np.empty(0, np.float32)
+    boxes = np.stack([x, y, x + w, y + h], axis=1)[mask]
+    scores = np.clip(1.0 - np.abs(aspect[mask] - 4.0) / 4.0, 0.05, 1.0).astype(np.float32)
+    return boxes, scores
+
+
+class PlateOCR:
+    """CTC text recognizer (CRNN / LPRNet style ONNX model)
+
+    Takes any (N, C, H, W) input; the output is (N, T, classes) or
+    (T, N, classes) with the CTC blank at index 0 followed by the charset.
+    The charset comes from the model's "charset" metadata, LPR_OCR_CHARSET,
+    or defaults to digits and Latin capitals.
+    """
+
+    def __init__(self, model_path: str, device: str, charset: Optional[str] = None):
+        self.model_path = model_path
+        self.device = device
+        self.charset = charset or os.environ.get("LPR_OCR_CHARSET")
+        self.session = None
+        self.input_name = None
+        self.channels = 3
+        width, _, height = os.environ.get("LPR_OCR_INPUT", "128x32").partition("x")
+        self.width, self.height = int(width), int(height)
+        self._input_buffer: Optional[np.ndarray] = None
+
+    def load(self):
+        self.session = ort_session(self.model_path, self.device)
+        model_input = self.session.get_inputs()[0]
+        self.input_name = model_input.name
+        _, channels, height, width = model_input.shape
+        if isinstance(channels, int):
+            self.channels = channels
+        if isinstance(height, int):
+            self.height = height
+        if isinstance(width, int):
+            self.width = width
+
+        if self.charset is None:
+            metadata = self.session.get_modelmeta().custom_metadata_map
+            self.charset = metadata.get("charset") or metadata.get("characters") or DEFAULT_CHARSET
+        logger.info(f"Plate OCR ready: {self.model_path} ({self.width}x{self.height}x{self.channels})")
+
+    def _batch_buffer(self, batch_size: int) -> np.ndarray:
+        if self._input_buffer is None or self._input_buffer.shape[0] < batch_size:
+            self._input_buffer = np.empty((batch_size, self.channels, self.height, self.width), np.float32)
+        return self._input_buffer[:batch_size]
+
+    def recognize(self, crops: Sequence[np.ndarray]) -> List[Tuple[str, float]]:
+        """Read text from plate crops in one forward pass"""
+        if not crops:
+            return []
+        batch = self._batch_buffer(len(crops))
+        for i, crop in enumerate(crops):
+            resized = resize_into(crop, self.width, self.height, "ocr", cv2.INTER_LINEAR)
+            if self.channels == 1:
+                gray = scratch("ocr_gray", (self.height, self.width))
+                resized = cv2.cvtColor(resized, cv2.COLOR_BGR2GRAY, dst=gray)[np.newaxis]
+            else:
+                resized = resized.transpose(2, 0, 1)
+            # uint8 -> [-1, 1]
+            np.multiply(resized, 1.0 / 127.5, out=batch[i], casting="unsafe")
+        batch -= 1.0
+
+        output = self.session.run(None, {self.input_name: batch})[0]
+        if output.shape[0] != len(crops) and output.shape[1] == len(crops):
+            output = output.transpose(1, 0, 2)
+        return self._ctc_greedy(output)
+
+    def _ctc_greedy(self, output: np.ndarray) -> List[Tuple[str, float]]:
+        # Logits -> probabilities when the graph has no softmax
+        if output.min() < 0 or not np.allclose(output[:, :1].sum(axis=-1), 1.0, atol=1e-3):
+            output = np.exp(output - output.max(axis=-1, keepdims=True))
+            output /= output.sum(axis=-1, keepdims=True)
+
+        indices = output.argmax(axis=-1)  # (N, T)
+        probs = output.max(axis=-1)
+        # Collapse repeats and drop blanks for all sequences at once
+        keep = indices != 0
+        keep[:, 1:] &= indices[:, 1:] != indices[:, :-1]
+
+        charset = self.charset
+        reads = []
+        for row, row_keep, row_probs in zip(indices, keep, probs):
+            chars = row[row_keep]
+            if chars.size == 0:
+                reads.append(("", 0.0))
+                continue
+            text = "".join(charset[c - 1] for c in chars.tolist() if c - 1 < len(charset))
+            reads.append((text, float(row_probs[row_keep].mean())))
+        return reads
+
+
+class PlateReader:
+    """Plate detection over vehicle crops followed by OCR over plate crops
+
+    Vehicle ROIs are numpy views into the decoded frame, so cropping never
+    copies pixels; the only copies are the resizes into each model's batch
+    buffer. All crops handed to read_batch share one plate-detector pass and
+    one OCR pass, however many frames and cameras they came from.
+    """
+
+    def __init__(self, device: str, plate_model_path: Optional[str] = None,
+                 ocr_model_path: Optional[str] = None):
+        self.device = device
+        self.plate_model_path = plate_model_path or os.environ.get("LPR_PLATE_MODEL_PATH")
+        self.ocr_model_path = ocr_model_path or os.environ.get("LPR_OCR_MODEL_PATH")
+        self.plate_confidence = float(os.environ.get("LPR_PLATE_CONF", 0.4))
+        self.min_vehicle_size = 24
+        self.detector: Optional[InferenceBackend] = None
+        self.ocr: Optional[PlateOCR] = None
+
+        # Stats
+        self.batches = 0
+        self.vehicles = 0
+        self.plates = 0
+        self.reads = 0
+        self.batch_times = collections.deque(maxlen=100)  # Seconds for the rolling average
+
+    def load(self) -> bool:
+        """Load whichever LPR models are configured"""
+        ok = True
+        if self.plate_model_path and self.detector is None:
+            try:
+                detector = create_backend(self.plate_model_path, self.device, BACKEND_AUTO,
+                                          int(os.environ.get("LPR_PLATE_INPUT_SIZE", 320)))
+                detector.load()
+                self.detector = detector
+                logger.info(f"Plate detector loaded: {self.plate_model_path}")
+            except Exception as e:
+                logger.error(f"Failed to load plate detector: {e}")
+                ok = False
+        if self.ocr_model_path and self.ocr is None:
+            try:
+                ocr = PlateOCR(self.ocr_model_path, self.device)
+                ocr.load()
+                self.ocr = ocr
+            except Exception as e:
+                logger.error(f"Failed to load plate OCR: {e}")
+                ok = False
+        if self.ocr is None:
+            logger.warning("No plate OCR model configured (LPR_OCR_MODEL_PATH); plates will have no text")
+        return ok
+
+    @staticmethod
+    def _vehicle_boxes(frame: np.ndarray, vehicles) -> Tuple[Detections, np.ndarray]:
+        if not isinstance(vehicles, Detections):
+            vehicles = Detections.from_dicts(vehicles)
+        vehicles = vehicles.of_classes(VEHICLE_CLASSES)
+        height, width = frame.shape[:2]
+        boxes = vehicles.boxes.astype(np.int32)
+        np.clip(boxes[:, 0::2], 0, width, out=boxes[:, 0::2])
+        np.clip(boxes[:, 1::2], 0, height, out=boxes[:, 1::2])
+        return vehicles, boxes
+
+    def _detect_plates(self, crops: List[np.ndarray]) -> List[Tuple[np.ndarray, float]]:
+        """Best plate box (crop coordinates) and score per vehicle crop"""
+        if self.detector is not None:
+            results = self.detector.infer_batch(crops, self.plate_confidence)
+            best = []
+            for plates in results:
+                if len(plates) == 0:
+                    best.append(None)
+                    continue
+                i = int(plates.scores.argmax())
+                best.append((plates.boxes[i], float(plates.scores[i])))
+            return best
+
+        best = []
+        for crop in crops:
+            boxes, scores = contour_plate_candidates(crop)
+            if len(scores) == 0:
+                best.append(None)
+                continue
+            i = int(scores.argmax())
+            best.append((boxes[i], float(scores[i])))
+        return best
+
+    def read_batch(self, jobs: Sequence[Tuple[np.ndarray, object]]) -> List[List[Dict]]:
+        """Read plates for several (frame, vehicle detections) pairs at once"""
+        started = time.time()
+        results: List[List[Dict]] = [[] for _ in jobs]
+
+        # Stage 1: crop every vehicle of every frame (views, no copies)
+        frames = []
+        owners: List[Tuple[int, int]] = []
+        crops: List[np.ndarray] = []
+        vehicle_sets = []
+        for job_index, (frame, vehicles) in enumerate(jobs):
+            if hasattr(frame, "download"):
+                frame = frame.download()
+            frames.append(frame)
+            vehicles, boxes = self._vehicle_boxes(frame, vehicles)
+            vehicle_sets.append((vehicles, boxes, vehicles.class_names))
+            for vehicle_index, (x1, y1, x2, y2) in enumerate(boxes.tolist()):
+                if x2 - x1 < self.min_vehicle_size or y2 - y1 < self.min_vehicle_size:
+                    continue
+                crops.append(frame[y1:y2, x1:x2])
+                owners.append((job_index, vehicle_index))
+        if not crops:
+            return results
+
+        # Stage 2: one plate-detector pass over all vehicle crops
+        plates = self._detect_plates(crops)
+
+        # Stage 3: one OCR pass over all plate crops, cut from the full frame
+        found = []
+        plate_crops = []
+        for (job_index, vehicle_index), plate in zip(owners, plates):
+            if plate is None:
+                continue
+            box, score = plate
+            vx1, vy1 = vehicle_sets[job_index][1][vehicle_index, :2]
+            frame = frames[job_index]
+            x1, y1, x2, y2 = box.tolist()
+            # A little margin helps OCR with tight detector boxes
+            margin_x, margin_y = (x2 - x1) * 0.05, (y2 - y1) * 0.1
+            px1 = max(0, int(vx1 + x1 - margin_x))
+            py1 = max(0, int(vy1 + y1 - margin_y))
+            px2 = min(frame.shape[1], int(vx1 + x2 + margin_x))
+            py2 = min(frame.shape[0], int(vy1 + y2 + margin_y))
+            if px2 - px1 < 4 or py2 - py1 < 4:
+                continue
+            found.append((job_index, vehicle_index, [px1, py1, px2, py2], score))
+            plate_crops.append(frame[py1:py2, px1:px2])
+
+        texts = self.ocr.recognize(plate_crops) if self.ocr is not None else [(None, 0.0)] * len(found)
+
+        timestamp = time.time()
+        for (job_index, vehicle_index, bbox, score), (text, text_confidence) in zip(found, texts):
+            vehicles, boxes, class_names = vehicle_sets[job_index]
+            results[job_index].append({
+                "bbox": bbox,
+                "confidence": text_confidence if text else score,
+                "detection_confidence": score,
+                "ocr_confidence": text_confidence,
+                "plate_text": text or None,
+                "class_name": "license_plate",
+                "vehicle_bbox": boxes[vehicle_index].tolist(),
+                "vehicle_class": class_names[vehicle_index],
+                "vehicle_confidence": float(vehicles.scores[vehicle_index]),
+                "vehicle_index": vehicle_index,
+                "timestamp": timestamp
+            })
+
+        # Update performance metrics
+        self.batches += 1
+        self.vehicles += len(crops)
+        self.plates += len(found)
+        self.reads += sum(1 for text, _ in texts if text)
+        self.batch_times.append(time.time() - started)
+        return results
+
+    def get_stats(self) -> Dict:
+        """Get LPR statistics"""
+        return {
+            "plate_detector": self.plate_model_path if self.detector is not None else "contours",
+            "ocr_model": self.ocr_model_path if self.ocr is not None else None,
+            "batches": self.batches,
+            "vehicles": self.vehicles,
+            "plates": self.plates,
+            "reads": self.reads,
+            "average_batch_time": float(np.mean(self.batch_times)) if self.batch_times else 0,
+        }
+
+
+class PlateJob:
+    """One frame's vehicles waiting for plate reading"""
+
+    __slots__ = ("stream_id", "frame", "vehicles", "future", "enqueued_at")
+
+    def __init__(self, stream_id: str, frame, vehicles):
+        self.stream_id = stream_id
+        self.frame = frame
+        self.vehicles = vehicles
+        self.future: Future = Future()
+        self.enqueued_at = time.time()
+
+
+class LPRScheduler:
+    """Collects plate jobs from every camera into shared read_batch calls"""
+
+    def __init__(self, reader: PlateReader, max_batch_size: int = None, max_wait_ms: float = None):
+        self.reader = reader
+        self.max_batch_size = max_batch_size or int(os.environ.get("LPR_MAX_BATCH", 8))
+        self.max_wait = (max_wait_ms if max_wait_ms is not None
+                         else float(os.environ.get("LPR_MAX_WAIT_MS", 20))) / 1000.0
+        self._queue: "queue.Queue[PlateJob]" = queue.Queue()
+        self._thread = None
+        self._lock = threading.Lock()
+        self.running = True
+        self.batches = 0
+        self.jobs = 0
+
+    def _ensure_started(self):
+        if self._thread is not None:
+            return
+        with self._lock:
+            if self._thread is None:
+                self._thread = threading.Thread(target=self._run, name="lpr-batcher", daemon=True)
+                self._thread.start()
+
+    def submit(self, stream_id: str, frame, vehicles) -> Future:
+        """Queue a frame's vehicles; the future resolves to its plate reads"""
+        self._ensure_started()
+        job = PlateJob(stream_id, frame, vehicles)
+        self._queue.put(job)
+        return job.future
+
+    def _collect_batch(self) -> List[PlateJob]:
+        first = self._queue.get()
+        batch = [first]
+        deadline = first.enqueued_at + self.max_wait
+        while len(batch) < self.max_batch_size:
+            remaining = deadline - time.time()
+            try:
+                batch.append(self._queue.get(timeout=remaining) if remaining > 0 else self._queue.get_nowait())
+            except queue.Empty:
+                break
+        return batch
+
+    def _run(self):
+        while self.running:
+            batch = self._collect_batch()
+            try:
+                results = self.reader.read_batch([(job.frame, job.vehicles) for job in batch])
+            except Exception as e:
+                logger.error(f"Plate reading failed: {e}")
+                results = [[] for _ in batch]
+            for job, plates in zip(batch, results):
+                if not job.future.done():
+                    job.future.set_result(plates)
+            self.batches += 1
+            self.jobs += len(batch)
+
+    def get_stats(self) -> Dict:
+        """Get batching statistics"""
+        return {
+            "max_batch_size": self.max_batch_size,
+            "batches": self.batches,
+            "jobs": self.jobs,
+            "average_batch_size": self.jobs / self.batches if self.batches else 0,
+            "queue_depth": self._queue.qsize(),
+        }
+
+
+class PlateResultsFeed:
+    """In-memory feed of recent plate reads for the dashboard
+
+    Reads are keyed per tracked vehicle (camera, tracker generation, track
+    id), so a car seen over dozens of frames is one entry whose text is
+    upgraded in place when a better read arrives.
+    Every new or upgraded result is also appended to a change log under an
+    increasing sequence number, which push clients resume from; listeners
+    on event loops are woken when changes are published.
+    """
+
+    def __init__(self, capacity: int = 1000, change_capacity: int = 2000):
+        self.capacity = capacity
+        self._results: "collections.OrderedDict[Tuple, Dict]" = collections.OrderedDict()
+        self._ids = itertools.count(1)
+        self._lock = threading.Lock()
+        self.seq = 0
+        self._changes: "collections.deque[Tuple[int, Dict]]" = collections.deque(maxlen=change_capacity)
+        self._listeners: Dict[object, object] = {}  # asyncio.Event -> its loop
+
+    def add(self, camera_id: str, plates: List[Dict], publish: bool = True, generation: int = 0) -> List[Dict]:
+        """Record plate reads with text; returns the stored (new or upgraded) results
+
+        generation identifies the tracker that numbered track_id. With
+        publish=False the caller annotates the results first and then calls
+        publish() itself.
+        """
+        stored = []
+        with self._lock:
+            for plate in plates:
+                if not plate.get("plate_text"):
+                    continue
+                track_id = plate.get("track_id")
+                key = (camera_id, generation, track_id) if track_id is not None else (camera_id, None, next(self._ids))
+                existing = self._results.get(key)
+                if existing is not None:
+                    if plate.get("confidence", 0.0) <= existing.get("confidence", 0.0):
+                        continue
+                    existing.update(plate, camera_id=camera_id)
+                    stored.append(existing)
+                    continue
+                result = dict(plate, id=next(self._ids), camera_id=camera_id,
+                              first_seen=plate.get("timestamp", time.time()))
+                self._results[key] = result
+                stored.append(result)
+                while len(self._results) > self.capacity:
+                    self._results.popitem(last=False)
+        if publish:
+            self.publish(stored)
+        return stored
+
+    def forget(self, camera_id: str, generation: int):
+        """Stop upgrading a detached tracker's reads; they stay in the feed"""
+        with self._lock:
+            self._results = collections.OrderedDict(
+                ((key[0], None, result["id"]) if key[0] == camera_id and key[1] == generation else key, result)
+                for key, result in self._results.items())
+
+    def publish(self, results: List[Dict]):
+        """Append results to the change log and wake push listeners"""
+        if not results:
+            return
+        with self._lock:
+            for result in results:
+                self.seq += 1
+                self._changes.append((self.seq, dict(result)))
+            listeners = list(self._listeners.items())
+        for event, loop in listeners:
+            try:
+                loop.call_soon_threadsafe(event.set)
+            except RuntimeError:
+                pass  # Loop closed
+
+    def changes_since(self, seq: int) -> Tuple[List[Tuple[int, Dict]], bool]:
+        """Changes after seq and whether the log still reaches back that far"""
+        with self._lock:
+            if seq > self.seq:
+                return [], False  # Cursor from an earlier run
+            oldest = self._changes[0][0] if self._changes else self.seq + 1
+            complete = seq >= oldest - 1
+            # Sequence numbers are contiguous, so the start is an offset
+            start = max(0, seq - oldest + 1)
+            return list(itertools.islice(self._changes, start, None)), complete
+
+    def subscribe(self, event, loop):
+        """Set event on loop whenever changes are published"""
+        with self._lock:
+            self._listeners[event] = loop
+
+    def unsubscribe(self, event):
+        with self._lock:
+            self._listeners.pop(event, None)
+
+    def latest(self, limit: int = 50) -> List[Dict]:
+        """Most recent results first"""
+        with self._lock:
+            return list(itertools.islice(reversed(self._results.values()), max(0, limit)))
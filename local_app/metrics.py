@@ -0,0 +1,172 @@
+"""
+Metrics
+Per-stream stage histograms and scrape-time collectors in the Prometheus text format
+"""
+
+import bisect
+import math
+import os
+from typing import Callable, Dict, Iterable, List, Optional, Tuple
+
+METRICS_ENABLED = os.environ.get("CCTV_METRICS", "1") != "0"
+
+# Seconds; fine at the bottom for resize/encode, coarse at the top for OCR and glass latency
+LATENCY_BUCKETS = (0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0)
+
+# Stages a frame goes through, in order. demux is grab() on frames that are
+# dropped undecoded (OpenCV's FFmpeg backend decodes inside grab), decode is
+# a read into a pooled buffer. inference and ocr are queue wait plus the
+# batched call; capture_to_send is capture timestamp to WebSocket send and
+# glass is capture timestamp to paint, reported back by the client
+STAGES = ("demux", "decode", "resize", "encode", "inference_queue", "inference", "ocr", "send",
+          "capture_to_send", "glass")
+
+Sample = Tuple[Dict[str, str], float]
+
+
+class Histogram:
+    """Fixed-bucket latency histogram without a lock
+
+    Each stage of a stream is written by one thread at a time (its capture
+    step, the batcher, or its WebSocket sender), so observe() is a bisect
+    and a few integer adds. Scrapes read the counts without stopping
+    writers; a scrape racing an observe can be one sample behind in one
+    bucket, which Prometheus tolerates.
+    """
+
+    __slots__ = ("bounds", "counts", "sum", "count")
+
+    def __init__(self, bounds: Tuple[float, ...] = LATENCY_BUCKETS):
+        self.bounds = bounds
+        self.counts = [0] * (len(bounds) + 1)
+        self.sum = 0.0
+        self.count = 0
+
+    def observe(self, value: float):
+        self.counts[bisect.bisect_left(self.bounds, value)] += 1
+        self.sum += value
+        self.count += 1
+
+    def quantile(self, q: float) -> Optional[float]:
+        """Upper bound of the bucket holding quantile q (None when empty)"""
+        counts = list(self.counts)
+        total = sum(counts)
+        if not total:
+            return None
+        rank = q * total
+        running = 0
+        for index, count in enumerate(counts):
+            running += count
+            if running >= rank:
+                return self.bounds[index] if index < len(self.bounds) else math.inf
+        return math.inf
+
+    def summary(self) -> Dict:
+        """Count, mean and bucket-bound p50/p95 in milliseconds (None past the last bucket)"""
+        def ms(value: Optional[float]) -> Optional[float]:
+            return value * 1000 if value is not None and value != math.inf else None
+
+        return {
+            "count": self.count,
+            "mean_ms": round(self.sum / self.count * 1000, 2) if self.count else None,
+            "p50_ms": ms(self.quantile(0.5)),
+            "p95_ms": ms(self.quantile(0.95)),
+        }
+
+
+def _escape(value) -> str:
+    return str(value).replace("\\", "\\\\").replace('"', '\\"').replace("\n", "\\n")
+
+
+def _format_labels(labels: Dict[str, str]) -> str:
+    if not labels:
+        return ""
+    return "{" + ",".join(f'{name}="{_escape(value)}"' for name, value in labels.items()) + "}"
+
+
+def _format_value(value: float) -> str:
+    if value == math.inf:
+        return "+Inf"
+    if isinstance(value, bool):
+        return "1" if value else "0"
+    return repr(float(value)) if isinstance(value, float) else str(value)
+
+
+class MetricsRegistry:
+    """Stage histograms per stream, plus collectors called at scrape time
+
+    Counters and gauges that already live in the service (frame counts, AI
+    skips, connection attempts, queue depths) are not duplicated: each
+    collector returns (name, type, help, samples) read off the live objects
+    when /metrics is scraped.
+    """
+
+    def __init__(self, enabled: bool = METRICS_ENABLED):
+        self.enabled = enabled
+        self._stages: Dict[str, Dict[str, Histogram]] = {}
+        self._collectors: List[Callable[[], Iterable[Tuple[str, str, str, List[Sample]]]]] = []
+
+    def histogram(self, stream_id: str, stage: str) -> Histogram:
+        stages = self._stages.get(stream_id)
+        if stages is None:
+            stages = self._stages.setdefault(stream_id, {})
+        histogram = stages.get(stage)
+        if histogram is None:
+            histogram = stages.setdefault(stage, Histogram())
+        return histogram
+
+    def observe(self, stream_id: str, stage: str, seconds: float):
+        if self.enabled:
+            self.histogram(stream_id, stage).observe(seconds)
+
+    def remove(self, stream_id: str):
+        self._stages.pop(stream_id, None)
+
+    def register(self, collector: Callable[[], Iterable[Tuple[str, str, str, List[Sample]]]]):
+        self._collectors.append(collector)
+
+    def stage_summary(self, stream_id: str) -> Dict:
+        return {stage: histogram.summary() for stage, histogram in self._stages.get(stream_id, {}).items()}
+
+    def bottleneck(self, stream_id: str) -> Optional[str]:
+        """Stage with the highest mean time for a stream (end-to-end totals excluded)"""
+        stages = {stage: h.sum / h.count for stage, h in self._stages.get(stream_id, {}).items()
+                  if h.count and stage not in ("capture_to_send", "glass")}
+        return max(stages, key=stages.get) if stages else None
+
+    def render(self) -> str:
+        """Prometheus text exposition format (version 0.0.4)"""
+        lines: List[str] = [
+            "# HELP cctv_stage_seconds Time per frame spent in each processing stage",
+            "# TYPE cctv_stage_seconds histogram",
+        ]
+        for stream_id, stages in list(self._stages.items()):
+            for stage, histogram in list(stages.items()):
+                counts = list(histogram.counts)
+                running = 0
+                for bound, count in zip(histogram.bounds + (math.inf,), counts):
+                    running += count
+                    labels = _format_labels({"stream": stream_id, "stage": stage, "le": _format_value(bound)})
+                    lines.append(f"cctv_stage_seconds_bucket{labels} {running}")
+                labels = _format_labels({"stream": stream_id, "stage": stage})
+                lines.append(f"cctv_stage_seconds_sum{labels} {histogram.sum!r}")
+                lines.append(f"cctv_stage_seconds_count{labels} {running}")
+
+        for collector in self._collectors:
+            try:
+                families = list(collector())
+            except Exception as e:
+                print(f"Metrics collector failed: {e}")
+                continue
+            for name, kind, description, samples in families:
+                lines.append(f"# HELP {name} {description}")
+                lines.append(f"# TYPE {name} {kind}")
+                for labels, value in samples:
+                    if value is None:
+                        continue
+                    lines.append(f"{name}{_format_labels(labels)} {_format_value(value)}")
+        return "\n".join(lines) + "\n"
+
+
+# Global registry, shared by the capture path, the AI stages and the API
+metrics = MetricsRegistry()
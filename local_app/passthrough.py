@@ -0,0 +1,441 @@
+"""
+Compressed Passthrough Streaming
+Remuxes the camera's H.264/H.265 into fragmented MP4 without decoding
+"""
+
+import asyncio
+import collections
+import os
+import shutil
+import struct
+import subprocess
+import threading
+import time
+from typing import Deque, Dict, Iterator, List, Optional, Set, Tuple
+
+FFMPEG_BINARY = os.environ.get("CCTV_FFMPEG", "ffmpeg")
+
+# Fragment at every keyframe, and at least this often in between (microseconds)
+FRAGMENT_DURATION_US = int(os.environ.get("CCTV_PASSTHROUGH_FRAGMENT_US", 200000))
+
+
+def ffmpeg_available() -> bool:
+    """Check whether the ffmpeg binary used for remuxing is on PATH"""
+    return shutil.which(FFMPEG_BINARY) is not None
+
+
+def iter_boxes(data: bytes, start: int = 0,
+               end: Optional[int] = None) -> Iterator[Tuple[bytes, int, int, int]]:
+    """Yield (type, box_start, payload_start, box_end) for each MP4 box in data[start:end]"""
+    end = len(data) if end is None else end
+    offset = start
+    while offset + 8 <= end:
+        size, box_type = struct.unpack_from(">I4s", data, offset)
+        header = 8
+        if size == 1:
+            if offset + 16 > end:
+                return
+            size = struct.unpack_from(">Q", data, offset + 8)[0]
+            header = 16
+        elif size == 0:
+            size = end - offset
+        if size < header or offset + size > end:
+            return
+        yield box_type, offset, offset + header, offset + size
+        offset += size
+
+
+def fragment_starts_with_keyframe(moof: bytes) -> Optional[bool]:
+    """Read the first sample's sync flag from a moof box (None if unknown)"""
+    for box_type, _, start, end in iter_boxes(moof, 8):
+        if box_type != b"traf":
+            continue
+        default_flags = None
+        for child, _, cstart, _ in iter_boxes(moof, start, end):
+            version_flags = struct.unpack_from(">I", moof, cstart)[0]
+            flags = version_flags & 0xFFFFFF
+            if child == b"tfhd":
+                offset = cstart + 8  # version/flags + track_ID
+                offset += 8 if flags & 0x01 else 0   # base_data_offset
+                offset += 4 if flags & 0x02 else 0   # sample_description_index
+                offset += 4 if flags & 0x08 else 0   # default_sample_duration
+                offset += 4 if flags & 0x10 else 0   # default_sample_size
+                if flags & 0x20:
+                    default_flags = struct.unpack_from(">I", moof, offset)[0]
+            elif child == b"trun":
+                offset = cstart + 8  # version/flags + sample_count
+                offset += 4 if flags & 0x01 else 0   # data_offset
+                if flags & 0x04:
+                    sample_flags = struct.unpack_from(">I", moof, offset)[0]
+                elif flags & 0x400:
+                    offset += 4 if flags & 0x100 else 0  # sample_duration
+                    offset += 4 if flags & 0x200 else 0  # sample_size
+                    sample_flags = struct.unpack_from(">I", moof, offset)[0]
+                else:
+                    sample_flags = default_flags
+                if sample_flags is None:
+                    return None
+                # sample_is_non_sync_sample is bit 16
+                return not (sample_flags >> 16) & 1
+    return None
+
+
+def codec_string(init: bytes) -> Optional[str]:
+    """RFC 6381 codec string for the video track of an init segment"""
+    index = init.find(b"avcC")
+    if index >= 0 and index + 8 <= len(init):
+        profile, compat, level = init[index + 5], init[index + 6], init[index + 7]
+        return f"avc1.{profile:02x}{compat:02x}{level:02x}"
+
+    index = init.find(b"hvcC")
+    if index >= 0 and index + 17 <= len(init):
+        entry = "hev1" if init.find(b"hev1") >= 0 else "hvc1"
+        config = init[index + 4:index + 17]
+        space = ("", "A", "B", "C")[config[1] >> 6]
+        tier = "H" if config[1] & 0x20 else "L"
+        profile = config[1] & 0x1F
+        compat = int("{:032b}".format(struct.unpack_from(">I", config, 2)[0])[::-1], 2)
+        constraints = bytearray(config[6:12]).rstrip(b"\x00")
+        parts = [entry, f"{space}{profile}", f"{compat:x}", f"{tier}{config[12]}"]
+        parts.extend(f"{byte:02X}" for byte in constraints)
+        return ".".join(parts)
+    return None
+
+
+class PassthroughSubscriber:
+    """One viewer of a passthrough stream
+
+    Fragments are delivered in order (compressed video cannot skip frames
+    the way JPEG can). A viewer that falls more than max_pending fragments
+    behind is resynchronized at the next keyframe instead of stalling the
+    remuxer.
+    """
+
+    def __init__(self, stream: "PassthroughStream", loop: asyncio.AbstractEventLoop, max_pending: int = 90):
+        self.stream = stream
+        self.loop = loop
+        self.max_pending = max_pending
+        self.pending: Deque[bytes] = collections.deque()
+        self.needs_init = True
+        self.waiting_for_keyframe = True
+        self.restarted = False  # Set when the remuxer restarts; the viewer must reset its decoder
+        self.sent_fragments = 0
+        self.resyncs = 0
+        self._event = asyncio.Event()
+
+    def _push(self, fragment: bytes, keyframe: bool):
+        # Runs on the event loop thread
+        if self.needs_init:
+            if self.stream.init_segment is None:
+                return
+            self.pending.append(self.stream.init_segment)
+            self.needs_init = False
+        if self.waiting_for_keyframe:
+            if not keyframe:
+                return
+            self.waiting_for_keyframe = False
+        if len(self.pending) >= self.max_pending:
+            self.pending.clear()
+            self.resyncs += 1
+            if not keyframe:
+                self.waiting_for_keyframe = True
+                return
+        self.pending.append(fragment)
+        self._event.set()
+
+    async def next_fragment(self, timeout: Optional[float] = None) -> Optional[bytes]:
+        """Await the next init segment or media fragment"""
+        if not self.pending:
+            self._event.clear()
+            if self.stream.closed:
+                return None
+            try:
+                await asyncio.wait_for(self._event.wait(), timeout)
+            except asyncio.TimeoutError:
+                return None
+        if not self.pending:
+            return None
+        self.sent_fragments += 1
+        return self.pending.popleft()
+
+    def wake(self):
+        self._event.set()
+
+
+class PassthroughStream:
+    """ffmpeg -c:v copy remuxer for one camera, shared by all its viewers
+
+    The remuxer only runs while someone is watching (or a sink such as the
+    recorder is attached) and stops a little after the last one leaves. The
+    current GOP is kept so a new viewer starts immediately at the latest
+    keyframe rather than waiting for the next one. Sinks are called on the
+    remuxer thread with on_init(init) and on_fragment(fragment, keyframe).
+    """
+
+    def __init__(self, stream_id: str, rtsp_url: str, idle_timeout: float = 10.0):
+        self.stream_id = stream_id
+        self.rtsp_url = rtsp_url
+        self.idle_timeout = idle_timeout
+        self.init_segment: Optional[bytes] = None
+        self.codec: Optional[str] = None
+        self.gop: List[bytes] = []
+        self.subscribers: Set[PassthroughSubscriber] = set()
+        self.sinks: Set = set()
+        self.closed = False
+        self._lock = threading.Lock()
+        self._process: Optional[subprocess.Popen] = None
+        self._thread: Optional[threading.Thread] = None
+        self._idle_since: Optional[float] = None
+        self._init_ready = threading.Event()
+
+        # Stats
+        self.fragments = 0
+        self.bytes_out = 0
+        self.restarts = 0
+
+    @property
+    def mime_type(self) -> Optional[str]:
+        return f'video/mp4; codecs="{self.codec}"' if self.codec else None
+
+    def _command(self) -> List[str]:
+        return [
+            FFMPEG_BINARY, "-hide_banner", "-loglevel", "error",
+            "-fflags", "+genpts+nobuffer", "-rtsp_transport", "tcp",
+            "-i", self.rtsp_url,
+            "-map", "0:v:0", "-an", "-c:v", "copy",
+            "-f", "mp4", "-movflags", "empty_moov+default_base_moof+frag_keyframe",
+            "-frag_duration", str(FRAGMENT_DURATION_US),
+            "pipe:1",
+        ]
+
+    def start(self):
+        """Start the remuxer if it is not running"""
+        with self._lock:
+            self._idle_since = None
+            if self._thread is not None and self._thread.is_alive():
+                return
+            self.closed = False
+            self._thread = threading.Thread(target=self._run, name=f"passthrough-{self.stream_id}", daemon=True)
+            self._thread.start()
+
+    def stop(self):
+        """Stop the remuxer and release every viewer"""
+        with self._lock:
+            self.closed = True
+            process = self._process
+        if process is not None and process.poll() is None:
+            process.terminate()
+        self._notify(lambda: [subscriber.wake() for subscriber in list(self.subscribers)])
+
+    def wait_ready(self, timeout: float) -> bool:
+        """Block until the init segment (and codec) is known"""
+        return self._init_ready.wait(timeout)
+
+    def subscribe(self, loop: asyncio.AbstractEventLoop) -> PassthroughSubscriber:
+        """Add a viewer, primed with the current GOP when one is buffered"""
+        subscriber = PassthroughSubscriber(self, loop)
+        with self._lock:
+            if self.init_segment is not None and self.gop:
+                subscriber.pending.append(self.init_segment)
+                subscriber.pending.extend(self.gop)
+                subscriber.needs_init = False
+                subscriber.waiting_for_keyframe = False
+            self.subscribers.add(subscriber)
+        self.start()
+        return subscriber
+
+    def unsubscribe(self, subscriber: PassthroughSubscriber):
+        with self._lock:
+            self.subscribers.discard(subscriber)
+            if not self.subscribers and not self.sinks:
+                self._idle_since = time.time()
+
+    def add_sink(self, sink):
+        """Attach a thread-side consumer; it keeps the remuxer running"""
+        with self._lock:
+            self.sinks.add(sink)
+            init = self.init_segment
+        if init is not None:
+            sink.on_init(init)
+        self.start()
+
+    def remove_sink(self, sink):
+        with self._lock:
+            self.sinks.discard(sink)
+            if not self.subscribers and not self.sinks:
+                self._idle_since = time.time()
+
+    @property
+    def idle(self) -> bool:
+        return (not self.subscribers and not self.sinks and self._idle_since is not None
+                and time.time() - self._idle_since > self.idle_timeout)
+
+    @property
+    def active(self) -> bool:
+        return bool(self.subscribers) or bool(self.sinks)
+
+    def _notify(self, callback):
+        loops = {subscriber.loop for subscriber in list(self.subscribers)}
+        for loop in loops:
+            if loop.is_closed():
+                continue
+            try:
+                loop.call_soon_threadsafe(callback)
+            except RuntimeError:
+                pass  # Loop shut down under us
+
+    def _publish(self, fragment: bytes, keyframe: bool):
+        with self._lock:
+            if keyframe:
+                self.gop = [fragment]
+            elif self.gop:
+                self.gop.append(fragment)
+            subscribers = list(self.subscribers)
+            sinks = list(self.sinks)
+        self.fragments += 1
+        self.bytes_out += len(fragment) * len(subscribers)
+        for sink in sinks:
+            try:
+                sink.on_fragment(fragment, keyframe)
+            except Exception as e:
+                print(f"Passthrough sink error for {self.stream_id}: {e}")
+        for loop in {subscriber.loop for subscriber in subscribers}:
+            group = [subscriber for subscriber in subscribers if subscriber.loop is loop]
+            try:
+                loop.call_soon_threadsafe(lambda group=group: [s._push(fragment, keyframe) for s in group])
+            except RuntimeError:
+                pass
+
+    def _run(self):
+        backoff = 1.0
+        while not self.closed:
+            if self.idle:
+                print(f"Passthrough for {self.stream_id} idle, stopping remuxer")
+                break
+            try:
+                self._process = subprocess.Popen(self._command(), stdout=subprocess.PIPE,
+                                                 stderr=subprocess.DEVNULL, bufsize=0)
+            except OSError as e:
+                print(f"Failed to start ffmpeg for passthrough {self.stream_id}: {e}")
+                break
+
+            started = time.time()
+            self._read_fragments(self._process)
+            if self._process.poll() is None:
+                self._process.terminate()
+            self._process.wait()
+            if self.closed or self.idle:
+                break
+
+            # Remuxer died (camera dropped, network); retry with backoff
+            self.restarts += 1
+            backoff = 1.0 if time.time() - started > 30 else min(backoff * 2, 30.0)
+            print(f"Passthrough remuxer for {self.stream_id} exited, restarting in {backoff:.0f}s")
+            time.sleep(backoff)
+
+        with self._lock:
+            self._process = None
+
+    def _read_fragments(self, process: subprocess.Popen):
+        buffer = bytearray()
+        init_boxes: List[bytes] = []
+        moof: Optional[bytes] = None
+        fd = process.stdout.fileno()
+        first = True
+
+        while not self.closed:
+            if self.idle:
+                return
+            chunk = os.read(fd, 1 << 16)
+            if not chunk:
+                return
+            buffer += chunk
+
+            consumed = 0
+            for box_type, start, _, end in iter_boxes(buffer):
+                box = bytes(buffer[start:end])
+                consumed = end
+                if box_type in (b"ftyp", b"moov"):
+                    init_boxes.append(box)
+                    if box_type == b"moov":
+                        self._set_init(b"".join(init_boxes))
+                elif box_type == b"moof":
+                    moof = box
+                elif box_type == b"mdat" and moof is not None:
+                    keyframe = fragment_starts_with_keyframe(moof)
+                    self._publish(moof + box, bool(keyframe) or (first and keyframe is None))
+                    first = False
+                    moof = None
+            if consumed:
+                del buffer[:consumed]
+
+    def _set_init(self, init: bytes):
+        with self._lock:
+            restarted = self.init_segment is not None
+            self.init_segment = init
+            self.codec = codec_string(init)
+            self.gop = []
+            subscribers = list(self.subscribers)
+            sinks = list(self.sinks)
+        self._init_ready.set()
+        for sink in sinks:
+            try:
+                sink.on_init(init)
+            except Exception as e:
+                print(f"Passthrough sink error for {self.stream_id}: {e}")
+
+        # A restarted remuxer has a new timeline; viewers re-initialize at its first keyframe
+        if restarted:
+            def reset():
+                for subscriber in subscribers:
+                    subscriber.pending.clear()
+                    subscriber.needs_init = True
+                    subscriber.waiting_for_keyframe = True
+                    subscriber.restarted = True
+            self._notify(reset)
+
+    def get_stats(self) -> Dict:
+        """Get passthrough statistics"""
+        return {
+            "running": self._process is not None and self._process.poll() is None,
+            "codec": self.codec,
+            "viewers": len(self.subscribers),
+            "sinks": len(self.sinks),
+            "fragments": self.fragments,
+            "bytes_out": self.bytes_out,
+            "gop_fragments": len(self.gop),
+            "restarts": self.restarts,
+        }
+
+
+class PassthroughHub:
+    """Passthrough streams by stream id"""
+
+    def __init__(self):
+        self.streams: Dict[str, PassthroughStream] = {}
+        self._lock = threading.Lock()
+
+    def get(self, stream_id: str, rtsp_url: str) -> PassthroughStream:
+        """Get or create the passthrough stream for a camera"""
+        with self._lock:
+            stream = self.streams.get(stream_id)
+            if stream is None or stream.rtsp_url != rtsp_url:
+                if stream is not None:
+                    stream.stop()
+                stream = PassthroughStream(stream_id, rtsp_url)
+                self.streams[stream_id] = stream
+            return stream
+
+    def active(self, stream_id: str) -> bool:
+        stream = self.streams.get(stream_id)
+        return stream is not None and stream.active
+
+    def remove(self, stream_id: str):
+        with self._lock:
+            stream = self.streams.pop(stream_id, None)
+        if stream is not None:
+            stream.stop()
+
+    def get_stats(self, stream_id: str) -> Optional[Dict]:
+        stream = self.streams.get(stream_id)
+        return stream.get_stats() if stream is not None else None
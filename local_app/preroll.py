@@ -0,0 +1,349 @@
+"""
+Event Pre-roll
+Per-stream ring of compressed fragments in a fixed arena, snapshotted into clips when the AI fires
+"""
+
+import collections
+import os
+import threading
+import time
+from datetime import datetime
+from typing import Deque, Dict, List, Optional, Tuple
+
+from recorder import safe_name
+
+PREROLL_SECONDS = float(os.environ.get("CCTV_PREROLL_SECONDS", 10))
+PREROLL_BYTES = int(float(os.environ.get("CCTV_PREROLL_MB", 8)) * (1 << 20))
+POSTROLL_SECONDS = float(os.environ.get("CCTV_POSTROLL_SECONDS", 10))
+CLIP_MAX_SECONDS = float(os.environ.get("CCTV_EVENT_CLIP_MAX_SECONDS", 60))
+CLIPS_DIR = os.environ.get("CCTV_EVENT_CLIPS_DIR", "event_clips")
+CLIPS_KEEP = int(os.environ.get("CCTV_EVENT_CLIPS_KEEP", 500))
+EVENT_CLIPS_ENABLED = os.environ.get("CCTV_EVENT_CLIPS", "1").lower() not in ("0", "false", "no")
+
+
+class PrerollRing:
+    """Last seconds of fMP4 fragments, stored back to back in one preallocated arena
+
+    The arena never grows: a fragment that does not fit evicts the oldest
+    ones, so memory per camera is the arena size whatever the bitrate, and
+    a bitrate spike only shortens the window. Fragments older than the
+    window are evicted as well. Each record is (timestamp, offset, length,
+    keyframe); a fragment is stored contiguously, wrapping to the start of
+    the arena when it would run past the end.
+    """
+
+    def __init__(self, seconds: float = PREROLL_SECONDS, arena_bytes: int = PREROLL_BYTES):
+        self.seconds = seconds
+        self.arena = bytearray(arena_bytes)
+        self._view = memoryview(self.arena)
+        self.records: Deque[List] = collections.deque()
+        self.tail = 0  # Next write offset
+        self.used = 0
+        self.appended = 0  # Fragments ever appended, so clips can tell what they already hold
+        self.lock = threading.Lock()
+
+        # Stats
+        self.evicted_for_space = 0
+        self.dropped_oversize = 0
+
+    def _evict(self):
+        _, _, length, _ = self.records.popleft()
+        self.used -= length
+
+    def append(self, fragment: bytes, keyframe: bool, timestamp: float) -> int:
+        """Copy a fragment into the arena, evicting what it overwrites; returns its number"""
+        length = len(fragment)
+        with self.lock:
+            self.appended += 1
+            if length > len(self.arena):
+                # Larger than the whole window; what precedes it can't start a clip anyway
+                self.dropped_oversize += 1
+                self.clear_locked()
+                return self.appended
+            position = self.tail
+            if position + length > len(self.arena):
+                # Wrap: records between the tail and the end are the oldest
+                while self.records and self.records[0][1] >= position:
+                    self._evict()
+                    self.evicted_for_space += 1
+                position = 0
+            while self.records:
+                _, offset, size, _ = self.records[0]
+                if offset < position + length and offset + size > position:
+                    self._evict()
+                    self.evicted_for_space += 1
+                else:
+                    break
+            self._view[position:position + length] = fragment
+            self.records.append([timestamp, position, length, keyframe])
+            self.tail = position + length
+            self.used += length
+
+            cutoff = timestamp - self.seconds
+            while len(self.records) > 1 and self.records[0][0] < cutoff:
+                self._evict()
+            return self.appended
+
+    def clear_locked(self):
+        self.records.clear()
+        self.tail = 0
+        self.used = 0
+
+    def clear(self):
+        with self.lock:
+            self.clear_locked()
+
+    def window_locked(self, since: float) -> Tuple[Optional[float], List[memoryview]]:
+        """Start time and views of the fragments from the last keyframe at or before since
+
+        Call under the lock: the views alias the arena, so they must be
+        consumed before it is released.
+        """
+        start = None
+        for index, (timestamp, _, _, keyframe) in enumerate(self.records):
+            if keyframe and (start is None or timestamp <= since):
+                start = index
+            if timestamp > since and start is not None:
+                break
+        if start is None:
+            return None, []
+        records = list(self.records)[start:]
+        return records[0][0], [self._view[offset:offset + length] for _, offset, length, _ in records]
+
+    def duration(self) -> float:
+        with self.lock:
+            if not self.records:
+                return 0.0
+            return self.records[-1][0] - self.records[0][0]
+
+    def get_stats(self) -> Dict:
+        return {
+            "arena_bytes": len(self.arena),
+            "used_bytes": self.used,
+            "fragments": len(self.records),
+            "seconds": round(self.duration(), 2),
+            "window_seconds": self.seconds,
+            "evicted_for_space": self.evicted_for_space,
+            "dropped_oversize": self.dropped_oversize,
+        }
+
+
+class EventClip:
+    """One clip file: init segment, pre-roll, then live fragments until the post-roll ends"""
+
+    def __init__(self, clip_id: str, stream_id: str, path: str, trigger_time: float):
+        self.clip_id = clip_id
+        self.stream_id = stream_id
+        self.path = path
+        self.trigger_time = trigger_time
+        self.start: Optional[float] = None
+        self.end: Optional[float] = None
+        self.deadline = trigger_time + POSTROLL_SECONDS
+        self.events: List[Dict] = []
+        self.bytes = 0
+        self.file = None
+        self.last_fragment = 0  # Ring number of the newest fragment written
+
+    @property
+    def finished(self) -> bool:
+        return self.file is None
+
+    def to_dict(self) -> Dict:
+        return {
+            "clip_id": self.clip_id,
+            "stream_id": self.stream_id,
+            "trigger_time": self.trigger_time,
+            "start": self.start,
+            "end": self.end,
+            "preroll_seconds": round(self.trigger_time - self.start, 2) if self.start else 0.0,
+            "bytes": self.bytes,
+            "finished": self.finished,
+            "events": self.events,
+        }
+
+
+class StreamPreroll:
+    """Remuxer sink for one camera: keeps the pre-roll ring and extends the open clip"""
+
+    def __init__(self, stream_id: str, manager: "EventClipManager"):
+        self.stream_id = stream_id
+        self.manager = manager
+        self.ring = PrerollRing()
+        self.init: Optional[bytes] = None
+        self.clip: Optional[EventClip] = None
+        self.lock = threading.Lock()
+
+    def on_init(self, init: bytes):
+        # A new init is a new timeline; buffered fragments no longer fit it
+        with self.lock:
+            self.init = init
+            self.ring.clear()
+            self._finish_clip()
+
+    def on_fragment(self, fragment: bytes, keyframe: bool):
+        now = time.time()
+        number = self.ring.append(fragment, keyframe, now)
+        with self.lock:
+            clip = self.clip
+            if clip is None or number <= clip.last_fragment:
+                return  # No clip, or already written with the pre-roll
+            try:
+                clip.file.write(fragment)
+                clip.bytes += len(fragment)
+                clip.end = now
+            except OSError as e:
+                print(f"Event clip write failed for {self.stream_id}: {e}")
+                self._finish_clip()
+                return
+            if now >= clip.deadline:
+                self._finish_clip()
+
+    def trigger(self, kind: str, info: Dict) -> Optional[EventClip]:
+        """Start a clip at the pre-roll, or extend the one already open"""
+        now = time.time()
+        event = dict(info, kind=kind, time=now)
+        with self.lock:
+            if self.clip is not None:
+                # Overlapping events share a clip, up to the length cap
+                self.clip.deadline = min(max(self.clip.deadline, now + POSTROLL_SECONDS),
+                                         self.clip.start + CLIP_MAX_SECONDS)
+                self.clip.events.append(event)
+                return self.clip
+            if self.init is None:
+                return None
+
+            day = datetime.fromtimestamp(now).strftime("%Y-%m-%d")
+            name = f"{int(now * 1000)}_{safe_name(kind)}"
+            path = os.path.join(self.manager.root, safe_name(self.stream_id), day, name + ".mp4")
+            clip = EventClip(f"{safe_name(self.stream_id)}-{name}", self.stream_id, path, now)
+            clip.events.append(event)
+            try:
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+                # Unbuffered, so the pre-roll goes from the arena to the kernel without a copy
+                clip.file = open(path, "wb", buffering=0)
+                clip.file.write(self.init)
+                clip.bytes = len(self.init)
+                # The ring lock keeps the remuxer from overwriting these fragments meanwhile
+                with self.ring.lock:
+                    start, views = self.ring.window_locked(now - self.ring.seconds)
+                    for view in views:
+                        clip.file.write(view)
+                        clip.bytes += len(view)
+                    clip.last_fragment = self.ring.appended
+                clip.start = start if start is not None else now
+                clip.end = now
+            except OSError as e:
+                print(f"Cannot open event clip for {self.stream_id}: {e}")
+                if clip.file is not None:
+                    clip.file.close()
+                    clip.file = None
+                return None
+            self.clip = clip
+        self.manager.register(clip)
+        return clip
+
+    def _finish_clip(self):
+        clip = self.clip
+        if clip is None:
+            return
+        self.clip = None
+        try:
+            clip.file.close()
+        except OSError:
+            pass
+        clip.file = None
+
+    def close(self):
+        with self.lock:
+            self._finish_clip()
+        self.ring.clear()
+
+
+class EventClipManager:
+    """Pre-roll rings for AI-enabled cameras and the clips cut from them
+
+    Rings are fed by the passthrough remuxer, so clips hold the camera's
+    own packets with no decode or re-encode. A trigger writes the init
+    segment and the pre-roll (from the keyframe that starts it), then keeps
+    appending live fragments for POSTROLL_SECONDS.
+    """
+
+    def __init__(self, passthrough, root: str = CLIPS_DIR, keep: int = CLIPS_KEEP):
+        self.passthrough = passthrough
+        self.root = root
+        self.keep = keep
+        self.streams: Dict[str, StreamPreroll] = {}
+        self.clips: "collections.OrderedDict[str, EventClip]" = collections.OrderedDict()
+        self._lock = threading.Lock()
+        self.triggers = 0
+        self.missed_triggers = 0
+
+    def start(self, stream_id: str, rtsp_url: str):
+        """Keep a pre-roll ring for a camera"""
+        with self._lock:
+            if stream_id in self.streams:
+                return
+            preroll = StreamPreroll(stream_id, self)
+            self.streams[stream_id] = preroll
+        self.passthrough.get(stream_id, rtsp_url).add_sink(preroll)
+
+    def stop(self, stream_id: str):
+        with self._lock:
+            preroll = self.streams.pop(stream_id, None)
+        if preroll is None:
+            return
+        stream = self.passthrough.streams.get(stream_id)
+        if stream is not None:
+            stream.remove_sink(preroll)
+        preroll.close()  # Frees the arena
+
+    def is_active(self, stream_id: str) -> bool:
+        return stream_id in self.streams
+
+    def trigger(self, stream_id: str, kind: str, info: Dict = None) -> Optional[EventClip]:
+        """Cut (or extend) a clip for an event on a stream"""
+        preroll = self.streams.get(stream_id)
+        if preroll is None:
+            return None
+        clip = preroll.trigger(kind, info or {})
+        self.triggers += 1
+        if clip is None:
+            self.missed_triggers += 1
+        return clip
+
+    def register(self, clip: EventClip):
+        expired = []
+        with self._lock:
+            self.clips[clip.clip_id] = clip
+            while len(self.clips) > self.keep:
+                _, old = self.clips.popitem(last=False)
+                expired.append(old)
+        for old in expired:
+            if old.finished:
+                try:
+                    os.remove(old.path)
+                except OSError:
+                    pass
+
+    def get_clip(self, clip_id: str) -> Optional[EventClip]:
+        return self.clips.get(clip_id)
+
+    def list_clips(self, stream_id: Optional[str] = None, limit: int = 50) -> List[Dict]:
+        """Most recent clips first"""
+        with self._lock:
+            clips = list(reversed(self.clips.values()))
+        if stream_id is not None:
+            clips = [clip for clip in clips if clip.stream_id == stream_id]
+        return [clip.to_dict() for clip in clips[:max(0, limit)]]
+
+    def get_stats(self) -> Dict:
+        """Get pre-roll and clip statistics"""
+        return {
+            "root": os.path.abspath(self.root),
+            "preroll_seconds": PREROLL_SECONDS,
+            "postroll_seconds": POSTROLL_SECONDS,
+            "triggers": self.triggers,
+            "missed_triggers": self.missed_triggers,
+            "clips": len(self.clips),
+            "streams": {stream_id: preroll.ring.get_stats() for stream_id, preroll in list(self.streams.items())},
+        }
@@ -0,0 +1,532 @@
+"""
+Continuous Recording
+Fixed-duration fMP4 segments from the passthrough remuxer with memory-mapped seek indexes
+"""
+
+import bisect
+import collections
+import mmap
+import os
+import re
+import struct
+import threading
+import time
+from datetime import datetime
+from typing import Dict, Iterator, List, Optional, Tuple
+
+RECORDINGS_DIR = os.environ.get("CCTV_RECORDINGS_DIR", "recordings")
+SEGMENT_SECONDS = float(os.environ.get("CCTV_SEGMENT_SECONDS", 60))
+RECORDING_QUOTA_BYTES = int(float(os.environ.get("CCTV_RECORDING_QUOTA_GB", 100)) * (1 << 30))
+RETENTION_DAYS = float(os.environ.get("CCTV_RECORDING_RETENTION_DAYS", 0))  # 0 keeps until the quota
+RECORD_BY_DEFAULT = os.environ.get("CCTV_RECORD_BY_DEFAULT", "0").lower() not in ("0", "false", "no")
+
+# Index file: header, then one fixed-size entry per fragment in time order
+INDEX_MAGIC = b"CCTVIDX1"
+INDEX_HEADER = struct.Struct("<8sII")   # magic, init segment size, remuxer run id
+INDEX_ENTRY = struct.Struct("<dQII")    # timestamp (s), byte offset, fragment size, flags
+INDEX_TIMESTAMP = struct.Struct("<d")
+FLAG_KEYFRAME = 1
+
+EXPORT_CHUNK_BYTES = 1 << 20
+
+
+def safe_name(stream_id: str) -> str:
+    """Directory name for a stream id"""
+    return re.sub(r"[^A-Za-z0-9_.-]", "_", stream_id) or "_"
+
+
+class SegmentIndex:
+    """Read-only memory-mapped view of a segment index
+
+    Indexing the object yields entry timestamps, so bisect finds a time in
+    O(log n) without reading the entries it skips. The live segment's index
+    keeps growing; a view only sees the entries present when it was opened.
+
+    Views are reference counted: the opener holds the first reference,
+    acquire() adds one and close() drops one, so a cached view evicted or
+    deleted by retention stays mapped until its last reader is done.
+    """
+
+    def __init__(self, path: str):
+        self.path = path
+        self.init_size = 0
+        self.run = 0
+        self.count = 0
+        self._refs = 1
+        self._refs_lock = threading.Lock()
+        self._map: Optional[mmap.mmap] = None
+        with open(path, "rb") as f:
+            size = os.fstat(f.fileno()).st_size
+            if size >= INDEX_HEADER.size:
+                self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if self._map is not None:
+            magic, self.init_size, self.run = INDEX_HEADER.unpack_from(self._map, 0)
+            if magic != INDEX_MAGIC:
+                self._map.close()
+                self._map = None
+                raise ValueError(f"Not a segment index: {path}")
+            self.count = (size - INDEX_HEADER.size) // INDEX_ENTRY.size
+
+    def __len__(self) -> int:
+        return self.count
+
+    def __getitem__(self, i: int) -> float:
+        if not 0 <= i < self.count:
+            raise IndexError(i)
+        return INDEX_TIMESTAMP.unpack_from(self._map, INDEX_HEADER.size + i * INDEX_ENTRY.size)[0]
+
+    def entry(self, i: int) -> Tuple[float, int, int, int]:
+        """(timestamp, offset, size, flags) of entry i"""
+        return INDEX_ENTRY.unpack_from(self._map, INDEX_HEADER.size + i * INDEX_ENTRY.size)
+
+    def seek(self, timestamp: float) -> int:
+        """Entry of the last keyframe at or before a time (0 if the time precedes the segment)"""
+        i = bisect.bisect_right(self, timestamp) - 1
+        while i > 0 and not self.entry(i)[3] & FLAG_KEYFRAME:
+            i -= 1
+        return max(i, 0)
+
+    def end(self, timestamp: float) -> int:
+        """Entry one past the last fragment at or before a time"""
+        return bisect.bisect_right(self, timestamp)
+
+    def acquire(self) -> "SegmentIndex":
+        with self._refs_lock:
+            self._refs += 1
+        return self
+
+    def close(self):
+        with self._refs_lock:
+            self._refs -= 1
+            if self._refs > 0:
+                return
+            if self._map is not None:
+                self._map.close()
+                self._map = None
+
+
+class Segment:
+    """One recorded segment: <start_ms>.mp4 with its <start_ms>.idx"""
+
+    __slots__ = ("start", "path", "size", "end", "live")
+
+    def __init__(self, start: float, path: str, size: int = 0, end: Optional[float] = None):
+        self.start = start
+        self.path = path  # Without extension
+        self.size = size
+        self.end = end
+        self.live = False
+
+    @property
+    def media_path(self) -> str:
+        return self.path + ".mp4"
+
+    @property
+    def index_path(self) -> str:
+        return self.path + ".idx"
+
+    def to_dict(self) -> Dict:
+        return {"start": self.start, "end": self.end, "bytes": self.size, "live": self.live}
+
+
+class SegmentWriter:
+    """Appends fragments to the live segment and its index"""
+
+    def __init__(self, segment: Segment, init: bytes, run: int):
+        self.segment = segment
+        os.makedirs(os.path.dirname(segment.path), exist_ok=True)
+        self.media = open(segment.media_path, "wb")
+        self.index = open(segment.index_path, "wb")
+        self.media.write(init)
+        self.index.write(INDEX_HEADER.pack(INDEX_MAGIC, len(init), run))
+        self.offset = len(init)
+        segment.size = len(init)
+        segment.live = True
+
+    def append(self, fragment: bytes, keyframe: bool, timestamp: float):
+        # Media first, so an index entry never points past the written data
+        self.media.write(fragment)
+        self.media.flush()
+        self.index.write(INDEX_ENTRY.pack(timestamp, self.offset, len(fragment),
+                                          FLAG_KEYFRAME if keyframe else 0))
+        self.index.flush()
+        self.offset += len(fragment)
+        self.segment.size = self.offset + self.index.tell()
+        self.segment.end = timestamp
+
+    def close(self):
+        self.media.close()
+        self.index.close()
+        self.segment.live = False
+
+
+class StreamRecorder:
+    """Segment catalog for one camera, and the remuxer sink that extends it
+
+    Segments start on a keyframe and roll at the first keyframe after
+    SEGMENT_SECONDS, so each file plays on its own. Segment start times are
+    kept sorted, so finding the segment for a time is a bisect.
+    """
+
+    def __init__(self, stream_id: str, directory: str, manager: "RecordingManager"):
+        self.stream_id = stream_id
+        self.directory = directory
+        self.manager = manager
+        self.segments: List[Segment] = []
+        self.starts: List[float] = []
+        self.lock = threading.Lock()
+        self.init: Optional[bytes] = None
+        self.run = 0  # Remuxer run the current init belongs to
+        self.writer: Optional[SegmentWriter] = None
+        self.recording = False
+        self.fragments = 0
+        self.write_errors = 0
+        self._load()
+
+    def _load(self):
+        found = []
+        if os.path.isdir(self.directory):
+            for day in os.scandir(self.directory):
+                if not day.is_dir():
+                    continue
+                for entry in os.scandir(day.path):
+                    name, ext = os.path.splitext(entry.name)
+                    if ext != ".mp4" or not name.isdigit():
+                        continue
+                    path = os.path.join(day.path, name)
+                    size = entry.stat().st_size
+                    if os.path.exists(path + ".idx"):
+                        size += os.path.getsize(path + ".idx")
+                    found.append(Segment(int(name) / 1000.0, path, size))
+        found.sort(key=lambda segment: segment.start)
+        self.segments = found
+        self.starts = [segment.start for segment in found]
+
+    # Remuxer sink
+
+    def on_init(self, init: bytes):
+        # A new init means a new timeline; the next keyframe opens a new segment.
+        # ffmpeg writes the same init bytes on every run, so runs are told apart
+        # by an id kept in each segment's index (milliseconds, unique enough
+        # across service restarts)
+        with self.lock:
+            run = int(time.time() * 1000) & 0xFFFFFFFF
+            self.run = run + 1 if run == self.run else run
+            self.init = init
+            self._close_writer()
+
+    def on_fragment(self, fragment: bytes, keyframe: bool):
+        now = time.time()
+        rolled = False
+        with self.lock:
+            if not self.recording or self.init is None:
+                return
+            writer = self.writer
+            if writer is None or (keyframe and now - writer.segment.start >= SEGMENT_SECONDS):
+                if not keyframe:
+                    return  # Segments must start on a keyframe
+                self._close_writer()
+                writer = self._open_writer(now)
+                rolled = writer is not None
+            if writer is None:
+                return
+            try:
+                writer.append(fragment, keyframe, now)
+                self.fragments += 1
+            except OSError as e:
+                self.write_errors += 1
+                print(f"Recording write failed for {self.stream_id}: {e}")
+                self._close_writer()
+        if rolled:
+            self.manager.enforce_retention()
+
+    def _open_writer(self, now: float) -> Optional[SegmentWriter]:
+        day = datetime.fromtimestamp(now).strftime("%Y-%m-%d")
+        segment = Segment(now, os.path.join(self.directory, day, str(int(now * 1000))))
+        try:
+            self.writer = SegmentWriter(segment, self.init, self.run)
+        except OSError as e:
+            self.write_errors += 1
+            print(f"Cannot open recording segment for {self.stream_id}: {e}")
+            return None
+        self.segments.append(segment)
+        self.starts.append(segment.start)
+        return self.writer
+
+    def _close_writer(self):
+        if self.writer is not None:
+            self.writer.close()
+            self.writer = None
+
+    def stop(self):
+        with self.lock:
+            self.recording = False
+            self._close_writer()
+
+    # Queries
+
+    def find(self, start: float, end: float) -> List[Segment]:
+        """Segments overlapping [start, end], in time order"""
+        with self.lock:
+            i = max(bisect.bisect_right(self.starts, start) - 1, 0)
+            j = bisect.bisect_right(self.starts, end)
+            return self.segments[i:j]
+
+    def pop_oldest(self) -> Optional[Segment]:
+        """Remove the oldest finished segment from the catalog"""
+        with self.lock:
+            if not self.segments or self.segments[0].live:
+                return None
+            self.starts.pop(0)
+            return self.segments.pop(0)
+
+    def export(self, start: float, end: float) -> Iterator[bytes]:
+        """fMP4 bytes covering [start, end], starting at the keyframe before start
+
+        Consecutive segments from one remuxer run share a timeline and are
+        joined under a single init segment; after a remuxer restart the new
+        init segment is emitted before its fragments.
+        """
+        last_run = None
+        for segment in self.find(start, end):
+            index = self.manager.open_index(segment)
+            if index is None:
+                continue
+            try:
+                if len(index) == 0:
+                    continue
+                first = index.seek(start) if segment.start <= start else 0
+                stop = index.end(end)
+                if stop <= first:
+                    continue
+                begin = index.entry(first)[1]
+                last = index.entry(stop - 1)
+                finish = last[1] + last[2]
+                init_size = index.init_size
+                run = index.run
+            finally:
+                index.close()
+
+            try:
+                with open(segment.media_path, "rb") as media:
+                    if run != last_run:
+                        yield media.read(init_size)
+                        last_run = run
+                    media.seek(begin)
+                    remaining = finish - begin
+                    while remaining > 0:
+                        chunk = media.read(min(EXPORT_CHUNK_BYTES, remaining))
+                        if not chunk:
+                            break
+                        remaining -= len(chunk)
+                        yield chunk
+            except FileNotFoundError:
+                continue  # Removed by retention while exporting
+
+    def segment_end(self, segment: Segment) -> Optional[float]:
+        """End time of a segment, read from its index once"""
+        if segment.end is None and not segment.live:
+            index = self.manager.open_index(segment)
+            if index is not None:
+                try:
+                    if len(index):
+                        segment.end = index[len(index) - 1]
+                finally:
+                    index.close()
+        return segment.end
+
+    def get_stats(self) -> Dict:
+        """Get per-stream recording statistics"""
+        with self.lock:
+            first = self.segments[0].start if self.segments else None
+            live = self.writer.segment.to_dict() if self.writer is not None else None
+            return {
+                "recording": self.recording,
+                "segments": len(self.segments),
+                "bytes": sum(segment.size for segment in self.segments),
+                "oldest": first,
+                "live_segment": live,
+                "fragments_written": self.fragments,
+                "write_errors": self.write_errors,
+            }
+
+
+class RecordingManager:
+    """Recorders for all cameras, sharing one disk quota
+
+    Recording rides on the passthrough remuxer, so packets are written as
+    the camera sent them, without decoding or re-encoding. When the quota
+    (or the optional age limit) is exceeded the oldest segments of any
+    camera are deleted first.
+    """
+
+    def __init__(self, passthrough, root: str = RECORDINGS_DIR, quota_bytes: int = RECORDING_QUOTA_BYTES,
+                 retention_days: float = RETENTION_DAYS, index_cache_size: int = 64):
+        self.passthrough = passthrough
+        self.root = root
+        self.quota_bytes = quota_bytes
+        self.retention_days = retention_days
+        self.recorders: Dict[str, StreamRecorder] = {}
+        self._lock = threading.Lock()
+        self._retention_lock = threading.Lock()
+        self._loaded = False
+        self._indexes: "collections.OrderedDict[str, SegmentIndex]" = collections.OrderedDict()
+        self._index_lock = threading.Lock()
+        self._index_cache_size = index_cache_size
+        self.deleted_segments = 0
+
+    def _ensure_loaded(self):
+        # Catalogs of cameras recorded earlier count against the quota too
+        with self._lock:
+            if self._loaded:
+                return
+            self._loaded = True
+            if os.path.isdir(self.root):
+                for entry in os.scandir(self.root):
+                    if entry.is_dir() and entry.name not in self.recorders:
+                        self.recorders[entry.name] = StreamRecorder(entry.name, entry.path, self)
+
+    def recorder(self, stream_id: str) -> StreamRecorder:
+        self._ensure_loaded()
+        name = safe_name(stream_id)
+        with self._lock:
+            recorder = self.recorders.get(name)
+            if recorder is None:
+                recorder = StreamRecorder(stream_id, os.path.join(self.root, name), self)
+                self.recorders[name] = recorder
+            recorder.stream_id = stream_id
+            return recorder
+
+    def get(self, stream_id: str) -> Optional[StreamRecorder]:
+        self._ensure_loaded()
+        return self.recorders.get(safe_name(stream_id))
+
+    def start(self, stream_id: str, rtsp_url: str) -> bool:
+        """Start recording a camera through its passthrough remuxer"""
+        recorder = self.recorder(stream_id)
+        if recorder.recording:
+            return True
+        recorder.recording = True
+        self.passthrough.get(stream_id, rtsp_url).add_sink(recorder)
+        print(f"Recording {stream_id} to {recorder.directory}")
+        return True
+
+    def stop(self, stream_id: str):
+        """Stop recording a camera; its segments stay on disk"""
+        recorder = self.get(stream_id)
+        if recorder is None or not recorder.recording:
+            return
+        stream = self.passthrough.streams.get(stream_id)
+        if stream is not None:
+            stream.remove_sink(recorder)
+        recorder.stop()
+        print(f"Stopped recording {stream_id}")
+
+    def is_recording(self, stream_id: str) -> bool:
+        recorder = self.get(stream_id)
+        return recorder is not None and recorder.recording
+
+    def open_index(self, segment: Segment) -> Optional[SegmentIndex]:
+        """Memory-mapped index of a segment; the caller must close() it
+
+        Finished segments are cached and the caller gets its own reference,
+        so eviction or retention never unmaps an index mid-read. The live
+        segment's index is opened fresh, since it grows while it is written.
+        """
+        if segment.live:
+            try:
+                return SegmentIndex(segment.index_path)
+            except (OSError, ValueError):
+                return None
+        with self._index_lock:
+            index = self._indexes.get(segment.index_path)
+            if index is not None:
+                self._indexes.move_to_end(segment.index_path)
+                return index.acquire()
+            try:
+                index = SegmentIndex(segment.index_path)
+            except (OSError, ValueError):
+                return None
+            self._indexes[segment.index_path] = index
+            index.acquire()
+            while len(self._indexes) > self._index_cache_size:
+                self._indexes.popitem(last=False)[1].close()
+            return index
+
+    def _total_bytes(self) -> int:
+        return sum(segment.size for recorder in list(self.recorders.values()) for segment in recorder.segments)
+
+    def enforce_retention(self):
+        """Delete the oldest segments across cameras until quota and age limits hold"""
+        if not self._retention_lock.acquire(blocking=False):
+            return  # Another recorder thread is already cleaning up
+        try:
+            total = self._total_bytes()
+            cutoff = time.time() - self.retention_days * 86400 if self.retention_days > 0 else None
+            while True:
+                heads = [(recorder.segments[0].start, recorder) for recorder in list(self.recorders.values())
+                         if recorder.segments and not recorder.segments[0].live]
+                if not heads:
+                    return
+                start, recorder = min(heads, key=lambda head: head[0])
+                if total <= self.quota_bytes and (cutoff is None or start >= cutoff):
+                    return
+                segment = recorder.pop_oldest()
+                if segment is None:
+                    return
+                total -= segment.size
+                self._delete(segment)
+        finally:
+            self._retention_lock.release()
+
+    def _delete(self, segment: Segment):
+        with self._index_lock:
+            index = self._indexes.pop(segment.index_path, None)
+            if index is not None:
+                index.close()
+        for path in (segment.media_path, segment.index_path):
+            try:
+                os.remove(path)
+            except FileNotFoundError:
+                pass
+            except OSError as e:
+                print(f"Failed to delete recording {path}: {e}")
+        self.deleted_segments += 1
+        day = os.path.dirname(segment.path)
+        try:
+            if not os.listdir(day):
+                os.rmdir(day)
+        except OSError:
+            pass
+
+    def list_segments(self, stream_id: str, start: float, end: float) -> List[Dict]:
+        recorder = self.get(stream_id)
+        if recorder is None:
+            return []
+        segments = []
+        for segment in recorder.find(start, end):
+            info = segment.to_dict()
+            info["end"] = recorder.segment_end(segment)
+            if info["end"] is not None and info["end"] < start:
+                continue
+            segments.append(info)
+        return segments
+
+    def export(self, stream_id: str, start: float, end: float) -> Optional[Iterator[bytes]]:
+        recorder = self.get(stream_id)
+        if recorder is None or not recorder.find(start, end):
+            return None
+        return recorder.export(start, end)
+
+    def get_stats(self) -> Dict:
+        """Get recording statistics"""
+        self._ensure_loaded()
+        return {
+            "root": os.path.abspath(self.root),
+            "segment_seconds": SEGMENT_SECONDS,
+            "quota_bytes": self.quota_bytes,
+            "used_bytes": self._total_bytes(),
+            "retention_days": self.retention_days,
+            "deleted_segments": self.deleted_segments,
+            "streams": {recorder.stream_id: recorder.get_stats() for recorder in list(self.recorders.values())},
+        }
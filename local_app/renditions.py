@@ -0,0 +1,97 @@
+"""
+Rendition Ladder
+Per-viewer resolution / quality / frame-rate rungs for JPEG streaming
+"""
+
+import os
+import time
+from typing import Callable, Dict, Iterable, Optional
+
+from capture_source import to_host
+from image_kernels import jpeg_encoder, resize_to_width
+
+
+class Rendition:
+    """One rung of the ladder; max_width None keeps the native resolution"""
+
+    __slots__ = ("name", "max_width", "jpeg_quality", "max_fps")
+
+    def __init__(self, name: str, max_width: Optional[int], jpeg_quality: int, max_fps: float):
+        self.name = name
+        self.max_width = max_width
+        self.jpeg_quality = jpeg_quality
+        self.max_fps = max_fps
+
+    def to_dict(self) -> Dict:
+        return {
+            "name": self.name,
+            "max_width": self.max_width,
+            "jpeg_quality": self.jpeg_quality,
+            "max_fps": self.max_fps,
+        }
+
+
+RENDITION_THUMB = "thumb"
+RENDITION_SD = "sd"
+RENDITION_HD = "hd"
+RENDITION_NATIVE = "native"
+
+# hd matches the service's original single encode (1280 px, quality 40)
+RENDITIONS: Dict[str, Rendition] = {
+    RENDITION_THUMB: Rendition(RENDITION_THUMB, 320, 35, float(os.environ.get("CCTV_THUMB_FPS", 8))),
+    RENDITION_SD: Rendition(RENDITION_SD, 640, 45, 15),
+    RENDITION_HD: Rendition(RENDITION_HD, 1280, 40, 30),
+    RENDITION_NATIVE: Rendition(RENDITION_NATIVE, None, 75, 30),
+}
+
+DEFAULT_RENDITION = os.environ.get("CCTV_DEFAULT_RENDITION", RENDITION_HD)
+if DEFAULT_RENDITION not in RENDITIONS:
+    DEFAULT_RENDITION = RENDITION_HD
+
+
+def rendition_for_quality(quality: int) -> str:
+    """Map the client's legacy JPEG quality presets (30/50/70/90) onto the ladder"""
+    if quality <= 30:
+        return RENDITION_SD
+    if quality <= 70:
+        return RENDITION_HD
+    return RENDITION_NATIVE
+
+
+def resolve_rendition(name: Optional[str] = None, quality: Optional[int] = None) -> Optional[str]:
+    """Resolve a rendition name or legacy quality to a ladder rung (None if unknown)"""
+    if name:
+        return name if name in RENDITIONS else None
+    if quality is not None:
+        return rendition_for_quality(quality)
+    return DEFAULT_RENDITION
+
+
+def encode_renditions(frame, names: Iterable[str], encode_times: Dict[str, float], now: float,
+                      publish: Callable[[str, bytes, int, int], None],
+                      observe: Optional[Callable[[str, float], None]] = None):
+    """Encode a decoded frame for every watched rendition whose FPS budget allows it
+
+    Widest first so each smaller rung is resized from the previous one; GPU
+    frames are downscaled on the device to the widest rung. observe(stage,
+    seconds) gets the time spent in "resize" (including the device download)
+    and "encode" for each rendition.
+    """
+    due = [name for name in names if now - encode_times.get(name, 0.0) >= 0.9 / RENDITIONS[name].max_fps]
+    if not due:
+        return
+    due.sort(key=lambda name: RENDITIONS[name].max_width or 1 << 30, reverse=True)
+    started = time.perf_counter()
+    image = to_host(frame, RENDITIONS[due[0]].max_width)
+    for name in due:
+        rendition = RENDITIONS[name]
+        image = resize_to_width(image, rendition.max_width, name)
+        resized = time.perf_counter()
+        data = jpeg_encoder.encode(image, rendition.jpeg_quality)
+        encoded = time.perf_counter()
+        if observe is not None:
+            observe("resize", resized - started)
+            observe("encode", encoded - resized)
+        publish(name, data, image.shape[1], image.shape[0])
+        encode_times[name] = now
+        started = time.perf_counter()
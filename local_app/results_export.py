@@ -0,0 +1,159 @@
+"""
+Results Export
+Streams plate reads from the results store as CSV, Parquet or a zip with plate crops
+"""
+
+import csv
+import io
+import zipfile
+from datetime import datetime
+from typing import Callable, Dict, Iterable, Iterator, List, Optional
+
+EXPORT_FORMATS = ("csv", "parquet", "zip")
+EXPORT_MEDIA_TYPES = {"csv": "text/csv; charset=utf-8", "parquet": "application/vnd.apache.parquet",
+                      "zip": "application/zip"}
+
+COLUMNS = ("id", "time", "timestamp", "camera_id", "plate_text", "confidence", "ocr_confidence",
+           "x1", "y1", "x2", "y2", "vehicle_class", "track_id", "event_clip", "crop")
+
+
+def parquet_available() -> bool:
+    try:
+        import pyarrow  # noqa: F401
+        import pyarrow.parquet  # noqa: F401
+    except ImportError:
+        return False
+    return True
+
+
+def to_row(result: Dict) -> List:
+    """Flat export row for a stored result"""
+    bbox = result.get("bbox") or [None] * 4
+    timestamp = result.get("timestamp")
+    return [
+        result.get("id"),
+        datetime.fromtimestamp(timestamp).isoformat(timespec="milliseconds") if timestamp else None,
+        timestamp,
+        result.get("camera_id"),
+        result.get("plate_text"),
+        result.get("confidence"),
+        result.get("ocr_confidence"),
+        *(list(bbox[:4]) if len(bbox) >= 4 else [None] * 4),
+        result.get("vehicle_class"),
+        result.get("track_id"),
+        result.get("event_clip"),
+        result.get("crop"),
+    ]
+
+
+class ChunkSink(io.RawIOBase):
+    """Write-only, unseekable file that hands back what was written since the last drain
+
+    Lets zipfile and pyarrow write into a streamed response: after each
+    chunk of rows the generator yields drain() so memory stays bounded.
+    """
+
+    def __init__(self):
+        super().__init__()
+        self._parts: List[bytes] = []
+        self._position = 0
+
+    def writable(self) -> bool:
+        return True
+
+    def write(self, data) -> int:
+        data = bytes(data)
+        self._parts.append(data)
+        self._position += len(data)
+        return len(data)
+
+    def tell(self) -> int:
+        return self._position
+
+    def drain(self) -> bytes:
+        data = b"".join(self._parts)
+        self._parts = []
+        return data
+
+
+def _csv_lines(rows: Iterable[List], header: bool) -> str:
+    buffer = io.StringIO()
+    writer = csv.writer(buffer)
+    if header:
+        writer.writerow(COLUMNS)
+    writer.writerows(rows)
+    return buffer.getvalue()
+
+
+def export_csv(chunks: Iterable[List[Dict]]) -> Iterator[bytes]:
+    """CSV with a UTF-8 BOM so spreadsheet tools read Persian plate text correctly"""
+    yield "\ufeff".encode("utf-8")
+    header = True
+    for chunk in chunks:
+        yield _csv_lines((to_row(result) for result in chunk), header).encode("utf-8")
+        header = False
+    if header:
+        yield _csv_lines((), True).encode("utf-8")
+
+
+def export_parquet(chunks: Iterable[List[Dict]]) -> Iterator[bytes]:
+    """Parquet with one row group per store chunk (needs pyarrow)"""
+    import pyarrow as pa
+    import pyarrow.parquet as pq
+
+    schema = pa.schema([
+        ("id", pa.int64()), ("time", pa.string()), ("timestamp", pa.float64()), ("camera_id", pa.string()),
+        ("plate_text", pa.string()), ("confidence", pa.float64()), ("ocr_confidence", pa.float64()),
+        ("x1", pa.float64()), ("y1", pa.float64()), ("x2", pa.float64()), ("y2", pa.float64()),
+        ("vehicle_class", pa.string()), ("track_id", pa.int64()), ("event_clip", pa.string()),
+        ("crop", pa.string()),
+    ])
+    sink = ChunkSink()
+    writer = pq.ParquetWriter(sink, schema, compression="zstd")
+    try:
+        for chunk in chunks:
+            columns = list(zip(*(to_row(result) for result in chunk)))
+            writer.write_table(pa.Table.from_arrays(
+                [pa.array(column, type=field.type) for column, field in zip(columns, schema)], schema=schema))
+            yield sink.drain()
+    finally:
+        writer.close()
+    yield sink.drain()
+
+
+def export_zip(query: Callable[[], Iterable[List[Dict]]],
+               crop_path: Callable[[str], Optional[str]]) -> Iterator[bytes]:
+    """results.csv plus the plate crop of every row under crops/
+
+    Only one zip member can be open at a time, so the query runs twice:
+    once for the CSV, then again for the crops, instead of remembering
+    every crop path. The archive is written to an unseekable sink, so
+    zipfile streams each member with a data descriptor.
+    """
+    sink = ChunkSink()
+    archive = zipfile.ZipFile(sink, "w", compression=zipfile.ZIP_DEFLATED, allowZip64=True)
+    with archive.open("results.csv", "w", force_zip64=True) as member:
+        member.write("\ufeff".encode("utf-8"))
+        header = True
+        for chunk in query():
+            member.write(_csv_lines((to_row(result) for result in chunk), header).encode("utf-8"))
+            header = False
+            yield sink.drain()
+        if header:
+            member.write(_csv_lines((), True).encode("utf-8"))
+    yield sink.drain()
+
+    # JPEGs are already compressed; store them as they are
+    for chunk in query():
+        for result in chunk:
+            relative = result.get("crop")
+            path = crop_path(relative) if relative else None
+            if path is None:
+                continue
+            try:
+                archive.write(path, "crops/" + relative, compress_type=zipfile.ZIP_STORED)
+            except FileNotFoundError:
+                continue
+        yield sink.drain()
+    archive.close()
+    yield sink.drain()
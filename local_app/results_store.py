@@ -0,0 +1,342 @@
+"""
+Plate Results Store
+Persistent, indexed plate reads in SQLite with fuzzy plate lookup and cursor pagination
+"""
+
+import json
+import os
+import queue
+import sqlite3
+import threading
+import time
+from datetime import datetime
+from typing import Dict, Iterator, List, Optional, Tuple
+
+import cv2
+
+from image_kernels import jpeg_encoder
+
+RESULTS_DB = os.environ.get("CCTV_RESULTS_DB", "results.db")
+SEARCH_MAX_LIMIT = 500
+PLATE_CROPS_ENABLED = os.environ.get("CCTV_PLATE_CROPS", "1").lower() not in ("0", "false", "no")
+PLATE_CROPS_DIR = os.environ.get("CCTV_PLATE_CROPS_DIR", "plate_crops")
+
+# Characters OCR confuses on plates fold to one key character, so "B0O8"
+# and "80O8" share a key. Persian and Arabic-Indic digits fold to ASCII.
+CONFUSABLE = {"O": "0", "Q": "0", "D": "0", "I": "1", "L": "1", "|": "1",
+              "Z": "2", "S": "5", "G": "6", "T": "7", "B": "8"}
+for _digit in range(10):
+    CONFUSABLE[chr(0x06F0 + _digit)] = str(_digit)
+    CONFUSABLE[chr(0x0660 + _digit)] = str(_digit)
+
+KEY_MAX = "\U0010ffff"
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS plate_reads (
+    id INTEGER PRIMARY KEY,
+    result_key TEXT NOT NULL UNIQUE,
+    timestamp REAL NOT NULL,
+    first_seen REAL,
+    camera_id TEXT NOT NULL,
+    plate_text TEXT,
+    plate_key TEXT,
+    plate_rkey TEXT,
+    confidence REAL,
+    track_id INTEGER,
+    data TEXT NOT NULL
+);
+CREATE INDEX IF NOT EXISTS idx_reads_time ON plate_reads (timestamp, id);
+CREATE INDEX IF NOT EXISTS idx_reads_camera_time ON plate_reads (camera_id, timestamp, id);
+CREATE INDEX IF NOT EXISTS idx_reads_key ON plate_reads (plate_key, timestamp);
+CREATE INDEX IF NOT EXISTS idx_reads_rkey ON plate_reads (plate_rkey, timestamp);
+"""
+
+SEARCH_MODES = ("exact", "prefix", "suffix", "contains")
+
+
+def plate_key(text: Optional[str]) -> str:
+    """Normalized plate text: uppercase, separators dropped, confusable characters folded"""
+    if not text:
+        return ""
+    return "".join(CONFUSABLE.get(ch, ch) for ch in text.upper() if ch.isalnum())
+
+
+def encode_cursor(timestamp: float, row_id: int) -> str:
+    return f"{timestamp!r}:{row_id}"
+
+
+def decode_cursor(cursor: str) -> Tuple[float, int]:
+    timestamp, row_id = cursor.rsplit(":", 1)
+    return float(timestamp), int(row_id)
+
+
+class ResultsStore:
+    """Plate reads kept on disk and queryable by time, camera and plate text
+
+    Every stored read is one row; a better read of the same tracked vehicle
+    replaces its row, so history holds one entry per vehicle pass like the
+    live feed. Writes are queued and committed in batches by one writer
+    thread, so the LPR path never waits on disk. Queries use their own
+    per-thread connection (WAL lets them run alongside the writer) and page
+    newest first with a (timestamp, id) keyset cursor, so any page costs an
+    index seek regardless of its depth. Plate crops handed to add() are
+    JPEG-encoded on the writer thread and saved next to the database; the
+    result records their path relative to crops_dir.
+    """
+
+    def __init__(self, path: str = RESULTS_DB, batch_size: int = 256, flush_interval: float = 0.5,
+                 crops_dir: str = PLATE_CROPS_DIR, save_crops: bool = PLATE_CROPS_ENABLED):
+        self.path = path
+        self.crops_dir = crops_dir
+        self.save_crops = save_crops
+        self.batch_size = batch_size
+        self.flush_interval = flush_interval
+        # Feed ids restart with the process; the run prefix keeps keys unique
+        self.run_id = f"{int(time.time() * 1000):x}"
+        self._queue: "queue.Queue[Optional[Tuple[Dict, object]]]" = queue.Queue()
+        self._local = threading.local()
+        self._closed = False
+
+        directory = os.path.dirname(os.path.abspath(path))
+        os.makedirs(directory, exist_ok=True)
+        connection = self._connect()
+        connection.executescript(SCHEMA)
+        connection.commit()
+
+        # Stats
+        self.written = 0
+        self.write_errors = 0
+        self.queries = 0
+        self.query_time = 0.0
+
+        self._writer = threading.Thread(target=self._write_loop, name="results-store", daemon=True)
+        self._writer.start()
+
+    def _connect(self) -> sqlite3.Connection:
+        connection = sqlite3.connect(self.path, timeout=10.0, check_same_thread=False)
+        connection.row_factory = sqlite3.Row
+        connection.execute("PRAGMA journal_mode=WAL")
+        connection.execute("PRAGMA synchronous=NORMAL")
+        return connection
+
+    def _reader(self) -> sqlite3.Connection:
+        connection = getattr(self._local, "connection", None)
+        if connection is None:
+            connection = self._connect()
+            self._local.connection = connection
+        return connection
+
+    def add(self, results: List[Dict], crops: Optional[Dict[int, object]] = None):
+        """Queue stored feed results for persistence, with plate crops by result id"""
+        if self._closed:
+            return
+        for result in results:
+            crop = crops.get(result.get("id")) if crops else None
+            self._queue.put((dict(result), crop))
+
+    def _save_crop(self, result: Dict, crop):
+        day = datetime.fromtimestamp(float(result.get("timestamp") or time.time())).strftime("%Y-%m-%d")
+        relative = os.path.join(day, f"{self.run_id}_{result.get('id')}.jpg")
+        try:
+            encoded = jpeg_encoder.encode(crop, 90)
+        except ValueError:
+            return
+        path = os.path.join(self.crops_dir, relative)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        # An upgraded read replaces the crop of its earlier read
+        with open(path, "wb") as f:
+            f.write(encoded)
+        result["crop"] = relative.replace(os.sep, "/")
+
+    def crop_path(self, relative: str) -> Optional[str]:
+        """Absolute path of a stored crop, or None if it escapes crops_dir"""
+        root = os.path.abspath(self.crops_dir)
+        path = os.path.abspath(os.path.join(root, relative))
+        return path if path.startswith(root + os.sep) else None
+
+    def _row(self, result: Dict) -> Tuple:
+        key = plate_key(result.get("plate_text"))
+        track_id = result.get("track_id")
+        return (
+            f"{self.run_id}:{result.get('id')}",
+            float(result.get("timestamp") or time.time()),
+            result.get("first_seen"),
+            result.get("camera_id") or "",
+            result.get("plate_text"),
+            key,
+            key[::-1],
+            result.get("confidence"),
+            int(track_id) if track_id is not None else None,
+            json.dumps(result, default=str),
+        )
+
+    def _write_loop(self):
+        connection = self._connect()
+        while True:
+            try:
+                item = self._queue.get(timeout=self.flush_interval)
+            except queue.Empty:
+                continue
+            if item is None:
+                break
+            batch = [item]
+            stop = False
+            while len(batch) < self.batch_size:
+                try:
+                    item = self._queue.get_nowait()
+                except queue.Empty:
+                    break
+                if item is None:
+                    stop = True
+                    break
+                batch.append(item)
+            for result, crop in batch:
+                if crop is not None:
+                    try:
+                        self._save_crop(result, crop)
+                    except (OSError, cv2.error) as e:
+                        print(f"Plate crop save failed: {e}")
+            try:
+                with connection:
+                    connection.executemany(
+                        "INSERT INTO plate_reads (result_key, timestamp, first_seen, camera_id, plate_text,"
+                        " plate_key, plate_rkey, confidence, track_id, data)"
+                        " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"
+                        " ON CONFLICT(result_key) DO UPDATE SET timestamp = excluded.timestamp,"
+                        " plate_text = excluded.plate_text, plate_key = excluded.plate_key,"
+                        " plate_rkey = excluded.plate_rkey, confidence = excluded.confidence,"
+                        " data = excluded.data",
+                        [self._row(result) for result, _ in batch])
+                self.written += len(batch)
+            except sqlite3.Error as e:
+                self.write_errors += len(batch)
+                print(f"Results store write failed: {e}")
+            if stop:
+                break
+        connection.close()
+
+    def search(self, plate: Optional[str] = None, mode: str = "prefix", camera_id: Optional[str] = None,
+               start: Optional[float] = None, end: Optional[float] = None,
+               min_confidence: Optional[float] = None, limit: int = 50,
+               cursor: Optional[str] = None) -> Dict:
+        """Reads matching the filters, newest first, with the cursor for the next page
+
+        Plate text is matched on its normalized key, so "12B345" finds a
+        read stored as "12 8345". exact, prefix and suffix matches are index
+        range scans; contains has to scan the keys and is the slow path.
+        """
+        limit = max(1, min(int(limit), SEARCH_MAX_LIMIT))
+        clauses, params = self._filters(plate, mode, camera_id, start, end, min_confidence)
+        if cursor:
+            cursor_time, cursor_id = decode_cursor(cursor)
+            clauses.append("(timestamp < ? OR (timestamp = ? AND id < ?))")
+            params.extend((cursor_time, cursor_time, cursor_id))
+
+        sql = "SELECT id, timestamp, data FROM plate_reads"
+        if clauses:
+            sql += " WHERE " + " AND ".join(clauses)
+        sql += " ORDER BY timestamp DESC, id DESC LIMIT ?"
+        params.append(limit + 1)
+
+        began = time.perf_counter()
+        rows = self._reader().execute(sql, params).fetchall()
+        self.queries += 1
+        self.query_time += time.perf_counter() - began
+
+        more = len(rows) > limit
+        rows = rows[:limit]
+        results = [json.loads(row["data"]) for row in rows]
+        next_cursor = encode_cursor(rows[-1]["timestamp"], rows[-1]["id"]) if more else None
+        return {"results": results, "next_cursor": next_cursor}
+
+    def iter_results(self, plate: Optional[str] = None, mode: str = "prefix", camera_id: Optional[str] = None,
+                     start: Optional[float] = None, end: Optional[float] = None,
+                     min_confidence: Optional[float] = None, chunk_size: int = 1000) -> Iterator[List[Dict]]:
+        """Every matching read, oldest first, in chunks of chunk_size
+
+        Each chunk is its own short keyset query, so an export of millions of
+        rows holds one chunk in memory and never pins a long read
+        transaction against the writer.
+        """
+        clauses, params = self._filters(plate, mode, camera_id, start, end, min_confidence)
+        after: Optional[Tuple[float, int]] = None
+        while True:
+            chunk_clauses, chunk_params = list(clauses), list(params)
+            if after is not None:
+                chunk_clauses.append("(timestamp > ? OR (timestamp = ? AND id > ?))")
+                chunk_params.extend((after[0], after[0], after[1]))
+            sql = "SELECT id, timestamp, data FROM plate_reads"
+            if chunk_clauses:
+                sql += " WHERE " + " AND ".join(chunk_clauses)
+            sql += " ORDER BY timestamp, id LIMIT ?"
+            chunk_params.append(chunk_size)
+            rows = self._reader().execute(sql, chunk_params).fetchall()
+            if not rows:
+                return
+            yield [json.loads(row["data"]) for row in rows]
+            if len(rows) < chunk_size:
+                return
+            after = (rows[-1]["timestamp"], rows[-1]["id"])
+
+    @staticmethod
+    def _filters(plate: Optional[str], mode: str, camera_id: Optional[str], start: Optional[float],
+                 end: Optional[float], min_confidence: Optional[float]) -> Tuple[List[str], List]:
+        if mode not in SEARCH_MODES:
+            raise ValueError(f"Unknown search mode '{mode}', expected one of {list(SEARCH_MODES)}")
+        clauses: List[str] = []
+        params: List = []
+
+        key = plate_key(plate)
+        if key:
+            if mode == "exact":
+                clauses.append("plate_key = ?")
+                params.append(key)
+            elif mode == "prefix":
+                clauses.append("plate_key >= ? AND plate_key < ?")
+                params.extend((key, key + KEY_MAX))
+            elif mode == "suffix":
+                clauses.append("plate_rkey >= ? AND plate_rkey < ?")
+                params.extend((key[::-1], key[::-1] + KEY_MAX))
+            else:
+                escaped = key.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_")
+                clauses.append("plate_key LIKE ? ESCAPE '\\'")
+                params.append(f"%{escaped}%")
+        if camera_id:
+            clauses.append("camera_id = ?")
+            params.append(camera_id)
+        if start is not None:
+            clauses.append("timestamp >= ?")
+            params.append(start)
+        if end is not None:
+            clauses.append("timestamp <= ?")
+            params.append(end)
+        if min_confidence is not None:
+            clauses.append("confidence >= ?")
+            params.append(min_confidence)
+        return clauses, params
+
+    def latest(self, limit: int = 50) -> List[Dict]:
+        """Most recent reads first"""
+        return self.search(limit=limit)["results"]
+
+    def count(self) -> int:
+        return self._reader().execute("SELECT COUNT(*) FROM plate_reads").fetchone()[0]
+
+    def close(self):
+        """Flush queued writes and stop the writer"""
+        if self._closed:
+            return
+        self._closed = True
+        self._queue.put(None)
+        self._writer.join(timeout=5.0)
+
+    def get_stats(self) -> Dict:
+        """Get results store statistics"""
+        return {
+            "path": os.path.abspath(self.path),
+            "written": self.written,
+            "write_errors": self.write_errors,
+            "pending": self._queue.qsize(),
+            "queries": self.queries,
+            "average_query_ms": self.query_time / self.queries * 1000 if self.queries else 0,
+        }
@@ -3,21 +3,41 @@ Optimized CCTV Service with WebSocket Streaming
 High-performance local RTSP stream processing
 """
 
-from fastapi import FastAPI, WebSocket, WebSocketDisconnect, HTTPException, Query
-from fastapi.responses import StreamingResponse, JSONResponse
+from fastapi import FastAPI, WebSocket, WebSocketDisconnect, HTTPException, Query, Header, Request
+from fastapi.responses import FileResponse, StreamingResponse, JSONResponse, Response
 from fastapi.middleware.cors import CORSMiddleware
 import uvicorn
 import cv2
-import numpy as np
-import io
 import os
 import time
 import threading
-import queue
 import asyncio
+import json
 from datetime import datetime
 from typing import Dict, List, Optional, Set
 
+from ai_processor import ai_processor
+from ai_stage import AIPipeline
+from capture_scheduler import CaptureScheduler
+from capture_source import CaptureSource, GpuFrame, DEFAULT_DECODE_MODE, DECODE_MODES
+from cluster import COORDINATOR_ENABLED, COORDINATOR_URL, ClusterAgent, ClusterCoordinator
+from connection_manager import ConnectionManager
+from discovery import DiscoveryEngine, rtsp_describe
+from frame_pool import FrameHandle, FramePool
+from frame_ring import EncodedFrameRing
+from image_kernels import simd_features
+from metrics import metrics
+from passthrough import PassthroughHub, ffmpeg_available
+from preroll import EVENT_CLIPS_ENABLED, EventClipManager
+from recorder import RECORD_BY_DEFAULT, RecordingManager
+from renditions import DEFAULT_RENDITION, RENDITIONS, encode_renditions, resolve_rendition
+from results_export import EXPORT_FORMATS, EXPORT_MEDIA_TYPES, export_csv, export_parquet, export_zip, parquet_available
+from results_store import SEARCH_MAX_LIMIT, SEARCH_MODES, ResultsStore
+from stream_channel import StreamChannel, StreamSubscriber
+from stream_mux import pack_batch
+from stream_profile import MAIN_DETAIL_FPS, MainStream
+from stream_shards import SHARD_WORKERS, ShardSupervisor
+
 # Configure OpenCV for better RTSP performance
 os.environ['OPENCV_FFMPEG_CAPTURE_OPTIONS'] = 'rtsp_transport;tcp|rtsp_flags;prefer_tcp|stimeout;60000000'
 
@@ -34,25 +54,100 @@ app.add_middleware(
     allow_credentials=True,
     allow_methods=["*"],
     allow_headers=["*"],
+    expose_headers=["ETag", "X-Frame-Seq"],
 )
 
+class StreamCaptureState:
+    """Per-stream capture bookkeeping owned by the scheduler task"""
+    
+    def __init__(self, cap: CaptureSource):
+        self.cap = cap
+        self.frame_count = 0
+        self.last_successful_frame_time = time.time()
+        self.last_decode_time = 0.0
+        self.grabbed_frames = 0
+        self.decoded_frames = 0
+        self.parked = False  # Capture closed while only passthrough viewers watch
+        self.connecting = False  # Waiting on the connection manager for a capture
+        self.rendition_encode_times: Dict[str, float] = {}
+    
+    def release(self):
+        if self.cap is not None:
+            self.cap.release()
+            self.cap = None
+
 # Global stream processor
 class OptimizedStreamProcessor:
     def __init__(self):
-        self.streams: Dict[str, cv2.VideoCapture] = {}
+        self.streams: Dict[str, CaptureSource] = {}
         self.stream_urls: Dict[str, str] = {}
-        self.latest_frames: Dict[str, np.ndarray] = {}
+        self.decode_modes: Dict[str, str] = {}
+        # Latest decoded frame per stream; the handle keeps its pooled buffer
+        # alive until every reader has released it
+        self.latest_frames: Dict[str, FrameHandle] = {}
         self.frame_locks: Dict[str, threading.Lock] = {}
-        self.processing_threads: Dict[str, threading.Thread] = {}
+        self.frame_pools: Dict[str, FramePool] = {}
+        self.capture_states: Dict[str, StreamCaptureState] = {}
+        # Dual-stream profiles: stream_urls holds the sub-stream and these the
+        # main streams, opened only while something needs full resolution
+        self.main_streams: Dict[str, MainStream] = {}
         self.running = True
         
-        # Performance settings
-        self.jpeg_quality = 40  # Lower quality for faster transmission
+        # Performance settings - size and quality come from the rendition
+        # ladder; max_fps caps decode across all renditions
         self.max_fps = 30
-        self.frame_queues: Dict[str, queue.Queue] = {}
         
-        # WebSocket connections
-        self.active_connections: Dict[str, Set[WebSocket]] = {}
+        # Demand tracking - frames are only decoded while someone needs them
+        self.ai_enabled: Dict[str, bool] = {}
+        self.last_snapshot_request: Dict[str, Dict[str, float]] = {}  # stream -> rendition -> time
+        self.snapshot_demand_window = 5.0  # Seconds a /frame request keeps decode alive
+        
+        # Small worker pool shared by all streams instead of a thread per camera
+        self.capture_scheduler = CaptureScheduler()
+        
+        # Camera opens and reconnects, in parallel and off the capture workers
+        self.connections = ConnectionManager(self._open_capture)
+        
+        # With CCTV_SHARD_WORKERS, capture and encode run in worker processes
+        # and the scheduler above only moves their frames out of shared memory
+        self.shards = ShardSupervisor(SHARD_WORKERS) if SHARD_WORKERS > 0 else None
+        
+        # Per-stream AI stages fed from the capture loop
+        self.ai = AIPipeline(ai_processor)
+        
+        # Plate reads persisted for history and search
+        self.results_store = ResultsStore()
+        self.ai.store = self.results_store
+        
+        # Compressed fMP4 remuxers for viewers that decode in the client
+        self.passthrough = PassthroughHub()
+        
+        # Continuous recording of the same compressed packets to disk
+        self.recorder = RecordingManager(self.passthrough)
+        
+        # Pre-roll rings for AI streams, cut into event clips on detections
+        self.events = EventClipManager(self.passthrough)
+        self.ai.on_event = self._on_ai_event
+        
+        # Shared encoded frames - each frame is encoded once per stream and
+        # every WebSocket, MJPEG and snapshot consumer reads it from here
+        self.frame_rings: Dict[str, EncodedFrameRing] = {}
+        
+        # Broadcast channels over the rings for async consumers
+        self.channels: Dict[str, StreamChannel] = {}
+        
+        # Per-stream rendition ladder: one ring/channel per rung, created on
+        # first subscribe and encoded only while it has subscribers. The
+        # default rung is the channel above, which also serves snapshots
+        self.rendition_channels: Dict[str, Dict[str, StreamChannel]] = {}
+        self.default_renditions: Dict[str, str] = {}
+        
+        # WebSocket connections, each with its own subscriber cursor
+        self.active_connections: Dict[str, Dict[WebSocket, StreamSubscriber]] = {}
+        
+        # Multiplexed connections carry many streams, so removing one stream
+        # must not close them
+        self.mux_connections: Set[WebSocket] = set()
         
         # Performance monitoring
         self.fps_counters: Dict[str, int] = {}
@@ -62,101 +157,179 @@ class OptimizedStreamProcessor:
         self.consecutive_failures: Dict[str, int] = {}
         self.max_consecutive_failures = 30
         
+        # Counters and gauges for /metrics, read off the objects above at scrape time
+        metrics.register(self._collect_metrics)
+        
         print("OptimizedStreamProcessor initialized")
     
-    def add_stream(self, stream_id: str, rtsp_url: str) -> bool:
-        """Add a new RTSP stream"""
+    def add_stream(self, stream_id: str, rtsp_url: str, decode_mode: str = DEFAULT_DECODE_MODE,
+                   enable_ai: bool = True, record: bool = RECORD_BY_DEFAULT,
+                   main_url: Optional[str] = None) -> bool:
+        """Add a new RTSP stream; with main_url, rtsp_url is the camera's sub-stream"""
         try:
-            # If stream already exists, return success
-            if stream_id in self.streams:
+            # If stream already exists (or is still connecting), return success
+            if stream_id in self.stream_urls:
                 return True
             
-            # Store URL for potential reconnection
+            # Store URL and decode mode for potential reconnection
             self.stream_urls[stream_id] = rtsp_url
+            self.decode_modes[stream_id] = decode_mode
+            self.ai_enabled[stream_id] = enable_ai
+            if main_url and main_url != rtsp_url:
+                self.main_streams[stream_id] = MainStream(main_url, decode_mode)
             
             # Create lock for this stream
             self.frame_locks[stream_id] = threading.Lock()
+            self.frame_pools[stream_id] = FramePool()
             
-            # Create frame queue for WebSocket streaming
-            self.frame_queues[stream_id] = queue.Queue(maxsize=2)  # Only keep latest frames
+            # Create shared encoded-frame ring for all consumers
+            self.frame_rings[stream_id] = EncodedFrameRing()
+            self.channels[stream_id] = StreamChannel(self.frame_rings[stream_id])
+            self.rendition_channels[stream_id] = {DEFAULT_RENDITION: self.channels[stream_id]}
             
-            # Initialize active connections set
-            self.active_connections[stream_id] = set()
+            # Initialize active connections
+            self.active_connections[stream_id] = {}
             
-            # Try to use hardware acceleration if available
-            try:
-                # Try CUDA first
-                cap = cv2.VideoCapture(rtsp_url, cv2.CAP_FFMPEG)
-                # Check if CUDA is available and set properties accordingly
-                if cv2.__version__ >= '4.5.0' and hasattr(cv2, 'cuda') and cv2.cuda.getCudaEnabledDeviceCount() > 0:
-                    print(f"CUDA acceleration available, using for stream {stream_id}")
-                    # CUDA specific settings could be added here
-            except:
-                # Fall back to standard capture
-                cap = cv2.VideoCapture(rtsp_url, cv2.CAP_FFMPEG)
-            
-            # Set optimized properties
-            cap.set(cv2.CAP_PROP_BUFFERSIZE, 1)  # Minimize buffer for lowest latency
-            cap.set(cv2.CAP_PROP_FPS, 30)  # Target 30 FPS
-            
-            # Try to set timeout properties
-            try:
-                cap.set(cv2.CAP_PROP_OPEN_TIMEOUT_MSEC, 30000)  # 30 second open timeout
-                cap.set(cv2.CAP_PROP_READ_TIMEOUT_MSEC, 5000)   # 5 second read timeout
-            except:
-                pass  # Some OpenCV versions don't support these properties
-            
-            if not cap.isOpened():
-                print(f"Failed to open stream: {rtsp_url}")
-                return False
-            
-            self.streams[stream_id] = cap
             self.fps_counters[stream_id] = 0
             self.last_fps_time[stream_id] = time.time()
             self.consecutive_failures[stream_id] = 0
             
-            # Start processing thread for this stream
-            thread = threading.Thread(
-                target=self._process_stream,
-                args=(stream_id,),
-                daemon=True
+            if enable_ai:
+                self._attach_ai(stream_id)
+                self._start_preroll(stream_id)
+            
+            if record:
+                self.start_recording(stream_id)
+            
+            # Hand the stream to the shared capture workers; its step idles
+            # until the connection manager delivers the capture
+            state = StreamCaptureState(None)
+            state.connecting = True
+            self.capture_states[stream_id] = state
+            service = self._service_shared_stream if self.shards is not None else self._service_stream
+            self.capture_scheduler.add(
+                stream_id,
+                lambda: service(stream_id, state),
+                on_cancel=state.release
             )
-            thread.start()
-            self.processing_threads[stream_id] = thread
             
-            print(f"Added stream {stream_id}: {rtsp_url}")
+            main = self.main_streams.get(stream_id)
+            if main is not None:
+                self.capture_scheduler.add(
+                    f"{stream_id}#main",
+                    lambda: self._service_main_stream(stream_id, main),
+                    on_cancel=main.close
+                )
+            
+            self.connections.connect(stream_id, rtsp_url, decode_mode,
+                                     lambda cap: self._on_capture_open(stream_id, state, cap))
+            print(f"Added stream {stream_id}: {rtsp_url} (decode: {decode_mode}"
+                  f"{', main stream on demand' if main is not None else ''}), connecting")
             return True
             
         except Exception as e:
             print(f"Error adding stream {stream_id}: {e}")
             return False
     
+    def _open_capture(self, stream_id: str, rtsp_url: str, decode_mode: str):
+        """Open a stream's capture for the connection manager; None if it failed
+        
+        Unavailable hardware modes fall back to software decode inside
+        CaptureSource. Sharded streams open in their worker process.
+        """
+        if self.shards is not None:
+            return self.shards.add(stream_id, rtsp_url, decode_mode)
+        cap = CaptureSource(rtsp_url, decode_mode)
+        if not cap.isOpened():
+            cap.release()
+            return None
+        return cap
+    
+    def _on_capture_open(self, stream_id: str, state: StreamCaptureState, cap):
+        """Hand a capture opened by the connection manager to the stream's capture task"""
+        state.cap = cap
+        if self.capture_states.get(stream_id) is not state:
+            # Removed while connecting
+            state.release()
+            return
+        state.last_successful_frame_time = time.time()
+        self.streams[stream_id] = cap
+        self.consecutive_failures[stream_id] = 0
+        state.connecting = False
+    
+    def packet_url(self, stream_id: str) -> Optional[str]:
+        """URL the passthrough remuxer copies packets from: the main stream when there is one
+        
+        Remuxing never decodes, so recording, pre-roll and passthrough viewers
+        get full resolution at no decode cost.
+        """
+        main = self.main_streams.get(stream_id)
+        return main.rtsp_url if main is not None else self.stream_urls.get(stream_id)
+    
+    def start_recording(self, stream_id: str) -> bool:
+        """Record a stream's compressed packets through its passthrough remuxer"""
+        rtsp_url = self.packet_url(stream_id)
+        if rtsp_url is None:
+            return False
+        if not ffmpeg_available():
+            print(f"Cannot record {stream_id}: ffmpeg not found")
+            return False
+        return self.recorder.start(stream_id, rtsp_url)
+    
     def remove_stream(self, stream_id: str) -> bool:
         """Remove a stream"""
         try:
+            # The capture is released by the scheduler once no worker holds it
+            self.capture_scheduler.remove(stream_id)
+            self.capture_states.pop(stream_id, None)
+            self.connections.cancel(stream_id)
+            metrics.remove(stream_id)
+            if self.main_streams.pop(stream_id, None) is not None:
+                self.capture_scheduler.remove(f"{stream_id}#main")
+                self.connections.cancel(f"{stream_id}#main")
+                metrics.remove(f"{stream_id}#main")
+            if self.shards is not None:
+                self.shards.remove(stream_id)
+            
             if stream_id in self.streams:
-                self.streams[stream_id].release()
                 del self.streams[stream_id]
             
-            if stream_id in self.latest_frames:
-                del self.latest_frames[stream_id]
+            latest = self.latest_frames.pop(stream_id, None)
+            if latest is not None:
+                latest.release()
+            self.frame_pools.pop(stream_id, None)
             
             if stream_id in self.frame_locks:
                 del self.frame_locks[stream_id]
             
-            if stream_id in self.processing_threads:
-                del self.processing_threads[stream_id]
-            
             if stream_id in self.stream_urls:
                 del self.stream_urls[stream_id]
             
-            if stream_id in self.frame_queues:
-                del self.frame_queues[stream_id]
+            if stream_id in self.decode_modes:
+                del self.decode_modes[stream_id]
+            
+            self.ai_enabled.pop(stream_id, None)
+            self.ai.detach(stream_id)
+            self.recorder.stop(stream_id)
+            self.events.stop(stream_id)
+            self.passthrough.remove(stream_id)
+            self.last_snapshot_request.pop(stream_id, None)
+            
+            for channel in self.rendition_channels.pop(stream_id, {}).values():
+                channel.close()
+                channel.ring.clear()
+            self.channels.pop(stream_id, None)
+            self.default_renditions.pop(stream_id, None)
+            
+            if stream_id in self.frame_rings:
+                self.frame_rings[stream_id].clear()
+                del self.frame_rings[stream_id]
             
             if stream_id in self.active_connections:
                 # Close all WebSocket connections for this stream
                 for connection in self.active_connections[stream_id]:
-                    asyncio.create_task(connection.close())
+                    if connection not in self.mux_connections:
+                        asyncio.create_task(connection.close())
                 del self.active_connections[stream_id]
             
             print(f"Removed stream {stream_id}")
@@ -166,185 +339,680 @@ class OptimizedStreamProcessor:
             print(f"Error removing stream {stream_id}: {e}")
             return False
     
-    def _reconnect_stream(self, stream_id: str) -> bool:
-        """Reconnect a failed stream"""
+    def _reconnect_stream(self, stream_id: str):
+        """Hand a failed stream to the connection manager
+        
+        Its capture step idles until the new capture arrives; retries back
+        off per camera instead of holding a capture worker.
+        """
+        state = self.capture_states.get(stream_id)
+        rtsp_url = self.stream_urls.get(stream_id)
+        if state is None or rtsp_url is None or state.connecting:
+            return
+        print(f"Reconnecting stream {stream_id}...")
+        state.release()
+        state.connecting = True
+        self.streams.pop(stream_id, None)
+        self.connections.connect(stream_id, rtsp_url, self.decode_modes.get(stream_id, DEFAULT_DECODE_MODE),
+                                 lambda cap: self._on_capture_open(stream_id, state, cap))
+    
+    def _stream_demand(self, stream_id: str) -> float:
+        """Target decode FPS from viewers (0 means nobody is watching)
+        
+        The fastest subscribed rendition sets the rate, so a wall of
+        thumbnails decodes at thumbnail FPS. AI decode is driven separately
+        by the stream's detection interval.
+        """
+        fps = 0.0
+        for name in self._sub_renditions(stream_id):
+            fps = max(fps, RENDITIONS[name].max_fps)
+        return min(fps, self.max_fps)
+    
+    def _active_renditions(self, stream_id: str) -> List[str]:
+        """Renditions that currently have a consumer"""
+        active = [name for name, channel in self.rendition_channels.get(stream_id, {}).items()
+                  if channel.subscribers]
+        now = time.time()
+        for name, requested in self.last_snapshot_request.get(stream_id, {}).items():
+            if name not in active and now - requested < self.snapshot_demand_window:
+                active.append(name)
+        return active
+    
+    def _sub_renditions(self, stream_id: str) -> List[str]:
+        """Watched renditions encoded from the stream's own capture
+        
+        For dual-stream profiles that leaves out renditions the main stream
+        is serving; asking also keeps the main stream open while they are watched.
+        """
+        active = self._active_renditions(stream_id)
+        main = self.main_streams.get(stream_id)
+        return main.split(active)[0] if main is not None else active
+    
+    def get_rendition_channel(self, stream_id: str, rendition: str) -> Optional[StreamChannel]:
+        """Get (creating on first use) the broadcast channel for a stream rendition"""
+        channels = self.rendition_channels.get(stream_id)
+        if channels is None or rendition not in RENDITIONS:
+            return None
+        channel = channels.get(rendition)
+        if channel is None:
+            channel = StreamChannel(EncodedFrameRing())
+            channels[rendition] = channel
+        return channel
+    
+    def set_ai_enabled(self, stream_id: str, enabled: bool) -> bool:
+        """Enable or disable the AI stage for a stream"""
         if stream_id not in self.stream_urls:
-            print(f"Cannot reconnect {stream_id}: URL not stored")
             return False
+        self.ai_enabled[stream_id] = enabled
+        if enabled:
+            self._attach_ai(stream_id).set_enabled(True)
+            self._start_preroll(stream_id)
+        else:
+            stage = self.ai.get(stream_id)
+            if stage is not None:
+                stage.set_enabled(False)
+            self.events.stop(stream_id)
+        return True
+    
+    def _attach_ai(self, stream_id: str):
+        stage = self.ai.attach(stream_id)
+        main = self.main_streams.get(stream_id)
+        if main is not None:
+            # Detect on the sub-stream, read plates off the main stream
+            stage.detail_source = main.acquire_detail
+        stage.on_overlay = lambda stage: self._notify_overlay(stream_id)
+        return stage
+    
+    def _rendition_seqs(self, stream_id: str) -> Dict[str, int]:
+        """Newest frame sequence number of each rendition ring"""
+        return {name: channel.ring.seq for name, channel in self.rendition_channels.get(stream_id, {}).items()}
+    
+    def _notify_overlay(self, stream_id: str):
+        # Wake viewers so new boxes go out without waiting for the next frame
+        for channel in list(self.rendition_channels.get(stream_id, {}).values()):
+            channel.notify_threadsafe()
+    
+    def overlay_message(self, stream_id: str, subscriber: StreamSubscriber, after_version: int) -> Optional[Dict]:
+        """The stream's detection overlay newer than after_version, for a viewer
         
-        rtsp_url = self.stream_urls[stream_id]
+        Held back until the viewer has been sent the frame the detections
+        were run on, so boxes never lead the video. seq is that frame's
+        sequence number in the viewer's rendition.
+        """
+        stage = self.ai.get(stream_id)
+        overlay = stage.overlay if stage is not None else None
+        if overlay is None or overlay[0] <= after_version:
+            return None
+        version, seqs, payload = overlay
+        seq = seqs.get(subscriber.rendition, 0)
+        if subscriber.cursor < seq:
+            return None
+        return dict(payload, type="detections", stream_id=stream_id, seq=seq, version=version)
+    
+    def _start_preroll(self, stream_id: str):
+        # Pre-roll needs the compressed packets, i.e. the passthrough remuxer
+        if EVENT_CLIPS_ENABLED and ffmpeg_available():
+            self.events.start(stream_id, self.packet_url(stream_id))
+    
+    def _on_ai_event(self, stream_id: str, kind: str, info: Dict) -> Optional[str]:
+        """Cut an event clip for a detection; returns its id"""
+        clip = self.events.trigger(stream_id, kind, info)
+        return clip.clip_id if clip is not None else None
+    
+    def get_detections(self, stream_id: str) -> Optional[Dict]:
+        """Get the latest AI detections for a stream"""
+        if stream_id not in self.stream_urls:
+            return None
+        stage = self.ai.get(stream_id)
+        detections = stage.latest if stage is not None else None
+        return {
+            "stream_id": stream_id,
+            "ai_enabled": self.ai_enabled.get(stream_id, False),
+            "frame_seq": stage.latest_seq if detections is not None else None,
+            "timestamp": detections.timestamp if detections is not None else None,
+            "count": len(detections) if detections is not None else 0,
+            "detections": detections.to_dicts() if detections is not None else [],
+            "plates": stage.latest_plates if stage is not None else []
+        }
+    
+    def _collect_metrics(self):
+        """Per-stream counters, reconnects and queue depths for /metrics"""
+        streams = list(self.stream_urls)
+        fps, grabbed, decoded, viewers, dropped = [], [], [], [], []
+        ai_frames, lpr_jobs = [], []
+        for stream_id in streams:
+            labels = {"stream": stream_id}
+            fps.append((labels, self.fps_counters.get(stream_id, 0)))
+            state = self.capture_states.get(stream_id)
+            if state is not None:
+                grabbed.append((labels, state.grabbed_frames))
+                decoded.append((labels, state.decoded_frames))
+            subscribers = list(self.active_connections.get(stream_id, {}).values())
+            viewers.append((labels, len(subscribers)))
+            dropped.append((labels, sum(subscriber.dropped_frames for subscriber in subscribers)))
+            stage = self.ai.get(stream_id)
+            if stage is not None:
+                for outcome in ("submitted", "completed", "skipped_static", "skipped_busy"):
+                    ai_frames.append(({"stream": stream_id, "outcome": outcome}, getattr(stage, outcome)))
+                for outcome in ("submitted", "skipped_busy", "skipped_tracked"):
+                    lpr_jobs.append(({"stream": stream_id, "outcome": outcome}, getattr(stage, f"lpr_{outcome}")))
         
-        print(f"Attempting to reconnect stream {stream_id}...")
+        connections = self.connections.get_stats()
+        attempts, failures, states = [], [], []
+        for key, connection in connections["cameras"].items():
+            attempts.append(({"stream": key}, connection["attempts"]))
+            failures.append(({"stream": key}, connection["failures"]))
+            states.append(({"stream": key, "state": connection["state"]}, 1))
         
-        try:
-            # Release old capture
-            if stream_id in self.streams:
-                old_cap = self.streams[stream_id]
-                old_cap.release()
-                del self.streams[stream_id]
-            
-            # Wait a bit before reconnecting
-            time.sleep(1)
-            
-            # Create new capture with same settings as add_stream
-            cap = cv2.VideoCapture(rtsp_url, cv2.CAP_FFMPEG)
-            cap.set(cv2.CAP_PROP_BUFFERSIZE, 1)
-            cap.set(cv2.CAP_PROP_FPS, 30)
-            
-            if not cap.isOpened():
-                print(f"Failed to reconnect stream {stream_id}")
-                return False
-            
-            self.streams[stream_id] = cap
-            self.consecutive_failures[stream_id] = 0
+        queues = [
+            ({"queue": "capture_ready"}, self.capture_scheduler.ready_depth),
+            ({"queue": "capture_delayed"}, self.capture_scheduler.pending_delayed()),
+            ({"queue": "connect_in_flight"}, connections["in_flight"]),
+            ({"queue": "inference"}, ai_processor.scheduler.get_stats()["queue_depth"]),
+            ({"queue": "lpr"}, ai_processor.lpr_scheduler.get_stats()["queue_depth"]),
+        ]
+        return [
+            ("cctv_streams", "gauge", "Configured streams", [({}, len(streams))]),
+            ("cctv_stream_fps", "gauge", "Frames decoded in the last second", fps),
+            ("cctv_frames_grabbed_total", "counter", "Frames pulled from the camera", grabbed),
+            ("cctv_frames_decoded_total", "counter", "Frames decoded to pixels", decoded),
+            ("cctv_viewers", "gauge", "JPEG WebSocket viewers", viewers),
+            ("cctv_viewer_dropped_frames", "gauge", "Frames skipped by current viewers (latest-frame-wins)", dropped),
+            ("cctv_ai_frames_total", "counter", "Frames offered to detection, by outcome", ai_frames),
+            ("cctv_lpr_jobs_total", "counter", "Plate reading jobs, by outcome", lpr_jobs),
+            ("cctv_connect_attempts_total", "counter", "Camera open attempts, including reconnects", attempts),
+            ("cctv_connect_failures", "gauge", "Consecutive failed opens of a camera", failures),
+            ("cctv_connection_state", "gauge", "Camera connection state", states),
+            ("cctv_connects_total", "counter", "Camera opens by result",
+             [({"result": "opened"}, connections["opened"]), ({"result": "failed"}, connections["failed"])]),
+            ("cctv_queue_depth", "gauge", "Items waiting in each work queue", queues),
+        ]
+    
+    def get_stage_stats(self) -> Dict:
+        """Per-stream stage timings and the slowest stage of each"""
+        keys = list(self.stream_urls) + [f"{stream_id}#main" for stream_id in list(self.main_streams)]
+        return {key: {"bottleneck": metrics.bottleneck(key), "stages": metrics.stage_summary(key)} for key in keys}
+    
+    def note_snapshot_request(self, stream_id: str, rendition: str = DEFAULT_RENDITION):
+        """Record a /frame request so the rendition keeps encoding for a while"""
+        if stream_id in self.stream_urls:
+            self.last_snapshot_request.setdefault(stream_id, {})[rendition] = time.time()
+    
+    def _service_stream(self, stream_id: str, state: StreamCaptureState) -> Optional[float]:
+        """Run one capture step for a stream
+        
+        Returns the delay before the stream should be serviced again, or None
+        once the stream is gone. Blocks on the demuxer instead of sleeping:
+        frames are decoded only when a consumer wants them at the current
+        rate, otherwise they are grabbed and dropped to keep latency low.
+        """
+        if not self.running or stream_id not in self.stream_urls:
+            return None
+        
+        if state.connecting:
+            return 0.25
+        
+        now = time.time()
+        target_fps = self._stream_demand(stream_id)
+        stage = self.ai.get(stream_id)
+        
+        # Passthrough viewers and the recorder take compressed packets, so with
+        # no JPEG viewers, snapshots or AI the capture is parked and its RTSP
+        # session closed
+        needs_pixels = target_fps > 0 or (stage is not None and stage.enabled)
+        if not needs_pixels and (state.parked or self.passthrough.active(stream_id)):
+            if not state.parked:
+                state.release()
+                state.parked = True
+                print(f"Parked capture for {stream_id} (passthrough viewers or recording only)")
+            return 0.25
+        if state.parked:
+            state.parked = False
+            print(f"Resuming capture for {stream_id}")
+            self._reconnect_stream(stream_id)
+            return 0.25
+        
+        cap = state.cap
+        
+        # Reopen a closed capture, or one that stopped delivering frames
+        if cap is None or not cap.isOpened() or now - state.last_successful_frame_time > 30:
+            self._reconnect_stream(stream_id)
+            return 0.25
+        
+        # Decode only when a consumer wants a frame at this point in time;
+        # grab() still drains the demuxer but skips colour conversion and
+        # the host-side frame allocation. Decodes land in a pooled buffer
+        ai_due = stage is not None and stage.due()
+        view_due = target_fps > 0 and (now - state.last_decode_time) >= (1.0 / target_fps)
+        frame = None
+        if view_due or ai_due:
+            if view_due:
+                state.last_decode_time = now
+            pool = self.frame_pools.get(stream_id)
+            if pool is None:
+                return None
+            started = time.perf_counter()
+            frame = pool.read(cap)
+            ret = frame is not None
+            if ret:
+                metrics.observe(stream_id, "decode", time.perf_counter() - started)
+        else:
+            started = time.perf_counter()
+            ret = cap.grab()
+            if ret:
+                metrics.observe(stream_id, "demux", time.perf_counter() - started)
+        
+        if not ret:
+            self.consecutive_failures[stream_id] = self.consecutive_failures.get(stream_id, 0) + 1
             
-            print(f"Successfully reconnected stream {stream_id}")
-            return True
+            if self.consecutive_failures[stream_id] >= self.max_consecutive_failures:
+                self._reconnect_stream(stream_id)
             
-        except Exception as e:
-            print(f"Error reconnecting stream {stream_id}: {e}")
-            return False
+            return 0.033
+        
+        # Successfully read frame - reset failure counter
+        self.consecutive_failures[stream_id] = 0
+        state.last_successful_frame_time = time.time()
+        # Carried to viewers as the frame timestamp, for capture-to-glass latency
+        captured_at = state.last_successful_frame_time
+        state.grabbed_frames += 1
+        if stage is not None:
+            stage.tick()
+        
+        if frame is None:
+            return 0.0
+        
+        state.decoded_frames += 1
+        main = self.main_streams.get(stream_id)
+        if main is not None:
+            main.sub_width = frame.frame.shape[1]
+        try:
+            if view_due:
+                self._publish_frame(stream_id, frame, state, captured_at)
+            if ai_due:
+                ring = self.frame_rings.get(stream_id)
+                stage.offer(frame, ring.seq if ring is not None and view_due else 0, self._rendition_seqs(stream_id))
+        finally:
+            # Publishing and the AI stage retain the frame if they keep it
+            frame.release()
+        
+        # Update FPS counter
+        state.frame_count += 1
+        current_time = time.time()
+        if current_time - self.last_fps_time.get(stream_id, current_time) >= 1.0:
+            self.fps_counters[stream_id] = state.frame_count
+            state.frame_count = 0
+            self.last_fps_time[stream_id] = current_time
+        
+        return 0.0
     
-    def _process_stream(self, stream_id: str):
-        """Process a single stream in a separate thread"""
-        frame_count = 0
-        last_successful_frame_time = time.time()
-        reconnect_cooldown = 0
-        last_frame_time = time.time()
+    def _service_shared_stream(self, stream_id: str, state: StreamCaptureState) -> Optional[float]:
+        """Run one step for a stream captured by a shard worker
         
-        while self.running and stream_id in self.streams:
-            try:
-                cap = self.streams.get(stream_id)
-                if cap is None:
-                    time.sleep(0.5)
-                    continue
-                
-                # Check if capture is still opened
-                if not cap.isOpened():
-                    if time.time() - reconnect_cooldown > 5:
-                        if not self._reconnect_stream(stream_id):
-                            reconnect_cooldown = time.time()
-                    time.sleep(0.5)
-                    continue
-                
-                # Check if too long since last successful frame
-                if time.time() - last_successful_frame_time > 30:
-                    if time.time() - reconnect_cooldown > 10:
-                        if not self._reconnect_stream(stream_id):
-                            reconnect_cooldown = time.time()
-                        else:
-                            last_successful_frame_time = time.time()
-                    continue
-                
-                # Frame rate limiting
-                current_time = time.time()
-                if (current_time - last_frame_time) < (1.0 / self.max_fps):
-                    time.sleep(0.001)
-                    continue
-                last_frame_time = current_time
-                
-                ret, frame = cap.read()
-                if not ret or frame is None:
-                    self.consecutive_failures[stream_id] = self.consecutive_failures.get(stream_id, 0) + 1
-                    
-                    if self.consecutive_failures[stream_id] >= self.max_consecutive_failures:
-                        if time.time() - reconnect_cooldown > 10:
-                            if not self._reconnect_stream(stream_id):
-                                reconnect_cooldown = time.time()
-                            else:
-                                last_successful_frame_time = time.time()
-                    
-                    time.sleep(0.033)
-                    continue
-                
-                # Successfully read frame - reset failure counter
-                self.consecutive_failures[stream_id] = 0
-                last_successful_frame_time = time.time()
-                
-                # Update latest frame with thread safety
-                with self.frame_locks[stream_id]:
-                    self.latest_frames[stream_id] = frame.copy()
-                
-                # Add frame to queue for WebSocket streaming
+        Writes the stream's demand (watched renditions, AI frame requests,
+        whether the worker may park) into shared memory and republishes the
+        frames the worker encoded into the local channels, so every endpoint
+        serves sharded streams unchanged. AI frames are copied into the
+        stream's frame pool and go through the same stage as local capture.
+        """
+        if not self.running or stream_id not in self.stream_urls:
+            return None
+        
+        shared = self.shards.get(stream_id)
+        if shared is None:
+            return 0.5  # Worker restarting
+        if state.cap is not shared:
+            state.cap = shared
+            self.streams[stream_id] = shared
+        
+        now = time.time()
+        main = self.main_streams.get(stream_id)
+        if main is not None:
+            main.sub_width = int(shared.get(cv2.CAP_PROP_FRAME_WIDTH))
+        active = self._sub_renditions(stream_id)
+        stage = self.ai.get(stream_id)
+        ai_on = stage is not None and stage.enabled
+        shared.set_demand(active, now + 1.0, parkable=not ai_on and self.passthrough.active(stream_id))
+        state.parked = shared.parked
+        
+        grabbed, decoded = shared.poll_counters()
+        state.grabbed_frames += grabbed
+        state.decoded_frames += decoded
+        state.frame_count += decoded
+        if stage is not None and grabbed:
+            stage.tick(grabbed)
+        if now - self.last_fps_time.get(stream_id, now) >= 1.0:
+            self.fps_counters[stream_id] = state.frame_count
+            state.frame_count = 0
+            self.last_fps_time[stream_id] = now
+        
+        for name in active:
+            encoded = shared.read_encoded(name)
+            if encoded is not None:
+                channel = self.get_rendition_channel(stream_id, name)
+                if channel is not None:
+                    channel.publish(*encoded)
+        
+        if ai_on:
+            pool = self.frame_pools.get(stream_id)
+            frame = pool.read(shared) if pool is not None else None
+            if frame is not None:
                 try:
-                    # Remove old frame if queue is full
-                    if self.frame_queues[stream_id].full():
-                        try:
-                            self.frame_queues[stream_id].get_nowait()
-                        except queue.Empty:
-                            pass
-                    
-                    # Resize frame for better performance if needed
-                    if frame.shape[1] > 1280:  # If width > 1280
-                        scale = 1280 / frame.shape[1]
-                        new_width = 1280
-                        new_height = int(frame.shape[0] * scale)
-                        frame = cv2.resize(frame, (new_width, new_height))
-                    
-                    # Encode frame as JPEG with lower quality
-                    _, buffer = cv2.imencode('.jpg', frame, [cv2.IMWRITE_JPEG_QUALITY, self.jpeg_quality])
-                    
-                    # Put encoded frame in queue
-                    self.frame_queues[stream_id].put_nowait(buffer.tobytes())
-                except queue.Full:
-                    pass  # Skip frame if queue is full
-                except Exception as e:
-                    print(f"Error encoding frame: {e}")
-                
-                # Update FPS counter
-                frame_count += 1
-                current_time = time.time()
-                if current_time - self.last_fps_time[stream_id] >= 1.0:
-                    self.fps_counters[stream_id] = frame_count
-                    frame_count = 0
-                    self.last_fps_time[stream_id] = current_time
-                
-            except Exception as e:
-                print(f"Error processing stream {stream_id}: {e}")
-                time.sleep(0.5)
+                    self._store_latest(stream_id, frame)
+                    ring = self.frame_rings.get(stream_id)
+                    stage.offer(frame, ring.seq if ring is not None else 0, self._rendition_seqs(stream_id))
+                finally:
+                    frame.release()
+            elif stage.due():
+                shared.request_frame()
+        
+        # Poll at twice the fastest watched rendition's rate
+        fps = max((RENDITIONS[name].max_fps for name in active), default=0.0)
+        if fps > 0:
+            return 0.5 / fps
+        return 0.02 if ai_on else 0.1
+    
+    def _service_main_stream(self, stream_id: str, main: MainStream) -> Optional[float]:
+        """Run one capture step for a dual-stream camera's main stream
+        
+        Opens the main stream while viewers watch renditions wider than the
+        sub-stream or plate reading asks for detail, decodes at the rate
+        they need and closes it once neither has for a while.
+        """
+        if not self.running or self.main_streams.get(stream_id) is not main:
+            return None
+        
+        now = time.time()
+        names = main.wide(self._active_renditions(stream_id))
+        if names:
+            main.last_view_demand = now
+        key = f"{stream_id}#main"
+        if not main.wanted(now):
+            if main.cap is not None or main.connecting:
+                self.connections.cancel(key)
+                main.close()
+                print(f"Closed idle main stream for {stream_id}")
+            return 0.25
+        
+        cap = main.cap
+        if main.connecting:
+            return 0.1
+        if cap is None or not cap.isOpened():
+            main.close()
+            main.connecting = True
+            self.connections.connect(key, main.rtsp_url, main.decode_mode,
+                                     lambda cap: self._on_main_open(stream_id, main, cap),
+                                     opener=main.open_capture)
+            return 0.1
+        
+        fps = max((RENDITIONS[name].max_fps for name in names), default=0.0)
+        if main.detail_wanted(now):
+            fps = max(fps, MAIN_DETAIL_FPS)
+        fps = min(fps, self.max_fps)
+        if fps > 0 and now - main.last_decode_time >= 1.0 / fps:
+            main.last_decode_time = now
+            started = time.perf_counter()
+            frame = main.pool.read(cap)
+            ret = frame is not None
+            if ret:
+                metrics.observe(key, "decode", time.perf_counter() - started)
+        else:
+            frame = None
+            started = time.perf_counter()
+            ret = cap.grab()
+            if ret:
+                metrics.observe(key, "demux", time.perf_counter() - started)
+        
+        if not ret:
+            main.consecutive_failures += 1
+            if main.consecutive_failures >= self.max_consecutive_failures:
+                main.close()  # Reopened through the connection manager next step
+            return 0.033
+        main.consecutive_failures = 0
+        if frame is None:
+            return 0.0
+        
+        main.decoded_frames += 1
+        captured_at = time.time()
+        
+        def publish(name: str, data: bytes, width: int, height: int):
+            channel = self.get_rendition_channel(stream_id, name)
+            if channel is not None:
+                channel.publish(data, width, height, captured_at)
+        
+        try:
+            main.store_latest(frame)
+            encode_renditions(frame.frame, names, main.rendition_encode_times, now, publish,
+                              lambda stage, seconds: metrics.observe(key, stage, seconds))
+        except Exception as e:
+            print(f"Error encoding main stream frame: {e}")
+        finally:
+            frame.release()
+        return 0.0
+    
+    def _on_main_open(self, stream_id: str, main: MainStream, cap):
+        # Scheduler steps don't touch the capture while main.connecting is set
+        if self.main_streams.get(stream_id) is not main or not main.connecting:
+            cap.release()
+            return
+        main.attach(cap)
+        print(f"Opened main stream for {stream_id}")
     
-    def get_latest_frame(self, stream_id: str) -> Optional[np.ndarray]:
-        """Get the latest frame from a stream"""
+    def _publish_frame(self, stream_id: str, handle: FrameHandle, state: Optional[StreamCaptureState] = None,
+                       captured_at: Optional[float] = None):
+        """Store a decoded frame and publish it to every rendition being watched
+        
+        Encoded frames carry captured_at as their timestamp, so every send
+        (and the mux frame header) knows how old the picture is.
+        """
+        if stream_id not in self.frame_locks:
+            return
+        self._store_latest(stream_id, handle)
+        
+        # Each rendition is paced to its own FPS off the shared decode rate
+        encode_times = state.rendition_encode_times if state is not None else {}
+        
+        def publish(name: str, data: bytes, width: int, height: int):
+            channel = self.get_rendition_channel(stream_id, name)
+            if channel is not None:
+                channel.publish(data, width, height, captured_at)
+        
+        try:
+            encode_renditions(handle.frame, self._sub_renditions(stream_id), encode_times, time.time(), publish,
+                              lambda stage, seconds: metrics.observe(stream_id, stage, seconds))
+        except Exception as e:
+            print(f"Error encoding frame: {e}")
+    
+    def _store_latest(self, stream_id: str, handle: FrameHandle):
+        """Swap in the latest frame
+        
+        The previous one goes back to its pool once its other readers release it.
+        """
+        lock = self.frame_locks.get(stream_id)
+        if lock is None:
+            return
+        with lock:
+            previous = self.latest_frames.get(stream_id)
+            self.latest_frames[stream_id] = handle.retain()
+        if previous is not None:
+            previous.release()
+    
+    def get_latest_frame(self, stream_id: str, keep_on_gpu: bool = False):
+        """Get the latest frame from a stream
+        
+        Returns a host ndarray copy by default. With keep_on_gpu, NVDEC frames
+        are returned as GpuFrame so inference can consume them in place.
+        """
         if stream_id not in self.frame_locks:
             return None
         
+        # Copied under the lock: the pooled buffer is reused once a newer
+        # frame replaces it. Readers that can release use acquire_latest_frame
         with self.frame_locks[stream_id]:
-            return self.latest_frames.get(stream_id, None).copy() if stream_id in self.latest_frames else None
+            handle = self.latest_frames.get(stream_id, None)
+            if handle is None:
+                return None
+            if keep_on_gpu and isinstance(handle.frame, GpuFrame):
+                return handle.frame
+            return handle.frame.copy()
+    
+    def acquire_latest_frame(self, stream_id: str) -> Optional[FrameHandle]:
+        """Get the latest frame without a copy; the caller must release() the handle"""
+        lock = self.frame_locks.get(stream_id)
+        if lock is None:
+            return None
+        with lock:
+            handle = self.latest_frames.get(stream_id)
+            return handle.retain() if handle is not None else None
+    
+    def get_encoded_frame_ring(self, stream_id: str) -> Optional[EncodedFrameRing]:
+        """Get the shared encoded-frame ring for a stream"""
+        return self.frame_rings.get(stream_id)
+    
+    def get_channel(self, stream_id: str) -> Optional[StreamChannel]:
+        """Get the broadcast channel for a stream"""
+        return self.channels.get(stream_id)
+    
+    def has_stream(self, stream_id: str) -> bool:
+        """Whether a stream is registered, including while it connects or backs off
+        
+        Viewers stay attached across reconnects; self.streams only holds open captures.
+        """
+        return stream_id in self.stream_urls
     
     def get_stream_info(self, stream_id: str) -> Dict:
         """Get stream information and performance metrics"""
-        if stream_id not in self.streams:
+        if stream_id not in self.stream_urls:
             return {"error": "Stream not found"}
         
-        cap = self.streams[stream_id]
+        cap = self.streams.get(stream_id)
+        if cap is None:
+            # Connecting or reconnecting
+            return {
+                "stream_id": stream_id,
+                "is_opened": False,
+                "parked": stream_id in self.capture_states and self.capture_states[stream_id].parked,
+                "connection": self.connections.state(stream_id),
+                "ai_enabled": self.ai_enabled.get(stream_id, False),
+                "timestamp": datetime.now().isoformat()
+            }
         return {
             "stream_id": stream_id,
             "is_opened": cap.isOpened(),
+            "connection": self.connections.state(stream_id),
+            "decode_mode": cap.decode_mode,
+            "decoding": self._stream_demand(stream_id) > 0,
+            "parked": stream_id in self.capture_states and self.capture_states[stream_id].parked,
+            "passthrough": self.passthrough.get_stats(stream_id),
+            "recording": self.recorder.is_recording(stream_id),
+            "ai_enabled": self.ai_enabled.get(stream_id, False),
             "fps": self.fps_counters.get(stream_id, 0),
             "frame_width": int(cap.get(cv2.CAP_PROP_FRAME_WIDTH)),
             "frame_height": int(cap.get(cv2.CAP_PROP_FRAME_HEIGHT)),
             "timestamp": datetime.now().isoformat(),
-            "active_websocket_connections": len(self.active_connections.get(stream_id, set()))
+            "frame_seq": self.frame_rings[stream_id].seq if stream_id in self.frame_rings else 0,
+            "default_rendition": self.default_renditions.get(stream_id, DEFAULT_RENDITION),
+            "renditions": {name: len(channel.subscribers)
+                           for name, channel in self.rendition_channels.get(stream_id, {}).items()},
+            "active_websocket_connections": len(self.active_connections.get(stream_id, {})),
+            "frame_pool": self.frame_pools[stream_id].get_stats() if stream_id in self.frame_pools else None,
+            "main_stream": self.main_streams[stream_id].get_stats() if stream_id in self.main_streams else None
         }
     
     def get_all_streams_info(self) -> List[Dict]:
         """Get information for all streams"""
-        return [self.get_stream_info(stream_id) for stream_id in self.streams.keys()]
+        return [self.get_stream_info(stream_id) for stream_id in list(self.stream_urls)]
     
-    async def register_websocket(self, stream_id: str, websocket: WebSocket):
-        """Register a WebSocket connection for a stream"""
+    async def register_websocket(self, stream_id: str, websocket: WebSocket, rendition: Optional[str] = None,
+                                 event: Optional[asyncio.Event] = None) -> Optional[StreamSubscriber]:
+        """Register a WebSocket connection for a stream and subscribe it to a rendition"""
+        rendition = rendition or self.default_renditions.get(stream_id, DEFAULT_RENDITION)
+        subscriber = self.subscribe_rendition(stream_id, rendition, websocket, event)
+        if subscriber is None:
+            return None
         if stream_id not in self.active_connections:
-            self.active_connections[stream_id] = set()
-        self.active_connections[stream_id].add(websocket)
+            self.active_connections[stream_id] = {}
+        self.active_connections[stream_id][websocket] = subscriber
+        return subscriber
+    
+    def subscribe_rendition(self, stream_id: str, rendition: str, owner=None,
+                            event: Optional[asyncio.Event] = None) -> Optional[StreamSubscriber]:
+        """Subscribe to a stream rendition, skipping a stale frame left from earlier viewers"""
+        channel = self.get_rendition_channel(stream_id, rendition)
+        if channel is None:
+            return None
+        channel.bind_loop(asyncio.get_running_loop())
+        subscriber = channel.subscribe(owner, event)
+        subscriber.rendition = rendition
+        latest = channel.ring.latest()
+        if latest is not None and time.time() - latest.timestamp > 1.0:
+            subscriber.cursor = latest.seq
+        return subscriber
+    
+    def set_websocket_rendition(self, stream_id: str, websocket: WebSocket, rendition: str) -> bool:
+        """Move one WebSocket viewer to another rendition (must run on the event loop)"""
+        connections = self.active_connections.get(stream_id, {})
+        current = connections.get(websocket)
+        if current is None or rendition not in RENDITIONS:
+            return False
+        if current.rendition == rendition:
+            return True
+        subscriber = self.subscribe_rendition(stream_id, rendition, websocket, current.event)
+        if subscriber is None:
+            return False
+        connections[websocket] = subscriber
+        current.channel.unsubscribe(current)
+        # Release the sender waiting on the old rung so it picks up the new one
+        current.wake()
+        return True
+    
+    def set_stream_rendition(self, stream_id: str, rendition: str) -> int:
+        """Set a stream's default rendition and move its WebSocket viewers to it"""
+        self.default_renditions[stream_id] = rendition
+        moved = 0
+        for websocket in list(self.active_connections.get(stream_id, {})):
+            if self.set_websocket_rendition(stream_id, websocket, rendition):
+                moved += 1
+        return moved
     
     async def unregister_websocket(self, stream_id: str, websocket: WebSocket):
         """Unregister a WebSocket connection for a stream"""
         if stream_id in self.active_connections:
-            self.active_connections[stream_id].discard(websocket)
+            subscriber = self.active_connections[stream_id].pop(websocket, None)
+            if subscriber is not None:
+                subscriber.channel.unsubscribe(subscriber)
 
 # Global stream processor instance
 stream_processor = OptimizedStreamProcessor()
 
+# Cluster roles: a coordinator places cameras, an agent joins this node to one
+cluster_coordinator = ClusterCoordinator() if COORDINATOR_ENABLED else None
+cluster_agent = ClusterAgent(stream_processor) if COORDINATOR_URL else None
+discovery_engine = DiscoveryEngine()
+
+@app.on_event("startup")
+def join_cluster():
+    """Start heartbeating to the coordinator when this process is a cluster node"""
+    if cluster_agent is not None:
+        cluster_agent.start()
+
+@app.on_event("shutdown")
+def leave_cluster():
+    """Stop heartbeats; the coordinator moves this node's cameras after its TTL"""
+    if cluster_agent is not None:
+        cluster_agent.stop()
+
+@app.on_event("shutdown")
+def flush_results():
+    """Commit plate reads still queued for the results store"""
+    stream_processor.results_store.close()
+
+@app.on_event("shutdown")
+def stop_shards():
+    """Stop shard worker processes; each unlinks its shared memory"""
+    if stream_processor.shards is not None:
+        stream_processor.shards.shutdown()
+
 @app.get("/")
 async def root():
     """Root endpoint"""
@@ -367,30 +1035,60 @@ async def health():
         "active_streams": len(stream_processor.streams)
     }
 
+@app.get("/healthz")
+async def healthz():
+    """Liveness probe used by the Electron client"""
+    return {"status": "ok", "active_streams": len(stream_processor.streams)}
+
 @app.get("/discover")
-async def discover(ip: str = "192.168.4.252", user: str = "admin", password: str = "test1234", brand: str = "reolink"):
-    """Discover available cameras"""
-    return {
-        "candidates": [
-            f"rtsp://{user}:{password}@{ip}:554/h264Preview_01_sub",
-            f"rtsp://{user}:{password}@{ip}:554/h264Preview_01_main"
-        ]
-    }
+async def discover(ip: str = "192.168.4.252", user: str = "admin", password: str = "test1234", brand: str = "reolink",
+                   refresh: bool = Query(False)):
+    """Probe a camera's RTSP streams with DESCRIBE (codec, resolution and FPS from the SDP, no decoding)"""
+    return await discovery_engine.probe(ip, user, password, brand, refresh)
+
+@app.get("/discover/scan")
+async def discover_scan(subnet: str = Query(...), user: str = "admin", password: str = "", brand: str = "",
+                        refresh: bool = Query(False)):
+    """Find cameras on a subnet by WS-Discovery and concurrent RTSP probing"""
+    try:
+        return await discovery_engine.scan(subnet, user, password, brand, refresh)
+    except ValueError as e:
+        raise HTTPException(status_code=400, detail=str(e))
+
+@app.get("/discover/probe")
+async def discover_probe(url: str = Query(...)):
+    """DESCRIBE one RTSP URL and report its stream info"""
+    return await rtsp_describe(url)
+
+@app.get("/discovery_stats")
+async def discovery_stats():
+    """Get discovery concurrency and probe cache statistics"""
+    return discovery_engine.get_stats()
 
 from urllib.parse import unquote
 
 @app.post("/add_stream")
-async def add_stream(stream_id: str = Query(...), rtsp_url: str = Query(...), enable_ai: bool = Query(True)):
-    """Add a stream to the service"""
+async def add_stream(stream_id: str = Query(...), rtsp_url: str = Query(...), enable_ai: bool = Query(True),
+                     decode: str = Query(DEFAULT_DECODE_MODE), record: bool = Query(RECORD_BY_DEFAULT),
+                     main_url: Optional[str] = Query(None)):
+    """Add a stream to the service; main_url makes rtsp_url the sub-stream of a dual-stream camera"""
+    if decode not in DECODE_MODES:
+        raise HTTPException(status_code=400, detail=f"Unknown decode mode '{decode}', expected one of {list(DECODE_MODES)}")
     decoded_rtsp_url = unquote(rtsp_url)
-    success = stream_processor.add_stream(stream_id, decoded_rtsp_url)
+    success = stream_processor.add_stream(stream_id, decoded_rtsp_url, decode, enable_ai, record,
+                                          unquote(main_url) if main_url else None)
     if success:
         return {
             "success": True,
             "message": "Stream added successfully",
             "stream_id": stream_id,
             "rtsp_url": rtsp_url,
-            "enable_ai": enable_ai
+            "enable_ai": enable_ai,
+            "decode_mode": (stream_processor.streams[stream_id].decode_mode
+                            if stream_id in stream_processor.streams else decode),
+            "dual_stream": stream_id in stream_processor.main_streams,
+            "connection": stream_processor.connections.state(stream_id),
+            "recording": stream_processor.recorder.is_recording(stream_id)
         }
     else:
         raise HTTPException(status_code=400, detail="Failed to add stream")
@@ -420,67 +1118,349 @@ async def get_stream_info(stream_id: str):
         raise HTTPException(status_code=404, detail=info["error"])
     return info
 
+def frame_etag(rendition: str, seq: int) -> str:
+    return f'"{rendition}-{seq}"'
+
+def etag_seq(if_none_match: Optional[str], rendition: str) -> Optional[int]:
+    """Sequence number from an If-None-Match header issued for this rendition"""
+    if not if_none_match:
+        return None
+    prefix = f'"{rendition}-'
+    for tag in if_none_match.split(","):
+        tag = tag.strip()
+        if tag.startswith("W/"):
+            tag = tag[2:]
+        if tag.startswith(prefix) and tag.endswith('"'):
+            try:
+                return int(tag[len(prefix):-1])
+            except ValueError:
+                return None
+    return None
+
+# Longest a conditional /frame request may block waiting for a newer frame
+MAX_FRAME_WAIT = 10.0
+
 @app.get("/stream/{stream_id}/frame")
-async def get_stream_frame(stream_id: str, quality: int = None):
-    """Get the latest frame from a stream as JPEG"""
-    frame = stream_processor.get_latest_frame(stream_id)
-    if frame is None:
+async def get_stream_frame(stream_id: str, quality: int = None, rendition: Optional[str] = None,
+                           after_seq: Optional[int] = None, wait: float = 0.0,
+                           if_none_match: Optional[str] = Header(None)):
+    """Get the latest frame from a stream as JPEG
+    
+    Frames are served from the rendition's shared ring, never re-encoded.
+    With after_seq (or an If-None-Match ETag from an earlier response) only a
+    newer frame is returned: the request blocks up to wait seconds for one,
+    then answers 304 Not Modified.
+    """
+    # The legacy quality presets map onto the rendition ladder
+    target = resolve_rendition(rendition, quality if rendition is None else None)
+    if target is None:
+        raise HTTPException(status_code=400, detail=f"Unknown rendition '{rendition}', expected one of {list(RENDITIONS)}")
+    
+    channel = stream_processor.get_rendition_channel(stream_id, target)
+    if channel is None:
         raise HTTPException(status_code=404, detail="Stream not found or no frame available")
     
-    # Use requested quality or default
-    jpeg_quality = quality if quality is not None else stream_processor.jpeg_quality
+    # Polling clients keep the rendition encoding while they are active
+    stream_processor.note_snapshot_request(stream_id, target)
     
-    # Encode frame as JPEG
-    _, buffer = cv2.imencode('.jpg', frame, [cv2.IMWRITE_JPEG_QUALITY, jpeg_quality])
+    last_seq = after_seq if after_seq is not None else etag_seq(if_none_match, target)
+    wait = min(max(wait, 0.0), MAX_FRAME_WAIT)
+    ring = channel.ring
+    encoded = ring.latest()
     
-    return StreamingResponse(
-        io.BytesIO(buffer.tobytes()),
-        media_type="image/jpeg",
-        headers={"Cache-Control": "no-cache"}
-    )
+    # If nobody was consuming, decode was idle; wait briefly for a fresh frame.
+    # A conditional request waits for anything past the client's sequence
+    stale = encoded is None or time.time() - encoded.timestamp > 1.0
+    seen = last_seq is not None and encoded is not None and encoded.seq <= last_seq
+    if stale or (seen and wait > 0):
+        subscriber = stream_processor.subscribe_rendition(stream_id, target)
+        if subscriber is not None:
+            subscriber.cursor = max(ring.seq if stale else 0, last_seq or 0)
+            try:
+                fresh = await subscriber.next_frame(timeout=max(wait, 2.0 if stale else 0.0))
+            finally:
+                channel.unsubscribe(subscriber)
+            if fresh is not None:
+                encoded = fresh
+    
+    if encoded is None:
+        raise HTTPException(status_code=404, detail="Stream not found or no frame available")
+    
+    headers = {"Cache-Control": "no-cache", "ETag": frame_etag(target, encoded.seq),
+               "X-Frame-Seq": str(encoded.seq), "X-Frame-Timestamp": f"{encoded.timestamp:.6f}"}
+    if last_seq is not None and encoded.seq <= last_seq:
+        return Response(status_code=304, headers=headers)
+    return Response(content=encoded.data, media_type="image/jpeg", headers=headers)
+
+@app.get("/stream/{stream_id}/detections")
+async def get_stream_detections(stream_id: str):
+    """Get the latest AI detections for a stream"""
+    result = stream_processor.get_detections(stream_id)
+    if result is None:
+        raise HTTPException(status_code=404, detail="Stream not found")
+    return result
+
+@app.get("/results/latest")
+async def latest_results(limit: int = Query(50, ge=1, le=SEARCH_MAX_LIMIT)):
+    """Get the most recent license plate reads across all streams, including earlier runs"""
+    stored = await asyncio.get_running_loop().run_in_executor(None, stream_processor.results_store.latest, limit)
+    # Reads still queued for the store are only in the live feed
+    merged = {(result.get("id"), result.get("first_seen")): result for result in stored}
+    for result in stream_processor.ai.results.latest(limit):
+        merged[(result.get("id"), result.get("first_seen"))] = result
+    return sorted(merged.values(), key=lambda result: result.get("timestamp") or 0, reverse=True)[:limit]
+
+@app.get("/results/stream")
+async def results_stream(request: Request, since: Optional[int] = None,
+                         last_event_id: Optional[str] = Header(None)):
+    """Server-sent events: one `result` event per new or upgraded plate read
+
+    Each event's id is its change sequence number. Reconnecting with
+    Last-Event-ID (EventSource does this itself) or ?since= resumes after
+    it. A fresh connection, or one whose cursor the change log no longer
+    reaches, first gets a `reset` event: reload /results/latest, then
+    apply the events that follow.
+    """
+    feed = stream_processor.ai.results
+    if since is None and last_event_id and last_event_id.isdigit():
+        since = int(last_event_id)
+    
+    async def events():
+        loop = asyncio.get_running_loop()
+        wake = asyncio.Event()
+        feed.subscribe(wake, loop)
+        try:
+            yield "retry: 1000\n\n"
+            position = feed.seq
+            _, complete = feed.changes_since(since) if since is not None else (None, False)
+            if complete:
+                position = since
+            else:
+                yield f"id: {position}\nevent: reset\ndata: {json.dumps({'seq': position})}\n\n"
+            
+            while True:
+                # Cleared before reading, so a publish in between is not missed
+                wake.clear()
+                changes, complete = feed.changes_since(position)
+                if not complete:
+                    position = feed.seq
+                    yield f"id: {position}\nevent: reset\ndata: {json.dumps({'seq': position})}\n\n"
+                    continue
+                for seq, result in changes:
+                    position = seq
+                    yield f"id: {seq}\nevent: result\ndata: {json.dumps(result, default=str)}\n\n"
+                
+                try:
+                    await asyncio.wait_for(wake.wait(), timeout=15.0)
+                except asyncio.TimeoutError:
+                    if await request.is_disconnected():
+                        break
+                    yield ": heartbeat\n\n"
+        finally:
+            feed.unsubscribe(wake)
+    
+    return StreamingResponse(events(), media_type="text/event-stream",
+                             headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"})
+
+@app.get("/results/search")
+async def search_results(plate: Optional[str] = None, mode: str = "prefix", camera_id: Optional[str] = None,
+                         start: Optional[float] = None, end: Optional[float] = None,
+                         min_confidence: Optional[float] = None,
+                         limit: int = Query(50, ge=1, le=SEARCH_MAX_LIMIT), cursor: Optional[str] = None):
+    """Search stored plate reads; pass next_cursor back as cursor for the next page"""
+    if mode not in SEARCH_MODES:
+        raise HTTPException(status_code=400, detail=f"Unknown mode '{mode}', expected one of {list(SEARCH_MODES)}")
+    try:
+        return await asyncio.get_running_loop().run_in_executor(
+            None, lambda: stream_processor.results_store.search(
+                plate, mode, camera_id, start, end, min_confidence, limit, cursor))
+    except ValueError:
+        raise HTTPException(status_code=400, detail="Invalid cursor")
+
+@app.get("/results/export")
+async def export_results(format: str = "csv", plate: Optional[str] = None, mode: str = "prefix",
+                         camera_id: Optional[str] = None, start: Optional[float] = None,
+                         end: Optional[float] = None, min_confidence: Optional[float] = None):
+    """Stream every matching stored read, oldest first, as CSV, Parquet or a zip with plate crops"""
+    if format not in EXPORT_FORMATS:
+        raise HTTPException(status_code=400, detail=f"Unknown format '{format}', expected one of {list(EXPORT_FORMATS)}")
+    if mode not in SEARCH_MODES:
+        raise HTTPException(status_code=400, detail=f"Unknown mode '{mode}', expected one of {list(SEARCH_MODES)}")
+    if format == "parquet" and not parquet_available():
+        raise HTTPException(status_code=501, detail="Parquet export needs pyarrow")
+    
+    store = stream_processor.results_store
+    
+    def query():
+        return store.iter_results(plate, mode, camera_id, start, end, min_confidence)
+    
+    if format == "zip":
+        body = export_zip(query, store.crop_path)
+    elif format == "parquet":
+        body = export_parquet(query())
+    else:
+        body = export_csv(query())
+    
+    filename = f"plate_reads_{datetime.now().strftime('%Y%m%d_%H%M%S')}.{format}"
+    # Plain generators run in the threadpool, so store reads and zipping don't block the loop
+    return StreamingResponse(body, media_type=EXPORT_MEDIA_TYPES[format],
+                             headers={"Content-Disposition": f'attachment; filename="{filename}"'})
+
+@app.get("/results/crops/{crop:path}")
+async def get_plate_crop(crop: str):
+    """Plate crop JPEG saved with a stored read"""
+    path = stream_processor.results_store.crop_path(crop)
+    if path is None or not os.path.exists(path):
+        raise HTTPException(status_code=404, detail="Crop not found")
+    return FileResponse(path, media_type="image/jpeg")
+
+@app.get("/results/stats")
+async def results_stats():
+    """Get results store statistics"""
+    return stream_processor.results_store.get_stats()
+
+@app.post("/toggle_ai")
+async def toggle_ai(stream_id: Optional[str] = None, enabled: Optional[bool] = None):
+    """Enable/disable AI processing for one stream, or all streams when stream_id is omitted"""
+    targets = [stream_id] if stream_id else list(stream_processor.stream_urls.keys())
+    if stream_id and stream_id not in stream_processor.stream_urls:
+        raise HTTPException(status_code=404, detail="Stream not found")
+    
+    states = {}
+    for target in targets:
+        # Without an explicit value, flip the current state
+        value = enabled if enabled is not None else not stream_processor.ai_enabled.get(target, False)
+        stream_processor.set_ai_enabled(target, value)
+        states[target] = value
+    return {"success": True, "ai_enabled": states}
+
+@app.post("/set_quality")
+async def set_quality(stream_id: str, quality: Optional[int] = None, rendition: Optional[str] = None):
+    """Set the rendition a stream's JPEG viewers receive
+    
+    Takes a rendition name, or a legacy JPEG quality preset which is mapped
+    onto the ladder. Current WebSocket viewers are moved and new ones start
+    there; a single viewer can also switch itself over its WebSocket.
+    """
+    if stream_id not in stream_processor.stream_urls:
+        raise HTTPException(status_code=404, detail="Stream not found")
+    target = resolve_rendition(rendition, quality)
+    if target is None:
+        raise HTTPException(status_code=400, detail=f"Unknown rendition '{rendition}', expected one of {list(RENDITIONS)}")
+    moved = stream_processor.set_stream_rendition(stream_id, target)
+    return {
+        "success": True,
+        "stream_id": stream_id,
+        "rendition": RENDITIONS[target].to_dict(),
+        "viewers_moved": moved
+    }
+
+@app.get("/renditions")
+async def list_renditions():
+    """List the rendition ladder"""
+    return {"default": DEFAULT_RENDITION, "renditions": [r.to_dict() for r in RENDITIONS.values()]}
+
+@app.get("/ai_stats")
+async def ai_stats():
+    """Get AI performance statistics"""
+    return {**stream_processor.ai.get_stats(), "image_kernels": simd_features()}
 
 @app.websocket("/ws/stream/{stream_id}")
-async def websocket_stream(websocket: WebSocket, stream_id: str):
-    """WebSocket endpoint for streaming frames"""
+async def websocket_stream(websocket: WebSocket, stream_id: str, rendition: Optional[str] = None,
+                           quality: Optional[int] = None, overlay: bool = False):
+    """WebSocket endpoint for streaming frames
+    
+    The viewer picks a rendition with ?rendition= (or a legacy ?quality=)
+    and can switch at any time by sending {"type": "rendition", "rendition": ...}.
+    With ?overlay=true (or {"type": "overlay", "enabled": true}) each AI
+    result follows the frame it was run on as a {"type": "detections"}
+    message for the viewer to draw.
+    """
     await websocket.accept()
     
     # Check if stream exists
-    if stream_id not in stream_processor.streams:
+    if not stream_processor.has_stream(stream_id):
         await websocket.send_text(f"Error: Stream {stream_id} not found")
         await websocket.close()
         return
     
+    requested = resolve_rendition(rendition, quality) if rendition or quality is not None else None
+    if rendition and requested is None:
+        await websocket.send_json({"type": "error", "message": f"Unknown rendition '{rendition}'"})
+        await websocket.close()
+        return
+    
     # Register WebSocket connection
-    await stream_processor.register_websocket(stream_id, websocket)
+    subscriber = await stream_processor.register_websocket(stream_id, websocket, requested)
+    if subscriber is None:
+        await websocket.send_text(f"Error: Stream {stream_id} not found")
+        await websocket.close()
+        return
     
+    overlay_on = overlay
+    overlay_version = 0
+    
+    async def receive_controls():
+        # Rendition switches and overlay toggles from the viewer; the sender picks them up below
+        nonlocal overlay_on
+        while True:
+            try:
+                message = json.loads(await websocket.receive_text())
+            except (WebSocketDisconnect, RuntimeError):
+                return
+            except (ValueError, KeyError, TypeError):
+                continue
+            if not isinstance(message, dict):
+                continue
+            if message.get("type") == "overlay":
+                overlay_on = bool(message.get("enabled"))
+                continue
+            if message.get("type") != "rendition":
+                continue
+            target = resolve_rendition(message.get("rendition"), message.get("quality"))
+            if target is not None:
+                stream_processor.set_websocket_rendition(stream_id, websocket, target)
+    
+    controls = asyncio.create_task(receive_controls())
     try:
         # Send initial stream info
         info = stream_processor.get_stream_info(stream_id)
         await websocket.send_json({"type": "info", "data": info})
+        await websocket.send_json({"type": "rendition", "data": RENDITIONS[subscriber.rendition].to_dict()})
         
-        # Stream frames
+        # Stream frames - the subscriber always jumps to the newest frame,
+        # so a slow client drops frames instead of slowing anyone else down
         while True:
             # Check if stream still exists
-            if stream_id not in stream_processor.streams:
+            if not stream_processor.has_stream(stream_id) or subscriber.channel.closed:
                 await websocket.send_text("Stream ended")
                 break
+            if controls.done():
+                break
             
-            try:
-                # Try to get frame from queue with timeout
-                if stream_id in stream_processor.frame_queues:
-                    try:
-                        # Non-blocking get with timeout
-                        frame_data = stream_processor.frame_queues[stream_id].get(timeout=1.0)
-                        await websocket.send_bytes(frame_data)
-                    except queue.Empty:
-                        # No frame available, send heartbeat
-                        await websocket.send_json({"type": "heartbeat"})
-                else:
-                    # Stream exists but no queue
-                    await asyncio.sleep(0.1)
-            except Exception as e:
-                print(f"Error sending frame via WebSocket: {e}")
-                await asyncio.sleep(0.1)
+            current = stream_processor.active_connections.get(stream_id, {}).get(websocket)
+            if current is not None and current is not subscriber:
+                subscriber = current
+                await websocket.send_json({"type": "rendition", "data": RENDITIONS[subscriber.rendition].to_dict()})
+            
+            frame = await subscriber.next_frame(timeout=1.0)
+            if frame is not None:
+                started = time.perf_counter()
+                await websocket.send_bytes(frame.data)
+                metrics.observe(stream_id, "send", time.perf_counter() - started)
+                metrics.observe(stream_id, "capture_to_send", time.time() - frame.timestamp)
+            
+            detections = stream_processor.overlay_message(stream_id, subscriber, overlay_version) if overlay_on else None
+            if detections is not None:
+                overlay_version = detections["version"]
+                await websocket.send_json(detections)
+                continue
+            
+            if frame is None:
+                if stream_processor.active_connections.get(stream_id, {}).get(websocket) is not subscriber:
+                    continue  # Switched rendition while waiting
+                # No frame available, send heartbeat
+                await websocket.send_json({"type": "heartbeat"})
     
     except WebSocketDisconnect:
         # Client disconnected
@@ -488,36 +1468,386 @@ async def websocket_stream(websocket: WebSocket, stream_id: str):
     except Exception as e:
         print(f"WebSocket error: {e}")
     finally:
+        controls.cancel()
         # Unregister WebSocket connection
         await stream_processor.unregister_websocket(stream_id, websocket)
 
+# Most capture-to-glass samples accepted from one client report
+GLASS_SAMPLES_MAX = 100
+
+@app.websocket("/ws/mux")
+async def websocket_mux(websocket: WebSocket):
+    """One WebSocket for any number of streams
+    
+    Control messages are JSON text: {"type": "subscribe", "stream_id", "rendition"},
+    {"type": "unsubscribe", "stream_id"} and {"type": "rendition", "stream_id",
+    "rendition"}. Frames are binary records (see stream_mux) coalesced per
+    send pass; the connection awaits each send, so a slow client skips to the
+    newest frame of every stream instead of queueing. Subscribing with
+    "overlay": true (or sending {"type": "overlay", "stream_id", "enabled"})
+    adds a {"type": "detections"} message after the frame each AI result
+    belongs to. Clients report capture-to-glass latency with
+    {"type": "latency", "stream_id", "samples": [seconds, ...]}.
+    """
+    await websocket.accept()
+    wake = asyncio.Event()
+    subscribed: Set[str] = set()
+    # stream_id -> overlay version last sent, for streams with the overlay on
+    overlays: Dict[str, int] = {}
+    # Replies are sent by the send loop so only one task writes to the socket
+    replies: List[Dict] = []
+    stream_processor.mux_connections.add(websocket)
+    
+    def subscriber_for(stream_id: str) -> Optional[StreamSubscriber]:
+        return stream_processor.active_connections.get(stream_id, {}).get(websocket)
+    
+    async def drop(stream_id: str):
+        subscribed.discard(stream_id)
+        overlays.pop(stream_id, None)
+        await stream_processor.unregister_websocket(stream_id, websocket)
+    
+    def reply(message: Dict):
+        replies.append(message)
+        wake.set()
+    
+    def set_overlay(stream_id: str, enabled):
+        if enabled:
+            overlays.setdefault(stream_id, 0)
+        else:
+            overlays.pop(stream_id, None)
+    
+    async def handle_control(message: Dict):
+        kind = message.get("type")
+        stream_id = message.get("stream_id")
+        if not isinstance(stream_id, str):
+            return
+        if kind == "subscribe":
+            target = resolve_rendition(message.get("rendition"), message.get("quality"))
+            if not stream_processor.has_stream(stream_id) or target is None:
+                reply({"type": "error", "stream_id": stream_id,
+                       "message": f"Stream {stream_id} not found" if target else "Unknown rendition"})
+                return
+            if stream_id in subscribed:
+                stream_processor.set_websocket_rendition(stream_id, websocket, target)
+                set_overlay(stream_id, message.get("overlay"))
+                return
+            if await stream_processor.register_websocket(stream_id, websocket, target, wake) is None:
+                return
+            subscribed.add(stream_id)
+            set_overlay(stream_id, message.get("overlay"))
+            reply({"type": "subscribed", "stream_id": stream_id, "rendition": RENDITIONS[target].to_dict(),
+                   "info": stream_processor.get_stream_info(stream_id)})
+        elif kind == "unsubscribe":
+            await drop(stream_id)
+            reply({"type": "unsubscribed", "stream_id": stream_id})
+        elif kind == "latency" and stream_id in subscribed:
+            # Capture-to-glass samples measured by the client off the frame header timestamp
+            samples = message.get("samples")
+            if isinstance(samples, list):
+                for seconds in samples[:GLASS_SAMPLES_MAX]:
+                    if isinstance(seconds, (int, float)) and 0 <= seconds < 60:
+                        metrics.observe(stream_id, "glass", float(seconds))
+        elif kind == "overlay" and stream_id in subscribed:
+            set_overlay(stream_id, message.get("enabled"))
+        elif kind == "rendition" and stream_id in subscribed:
+            target = resolve_rendition(message.get("rendition"), message.get("quality"))
+            if target is not None and stream_processor.set_websocket_rendition(stream_id, websocket, target):
+                reply({"type": "rendition", "stream_id": stream_id, "data": RENDITIONS[target].to_dict()})
+    
+    async def receive_controls():
+        while True:
+            try:
+                message = json.loads(await websocket.receive_text())
+            except (WebSocketDisconnect, RuntimeError):
+                return
+            except (ValueError, KeyError, TypeError):
+                continue
+            if isinstance(message, dict):
+                await handle_control(message)
+    
+    controls = asyncio.create_task(receive_controls())
+    try:
+        await websocket.send_json({"type": "hello", "renditions": list(RENDITIONS)})
+        
+        while not controls.done():
+            # Clear before polling so a publish during the pass is not lost
+            wake.clear()
+            while replies:
+                await websocket.send_json(replies.pop(0))
+            
+            batch = []
+            for stream_id in list(subscribed):
+                subscriber = subscriber_for(stream_id)
+                if subscriber is None or not stream_processor.has_stream(stream_id) or subscriber.channel.closed:
+                    await drop(stream_id)
+                    replies.append({"type": "ended", "stream_id": stream_id})
+                    continue
+                frame = subscriber.poll()
+                if frame is not None:
+                    batch.append((stream_id, subscriber.rendition, frame))
+            
+            # Overlays go after the frames they belong to
+            detections = []
+            for stream_id, version in list(overlays.items()):
+                subscriber = subscriber_for(stream_id)
+                message = stream_processor.overlay_message(stream_id, subscriber, version) if subscriber else None
+                if message is not None:
+                    overlays[stream_id] = message["version"]
+                    detections.append(message)
+            
+            if batch or replies or detections:
+                started = time.perf_counter()
+                for message in pack_batch(batch):
+                    await websocket.send_bytes(message)
+                if batch:
+                    elapsed, sent = time.perf_counter() - started, time.time()
+                    for stream_id, _, frame in batch:
+                        metrics.observe(stream_id, "send", elapsed)
+                        metrics.observe(stream_id, "capture_to_send", sent - frame.timestamp)
+                for message in detections:
+                    await websocket.send_json(message)
+                continue
+            
+            try:
+                await asyncio.wait_for(wake.wait(), 1.0)
+            except asyncio.TimeoutError:
+                await websocket.send_json({"type": "heartbeat"})
+    
+    except WebSocketDisconnect:
+        print("Mux WebSocket client disconnected")
+    except Exception as e:
+        print(f"Mux WebSocket error: {e}")
+    finally:
+        controls.cancel()
+        stream_processor.mux_connections.discard(websocket)
+        for stream_id in list(subscribed):
+            await stream_processor.unregister_websocket(stream_id, websocket)
+
+@app.websocket("/ws/passthrough/{stream_id}")
+async def websocket_passthrough(websocket: WebSocket, stream_id: str):
+    """WebSocket endpoint streaming the camera's own H.264/H.265 as fragmented MP4
+    
+    The first message is JSON with the MSE mime type, then the init segment
+    and media fragments follow as binary messages. When the remuxer restarts
+    another init message with "reset": true precedes the new init segment,
+    since the new timeline starts over and the viewer must rebuild its buffer.
+    """
+    await websocket.accept()
+    
+    rtsp_url = stream_processor.packet_url(stream_id)
+    if rtsp_url is None:
+        await websocket.send_json({"type": "error", "message": f"Stream {stream_id} not found"})
+        await websocket.close()
+        return
+    if not ffmpeg_available():
+        await websocket.send_json({"type": "error", "message": "Passthrough unavailable: ffmpeg not found"})
+        await websocket.close()
+        return
+    
+    stream = stream_processor.passthrough.get(stream_id, rtsp_url)
+    subscriber = stream.subscribe(asyncio.get_running_loop())
+    try:
+        # The codec is only known once the remuxer has written the init segment
+        ready = await asyncio.get_running_loop().run_in_executor(None, stream.wait_ready, 10.0)
+        if not ready or stream.codec is None:
+            await websocket.send_json({"type": "error", "message": "Passthrough remuxer did not start"})
+            return
+        await websocket.send_json({"type": "init", "codec": stream.codec, "mime": stream.mime_type})
+        
+        while True:
+            if stream_id not in stream_processor.stream_urls or stream.closed:
+                await websocket.send_text("Stream ended")
+                break
+            
+            fragment = await subscriber.next_fragment(timeout=1.0)
+            if subscriber.restarted and fragment is not None:
+                subscriber.restarted = False
+                await websocket.send_json({"type": "init", "codec": stream.codec,
+                                           "mime": stream.mime_type, "reset": True})
+            if fragment is None:
+                await websocket.send_json({"type": "heartbeat"})
+                continue
+            
+            await websocket.send_bytes(fragment)
+    
+    except WebSocketDisconnect:
+        print(f"Passthrough client disconnected from stream {stream_id}")
+    except Exception as e:
+        print(f"Passthrough WebSocket error: {e}")
+    finally:
+        stream.unsubscribe(subscriber)
+
+@app.post("/recording/{stream_id}/start")
+async def start_recording(stream_id: str):
+    """Start continuous recording of a stream"""
+    if stream_id not in stream_processor.stream_urls:
+        raise HTTPException(status_code=404, detail="Stream not found")
+    if not stream_processor.start_recording(stream_id):
+        raise HTTPException(status_code=503, detail="Recording unavailable: ffmpeg not found")
+    return {"success": True, "stream_id": stream_id, "recording": True}
+
+@app.post("/recording/{stream_id}/stop")
+async def stop_recording(stream_id: str):
+    """Stop recording a stream; recorded segments are kept"""
+    stream_processor.recorder.stop(stream_id)
+    return {"success": True, "stream_id": stream_id, "recording": False}
+
+@app.get("/recordings/{stream_id}")
+async def list_recordings(stream_id: str, start: float = Query(0.0), end: Optional[float] = Query(None)):
+    """Recorded segments overlapping a time range (Unix seconds)"""
+    end = time.time() if end is None else end
+    if end < start:
+        raise HTTPException(status_code=400, detail="end must not precede start")
+    segments = await asyncio.get_running_loop().run_in_executor(
+        None, stream_processor.recorder.list_segments, stream_id, start, end)
+    return {"stream_id": stream_id, "start": start, "end": end, "segments": segments}
+
+@app.get("/recordings/{stream_id}/export")
+async def export_recording(stream_id: str, start: float = Query(...), end: float = Query(...)):
+    """Recorded video for a time range as fragmented MP4, from the keyframe before start"""
+    if end < start:
+        raise HTTPException(status_code=400, detail="end must not precede start")
+    chunks = stream_processor.recorder.export(stream_id, start, end)
+    if chunks is None:
+        raise HTTPException(status_code=404, detail="No recording in that range")
+    filename = f"{stream_id}_{int(start)}_{int(end)}.mp4"
+    # A plain generator runs in the threadpool, so file reads don't block the loop
+    return StreamingResponse(chunks, media_type="video/mp4",
+                             headers={"Content-Disposition": f'attachment; filename="{filename}"'})
+
+@app.get("/recording_stats")
+async def recording_stats():
+    """Get recording statistics"""
+    return stream_processor.recorder.get_stats()
+
+@app.get("/events/clips")
+async def list_event_clips(stream_id: Optional[str] = None, limit: int = Query(50, ge=1, le=500)):
+    """Most recent event clips, optionally for one stream"""
+    return {"clips": stream_processor.events.list_clips(stream_id, limit)}
+
+@app.get("/events/clips/{clip_id}")
+async def get_event_clip(clip_id: str):
+    """Download an event clip as fragmented MP4"""
+    clip = stream_processor.events.get_clip(clip_id)
+    if clip is None or not os.path.exists(clip.path):
+        raise HTTPException(status_code=404, detail="Clip not found")
+    if not clip.finished:
+        raise HTTPException(status_code=409, detail="Clip is still recording its post-roll")
+    return FileResponse(clip.path, media_type="video/mp4", filename=os.path.basename(clip.path))
+
+@app.get("/shard_stats")
+async def shard_stats():
+    """Get shard worker process statistics"""
+    if stream_processor.shards is None:
+        return {"workers": 0}
+    return await asyncio.get_running_loop().run_in_executor(None, stream_processor.shards.get_stats)
+
+def require_coordinator() -> ClusterCoordinator:
+    if cluster_coordinator is None:
+        raise HTTPException(status_code=404, detail="This service is not a cluster coordinator (set CCTV_CLUSTER_COORDINATOR=1)")
+    return cluster_coordinator
+
+@app.post("/cluster/heartbeat")
+async def cluster_heartbeat(request: Request):
+    """Node heartbeat; returns the streams placed on the node"""
+    coordinator = require_coordinator()
+    try:
+        payload = await request.json()
+        return coordinator.heartbeat(str(payload["node_id"]), str(payload["url"]), int(payload["decode_slots"]),
+                                     int(payload.get("gpus", 0)), [str(s) for s in payload.get("streams", [])],
+                                     {str(k): str(v) for k, v in (payload.get("states") or {}).items()})
+    except (KeyError, TypeError, ValueError) as e:
+        raise HTTPException(status_code=400, detail=f"Malformed heartbeat: {e}")
+
+@app.post("/cluster/add_stream")
+async def cluster_add_stream(stream_id: str = Query(...), rtsp_url: str = Query(...), enable_ai: bool = Query(True),
+                             decode: str = Query(DEFAULT_DECODE_MODE), record: bool = Query(RECORD_BY_DEFAULT),
+                             main_url: Optional[str] = Query(None)):
+    """Add a camera to the cluster catalog; the node it hashes to starts it on its next heartbeat"""
+    coordinator = require_coordinator()
+    if decode not in DECODE_MODES:
+        raise HTTPException(status_code=400, detail=f"Unknown decode mode '{decode}', expected one of {list(DECODE_MODES)}")
+    node = coordinator.add_camera(stream_id, unquote(rtsp_url), decode, enable_ai, record,
+                                  unquote(main_url) if main_url else None)
+    return {
+        "success": True,
+        "stream_id": stream_id,
+        "node": node.node_id if node is not None else None,
+        "url": node.url if node is not None else None,
+    }
+
+@app.delete("/cluster/remove_stream/{stream_id}")
+async def cluster_remove_stream(stream_id: str):
+    """Remove a camera from the cluster catalog"""
+    if not require_coordinator().remove_camera(stream_id):
+        raise HTTPException(status_code=404, detail="Camera not in the cluster catalog")
+    return {"success": True, "message": "Camera removed from the cluster"}
+
+@app.get("/cluster/routes")
+async def cluster_routes():
+    """Routing table the Electron client uses to find each camera's node"""
+    return require_coordinator().routes()
+
+@app.get("/cluster/status")
+async def cluster_status():
+    """Get coordinator and node agent state"""
+    return {
+        "coordinator": cluster_coordinator.get_stats() if cluster_coordinator is not None else None,
+        "node": cluster_agent.get_stats() if cluster_agent is not None else None,
+    }
+
+@app.get("/metrics")
+async def prometheus_metrics():
+    """Stage histograms, frame and AI counters, reconnects and queue depths in the Prometheus text format"""
+    return Response(metrics.render(), media_type="text/plain; version=0.0.4; charset=utf-8")
+
+@app.get("/stage_stats")
+async def stage_stats():
+    """Per-stream stage timings (mean, p50, p95) and the slowest stage of each stream"""
+    return stream_processor.get_stage_stats()
+
+@app.get("/connection_stats")
+async def connection_stats():
+    """Get camera connection states, retry backoff and connect latencies"""
+    return stream_processor.connections.get_stats()
+
+@app.get("/event_stats")
+async def event_stats():
+    """Get pre-roll ring and event clip statistics"""
+    return stream_processor.events.get_stats()
+
 @app.get("/stream/{stream_id}/mjpeg")
-async def mjpeg_stream(stream_id: str):
-    """Stream as MJPEG (Motion JPEG)"""
-    if stream_id not in stream_processor.streams:
+async def mjpeg_stream(stream_id: str, rendition: str = DEFAULT_RENDITION):
+    """Stream as MJPEG (Motion JPEG)
+    
+    Each part carries Content-Length and the capture time as X-Frame-Timestamp.
+    """
+    if not stream_processor.has_stream(stream_id):
         raise HTTPException(status_code=404, detail="Stream not found")
+    if rendition not in RENDITIONS:
+        raise HTTPException(status_code=400, detail=f"Unknown rendition '{rendition}', expected one of {list(RENDITIONS)}")
     
     async def generate_mjpeg():
         """Generate MJPEG stream"""
         # MJPEG header
         boundary = "frame"
-        mjpeg_header = f"--{boundary}\r\nContent-Type: image/jpeg\r\n\r\n"
         
-        while True:
-            if stream_id not in stream_processor.streams:
-                break
-            
-            frame = stream_processor.get_latest_frame(stream_id)
-            if frame is not None:
-                # Encode frame as JPEG
-                _, buffer = cv2.imencode('.jpg', frame, [cv2.IMWRITE_JPEG_QUALITY, stream_processor.jpeg_quality])
-                frame_bytes = buffer.tobytes()
-                
-                # Yield MJPEG part
-                yield (mjpeg_header + frame_bytes.decode('latin1') + "\r\n").encode('latin1')
-            
-            # Control frame rate
-            await asyncio.sleep(1.0 / stream_processor.max_fps)
+        subscriber = stream_processor.subscribe_rendition(stream_id, rendition)
+        if subscriber is None:
+            return
+        channel = subscriber.channel
+        
+        try:
+            while stream_processor.has_stream(stream_id) and not channel.closed:
+                # Await the next frame this client has not seen yet
+                frame = await subscriber.next_frame(timeout=1.0)
+                if frame is not None:
+                    # Yield MJPEG part
+                    header = (f"--{boundary}\r\nContent-Type: image/jpeg\r\nContent-Length: {len(frame.data)}\r\n"
+                              f"X-Frame-Timestamp: {frame.timestamp:.6f}\r\n\r\n")
+                    yield header.encode('latin1') + frame.data + b"\r\n"
+        finally:
+            channel.unsubscribe(subscriber)
     
     return StreamingResponse(
         generate_mjpeg(),
@@ -533,7 +1863,7 @@ if __name__ == "__main__":
     print("Starting Optimized CCTV Service...")
     uvicorn.run(
         app,
-        host="127.0.0.1",
-        port=8091,
+        host=os.environ.get("CCTV_SERVICE_HOST", "127.0.0.1"),
+        port=int(os.environ.get("CCTV_SERVICE_PORT", 8091)),
         log_level="info"
     )
@@ -21,7 +21,14 @@ def install_requirements():
 
 def download_yolo_model():
     """Download YOLO model if not present"""
-    model_path = "yolov8n.pt"
+    model_path = os.environ.get("AI_MODEL_PATH", "yolov8n.pt")
+    if model_path.lower().endswith(".onnx"):
+        # ONNX models run through ONNX Runtime and are never downloaded
+        if not os.path.exists(model_path):
+            print(f"[ERROR] ONNX model not found: {model_path}")
+            return False
+        print("[OK] ONNX model found")
+        return True
     if not os.path.exists(model_path):
         print("Downloading YOLO model...")
         try:
@@ -0,0 +1,124 @@
+"""
+Per-Stream Broadcast Channel
+Async pub/sub on top of the shared encoded-frame ring
+"""
+
+import asyncio
+from typing import Optional, Set
+
+from frame_ring import EncodedFrame, EncodedFrameRing
+
+
+class StreamSubscriber:
+    """One consumer of a stream channel with its own cursor
+
+    Delivery is latest-frame-wins: a slow subscriber skips straight to the
+    newest frame instead of queueing, so its FPS never affects other viewers.
+    """
+
+    def __init__(self, channel: "StreamChannel", owner=None, event: Optional[asyncio.Event] = None):
+        self.channel = channel
+        self.owner = owner
+        self.rendition: Optional[str] = None
+        self.cursor = 0
+        self.sent_frames = 0
+        self.dropped_frames = 0
+        # Subscribers of one connection may share an event to wait on many streams
+        self.event = event if event is not None else asyncio.Event()
+
+    def _take(self, frame: EncodedFrame) -> EncodedFrame:
+        if self.cursor:
+            self.dropped_frames += max(0, frame.seq - self.cursor - 1)
+        self.cursor = frame.seq
+        self.sent_frames += 1
+        return frame
+
+    def poll(self) -> Optional[EncodedFrame]:
+        """Take the newest unseen frame without waiting"""
+        frame = self.channel.ring.get_newer(self.cursor)
+        return self._take(frame) if frame is not None else None
+
+    async def next_frame(self, timeout: Optional[float] = None) -> Optional[EncodedFrame]:
+        """Await the newest frame this subscriber has not seen yet"""
+        ring = self.channel.ring
+        frame = ring.get_newer(self.cursor)
+        if frame is not None:
+            return self._take(frame)
+
+        # Clear before re-checking so a publish between the two can't be lost
+        self.event.clear()
+        frame = ring.get_newer(self.cursor)
+        if frame is not None:
+            return self._take(frame)
+
+        if self.channel.closed:
+            return None
+
+        try:
+            await asyncio.wait_for(self.event.wait(), timeout)
+        except asyncio.TimeoutError:
+            return None
+
+        frame = ring.get_newer(self.cursor)
+        return self._take(frame) if frame is not None else None
+
+    def wake(self):
+        """Wake this subscriber (must run on the event loop thread)"""
+        self.event.set()
+
+
+class StreamChannel:
+    """Broadcast channel for one stream
+
+    The capture thread publishes through the channel, which stores the frame
+    in the ring and wakes every subscriber on the event loop without blocking
+    it.
+    """
+
+    def __init__(self, ring: EncodedFrameRing):
+        self.ring = ring
+        self.subscribers: Set[StreamSubscriber] = set()
+        self.closed = False
+        self._loop: Optional[asyncio.AbstractEventLoop] = None
+
+    def bind_loop(self, loop: asyncio.AbstractEventLoop):
+        """Bind the event loop that subscribers run on"""
+        self._loop = loop
+
+    def subscribe(self, owner=None, event: Optional[asyncio.Event] = None) -> StreamSubscriber:
+        """Create a new subscriber starting at the current frame"""
+        if self._loop is None:
+            self._loop = asyncio.get_running_loop()
+        subscriber = StreamSubscriber(self, owner, event)
+        self.subscribers.add(subscriber)
+        return subscriber
+
+    def unsubscribe(self, subscriber: StreamSubscriber):
+        """Remove a subscriber"""
+        self.subscribers.discard(subscriber)
+
+    def publish(self, data: bytes, width: int = 0, height: int = 0,
+                timestamp: Optional[float] = None) -> EncodedFrame:
+        """Publish an encoded frame from any thread"""
+        frame = self.ring.publish(data, width, height, timestamp)
+        self.notify_threadsafe()
+        return frame
+
+    def notify_threadsafe(self):
+        """Wake subscribers from a non-loop thread"""
+        loop = self._loop
+        if loop is None or not self.subscribers or loop.is_closed():
+            return
+        try:
+            loop.call_soon_threadsafe(self._wake_all)
+        except RuntimeError:
+            pass  # Loop shut down under us
+
+    def _wake_all(self):
+        for subscriber in list(self.subscribers):
+            subscriber.wake()
+
+    def close(self):
+        """Close the channel and release every waiting subscriber"""
+        self.closed = True
+        self.notify_threadsafe()
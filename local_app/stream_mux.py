@@ -0,0 +1,50 @@
+"""
+Stream Multiplexing
+Binary framing for many camera streams over one WebSocket
+"""
+
+import os
+import struct
+from typing import Iterable, List, Tuple
+
+from frame_ring import EncodedFrame
+from renditions import RENDITIONS
+
+MUX_VERSION = 1
+
+# Per-frame record header, network byte order: version, rendition code,
+# stream id length, sequence, timestamp (seconds), payload length. The
+# UTF-8 stream id and the JPEG payload follow it
+MUX_HEADER = struct.Struct("!BBHIdI")
+
+# Rendition codes are ladder positions; clients get the names in the hello message
+RENDITION_CODES = {name: code for code, name in enumerate(RENDITIONS)}
+
+# Records sent in one pass are coalesced into messages of up to this size
+MUX_MAX_MESSAGE_BYTES = int(os.environ.get("CCTV_MUX_MAX_MESSAGE_BYTES", 1 << 20))
+
+
+def pack_frame(stream_id: str, rendition: str, frame: EncodedFrame) -> bytes:
+    """Frame record: header, stream id, payload"""
+    stream_key = stream_id.encode("utf-8")
+    header = MUX_HEADER.pack(MUX_VERSION, RENDITION_CODES.get(rendition, 0), len(stream_key),
+                             frame.seq & 0xFFFFFFFF, frame.timestamp, len(frame.data))
+    return b"".join((header, stream_key, frame.data))
+
+
+def pack_batch(frames: Iterable[Tuple[str, str, EncodedFrame]],
+               max_bytes: int = MUX_MAX_MESSAGE_BYTES) -> List[bytes]:
+    """Coalesce frame records into as few WebSocket messages as the size cap allows"""
+    messages: List[bytes] = []
+    pending: List[bytes] = []
+    size = 0
+    for stream_id, rendition, frame in frames:
+        record = pack_frame(stream_id, rendition, frame)
+        if pending and size + len(record) > max_bytes:
+            messages.append(b"".join(pending))
+            pending, size = [], 0
+        pending.append(record)
+        size += len(record)
+    if pending:
+        messages.append(b"".join(pending))
+    return messages
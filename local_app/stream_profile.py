@@ -0,0 +1,152 @@
+"""
+Dual-Stream Profiles
+Sub-stream for AI and grid tiles, main stream opened on demand for detail
+"""
+
+import os
+import threading
+import time
+from typing import Dict, Iterable, List, Optional, Tuple
+
+from capture_source import CaptureSource
+from frame_pool import FrameHandle, FramePool
+from renditions import RENDITIONS
+
+# The main stream is closed once nothing has wanted it for this long
+MAIN_STREAM_IDLE_SECONDS = float(os.environ.get("CCTV_MAIN_STREAM_IDLE", 10.0))
+# Decode rate kept up while only plate reading wants main-stream frames
+MAIN_DETAIL_FPS = float(os.environ.get("CCTV_MAIN_DETAIL_FPS", 5.0))
+# A main frame older than this is too far from the sub frame it stands in for
+MAIN_DETAIL_MAX_AGE = 0.5
+
+
+class MainStream:
+    """The full-resolution stream of a camera added with a sub-stream profile
+
+    The sub-stream is the stream's regular capture and carries motion
+    gating, detection and the renditions it is wide enough for. This one
+    is opened when a viewer watches a wider rendition or plate reading
+    asks for detail, and closed after MAIN_STREAM_IDLE_SECONDS without
+    either, so a wall of tiles only ever decodes sub-streams.
+    """
+
+    def __init__(self, rtsp_url: str, decode_mode: str):
+        self.rtsp_url = rtsp_url
+        self.decode_mode = decode_mode
+        self.cap: Optional[CaptureSource] = None
+        self.pool = FramePool()
+        self.sub_width = 0  # Set by the sub-stream capture once it decodes
+        self.rendition_encode_times: Dict[str, float] = {}
+        self.last_decode_time = 0.0
+        self.last_view_demand = 0.0
+        self.last_detail_demand = 0.0
+        self.connecting = False  # Waiting on the connection manager
+        self.consecutive_failures = 0
+        self._latest: Optional[FrameHandle] = None
+        self._latest_time = 0.0
+        self._lock = threading.Lock()
+
+        # Stats
+        self.opens = 0
+        self.decoded_frames = 0
+        self.detail_served = 0
+        self.detail_missed = 0
+        self.open_seconds = 0.0
+        self._opened_at = 0.0
+
+    @property
+    def ready(self) -> bool:
+        return self.cap is not None and self.cap.isOpened() and self._latest is not None
+
+    def split(self, names: Iterable[str]) -> Tuple[List[str], List[str]]:
+        """Split watched renditions into (sub-stream, main-stream) ones
+
+        Renditions wider than the sub-stream want the main stream; until it
+        is open and decoding they are served from the sub-stream.
+        """
+        names = list(names)
+        detail = self.wide(names)
+        if not detail:
+            return names, []
+        self.last_view_demand = time.time()
+        if not self.ready:
+            return names, []
+        return [name for name in names if name not in detail], detail
+
+    def wide(self, names: Iterable[str]) -> List[str]:
+        """Renditions wider than the sub-stream"""
+        if not self.sub_width:
+            return []
+        return [name for name in names if (RENDITIONS[name].max_width or 1 << 30) > self.sub_width]
+
+    def wanted(self, now: float) -> bool:
+        return now - max(self.last_view_demand, self.last_detail_demand) < MAIN_STREAM_IDLE_SECONDS
+
+    def detail_wanted(self, now: float) -> bool:
+        return now - self.last_detail_demand < MAIN_STREAM_IDLE_SECONDS
+
+    def open_capture(self, key: str, rtsp_url: str, decode_mode: str) -> Optional[CaptureSource]:
+        """Opener for the connection manager"""
+        cap = CaptureSource(rtsp_url, decode_mode)
+        if not cap.isOpened():
+            cap.release()
+            return None
+        return cap
+
+    def attach(self, cap: CaptureSource):
+        """Take the capture the connection manager opened"""
+        self.cap = cap
+        self.opens += 1
+        self._opened_at = time.time()
+        self.consecutive_failures = 0
+        self.connecting = False
+
+    def close(self):
+        self.connecting = False
+        self._set_latest(None)
+        if self.cap is not None:
+            self.cap.release()
+            self.cap = None
+            self.open_seconds += time.time() - self._opened_at
+
+    def _set_latest(self, handle: Optional[FrameHandle]):
+        with self._lock:
+            previous, self._latest = self._latest, handle
+            self._latest_time = time.time()
+        if previous is not None:
+            previous.release()
+
+    def store_latest(self, handle: FrameHandle):
+        """Keep a decoded main frame for plate reading"""
+        self._set_latest(handle.retain())
+
+    def acquire_detail(self) -> Optional[FrameHandle]:
+        """A retained recent main-stream frame for plate crops, or None
+
+        Asking keeps the main stream open (and opens it if it is closed), so
+        the next vehicles on this camera are read at full resolution.
+        """
+        now = time.time()
+        self.last_detail_demand = now
+        with self._lock:
+            handle = self._latest
+            if handle is not None and now - self._latest_time <= MAIN_DETAIL_MAX_AGE:
+                self.detail_served += 1
+                return handle.retain()
+        self.detail_missed += 1
+        return None
+
+    def get_stats(self) -> Dict:
+        now = time.time()
+        return {
+            "main_url": self.rtsp_url,
+            "open": self.cap is not None,
+            "decode_mode": self.cap.decode_mode if self.cap is not None else None,
+            "sub_width": self.sub_width,
+            "opens": self.opens,
+            "open_seconds": round(self.open_seconds + (now - self._opened_at if self.cap is not None else 0.0), 1),
+            "decoded_frames": self.decoded_frames,
+            "detail_served": self.detail_served,
+            "detail_missed": self.detail_missed,
+            "frame_pool": self.pool.get_stats(),
+        }
@@ -0,0 +1,751 @@
+"""
+Stream Shards
+Capture/encode worker processes that publish frames through shared memory
+"""
+
+import itertools
+import json
+import os
+import struct
+import subprocess
+import sys
+import threading
+import time
+from concurrent.futures import Future
+from multiprocessing import shared_memory
+from typing import Dict, List, Optional, Tuple
+
+import cv2
+import numpy as np
+
+from capture_scheduler import CaptureScheduler
+from capture_source import CaptureSource, to_host
+from connection_manager import Backoff
+from frame_pool import FramePool
+from renditions import RENDITIONS, encode_renditions
+
+# 0 keeps capture in the API process; N spawns N worker processes
+SHARD_WORKERS = int(os.environ.get("CCTV_SHARD_WORKERS", 0))
+SHARD_SLOTS = int(os.environ.get("CCTV_SHARD_SLOTS", 3))
+SHARD_OPEN_TIMEOUT = 30.0
+SHARD_COMMAND_TIMEOUT = 5.0
+
+RENDITION_NAMES = tuple(RENDITIONS)
+
+# Control block, written only by the API process: per-rendition demand
+# deadline, AI frame requests and flags
+CONTROL = struct.Struct("<%ddQI4x" % len(RENDITION_NAMES))
+FLAG_PARKABLE = 1
+# Status block, written only by the worker: grabbed, decoded, AI requests
+# served, width, height, fps, opened, parked
+STATUS = struct.Struct("<QQQIIdII")
+# Latest sequence number of a rendition ring
+HEAD = struct.Struct("<Q")
+# Encoded frame slot: seq (0 while being written), timestamp, length, width, height
+SLOT = struct.Struct("<QdIII4x")
+# Raw frame slot for the AI stage: seq (0 while being written), timestamp, height, width, channels
+RAW = struct.Struct("<QdIII4x")
+ALIGN = 64
+
+
+def _align(size: int) -> int:
+    return (size + ALIGN - 1) // ALIGN * ALIGN
+
+
+class ShmLayout:
+    """Byte offsets of one stream's shared-memory block
+
+    Both processes derive it from the geometry the worker reports, so only
+    the geometry crosses the command pipe. Each rendition gets a ring of
+    slots sized at one byte per pixel of that rung (JPEG needs far less);
+    the raw slot holds one BGR frame at the stream's native size.
+    """
+
+    def __init__(self, width: int, height: int, slots: int = SHARD_SLOTS):
+        self.width = width
+        self.height = height
+        self.slots = slots
+        offset = 0
+        self.control = offset
+        offset += _align(CONTROL.size)
+        self.status = offset
+        offset += _align(STATUS.size)
+
+        self.renditions: Dict[str, Tuple[int, List[int], int]] = {}
+        for name in RENDITION_NAMES:
+            rung_width = min(RENDITIONS[name].max_width or width, width)
+            rung_height = max(1, height * rung_width // max(1, width))
+            capacity = rung_width * rung_height + 65536
+            head = offset
+            offset += _align(HEAD.size)
+            slot_offsets = []
+            for _ in range(slots):
+                slot_offsets.append(offset)
+                offset += _align(SLOT.size + capacity)
+            self.renditions[name] = (head, slot_offsets, capacity)
+
+        self.raw = offset
+        self.raw_capacity = width * height * 3
+        offset += _align(RAW.size + self.raw_capacity)
+        self.size = offset
+
+
+def _attach(name: str) -> shared_memory.SharedMemory:
+    """Open a worker's block without handing it to this process's resource tracker
+
+    The worker owns and unlinks the block; a tracked attach would unlink it
+    again (with a leak warning) when the API process exits.
+    """
+    try:
+        return shared_memory.SharedMemory(name=name, track=False)
+    except TypeError:
+        shm = shared_memory.SharedMemory(name=name)
+        if os.name == "posix":
+            from multiprocessing import resource_tracker
+            resource_tracker.unregister(shm._name, "shared_memory")
+        return shm
+
+
+class SharedStream:
+    """One stream's shared-memory block, seen from either side
+
+    The API process writes demand into the control block and reads encoded
+    frames and AI frames out; the worker reads the demand and writes the
+    status block and frames. Every field has exactly one writer, and frame
+    slots are seqlocked: the writer zeroes the slot's seq, fills it, then
+    stores the new seq, and a reader that sees the seq change while copying
+    drops the frame. In the API process it also stands in for the stream's
+    CaptureSource (isOpened, get, decode_mode).
+    """
+
+    def __init__(self, shm: shared_memory.SharedMemory, layout: ShmLayout, decode_mode: str,
+                 owner: bool = False):
+        self.shm = shm
+        self.buf = shm.buf
+        self.layout = layout
+        self.decode_mode = decode_mode
+        self.owner = owner
+        # Writer-side state
+        self._demand = [0.0] * len(RENDITION_NAMES)
+        self._ai_requests = 0
+        self._flags = 0
+        self._seqs = {name: 0 for name in RENDITION_NAMES}
+        self._raw_seq = 0
+        self.oversize = 0
+        # Reader-side state
+        self._seen = {name: 0 for name in RENDITION_NAMES}
+        self._raw_seen = 0
+        self._grabbed = 0
+        self._decoded = 0
+
+    @classmethod
+    def create(cls, name: str, layout: ShmLayout, decode_mode: str) -> "SharedStream":
+        # New blocks are zero-filled: no demand, nothing written yet
+        shm = shared_memory.SharedMemory(name=name, create=True, size=layout.size)
+        return cls(shm, layout, decode_mode, owner=True)
+
+    @classmethod
+    def attach(cls, reply: Dict) -> "SharedStream":
+        layout = ShmLayout(reply["width"], reply["height"], reply["slots"])
+        return cls(_attach(reply["shm"]), layout, reply["decode_mode"])
+
+    def close(self):
+        self.buf = None
+        try:
+            self.shm.close()
+        except BufferError:
+            pass  # A frame copy still holds a view; the mapping goes with the process
+        if self.owner:
+            try:
+                self.shm.unlink()
+            except FileNotFoundError:
+                pass
+
+    # API side
+
+    def set_demand(self, renditions: List[str], until: float, parkable: bool):
+        """Tell the worker which renditions to encode, until when, and whether it may park"""
+        for index, name in enumerate(RENDITION_NAMES):
+            self._demand[index] = until if name in renditions else 0.0
+        self._flags = FLAG_PARKABLE if parkable else 0
+        self._write_control()
+
+    def request_frame(self):
+        """Ask the worker for one raw frame for the AI stage"""
+        if self._ai_requests <= self.status()[2]:
+            self._ai_requests += 1
+            self._write_control()
+
+    def _write_control(self):
+        CONTROL.pack_into(self.buf, self.layout.control, *self._demand, self._ai_requests, self._flags)
+
+    def status(self) -> Tuple:
+        if self.buf is None:
+            return (0, 0, 0, 0, 0, 0.0, 0, 0)
+        return STATUS.unpack_from(self.buf, self.layout.status)
+
+    def poll_counters(self) -> Tuple[int, int]:
+        """Frames grabbed and decoded by the worker since the last poll"""
+        grabbed, decoded = self.status()[:2]
+        delta = (grabbed - self._grabbed, decoded - self._decoded)
+        self._grabbed, self._decoded = grabbed, decoded
+        return delta
+
+    @property
+    def parked(self) -> bool:
+        return bool(self.status()[7])
+
+    def isOpened(self) -> bool:
+        return self.buf is not None and bool(self.status()[6])
+
+    def get(self, prop_id: int) -> float:
+        _, _, _, width, height, fps, _, _ = self.status()
+        if prop_id == cv2.CAP_PROP_FRAME_WIDTH:
+            return float(width)
+        if prop_id == cv2.CAP_PROP_FRAME_HEIGHT:
+            return float(height)
+        if prop_id == cv2.CAP_PROP_FPS:
+            return fps
+        return 0.0
+
+    def release(self):
+        """The supervisor closes the block; the capture itself lives in the worker"""
+
+    def read_encoded(self, name: str) -> Optional[Tuple[bytes, int, int, float]]:
+        """The rendition's newest encoded frame if it wasn't read yet, as (data, width, height, timestamp)"""
+        head, slot_offsets, _ = self.layout.renditions[name]
+        latest, = HEAD.unpack_from(self.buf, head)
+        if latest <= self._seen[name]:
+            return None
+        offset = slot_offsets[latest % len(slot_offsets)]
+        seq, timestamp, length, width, height = SLOT.unpack_from(self.buf, offset)
+        if seq != latest:
+            return None
+        start = offset + SLOT.size
+        data = bytes(self.buf[start:start + length])
+        if SLOT.unpack_from(self.buf, offset)[0] != latest:
+            return None
+        self._seen[name] = latest
+        return data, width, height, timestamp
+
+    def read(self, out: Optional[np.ndarray] = None):
+        """Copy out the newest AI frame, with the CaptureSource.read signature FramePool expects"""
+        offset = self.layout.raw
+        seq, _, height, width, channels = RAW.unpack_from(self.buf, offset)
+        if seq == 0 or seq <= self._raw_seen:
+            return False, None
+        shape = (height, width, channels)
+        view = np.ndarray(shape, dtype=np.uint8, buffer=self.buf, offset=offset + RAW.size)
+        try:
+            if out is not None and out.shape == shape:
+                np.copyto(out, view)
+            else:
+                out = view.copy()
+        finally:
+            del view
+        if RAW.unpack_from(self.buf, offset)[0] != seq:
+            return False, None
+        self._raw_seen = seq
+        return True, out
+
+    # Worker side
+
+    def wanted(self, now: float) -> List[str]:
+        """Renditions the API process still has consumers for"""
+        control = CONTROL.unpack_from(self.buf, self.layout.control)
+        return [name for name, until in zip(RENDITION_NAMES, control) if until > now]
+
+    def ai_requests(self) -> int:
+        return CONTROL.unpack_from(self.buf, self.layout.control)[-2]
+
+    def parkable(self) -> bool:
+        return bool(CONTROL.unpack_from(self.buf, self.layout.control)[-1] & FLAG_PARKABLE)
+
+    def write_status(self, grabbed: int, decoded: int, ai_served: int, width: int, height: int,
+                     fps: float, opened: bool, parked: bool):
+        STATUS.pack_into(self.buf, self.layout.status, grabbed, decoded, ai_served, width, height,
+                         fps, int(opened), int(parked))
+
+    def write_encoded(self, name: str, data: bytes, width: int, height: int, timestamp: Optional[float] = None):
+        head, slot_offsets, capacity = self.layout.renditions[name]
+        if len(data) > capacity:
+            self.oversize += 1
+            return
+        seq = self._seqs[name] + 1
+        self._seqs[name] = seq
+        offset = slot_offsets[seq % len(slot_offsets)]
+        SLOT.pack_into(self.buf, offset, 0, 0.0, 0, 0, 0)
+        start = offset + SLOT.size
+        self.buf[start:start + len(data)] = data
+        SLOT.pack_into(self.buf, offset, seq, timestamp if timestamp is not None else time.time(),
+                       len(data), width, height)
+        HEAD.pack_into(self.buf, head, seq)
+
+    def write_frame(self, frame: np.ndarray):
+        height, width = frame.shape[:2]
+        channels = frame.shape[2] if frame.ndim == 3 else 1
+        if height * width * channels > self.layout.raw_capacity:
+            self.oversize += 1
+            return
+        offset = self.layout.raw
+        RAW.pack_into(self.buf, offset, 0, 0.0, 0, 0, 0)
+        view = np.ndarray(frame.shape, dtype=np.uint8, buffer=self.buf, offset=offset + RAW.size)
+        np.copyto(view, frame)
+        del view
+        self._raw_seq += 1
+        RAW.pack_into(self.buf, offset, self._raw_seq, time.time(), height, width, channels)
+
+
+class WorkerStream:
+    """One camera inside a shard worker: capture, rendition encode and the AI frame slot
+
+    Follows the API process's own capture loop: decode only while a
+    rendition or the AI stage wants a frame, grab and drop otherwise, park
+    when the API says only passthrough consumers remain, and reconnect
+    after repeated read failures.
+    """
+
+    def __init__(self, stream_id: str, rtsp_url: str, decode_mode: str):
+        self.stream_id = stream_id
+        self.rtsp_url = rtsp_url
+        self.decode_mode = decode_mode
+        self.cap = None
+        self.pool = FramePool()
+        self.shared: Optional[SharedStream] = None
+        self.width = 0
+        self.height = 0
+        self.fps = 0.0
+        self.parked = False
+        self.closed = False
+        self.last_successful_frame_time = time.time()
+        self.backoff = Backoff()
+        self.last_decode_time = 0.0
+        self.consecutive_failures = 0
+        self.encode_times: Dict[str, float] = {}
+        self.grabbed = 0
+        self.decoded = 0
+        self.ai_served = 0
+
+    def open(self) -> bool:
+        cap = CaptureSource(self.rtsp_url, self.decode_mode)
+        if not cap.isOpened():
+            cap.release()
+            return False
+        self.cap = cap
+        self.decode_mode = cap.decode_mode
+        self.width = int(cap.get(cv2.CAP_PROP_FRAME_WIDTH))
+        self.height = int(cap.get(cv2.CAP_PROP_FRAME_HEIGHT))
+        self.fps = cap.get(cv2.CAP_PROP_FPS)
+        if not self.width or not self.height:
+            handle = self.pool.read(cap)
+            if handle is None:
+                return False
+            self.height, self.width = handle.frame.shape[:2]
+            handle.release()
+        self.last_successful_frame_time = time.time()
+        self.consecutive_failures = 0
+        return True
+
+    def _release(self):
+        if self.cap is not None:
+            self.cap.release()
+            self.cap = None
+
+    def _reconnect(self) -> bool:
+        print(f"Attempting to reconnect stream {self.stream_id}...")
+        self._release()
+        try:
+            if self.open():
+                print(f"Successfully reconnected stream {self.stream_id}")
+                self.backoff.reset()
+                return True
+        except Exception as e:
+            print(f"Error reconnecting stream {self.stream_id}: {e}")
+        self._release()
+        delay = self.backoff.failed()
+        print(f"Retrying {self.stream_id} in {delay:.1f}s")
+        return False
+
+    def _publish_status(self):
+        self.shared.write_status(self.grabbed, self.decoded, self.ai_served, self.width, self.height,
+                                 self.fps, self.cap is not None or self.parked, self.parked)
+
+    def step(self) -> Optional[float]:
+        """One capture step, scheduled like the API process's own streams"""
+        if self.closed:
+            return None
+        shared = self.shared
+        now = time.time()
+        wanted = shared.wanted(now)
+        ai_requests = shared.ai_requests()
+        ai_wanted = ai_requests > self.ai_served
+
+        if not wanted and not ai_wanted and (self.parked or shared.parkable()):
+            if not self.parked:
+                self._release()
+                self.parked = True
+                self._publish_status()
+                print(f"Parked capture for {self.stream_id} (passthrough viewers or recording only)")
+            return 0.25
+        if self.parked:
+            self.parked = False
+            print(f"Resuming capture for {self.stream_id}")
+            if not self._reconnect():
+                self._publish_status()
+                return 0.5
+
+        cap = self.cap
+        if cap is None or not cap.isOpened() or now - self.last_successful_frame_time > 30:
+            if self.backoff.ready(now):
+                self._reconnect()
+            self._publish_status()
+            return 0.5
+
+        fps = min(30.0, max((RENDITIONS[name].max_fps for name in wanted), default=0.0))
+        view_due = fps > 0 and now - self.last_decode_time >= 1.0 / fps
+        handle = None
+        if view_due or ai_wanted:
+            if view_due:
+                self.last_decode_time = now
+            handle = self.pool.read(cap)
+            ok = handle is not None
+        else:
+            ok = cap.grab()
+
+        if not ok:
+            self.consecutive_failures += 1
+            if self.consecutive_failures >= 30 and self.backoff.ready(now):
+                self._reconnect()
+            return 0.033
+
+        self.consecutive_failures = 0
+        self.last_successful_frame_time = time.time()
+        self.grabbed += 1
+        if handle is not None:
+            self.decoded += 1
+            try:
+                if view_due:
+                    # Slots carry the capture time, which the API process publishes as the frame timestamp
+                    captured_at = self.last_successful_frame_time
+                    encode_renditions(handle.frame, wanted, self.encode_times, now,
+                                      lambda name, data, width, height:
+                                      shared.write_encoded(name, data, width, height, captured_at))
+                if ai_wanted:
+                    shared.write_frame(to_host(handle.frame))
+                    self.ai_served = ai_requests
+            finally:
+                handle.release()
+        self._publish_status()
+        return 0.0
+
+    def close(self):
+        self._release()
+        if self.shared is not None:
+            self.shared.close()
+            self.shared = None
+
+    def get_stats(self) -> Dict:
+        return {
+            "decode_mode": self.decode_mode,
+            "width": self.width,
+            "height": self.height,
+            "grabbed": self.grabbed,
+            "decoded": self.decoded,
+            "parked": self.parked,
+            "oversize_frames": self.shared.oversize if self.shared is not None else 0,
+            "frame_pool": self.pool.get_stats(),
+        }
+
+
+class ShardWorker:
+    """Worker process main: runs a CaptureScheduler over its streams and answers commands on stdin"""
+
+    def __init__(self, index: int, capture_threads: int):
+        self.index = index
+        self.scheduler = CaptureScheduler(capture_threads)
+        self.streams: Dict[str, WorkerStream] = {}
+        self._names = itertools.count()
+        self._lock = threading.Lock()
+
+    def add(self, stream_id: str, rtsp_url: str, decode_mode: str) -> Dict:
+        self.remove(stream_id)
+        stream = WorkerStream(stream_id, rtsp_url, decode_mode)
+        if not stream.open():
+            stream.close()
+            return {"ok": False, "error": f"Failed to open stream: {rtsp_url}"}
+
+        layout = ShmLayout(stream.width, stream.height)
+        name = f"cctv_{os.getpid()}_{next(self._names)}"
+        stream.shared = SharedStream.create(name, layout, stream.decode_mode)
+        stream._publish_status()
+        with self._lock:
+            self.streams[stream_id] = stream
+        self.scheduler.add(stream_id, stream.step, on_cancel=stream.close)
+        print(f"Shard {self.index} added stream {stream_id} (decode: {stream.decode_mode}, "
+              f"{stream.width}x{stream.height}, {layout.size // (1 << 20)} MB shared)")
+        return {"ok": True, "shm": name, "width": layout.width, "height": layout.height,
+                "slots": layout.slots, "decode_mode": stream.decode_mode}
+
+    def remove(self, stream_id: str) -> Dict:
+        with self._lock:
+            stream = self.streams.pop(stream_id, None)
+        if stream is not None:
+            # on_cancel closes the capture and unlinks the block once no thread holds it
+            self.scheduler.remove(stream_id)
+        return {"ok": True, "removed": stream is not None}
+
+    def get_stats(self) -> Dict:
+        with self._lock:
+            streams = dict(self.streams)
+        return {"ok": True, "pid": os.getpid(), "streams": {stream_id: stream.get_stats()
+                                                              for stream_id, stream in streams.items()}}
+
+    def handle(self, request: Dict) -> Dict:
+        op = request.get("op")
+        try:
+            if op == "add":
+                return self.add(request["stream_id"], request["rtsp_url"], request["decode_mode"])
+            if op == "remove":
+                return self.remove(request["stream_id"])
+            if op == "stats":
+                return self.get_stats()
+            return {"ok": False, "error": f"Unknown command {op!r}"}
+        except Exception as e:
+            return {"ok": False, "error": str(e)}
+
+    def shutdown(self):
+        with self._lock:
+            stream_ids = list(self.streams)
+        for stream_id in stream_ids:
+            self.remove(stream_id)
+        self.scheduler.shutdown()
+        # Cancelled tasks close as their workers finish the current step
+        time.sleep(0.5)
+
+
+def worker_main(index: int, capture_threads: int):
+    """Serve commands until the API process closes stdin"""
+    # stdout carries replies; anything else written to fd 1, by Python or
+    # by native libraries, goes to stderr instead
+    replies = os.fdopen(os.dup(sys.stdout.fileno()), "w")
+    os.dup2(sys.stderr.fileno(), sys.stdout.fileno())
+    sys.stdout = sys.stderr
+    worker = ShardWorker(index, capture_threads)
+    reply_lock = threading.Lock()
+
+    def respond(request: Dict):
+        reply = worker.handle(request)
+        reply["id"] = request.get("id")
+        with reply_lock:
+            replies.write(json.dumps(reply) + "\n")
+            replies.flush()
+
+    # Opening an RTSP stream can take seconds, so each command runs on its own thread
+    for line in sys.stdin:
+        try:
+            request = json.loads(line)
+        except ValueError:
+            continue
+        threading.Thread(target=respond, args=(request,), daemon=True).start()
+    worker.shutdown()
+
+
+class ShardProcess:
+    """API-side handle on one worker process and its JSON-lines command pipe"""
+
+    def __init__(self, index: int, capture_threads: int, on_exit):
+        self.index = index
+        self.on_exit = on_exit
+        self._ids = itertools.count(1)
+        self._pending: Dict[int, Future] = {}
+        self._lock = threading.Lock()
+        self.alive = True
+        here = os.path.dirname(os.path.abspath(__file__))
+        self.process = subprocess.Popen(
+            [sys.executable, os.path.join(here, "stream_shards.py"), "--worker", str(index), str(capture_threads)],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE, cwd=here, text=True, bufsize=1)
+        self._reader = threading.Thread(target=self._read_replies, name=f"shard-{index}-replies", daemon=True)
+        self._reader.start()
+
+    def _read_replies(self):
+        for line in self.process.stdout:
+            try:
+                reply = json.loads(line)
+            except ValueError:
+                continue
+            with self._lock:
+                future = self._pending.pop(reply.get("id"), None)
+            if future is not None:
+                future.set_result(reply)
+        # EOF: the worker exited
+        self.alive = False
+        with self._lock:
+            pending, self._pending = self._pending, {}
+        for future in pending.values():
+            future.set_exception(RuntimeError(f"Shard worker {self.index} exited"))
+        self.on_exit(self)
+
+    def request(self, op: str, timeout: float, **args) -> Dict:
+        """Send a command and wait for its reply; raises RuntimeError on failure"""
+        future: Future = Future()
+        with self._lock:
+            if not self.alive:
+                raise RuntimeError(f"Shard worker {self.index} is not running")
+            request_id = next(self._ids)
+            self._pending[request_id] = future
+            try:
+                self.process.stdin.write(json.dumps({"id": request_id, "op": op, **args}) + "\n")
+                self.process.stdin.flush()
+            except OSError as e:
+                self._pending.pop(request_id, None)
+                raise RuntimeError(f"Shard worker {self.index} pipe closed: {e}")
+        try:
+            reply = future.result(timeout)
+        except Exception:
+            with self._lock:
+                self._pending.pop(request_id, None)
+            raise
+        if not reply.get("ok"):
+            raise RuntimeError(reply.get("error", "shard command failed"))
+        return reply
+
+    def stop(self):
+        self.alive = False
+        try:
+            self.process.stdin.close()
+            self.process.wait(timeout=5)
+        except (OSError, subprocess.TimeoutExpired):
+            self.process.kill()
+
+
+class ShardSupervisor:
+    """Spreads streams over worker processes and restarts workers that die
+
+    Each worker owns the RTSP capture, decode and JPEG encode of its
+    streams in its own interpreter, so those no longer share one GIL. The
+    API process only routes add/remove, writes demand and copies the
+    finished frames out of shared memory. A worker that exits is restarted
+    and its streams re-added.
+    """
+
+    def __init__(self, workers: int = SHARD_WORKERS):
+        self.workers = max(1, workers)
+        self.capture_threads = max(2, (os.cpu_count() or 4) // self.workers)
+        self.processes: List[Optional[ShardProcess]] = [None] * self.workers
+        self.assignments: Dict[str, int] = {}
+        self.shared: Dict[str, SharedStream] = {}
+        self.sources: Dict[str, Tuple[str, str]] = {}
+        self._lock = threading.Lock()
+        self.running = True
+        self.restarts = 0
+
+    def _process(self, index: int) -> ShardProcess:
+        with self._lock:
+            process = self.processes[index]
+            if process is None or not process.alive:
+                process = ShardProcess(index, self.capture_threads, self._on_exit)
+                self.processes[index] = process
+                print(f"Started shard worker {index} (pid {process.process.pid})")
+            return process
+
+    def _least_loaded(self) -> int:
+        with self._lock:
+            loads = [0] * self.workers
+            for index in self.assignments.values():
+                loads[index] += 1
+        return min(range(self.workers), key=loads.__getitem__)
+
+    def add(self, stream_id: str, rtsp_url: str, decode_mode: str,
+            index: Optional[int] = None) -> Optional[SharedStream]:
+        """Open a stream on the least loaded worker; None if it failed to open"""
+        index = self._least_loaded() if index is None else index
+        try:
+            reply = self._process(index).request("add", SHARD_OPEN_TIMEOUT, stream_id=stream_id,
+                                                 rtsp_url=rtsp_url, decode_mode=decode_mode)
+            shared = SharedStream.attach(reply)
+        except Exception as e:
+            print(f"Shard worker {index} could not add {stream_id}: {e}")
+            return None
+        with self._lock:
+            previous = self.shared.get(stream_id)
+            self.assignments[stream_id] = index
+            self.shared[stream_id] = shared
+            self.sources[stream_id] = (rtsp_url, decode_mode)
+        if previous is not None:
+            previous.close()
+        return shared
+
+    def remove(self, stream_id: str):
+        with self._lock:
+            index = self.assignments.pop(stream_id, None)
+            shared = self.shared.pop(stream_id, None)
+            self.sources.pop(stream_id, None)
+            process = self.processes[index] if index is not None else None
+        if shared is not None:
+            shared.close()
+        if process is not None and process.alive:
+            try:
+                process.request("remove", SHARD_COMMAND_TIMEOUT, stream_id=stream_id)
+            except Exception as e:
+                print(f"Shard worker {index} could not remove {stream_id}: {e}")
+
+    def get(self, stream_id: str) -> Optional[SharedStream]:
+        return self.shared.get(stream_id)
+
+    def _on_exit(self, process: ShardProcess):
+        if not self.running:
+            return
+        print(f"Shard worker {process.index} exited (code {process.process.poll()}), restarting")
+        threading.Thread(target=self._restart, args=(process.index,), name=f"shard-{process.index}-restart",
+                         daemon=True).start()
+
+    def _restart(self, index: int):
+        self.restarts += 1
+        time.sleep(1.0)
+        with self._lock:
+            streams = [(stream_id, self.sources[stream_id]) for stream_id, assigned in self.assignments.items()
+                       if assigned == index]
+            # Readers see no stream until it is re-added
+            stale = [self.shared.pop(stream_id) for stream_id, _ in streams if stream_id in self.shared]
+        for shared in stale:
+            shared.close()
+        for stream_id, (rtsp_url, decode_mode) in streams:
+            if self.running and stream_id in self.assignments:
+                self.add(stream_id, rtsp_url, decode_mode, index)
+
+    def shutdown(self):
+        self.running = False
+        with self._lock:
+            processes = [process for process in self.processes if process is not None]
+            shared, self.shared = list(self.shared.values()), {}
+        for stream in shared:
+            stream.close()
+        for process in processes:
+            process.stop()
+
+    def get_stats(self) -> Dict:
+        workers = []
+        for index, process in enumerate(self.processes):
+            if process is None or not process.alive:
+                workers.append({"index": index, "running": False})
+                continue
+            try:
+                stats = process.request("stats", SHARD_COMMAND_TIMEOUT)
+            except Exception as e:
+                workers.append({"index": index, "running": True, "error": str(e)})
+                continue
+            workers.append({"index": index, "running": True, "pid": stats["pid"], "streams": stats["streams"]})
+        return {
+            "workers": self.workers,
+            "capture_threads_per_worker": self.capture_threads,
+            "streams": len(self.assignments),
+            "restarts": self.restarts,
+            "shards": workers,
+        }
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 4 and sys.argv[1] == "--worker":
+        worker_main(int(sys.argv[2]), int(sys.argv[3]))
+    else:
+        print("Usage: stream_shards.py --worker <index> <capture threads> (started by the service)")
@@ -0,0 +1,230 @@
+"""
+Multi-Object Tracker
+SORT-style Kalman tracks with ByteTrack two-pass IoU association
+"""
+
+import itertools
+import os
+import time
+from typing import Dict, Iterable, List, Optional, Tuple
+
+import numpy as np
+
+from detections import Detections
+
+
+def iou_matrix(a: np.ndarray, b: np.ndarray) -> np.ndarray:
+    """Pairwise IoU between (N, 4) and (M, 4) xyxy boxes"""
+    if len(a) == 0 or len(b) == 0:
+        return np.zeros((len(a), len(b)), np.float32)
+    x1 = np.maximum(a[:, None, 0], b[None, :, 0])
+    y1 = np.maximum(a[:, None, 1], b[None, :, 1])
+    x2 = np.minimum(a[:, None, 2], b[None, :, 2])
+    y2 = np.minimum(a[:, None, 3], b[None, :, 3])
+    inter = np.clip(x2 - x1, 0, None) * np.clip(y2 - y1, 0, None)
+    area_a = (a[:, 2] - a[:, 0]) * (a[:, 3] - a[:, 1])
+    area_b = (b[:, 2] - b[:, 0]) * (b[:, 3] - b[:, 1])
+    return inter / (area_a[:, None] + area_b[None, :] - inter + 1e-7)
+
+
+def greedy_match(scores: np.ndarray, threshold: float) -> List[Tuple[int, int]]:
+    """Greedy assignment on a score matrix, best pairs first"""
+    rows, cols = np.nonzero(scores >= threshold)
+    if len(rows) == 0:
+        return []
+    order = scores[rows, cols].argsort()[::-1]
+    used_rows, used_cols = set(), set()
+    matches = []
+    for i in order.tolist():
+        row, col = int(rows[i]), int(cols[i])
+        if row in used_rows or col in used_cols:
+            continue
+        used_rows.add(row)
+        used_cols.add(col)
+        matches.append((row, col))
+    return matches
+
+
+class Track:
+    """One tracked object with a constant-velocity Kalman filter
+
+    State is [cx, cy, area, aspect, vcx, vcy, varea] as in SORT, with
+    velocities per second so uneven detection intervals (striding, motion
+    gating) predict correctly. Plate reading state lives here too so each
+    vehicle is OCR'd once, plus again only when a clearly better crop shows up.
+    """
+
+    # Kalman model shared by all tracks
+    _H = np.eye(4, 7)
+    _R = np.diag([1.0, 1.0, 10.0, 0.01])
+    _Q = np.diag([1.0, 1.0, 1.0, 0.0001, 0.01, 0.01, 0.0001])
+
+    def __init__(self, track_id: int, box: np.ndarray, score: float, class_id: int, now: float):
+        self.track_id = track_id
+        self.class_id = class_id
+        self.score = score
+        self.x = np.zeros(7)
+        self.x[:4] = self._to_z(box)
+        self.P = np.diag([10.0, 10.0, 10.0, 10.0, 1e4, 1e4, 1e4])
+        self.first_seen = now
+        self.last_seen = now
+        self.last_predict = now
+        self.hits = 1
+
+        # Plate reading
+        self.plate_text: Optional[str] = None
+        self.plate_confidence = 0.0
+        self.plate: Optional[Dict] = None
+        self.read_attempts = 0
+        self.best_quality_tried = 0.0
+
+    @staticmethod
+    def _to_z(box: np.ndarray) -> np.ndarray:
+        width, height = box[2] - box[0], box[3] - box[1]
+        return np.array([box[0] + width / 2, box[1] + height / 2, width * height, width / max(height, 1e-6)])
+
+    @property
+    def box(self) -> np.ndarray:
+        area = max(self.x[2], 1e-6)
+        width = np.sqrt(area * max(self.x[3], 1e-6))
+        height = area / width
+        cx, cy = self.x[0], self.x[1]
+        return np.array([cx - width / 2, cy - height / 2, cx + width / 2, cy + height / 2], np.float32)
+
+    def predict(self, now: float) -> np.ndarray:
+        dt = max(0.0, now - self.last_predict)
+        self.last_predict = now
+        F = np.eye(7)
+        F[0, 4] = F[1, 5] = F[2, 6] = dt
+        if self.x[2] + self.x[6] * dt <= 0:
+            self.x[6] = 0.0
+        self.x = F @ self.x
+        self.P = F @ self.P @ F.T + self._Q * max(dt, 1e-3)
+        return self.box
+
+    def update(self, box: np.ndarray, score: float, class_id: int, now: float):
+        z = self._to_z(box)
+        H = self._H
+        y = z - H @ self.x
+        S = H @ self.P @ H.T + self._R
+        K = self.P @ H.T @ np.linalg.inv(S)
+        self.x = self.x + K @ y
+        self.P = (np.eye(7) - K @ H) @ self.P
+        self.score = score
+        self.class_id = class_id
+        self.last_seen = now
+        self.hits += 1
+
+    def wants_plate_read(self, quality: float, gain: float, max_reads: int) -> bool:
+        """OCR on a new track, or when this crop is clearly better than any tried"""
+        if self.read_attempts >= max_reads:
+            return False
+        if self.read_attempts == 0:
+            return True
+        return quality >= self.best_quality_tried * gain
+
+    def note_plate_attempt(self, quality: float):
+        self.read_attempts += 1
+        self.best_quality_tried = max(self.best_quality_tried, quality)
+
+    def offer_plate(self, plate: Dict) -> bool:
+        """Keep the most confident read; returns True if it replaced the best"""
+        text = plate.get("plate_text")
+        if not text or plate.get("confidence", 0.0) <= self.plate_confidence:
+            return False
+        self.plate_text = text
+        self.plate_confidence = plate["confidence"]
+        self.plate = plate
+        return True
+
+
+class ObjectTracker:
+    """Tracks detections across updates and assigns stable track IDs
+
+    High-confidence detections are matched to predicted track boxes first;
+    leftover tracks then get a second chance against low-confidence
+    detections (ByteTrack), which keeps IDs stable through partial
+    occlusions without spawning tracks from weak boxes. Classes in the same
+    group (e.g. car/truck) may match each other so a class flicker does not
+    restart a track.
+    """
+
+    def __init__(self, iou_threshold: float = 0.3, high_threshold: float = 0.5,
+                 max_age: float = None, class_groups: Optional[Iterable[Iterable[int]]] = None):
+        self.iou_threshold = iou_threshold
+        self.high_threshold = high_threshold
+        self.max_age = max_age if max_age is not None else float(os.environ.get("TRACK_MAX_AGE", 3.0))
+        self.groups: Dict[int, int] = {}
+        for group_id, group in enumerate(class_groups or ()):
+            for class_id in group:
+                self.groups[class_id] = -1 - group_id
+        self.tracks: Dict[int, Track] = {}
+        self._ids = itertools.count(1)
+        self.created = 0
+
+    def _class_keys(self, class_ids: np.ndarray) -> np.ndarray:
+        groups = self.groups
+        return np.array([groups.get(c, c) for c in class_ids.tolist()], np.int64)
+
+    def _associate(self, track_list: List[Track], track_boxes: np.ndarray, track_keys: np.ndarray,
+                   boxes: np.ndarray, keys: np.ndarray) -> List[Tuple[int, int]]:
+        scores = iou_matrix(track_boxes, boxes)
+        scores[track_keys[:, None] != keys[None, :]] = 0.0
+        return greedy_match(scores, self.iou_threshold)
+
+    def update(self, detections: Detections, now: Optional[float] = None) -> np.ndarray:
+        """Match a frame's detections to tracks; returns a track id per detection"""
+        now = now if now is not None else detections.timestamp
+        track_list = list(self.tracks.values())
+        track_boxes = (np.stack([track.predict(now) for track in track_list])
+                       if track_list else np.empty((0, 4), np.float32))
+        track_keys = self._class_keys(np.array([track.class_id for track in track_list], np.int32))
+
+        ids = np.full(len(detections), -1, np.int64)
+        keys = self._class_keys(detections.class_ids)
+        high = np.flatnonzero(detections.scores >= self.high_threshold)
+        low = np.flatnonzero(detections.scores < self.high_threshold)
+
+        # First pass: confident detections against every track
+        matched_tracks = set()
+        for t, d in self._associate(track_list, track_boxes, track_keys, detections.boxes[high], keys[high]):
+            det = high[d]
+            track_list[t].update(detections.boxes[det], float(detections.scores[det]),
+                                 int(detections.class_ids[det]), now)
+            ids[det] = track_list[t].track_id
+            matched_tracks.add(t)
+
+        # Second pass: weak detections keep unmatched tracks alive
+        remaining = [t for t in range(len(track_list)) if t not in matched_tracks]
+        if remaining and len(low):
+            for r, d in self._associate([track_list[t] for t in remaining], track_boxes[remaining],
+                                        track_keys[remaining], detections.boxes[low], keys[low]):
+                det, t = low[d], remaining[r]
+                track_list[t].update(detections.boxes[det], float(detections.scores[det]),
+                                     int(detections.class_ids[det]), now)
+                ids[det] = track_list[t].track_id
+
+        # Unmatched confident detections start new tracks
+        for det in high[ids[high] < 0].tolist():
+            track = Track(next(self._ids), detections.boxes[det], float(detections.scores[det]),
+                          int(detections.class_ids[det]), now)
+            self.tracks[track.track_id] = track
+            ids[det] = track.track_id
+            self.created += 1
+
+        # Drop tracks that have not been seen for a while
+        for track_id in [tid for tid, track in self.tracks.items() if now - track.last_seen > self.max_age]:
+            del self.tracks[track_id]
+
+        detections.track_ids = ids
+        return ids
+
+    def get(self, track_id: int) -> Optional[Track]:
+        return self.tracks.get(int(track_id))
+
+    def get_stats(self) -> Dict:
+        """Get tracker statistics"""
+        return {
+            "active_tracks": len(self.tracks),
+            "tracks_created": self.created,
+        }